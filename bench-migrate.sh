@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Measure tch2tcr end to end without real tyrants.
+#
+# Starts COUNT ttsink servers on localhost ( same port layout as
+# generate-backend-for.rb ), builds a tch2tcr routed at them in BENCH_DIR,
+# migrates the given database and reports records per second along with what
+# the sinks actually received.
+#
+#   ./bench-migrate.sh database.tch [tch2tcr options]
+#
+# environment:
+#   COUNT       number of sinks                ( default 16 )
+#   START_PORT  port of the first sink         ( default 11000 )
+#   STEP        port increment between sinks   ( default 2 )
+#   SINK_OPTS   extra ttsink options, e.g. "--latency 200 --bandwidth 50000000"
+#   BENCH_DIR   scratch directory              ( default ./bench )
+
+set -e
+
+if [ $# -lt 1 ]; then
+  echo "Usage: $0 database.tch [tch2tcr options]" >&2
+  exit 1
+fi
+
+DB=$1
+shift
+
+COUNT=${COUNT:-16}
+START_PORT=${START_PORT:-11000}
+STEP=${STEP:-2}
+BENCH_DIR=${BENCH_DIR:-./bench}
+TOP=$(pwd)
+
+mkdir -p $BENCH_DIR
+cp *.c *.h $BENCH_DIR/
+rm -f $BENCH_DIR/backend_for.c $BENCH_DIR/backend_for.h $BENCH_DIR/progress.txt
+
+ruby -rubygems generate-backend-for.rb --host 127.0.0.1 --start_port $START_PORT \
+     --count $COUNT --step $STEP --output_file $BENCH_DIR/backend_for
+make -s -C $BENCH_DIR -f $TOP/Makefile tch2tcr ttsink
+
+PIDS=""
+cleanup() {
+  [ -n "$PIDS" ] && kill $PIDS 2>/dev/null || true
+}
+trap cleanup EXIT INT TERM
+
+i=0
+while [ $i -lt $COUNT ]; do
+  port=$(( START_PORT + ( i * STEP ) ))
+  $BENCH_DIR/ttsink --port $port $SINK_OPTS > $BENCH_DIR/sink-$port.out &
+  PIDS="$PIDS $!"
+  i=$(( i + 1 ))
+done
+sleep 1
+
+start=$(date +%s.%N)
+$BENCH_DIR/tch2tcr --checkpoint $BENCH_DIR/progress.txt "$@" $DB
+stop=$(date +%s.%N)
+
+kill $PIDS
+wait $PIDS 2>/dev/null || true
+PIDS=""
+
+cat $BENCH_DIR/sink-*.out | awk -v start=$start -v stop=$stop '
+  { records += $5; bytes += $7 }
+  END {
+    secs = stop - start
+    printf "sinks received %d records, %d bytes in %.2f seconds\n", records, bytes, secs
+    printf "%.2f records per second, %.2f MB per second\n", records / secs, bytes / secs / 1048576
+  }'
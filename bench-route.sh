@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# Routing cost of backend_for as the number of servers grows.
+#
+# For each server count generates a backend_for in BENCH_DIR/route-COUNT,
+# builds route-bench against it, checks the batch parse against the scalar
+# one and runs the timings, one line per count.
+#
+#   ./bench-route.sh [route-bench options]
+#
+# environment:
+#   COUNTS      server counts to measure       ( default "16 64 256" )
+#   BENCH_DIR   scratch directory              ( default ./bench )
+
+set -e
+
+COUNTS=${COUNTS:-"16 64 256"}
+BENCH_DIR=${BENCH_DIR:-./bench}
+TOP=$(pwd)
+
+for COUNT in $COUNTS; do
+  DIR=$BENCH_DIR/route-$COUNT
+  mkdir -p $DIR
+  cp route-bench.c $DIR/
+  ruby -rubygems generate-backend-for.rb --host 127.0.0.1 --count $COUNT \
+       --output_file $DIR/backend_for
+  make -s -C $DIR -f $TOP/Makefile route-bench
+  $DIR/route-bench --verify 1000000
+  $DIR/route-bench "$@"
+done
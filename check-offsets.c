@@ -1,53 +1,263 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "tchhdr.h"
+#include "tchoff.h"
+#include "tchscan.h"
+#include "numparse.h"
+
+/*
+ * Check that every offset gen-offsets wrote lands on the magic byte of a data
+ * block.  The offsets are loaded all at once, from the binary file or from
+ * the text one through numparse, sorted into file order and checked with large positioned
+ * reads, so the database is read front to back once instead of a seek per
+ * bucket.  Anything that does not check out is printed by bucket, or by line
+ * number for a text file, which does not know the buckets.
+ */
+
+#define CHECK_WINDOW  ( 1024 * 1024 )
+
+extern void print_progress( FILE* file, time_t start_time, long long unsigned final, long long unsigned so_far );
+
+typedef struct offsets {
+  tchoff_entry_t *entries;
+  uint64_t        count;
+  bool            by_line;        /* bucket holds the line number */
+} offsets_t;
+
+typedef struct bad {
+  uint64_t offset;
+  uint64_t bucket;
+  int      byte;                  /* -1 past the end of the file  */
+} bad_t;
+
+static int offset_cmp( const void* a, const void* b )
+{
+  const tchoff_entry_t *x = (const tchoff_entry_t*)a;
+  const tchoff_entry_t *y = (const tchoff_entry_t*)b;
+  if ( x->offset != y->offset ) {
+    return ( x->offset > y->offset ) - ( x->offset < y->offset );
+  }
+  return ( x->bucket > y->bucket ) - ( x->bucket < y->bucket );
+}
+
+static int bad_cmp( const void* a, const void* b )
+{
+  uint64_t x = ((const bad_t*)a)->bucket;
+  uint64_t y = ((const bad_t*)b)->bucket;
+  return ( x > y ) - ( x < y );
+}
+
+bool load_binary( offsets_t* offsets, const char* path, const tchhdr_t* hdr )
+{
+  tchoff_reader_t reader;
+
+  if ( !tchoff_open( &reader, path ) ) {
+    return false;
+  }
+  // offsets from another database, or from this one before a rehash, would all look bad
+  if ( reader.alignment_pow != hdr->alignment_pow || reader.bucket_number != hdr->bucket_number ) {
+    fprintf( stderr, "ERROR: %s is for a database with bnum %llu, apow %d, not bnum %llu, apow %d\n", path,
+             (long long unsigned)reader.bucket_number, reader.alignment_pow,
+             (long long unsigned)hdr->bucket_number, hdr->alignment_pow );
+    tchoff_close( &reader );
+    return false;
+  }
+  if ( reader.entries > hdr->bucket_number ) {
+    fprintf( stderr, "ERROR: %s has more entries than the database has buckets\n", path );
+    tchoff_close( &reader );
+    return false;
+  }
+  if ( NULL == ( offsets->entries = (tchoff_entry_t*)malloc( reader.entries * sizeof( tchoff_entry_t ) + 1 ) ) ) {
+    fprintf( stderr, "ERROR: can not hold the %llu entries in %s\n", (long long unsigned)reader.entries, path );
+    tchoff_close( &reader );
+    return false;
+  }
+  offsets->count   = 0;
+  for ( uint64_t b = 0 ; b < reader.blocks ; b++ ) {
+    if ( offsets->count + reader.index[b].count > reader.entries ) {
+      fprintf( stderr, "ERROR: %s has more entries than its trailer says\n", path );
+      tchoff_close( &reader );
+      return false;
+    }
+    if ( !tchoff_read_block( &reader, b, offsets->entries + offsets->count ) ) {
+      tchoff_close( &reader );
+      return false;
+    }
+    offsets->count += reader.index[b].count;
+  }
+  tchoff_close( &reader );
+  return true;
+}
+
+bool load_text( offsets_t* offsets, const char* path )
+{
+  numparse_t parsed;
+
+  if ( !numparse_file( &parsed, path, true ) ) {
+    return false;
+  }
+  if ( NULL == ( offsets->entries = (tchoff_entry_t*)malloc( parsed.count * sizeof( tchoff_entry_t ) + 1 ) ) ) {
+    fprintf( stderr, "ERROR: can not hold the %llu offsets in %s\n", (long long unsigned)parsed.count, path );
+    numparse_free( &parsed );
+    return false;
+  }
+  offsets->count   = parsed.count;
+  offsets->by_line = true;
+  for ( uint64_t i = 0 ; i < parsed.count ; i++ ) {
+    offsets->entries[i].offset = parsed.values[i];
+    offsets->entries[i].bucket = parsed.lines[i];
+  }
+  numparse_free( &parsed );
+  return true;
+}
+
+bool load_offsets( offsets_t* offsets, const char* path, const tchhdr_t* hdr )
+{
+  char magic[sizeof( TCHOFF_MAGIC )];
+  bool binary;
+  int  fd;
+
+  memset( offsets, 0, sizeof( *offsets ) );
+  if ( -1 == ( fd = open( path, O_RDONLY ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", path, strerror( errno ) );
+    return false;
+  }
+  binary = ( sizeof( magic ) == pread( fd, magic, sizeof( magic ), 0 ) &&
+             0 == memcmp( magic, TCHOFF_MAGIC, sizeof( magic ) ) );
+  close( fd );
+
+  return binary ? load_binary( offsets, path, hdr ) : load_text( offsets, path );
+}
 
 int main( int argc, char ** argv )
 {
-  long long v = 0;
-  char buf[256];
-  FILE* infile;
-  FILE* dbfile;
-  long long c = 0;
-  unsigned char byte;
-  long long c8 = 0;
-  long long not_c8 = 0;
-
-
-  if ( argc < 3 ) {
-    fprintf(stderr, "Usage: %s dbfile infile\n", argv[0]);
+  offsets_t   offsets;
+  const char *db_path;
+  const char *offsets_path;
+  uint64_t    window      = CHECK_WINDOW;
+  bool        quiet       = false;
+  uint8_t    *buf;
+  uint64_t    buf_start   = 0;
+  uint64_t    buf_length  = 0;
+  bad_t      *bad         = NULL;
+  uint64_t    bad_count   = 0;
+  uint64_t    bad_cap     = 0;
+  uint64_t    c8          = 0;
+  uint64_t    reads       = 0;
+  struct stat st;
+  tchhdr_t    hdr;
+  time_t      start_time;
+  int         dbfd;
+  int         opt;
+
+  struct option long_options[] = {
+    { "window",  required_argument, NULL, 'w' },
+    { "quiet",   no_argument,       NULL, 'q' },
+    { NULL,      0,                 NULL,  0  }
+  };
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "w:q", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'w': window  = strtoull( optarg, NULL, 0 ); break;
+      case 'q': quiet   = true; break;
+      default :
+        fprintf( stderr, "Usage: %s [-w window_bytes] [-q] dbfile offsets_file\n", argv[0] );
+        exit(1);
+    }
+  }
+
+  if ( argc - optind < 2 || window < 1 ) {
+    fprintf( stderr, "Usage: %s [-w window_bytes] [-q] dbfile offsets_file\n", argv[0] );
     exit(1);
   }
+  db_path      = argv[optind];
+  offsets_path = argv[optind + 1];
 
-  dbfile = fopen(argv[1], "r");
-  infile = fopen(argv[2], "r");
+  if ( -1 == ( dbfd = open( db_path, O_RDONLY ) ) || 0 != fstat( dbfd, &st ) || !tchhdr_read( dbfd, &hdr ) ) {
+    fprintf( stderr, "open error on %s : %s\n", db_path, tchhdr_error( errno ) );
+    exit(1);
+  }
+  posix_fadvise( dbfd, 0, 0, POSIX_FADV_SEQUENTIAL );
 
-  while( !feof(infile) ) {
-    if ( fgets( buf, 256, infile ) ) {
-      v = strtoll( buf, NULL, 10 );
-      c++;
+  if ( !load_offsets( &offsets, offsets_path, &hdr ) ) {
+    exit(1);
+  }
+  qsort( offsets.entries, offsets.count, sizeof( tchoff_entry_t ), offset_cmp );
+  fprintf( stderr, "loaded %llu offsets from %s\n", (long long unsigned)offsets.count, offsets_path );
 
-      fseek( dbfile, v, SEEK_SET );
-      fread(&byte, 1, 1, dbfile);
+  /*
+   * the offsets are in file order now, so each read covers a window from the
+   * first offset it does not have yet and the next few hundred usually fall
+   * inside it
+   */
+  buf        = (uint8_t*)malloc( window );
+  start_time = time( NULL );
+  for ( uint64_t i = 0 ; i < offsets.count ; i++ ) {
+    tchoff_entry_t *e    = &(offsets.entries[i]);
+    int             byte = -1;
 
-      if ( 0xc8 == byte ) {
-        c8++;
-      } else {
-        not_c8++;
+    if ( e->offset < (uint64_t)st.st_size ) {
+      if ( e->offset < buf_start || e->offset >= buf_start + buf_length ) {
+        ssize_t got = pread( dbfd, buf, window, e->offset );
+        if ( got <= 0 ) {
+          fprintf( stderr, "read error on %s at %llu : %s\n", db_path, (long long unsigned)e->offset,
+                   ( 0 == got ) ? "short read" : strerror( errno ) );
+          exit(1);
+        }
+        buf_start  = e->offset;
+        buf_length = got;
+        reads     += 1;
       }
+      byte = buf[e->offset - buf_start];
+    }
 
-      if ( c % 10000 == 0 ) {
-        fprintf(stderr, " %llu : c8 -> %llu not c8 -> %llu \r", c, c8, not_c8);
-        fflush(stderr);
+    if ( TCH_MAGIC_DATA_BLOCK == byte ) {
+      c8 += 1;
+    } else {
+      if ( bad_count == bad_cap ) {
+        bad_cap = bad_cap ? bad_cap * 2 : 1024;
+        bad     = (bad_t*)realloc( bad, bad_cap * sizeof( bad_t ) );
       }
+      bad[bad_count].offset = e->offset;
+      bad[bad_count].bucket = e->bucket;
+      bad[bad_count].byte   = byte;
+      bad_count += 1;
     }
-  }
 
-  fprintf(stderr, "\nFinal %llu : c8 -> %llu not c8 -> %llu \r", c, c8, not_c8);
-  fclose( infile );
-  fclose( dbfile );
-  exit(0);
-}
+    if ( !quiet && 0 == ( i + 1 ) % 1000000 ) {
+      print_progress( stderr, start_time, offsets.count, i + 1 );
+    }
+  }
 
+  if ( bad_count > 0 ) {
+    qsort( bad, bad_count, sizeof( bad_t ), bad_cmp );
+  }
+  for ( uint64_t i = 0 ; i < bad_count ; i++ ) {
+    if ( bad[i].byte < 0 ) {
+      fprintf( stdout, "%s %llu : offset %llu is past the end of the file\n", offsets.by_line ? "line" : "bucket",
+               (long long unsigned)bad[i].bucket, (long long unsigned)bad[i].offset );
+    } else {
+      fprintf( stdout, "%s %llu : offset %llu has 0x%02x\n", offsets.by_line ? "line" : "bucket",
+               (long long unsigned)bad[i].bucket, (long long unsigned)bad[i].offset, bad[i].byte );
+    }
+  }
 
+  fprintf( stderr, "\nFinal %llu : c8 -> %llu not c8 -> %llu ( %llu reads of up to %llu bytes )\n",
+           (long long unsigned)offsets.count, (long long unsigned)c8, (long long unsigned)bad_count,
+           (long long unsigned)reads, (long long unsigned)window );
 
+  free( buf );
+  free( bad );
+  free( offsets.entries );
+  close( dbfd );
+  exit( 0 == bad_count ? 0 : 1 );
+}
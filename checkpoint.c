@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+
+static bool checkpoint_write( checkpoint_t* cp, uint64_t offset, uint64_t count, bool done )
+{
+  char buf[PATH_MAX + 256];
+  char dir[PATH_MAX + 1];
+  int  len;
+  int  fd;
+
+  len = snprintf( buf, sizeof( buf ), "source %s\nsize   %llu\noffset %llu\ncount  %llu\ndone   %d\n",
+                  cp->src_path, (long long unsigned)cp->src_size,
+                  (long long unsigned)offset, (long long unsigned)count, done ? 1 : 0 );
+
+  if ( -1 == ( fd = open( cp->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", cp->tmp_path, strerror( errno ) );
+    return false;
+  }
+
+  if ( len != write( fd, buf, len ) || 0 != fsync( fd ) ) {
+    fprintf( stderr, "write error on %s : %s\n", cp->tmp_path, strerror( errno ) );
+    close( fd );
+    return false;
+  }
+  close( fd );
+
+  if ( 0 != rename( cp->tmp_path, cp->path ) ) {
+    fprintf( stderr, "rename error %s -> %s : %s\n", cp->tmp_path, cp->path, strerror( errno ) );
+    return false;
+  }
+
+  // make the rename itself durable
+  strcpy( dir, cp->path );
+  if ( -1 != ( fd = open( dirname( dir ), O_RDONLY ) ) ) {
+    fsync( fd );
+    close( fd );
+  }
+
+  return true;
+}
+
+static void* checkpoint_thread( void* arg )
+{
+  checkpoint_t *cp = (checkpoint_t*)arg;
+
+  pthread_mutex_lock( &(cp->lock) );
+  while ( cp->running ) {
+    struct timespec until;
+    clock_gettime( CLOCK_REALTIME, &until );
+    until.tv_sec += cp->interval;
+    pthread_cond_timedwait( &(cp->wakeup), &(cp->lock), &until );
+
+    if ( cp->running && cp->offset != cp->written_offset ) {
+      uint64_t offset = cp->offset;
+      uint64_t count  = cp->count;
+
+      // do the file work without holding up checkpoint_update
+      pthread_mutex_unlock( &(cp->lock) );
+      bool ok = checkpoint_write( cp, offset, count, false );
+      pthread_mutex_lock( &(cp->lock) );
+
+      if ( ok ) {
+        cp->written_offset = offset;
+      }
+    }
+  }
+  pthread_mutex_unlock( &(cp->lock) );
+  return NULL;
+}
+
+bool checkpoint_start( checkpoint_t* cp, const char* path, const char* src_path, int interval )
+{
+  struct stat st;
+
+  memset( cp, 0, sizeof( checkpoint_t ) );
+
+  if ( NULL == realpath( src_path, cp->src_path ) || 0 != stat( cp->src_path, &st ) ) {
+    fprintf( stderr, "Failure finding source [%s] : %s\n", src_path, strerror( errno ) );
+    return false;
+  }
+
+  snprintf( cp->path, sizeof( cp->path ), "%s", path );
+  snprintf( cp->tmp_path, sizeof( cp->tmp_path ), "%s.tmp", path );
+  cp->src_size = st.st_size;
+  cp->interval = ( interval > 0 ) ? interval : 1;
+  cp->running  = true;
+
+  pthread_mutex_init( &(cp->lock), NULL );
+  pthread_cond_init( &(cp->wakeup), NULL );
+
+  if ( 0 != pthread_create( &(cp->thread), NULL, checkpoint_thread, cp ) ) {
+    fprintf( stderr, "Failure starting checkpoint thread\n" );
+    return false;
+  }
+  return true;
+}
+
+void checkpoint_update( checkpoint_t* cp, uint64_t offset, uint64_t count )
+{
+  pthread_mutex_lock( &(cp->lock) );
+  cp->offset = offset;
+  cp->count  = count;
+  pthread_mutex_unlock( &(cp->lock) );
+}
+
+void checkpoint_finish( checkpoint_t* cp, bool done )
+{
+  pthread_mutex_lock( &(cp->lock) );
+  cp->running = false;
+  cp->done    = done;
+  pthread_cond_signal( &(cp->wakeup) );
+  pthread_mutex_unlock( &(cp->lock) );
+
+  pthread_join( cp->thread, NULL );
+  checkpoint_write( cp, cp->offset, cp->count, cp->done );
+
+  pthread_cond_destroy( &(cp->wakeup) );
+  pthread_mutex_destroy( &(cp->lock) );
+}
+
+bool checkpoint_load( const char* path, const char* src_path,
+                      uint64_t* offset, uint64_t* count, bool* done )
+{
+  char               real_src[PATH_MAX+1];
+  char               cp_src[PATH_MAX+1];
+  long long unsigned cp_size, cp_offset, cp_count;
+  int                cp_done;
+  struct stat        st;
+  FILE              *f;
+
+  if ( NULL == realpath( src_path, real_src ) || 0 != stat( real_src, &st ) ) {
+    fprintf( stderr, "Failure finding source [%s] : %s\n", src_path, strerror( errno ) );
+    return false;
+  }
+
+  if ( NULL == ( f = fopen( path, "r" ) ) ) {
+    fprintf( stderr, "open error on checkpoint %s : %s\n", path, strerror( errno ) );
+    return false;
+  }
+
+  int found = fscanf( f, "source %4096[^\n]\nsize %llu\noffset %llu\ncount %llu\ndone %d",
+                      cp_src, &cp_size, &cp_offset, &cp_count, &cp_done );
+  fclose( f );
+
+  if ( 5 != found ) {
+    fprintf( stderr, "Checkpoint %s is not readable\n", path );
+    return false;
+  }
+
+  if ( 0 != strcmp( cp_src, real_src ) || cp_size != (long long unsigned)st.st_size ) {
+    fprintf( stderr, "Checkpoint %s is for %s ( %llu bytes ), not %s ( %llu bytes )\n",
+             path, cp_src, cp_size, real_src, (long long unsigned)st.st_size );
+    return false;
+  }
+
+  *offset = cp_offset;
+  *count  = cp_count;
+  *done   = ( 0 != cp_done );
+  return true;
+}
@@ -0,0 +1,69 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/*
+ * Durable progress checkpoint for long running scans of a source database.
+ *
+ * The scanning thread only ever calls checkpoint_update, which stores the
+ * offset of the next record to process under a mutex.  A background thread
+ * wakes every interval seconds and, if the position has moved, writes it to
+ * path.tmp, fsyncs it and renames it over path.  A crash therefore always
+ * leaves either the previous or the new checkpoint, never a torn one.
+ *
+ * The file is plain text:
+ *
+ *   source /full/path/to/db.tch
+ *   size   <size of the source file in bytes>
+ *   offset <offset of the next record to send>
+ *   count  <records sent before that offset>
+ *   done   <0 or 1>
+ */
+
+typedef struct checkpoint {
+  char            path[PATH_MAX+1];      /* where the checkpoint lives           */
+  char            tmp_path[PATH_MAX+5];  /* written here first, then renamed     */
+  char            src_path[PATH_MAX+1];  /* the source the offsets refer to      */
+  uint64_t        src_size;
+  int             interval;              /* seconds between checkpoint writes    */
+
+  pthread_mutex_t lock;
+  pthread_cond_t  wakeup;
+  pthread_t       thread;
+  bool            running;
+
+  uint64_t        offset;                /* offset of the next record to send    */
+  uint64_t        count;                 /* records sent before offset           */
+  bool            done;                  /* the whole source has been sent       */
+  uint64_t        written_offset;        /* last offset that made it to disk     */
+} checkpoint_t;
+
+/*
+ * Initialize cp for the source at src_path and start the writer thread.
+ */
+extern bool checkpoint_start( checkpoint_t* cp, const char* path, const char* src_path, int interval );
+
+/*
+ * Record that everything before offset has been sent.  Cheap, call as often
+ * as convenient from the hot loop.
+ */
+extern void checkpoint_update( checkpoint_t* cp, uint64_t offset, uint64_t count );
+
+/*
+ * Stop the writer thread and write a final checkpoint, marking the source as
+ * completely sent if done is true.
+ */
+extern void checkpoint_finish( checkpoint_t* cp, bool done );
+
+/*
+ * Read the checkpoint at path and make sure it belongs to the source at
+ * src_path.  Returns false, with the reason printed, if it can not be used.
+ */
+extern bool checkpoint_load( const char* path, const char* src_path,
+                             uint64_t* offset, uint64_t* count, bool* done );
+
+#endif
@@ -1,34 +1,277 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
 
-int main( int argc, char ** argv )
+#include "numparse.h"
+
+/*
+ * How fast an offset file, one decimal number a line as gen-offsets writes
+ * them, can be read into memory:
+ *
+ *   fgets     fgets and strtoll a line at a time, what this used to be
+ *   numparse  numparse_file
+ *
+ * Each is run --rounds times and the best taken, then the count and sum are
+ * checked against fgets.  The file is read once first so all of them
+ * find it in the page cache.
+ *
+ * --verify N instead parses N random lines, numbers of every length, leading
+ * blanks, junk after the number, lines with no number and numbers past 2^64,
+ * with numparse_buffer and with strtoull and fails on the first difference.
+ */
+
+#define ROUNDS       3
+#define FUZZ_LINES   1024
+#define FUZZ_SIZE    48
+
+typedef struct result {
+  uint64_t count;
+  uint64_t sum;
+} result_t;
+
+static double now( void )
 {
-  long long v = 0;
-  char buf[256];
-  FILE* infile;
-  long long c = 0;
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
+static uint64_t next_random( uint64_t* state )
+{
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
 
-  if ( argc < 2 ) {
-    fprintf(stderr, "Usage: %s infile\n", argv[0]);
-    exit(1);
+static bool run_fgets( const char* path, result_t* result )
+{
+  char  buf[256];
+  FILE *infile;
+
+  if ( NULL == ( infile = fopen( path, "r" ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", path, strerror( errno ) );
+    return false;
+  }
+  memset( result, 0, sizeof( *result ) );
+  while ( NULL != fgets( buf, sizeof( buf ), infile ) ) {
+    char      *end;
+    long long  v = strtoll( buf, &end, 10 );
+    if ( end != buf ) {
+      result->count += 1;
+      result->sum   += v;
+    }
+  }
+  fclose( infile );
+  return true;
+}
+
+static bool run_numparse( const char* path, result_t* result )
+{
+  numparse_t parsed;
+
+  if ( !numparse_file( &parsed, path, false ) ) {
+    return false;
+  }
+  memset( result, 0, sizeof( *result ) );
+  result->count = parsed.count;
+  for ( uint64_t i = 0 ; i < parsed.count ; i++ ) {
+    result->sum += parsed.values[i];
+  }
+  numparse_free( &parsed );
+  return true;
+}
+
+/*
+ * best of rounds, in seconds
+ */
+static double measure( const char* path, bool numparse, int rounds, result_t* result )
+{
+  double best = -1;
+
+  for ( int r = 0 ; r < rounds ; r++ ) {
+    double start = now();
+    bool   ok    = numparse ? run_numparse( path, result ) : run_fgets( path, result );
+    double took  = now() - start;
+    if ( !ok ) {
+      exit(1);
+    }
+    if ( best < 0 || took < best ) {
+      best = took;
+    }
+  }
+  return best;
+}
+
+/*
+ * a random line for --verify into buf, returns its length without the newline
+ */
+static int fuzz_line( uint64_t* state, char* buf )
+{
+  static const char *edges[] = { "18446744073709551615", "18446744073709551616", "99999999999999999999999",
+                                 "9999999999999999", "10000000000000000", "0000000000000000042", "0" };
+  static const char  junk[]  = " \t\r,x-+:\x80\xff";
+  int length = 0;
+  int blanks = next_random( state ) % 3;
+  int kind   = next_random( state ) % 8;
+
+  for ( int i = 0 ; i < blanks ; i++ ) {
+    buf[length++] = ( next_random( state ) & 1 ) ? ' ' : '\t';
+  }
+  if ( 0 == kind ) {
+    const char *edge = edges[next_random( state ) % ( sizeof( edges ) / sizeof( edges[0] ) )];
+    memcpy( buf + length, edge, strlen( edge ) );
+    length += strlen( edge );
+  } else if ( kind < 7 ) {
+    int digits = 1 + next_random( state ) % 20;
+    for ( int i = 0 ; i < digits ; i++ ) {
+      buf[length++] = '0' + next_random( state ) % 10;
+    }
+  }
+  if ( next_random( state ) % 4 == 0 ) {
+    int extra = next_random( state ) % 12;
+    for ( int i = 0 ; i < extra ; i++ ) {
+      buf[length++] = junk[next_random( state ) % ( sizeof( junk ) - 1 )];
+    }
   }
+  return length;
+}
+
+/*
+ * what numparse_buffer should make of one line
+ */
+static bool reference( const char* line, uint64_t* value )
+{
+  char *end;
+
+  while ( ' ' == *line || '\t' == *line ) {
+    line++;
+  }
+  if ( !isdigit( (unsigned char)*line ) ) {
+    return false;
+  }
+  *value = strtoull( line, &end, 10 );
+  return true;
+}
+
+static bool verify( uint64_t iterations )
+{
+  char     *text   = (char*)malloc( FUZZ_LINES * ( FUZZ_SIZE + 1 ) );
+  char    **starts = (char**)malloc( FUZZ_LINES * sizeof( char* ) );
+  int      *sizes  = (int*)malloc( FUZZ_LINES * sizeof( int ) );
+  uint64_t *values = (uint64_t*)malloc( ( FUZZ_LINES + 1 ) * sizeof( uint64_t ) );
+  uint64_t *lines  = (uint64_t*)malloc( ( FUZZ_LINES + 1 ) * sizeof( uint64_t ) );
+  char      line[FUZZ_SIZE + 1];
+  uint64_t  state  = 0x9e3779b97f4a7c15ULL;
+  uint64_t  done   = 0;
+
+  while ( done < iterations ) {
+    uint64_t length = 0;
+    uint64_t count;
+    uint64_t j = 0;
+
+    for ( int i = 0 ; i < FUZZ_LINES ; i++ ) {
+      starts[i] = text + length;
+      sizes[i]  = fuzz_line( &state, text + length );
+      length   += sizes[i];
+      text[length++] = '\n';
+    }
+    // now and then leave the last line without its newline
+    if ( next_random( &state ) & 1 ) {
+      length -= 1;
+    }
 
-  infile = fopen(argv[1], "r");
-  while( !feof(infile) ) {
-    if ( fgets( buf, 256, infile ) ) {
-      v = strtoll( buf, NULL, 10 );
-      c++;
-      if ( c % 1000000 == 0 ) {
-        fprintf(stderr, " %llu\r", c);
-        fflush(stderr);
+    count = numparse_buffer( text, text + length, 1, values, lines );
+    for ( int i = 0 ; i < FUZZ_LINES ; i++ ) {
+      uint64_t want;
+      memcpy( line, starts[i], sizes[i] );
+      line[sizes[i]] = '\0';
+      if ( !reference( line, &want ) ) {
+        continue;
       }
+      if ( j >= count || lines[j] != (uint64_t)( i + 1 ) || values[j] != want ) {
+        fprintf( stderr, "verify failed at line %d ( %s ) : want %llu, numparse gave %llu on line %llu\n", i + 1, line,
+                 (long long unsigned)want, ( j < count ) ? (long long unsigned)values[j] : 0ULL,
+                 ( j < count ) ? (long long unsigned)lines[j] : 0ULL );
+        return false;
+      }
+      j += 1;
+    }
+    if ( j != count ) {
+      fprintf( stderr, "verify failed : numparse found %llu numbers, strtoull %llu\n", (long long unsigned)count,
+               (long long unsigned)j );
+      return false;
     }
+    done += FUZZ_LINES;
   }
-  fclose( infile );
-  exit(0);
+
+  fprintf( stderr, "verify ok : %llu lines\n", (long long unsigned)done );
+  free( text );
+  free( starts );
+  free( sizes );
+  free( values );
+  free( lines );
+  return true;
 }
 
+int main( int argc, char ** argv )
+{
+  int         rounds  = ROUNDS;
+  uint64_t    fuzz    = 0;
+  const char *path;
+  result_t    base;
+  result_t    result;
+  double      base_time;
+  double      took;
+  int         opt;
 
+  struct option long_options[] = {
+    { "rounds",  required_argument, NULL, 'r' },
+    { "verify",  required_argument, NULL, 'v' },
+    { NULL,      0,                 NULL,  0  }
+  };
 
+  while ( -1 != ( opt = getopt_long( argc, argv, "r:v:", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'r': rounds  = atoi( optarg ); break;
+      case 'v': fuzz    = strtoull( optarg, NULL, 0 ); break;
+      default :
+        fprintf( stderr, "Usage: %s [-r rounds] infile | --verify N\n", argv[0] );
+        exit(1);
+    }
+  }
+
+  if ( fuzz > 0 ) {
+    exit( verify( fuzz ) ? 0 : 1 );
+  }
+
+  if ( optind >= argc || rounds < 1 ) {
+    fprintf( stderr, "Usage: %s [-r rounds] infile | --verify N\n", argv[0] );
+    exit(1);
+  }
+  path = argv[optind];
+
+  run_numparse( path, &result );
+
+  base_time = measure( path, false, rounds, &base );
+  fprintf( stdout, "%-10s %12llu lines %8.3f s %10.2f M lines/s\n", "fgets", (long long unsigned)base.count,
+           base_time, base.count / base_time / 1e6 );
+
+  took = measure( path, true, rounds, &result );
+  fprintf( stdout, "%-10s %12llu lines %8.3f s %10.2f M lines/s  %6.2fx\n", "numparse",
+           (long long unsigned)result.count, took, result.count / took / 1e6, base_time / took );
+  if ( result.count != base.count || result.sum != base.sum ) {
+    fprintf( stderr, "numparse disagrees with fgets : %llu numbers summing to %llu, not %llu and %llu\n",
+             (long long unsigned)result.count, (long long unsigned)result.sum,
+             (long long unsigned)base.count, (long long unsigned)base.sum );
+    exit(1);
+  }
+  exit(0);
+}
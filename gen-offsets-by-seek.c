@@ -3,14 +3,15 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <tchdb.h>
 #include <errno.h>
 #include <string.h>
 #include <time.h>
 
+#include "tchhdr.h"
+
 int main( int argc, char** argv) 
 {
-  TCHDB *hdb;
+  tchhdr_t hdr;
   uint64_t rnum = 0;
   uint64_t bnum = 0;
   uint64_t offset = 0;
@@ -26,8 +27,8 @@ int main( int argc, char** argv)
   char time_buf[256];
  
   int fd = 0;
-  int ecode;
   int apow;
+  int bytes_per;
   int x;
 
 
@@ -36,29 +37,26 @@ int main( int argc, char** argv)
     exit(1);
   }
 
-  hdb = tchdbnew();
   /* open the database */
-  if(!tchdbopen(hdb, argv[1], HDBOREADER )){
-    ecode = tchdbecode( hdb );
-    fprintf(stderr, "open error: %s\n", tchdberrmsg(ecode));
+  if( -1 == ( fd = open( argv[1], O_RDONLY ) ) || !tchhdr_read( fd, &hdr ) ){
+    fprintf(stderr, "open error on %s : %s\n", argv[1], tchhdr_error( errno ));
+    exit(1);
   }
 
-  rnum = tchdbrnum( hdb );
-  apow = hdb->apow;
-  bnum = hdb->bnum;
-  tchdbclose( hdb );
-  tchdbdel( hdb );
+  rnum      = hdr.record_number;
+  apow      = hdr.alignment_pow;
+  bnum      = hdr.bucket_number;
+  bytes_per = hdr.bytes_per;
 
   fprintf( stderr, "DB %s has rnum %llu, bnum %llu, apow %llu\n", argv[1], rnum, bnum, apow);
 
-  fd = open( argv[1], O_RDONLY );
-
   lseek64( fd, 256, SEEK_SET ); 
 
   start = time(NULL);
   /* loop over every element of the array */
   for( i = 0 ; i < bnum ; i++ ) {
-    read( fd, &offset, 8 );
+    offset = 0;
+    read( fd, &offset, bytes_per );
 
     /* if the value is > 0 then we have a number so write it out */
     if ( offset > 0 ) {
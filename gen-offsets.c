@@ -3,85 +3,278 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <tchdb.h>
 #include <sys/mman.h>
 #include <errno.h>
 #include <string.h>
+#include <getopt.h>
+#include <pthread.h>
 
-int main( int argc, char** argv) 
+#include "tchhdr.h"
+#include "tchoff.h"
+#include "tchstream.h"
+
+/*
+ * Write out the offset of the first record of every non empty bucket, one
+ * decimal number a line as it always has, or with --binary as the sorted,
+ * delta encoded blocks of tchoff.h.  The binary file is built by --threads
+ * threads sharing the mapped bucket array a block at a time.
+ */
+
+typedef struct gen_binary {
+  int             fd;
+  const uint8_t  *buckets;        /* the mapped bucket array     */
+  tchhdr_t        hdr;
+  uint64_t        next_block;     /* the next block to encode    */
+  uint64_t        block_count;
+
+  pthread_mutex_t lock;           /* everything below            */
+  uint64_t        pos;            /* bytes written so far        */
+  tchoff_index_t *index;
+  uint64_t        blocks;         /* written so far              */
+  uint64_t        found;
+  bool            failed;
+} gen_binary_t;
+
+static uint64_t bucket_at( const uint8_t* buckets, int bytes_per, uint64_t i )
 {
-  TCHDB *hdb;
-  uint64_t rnum = 0;
-  uint64_t bnum = 0;
-  uint64_t offset = 0;
-  uint64_t i;
-  int fd = 0;
-  int ecode;
-  int apow;
-  int found = 0;
-  int empty = 0;
-  void * mem = NULL;
-  uint64_t mem_length = 0;
-  uint64_t* offsets = NULL;
-
-  if ( argc < 2 ) {
-    fprintf(stderr, "Usage: %s dbfile\n", argv[0]);
-    exit(1);
+  if ( sizeof( uint64_t ) == bytes_per ) {
+    return ((const uint64_t*)buckets)[i];
   }
+  return ((const uint32_t*)buckets)[i];
+}
+
+/*
+ * Blocks are handed out one at a time rather than in one slice per thread,
+ * so a thread that gets the dense part of the array does not hold up the rest.
+ */
+void* gen_binary_thread( void* arg )
+{
+  gen_binary_t   *gen     = (gen_binary_t*)arg;
+  tchoff_entry_t *entries = (tchoff_entry_t*)malloc( TCHOFF_BLOCK_BUCKETS * sizeof( tchoff_entry_t ) );
+  uint8_t        *out     = (uint8_t*)malloc( TCHOFF_FRAME_SIZE + TCHOFF_MAX_PAYLOAD );
 
-  hdb = tchdbnew();
-  /* open the database */
-  if(!tchdbopen(hdb, argv[1], HDBOREADER )){
-    ecode = tchdbecode( hdb );
-    fprintf(stderr, "open error: %s\n", tchdberrmsg(ecode));
+  if ( NULL == entries || NULL == out ) {
+    fprintf( stderr, "out of memory for a block\n" );
+    pthread_mutex_lock( &(gen->lock) );
+    gen->failed = true;
+    pthread_mutex_unlock( &(gen->lock) );
+    free( entries );
+    free( out );
+    return NULL;
   }
 
-  rnum = tchdbrnum( hdb );
-  apow = hdb->apow;
-  bnum = hdb->bnum;
-  tchdbclose( hdb );
-  tchdbdel( hdb );
+  while ( 1 ) {
+    uint64_t block = __atomic_fetch_add( &(gen->next_block), 1, __ATOMIC_RELAXED );
+    uint64_t first = block * TCHOFF_BLOCK_BUCKETS;
+    uint64_t last;
+    uint64_t size;
+    uint32_t count = 0;
 
-  fprintf( stderr, "DB %s has rnum %llu, bnum %llu, apow %llu\n", argv[1], rnum, bnum, apow);
+    if ( block >= gen->block_count ) {
+      break;
+    }
+    last = first + TCHOFF_BLOCK_BUCKETS;
+    if ( last > gen->hdr.bucket_number ) {
+      last = gen->hdr.bucket_number;
+    }
 
-  fd = open( argv[1], O_RDONLY );
+    for ( uint64_t i = first ; i < last ; i++ ) {
+      uint64_t v = bucket_at( gen->buckets, gen->hdr.bytes_per, i );
+      if ( v > 0 ) {
+        entries[count].offset = v << gen->hdr.alignment_pow;
+        entries[count].bucket = i;
+        count += 1;
+      }
+    }
+    if ( 0 == count ) {
+      continue;
+    }
+    size = tchoff_encode_block( out, first, entries, count, gen->hdr.alignment_pow );
 
-  /*lseek64( fd, 256, SEEK_SET ); */
+    pthread_mutex_lock( &(gen->lock) );
+    if ( !gen->failed ) {
+      if ( tchstream_write_fully( gen->fd, out, size ) ) {
+        tchoff_index_t *ix = &(gen->index[gen->blocks++]);
+        ix->first_bucket = first;
+        ix->pos          = gen->pos;
+        ix->count        = count;
+        ix->size         = size - TCHOFF_FRAME_SIZE;
+        gen->pos        += size;
+        gen->found      += count;
+      } else {
+        fprintf( stderr, "write error : %s\n", strerror( errno ) );
+        gen->failed = true;
+      }
+    }
+    pthread_mutex_unlock( &(gen->lock) );
+  }
 
-  mem_length = 256 + ( sizeof(uint64_t) * bnum );
-  mem = mmap( NULL, mem_length , PROT_READ, MAP_SHARED, fd, 0);
-  if ( NULL == mem ) {
-    fprintf(stderr, "error mapping file : %d, %s\n", errno, strerror( errno ));
-    close( fd );
-    exit(1);
+  free( entries );
+  free( out );
+  return NULL;
+}
+
+bool gen_binary( const char* path, const uint8_t* buckets, const tchhdr_t* hdr, int threads )
+{
+  gen_binary_t  gen;
+  pthread_t    *tids;
+  int           started = 0;
+
+  memset( &gen, 0, sizeof( gen ) );
+  if ( -1 == ( gen.fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", path, strerror( errno ) );
+    return false;
   }
-  madvise( mem, mem_length, MADV_SEQUENTIAL);
-  offsets = (uint64_t*)(mem + 256);
+  if ( !tchoff_write_header( gen.fd, hdr->alignment_pow, hdr->bucket_number ) ) {
+    fprintf( stderr, "write error on %s : %s\n", path, strerror( errno ) );
+    close( gen.fd );
+    return false;
+  }
+
+  tids            = (pthread_t*)calloc( threads, sizeof( pthread_t ) );
+  gen.buckets     = buckets;
+  gen.hdr         = *hdr;
+  gen.pos         = TCHOFF_HEADER_SIZE;
+  gen.block_count = ( hdr->bucket_number + TCHOFF_BLOCK_BUCKETS - 1 ) / TCHOFF_BLOCK_BUCKETS;
+  gen.index       = (tchoff_index_t*)malloc( gen.block_count * sizeof( tchoff_index_t ) + 1 );
+  if ( NULL == tids || NULL == gen.index ) {
+    fprintf( stderr, "out of memory for the index of %llu blocks\n", (long long unsigned)gen.block_count );
+    free( tids );
+    free( gen.index );
+    close( gen.fd );
+    return false;
+  }
+  pthread_mutex_init( &(gen.lock), NULL );
+
+  while ( started < threads ) {
+    int rc = pthread_create( &(tids[started]), NULL, gen_binary_thread, &gen );
+    if ( 0 != rc ) {
+      fprintf( stderr, "Can not start thread %d : %s, carrying on with %d\n", started, strerror( rc ), started + 1 );
+      break;
+    }
+    started += 1;
+  }
+  // blocks are handed out as they are asked for, so the calling thread can take up the slack
+  if ( started < threads ) {
+    gen_binary_thread( &gen );
+  }
+  for ( int i = 0 ; i < started ; i++ ) {
+    pthread_join( tids[i], NULL );
+  }
+
+  if ( !gen.failed && !tchoff_write_index( gen.fd, gen.index, gen.blocks, gen.pos ) ) {
+    fprintf( stderr, "write error on %s : %s\n", path, strerror( errno ) );
+    gen.failed = true;
+  }
+  if ( 0 != close( gen.fd ) ) {
+    fprintf( stderr, "close error on %s : %s\n", path, strerror( errno ) );
+    gen.failed = true;
+  }
+
+  fprintf( stderr, "finished  %llu buckets : found = %llu in %llu blocks, %llu bytes, should = %llu\n",
+           (long long unsigned)hdr->bucket_number, (long long unsigned)gen.found, (long long unsigned)gen.blocks,
+           (long long unsigned)( gen.pos + gen.blocks * TCHOFF_INDEX_SIZE + TCHOFF_TRAILER_SIZE ),
+           (long long unsigned)hdr->record_number );
+
+  pthread_mutex_destroy( &(gen.lock) );
+  free( gen.index );
+  free( tids );
+  return !gen.failed;
+}
+
+void gen_text( const uint8_t* buckets, const tchhdr_t* hdr )
+{
+  uint64_t found = 0;
+  uint64_t empty = 0;
+  uint64_t i;
 
   /* loop over every element of the array */
-  for( i = 0 ; i < bnum ; i++ ) {
-    /*fprintf(stderr, "String at %llu\n", i); */
-    offset = *(offsets++);
-    /* fprintf(stderr, "value = %llu\n", offset); */
-    /* read( fd, &offset, 8 ); */
+  for( i = 0 ; i < hdr->bucket_number ; i++ ) {
+    uint64_t offset = bucket_at( buckets, hdr->bytes_per, i );
 
     /* if the value is > 0 then we have a number so write it out */
     if ( offset > 0 ) {
-      offset = offset << apow;
-      fprintf(stdout, "%llu\n", offset);
+      offset = offset << hdr->alignment_pow;
+      fprintf(stdout, "%llu\n", (long long unsigned)offset);
       found += 1;
     } else {
       empty += 1;
     }
 
     if ( i % 1000000 == 0 ) {
-      fprintf(stderr, " %llu / %llu : found = %llu, empty = %llu\r", i, bnum, found, empty );
+      fprintf(stderr, " %llu / %llu : found = %llu, empty = %llu\r", (long long unsigned)i,
+              (long long unsigned)hdr->bucket_number, (long long unsigned)found, (long long unsigned)empty );
       fflush(stderr);
     }
   }
-  munmap( offsets, mem_length );
-  fprintf(stderr, "finished  %llu / %llu : found = %llu, empty = %llu, should = %llu \n", i, bnum, found, empty, rnum );
-  close(fd);
+  fprintf(stderr, "finished  %llu / %llu : found = %llu, empty = %llu, should = %llu \n", (long long unsigned)i,
+          (long long unsigned)hdr->bucket_number, (long long unsigned)found, (long long unsigned)empty,
+          (long long unsigned)hdr->record_number );
 }
 
+void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options] dbfile\n", name );
+  fprintf( stderr, "  -b, --binary FILE   write the binary offset file to FILE instead of text to stdout\n" );
+  fprintf( stderr, "  -t, --threads N     with --binary, encode with N threads ( default 1 )\n" );
+}
+
+int main( int argc, char** argv)
+{
+  const char *binary_path = NULL;
+  int         threads     = 1;
+  tchhdr_t    hdr;
+  int         fd;
+  void       *mem         = NULL;
+  uint64_t    mem_length  = 0;
+  bool        ok          = true;
+  int         opt;
+
+  struct option long_options[] = {
+    { "binary",  required_argument, NULL, 'b' },
+    { "threads", required_argument, NULL, 't' },
+    { NULL,      0,                 NULL,  0  }
+  };
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "b:t:", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'b': binary_path = optarg; break;
+      case 't': threads     = atoi( optarg ); break;
+      default :
+        usage( argv[0] );
+        exit(1);
+    }
+  }
+
+  if ( optind >= argc || threads < 1 ) {
+    usage( argv[0] );
+    exit(1);
+  }
+
+  if ( -1 == ( fd = open( argv[optind], O_RDONLY ) ) || !tchhdr_read( fd, &hdr ) ) {
+    fprintf(stderr, "open error on %s : %s\n", argv[optind], tchhdr_error( errno ));
+    exit(1);
+  }
 
+  fprintf( stderr, "DB %s has rnum %llu, bnum %llu, apow %d\n", argv[optind], (long long unsigned)hdr.record_number,
+           (long long unsigned)hdr.bucket_number, hdr.alignment_pow);
+
+  mem_length = TCH_HEADER_SIZE + ( hdr.bytes_per * hdr.bucket_number );
+  mem = mmap( NULL, mem_length , PROT_READ, MAP_SHARED, fd, 0);
+  if ( MAP_FAILED == mem ) {
+    fprintf(stderr, "error mapping file : %d, %s\n", errno, strerror( errno ));
+    close( fd );
+    exit(1);
+  }
+  madvise( mem, mem_length, MADV_SEQUENTIAL);
+
+  if ( NULL != binary_path ) {
+    ok = gen_binary( binary_path, (const uint8_t*)mem + TCH_HEADER_SIZE, &hdr, threads );
+  } else {
+    gen_text( (const uint8_t*)mem + TCH_HEADER_SIZE, &hdr );
+  }
+
+  munmap( mem, mem_length );
+  close(fd);
+  exit( ok ? 0 : 1 );
+}
@@ -7,6 +7,13 @@ opts = Trollop::options do
   opt :count,      'The number of tyrants', :type => Integer, :default => 16
   opt :step,       'The the amount to increment the port numbers by', :type => Integer, :default => 2
   opt :output_file,'The basename (without extension) of the C file to output', :type => String, :default => "backend_for"
+  opt :map_file,   'Also write the same servers as a routing map ( see routing.h )', :type => String
+end
+
+# shards are picked by the low bits of the mlid alone, so there has to be a
+# power of 2 of them for every masked value to have exactly one owner
+unless opts[:count] > 0 && ( opts[:count] & ( opts[:count] - 1 ) ) == 0
+  Trollop::die :count, "must be a power of 2"
 end
 
 # The port list is [ start_port, stop_port ) stepped by 2
@@ -33,6 +40,9 @@ File.open( h_filename, "w+" ) do |dot_h|
 #include <errno.h>
 #include <ctype.h>
 #include <tcrdb.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /*
  * the data structure holding a storage server configuration
@@ -46,11 +56,45 @@ typedef struct {
 } storage_config_t;
 
 #define STORAGE_SERVER_COUNT #{opts[:count]}
+#define STORAGE_SERVER_MASK  #{"0x%02x" % (opts[:count] - 1)}
 
 extern storage_config_t storage_servers[];
 
+/*
+ * storage_servers indexed by mlid & STORAGE_SERVER_MASK
+ */
+extern const storage_config_t * const #{func_name}_table[STORAGE_SERVER_COUNT];
+
 extern const storage_config_t *#{func_name}( const char* mlid_s, int length );
 
+/*
+ * Route count keys in one call.  shards[i] gets the index in storage_servers
+ * of the server for keys[i], the same one #{func_name} returns, or -1 when
+ * there is no number in the key ( nothing is printed for those ).  Returns
+ * the number of keys routed.
+ */
+extern int #{func_name}_batch( const char * const *keys, const int *lengths, int count, int *shards );
+
+/*
+ * The number #{func_name} routes on, 1 and the number in *mlid, or 0 when
+ * the key has none ( nothing is printed ).
+ */
+extern int #{func_name}_parse( const char *mlid_s, int length, unsigned long long *mlid );
+
+/*
+ * The plain C parse #{func_name}_parse is checked against, same results.
+ */
+extern int #{func_name}_parse_scalar( const char *mlid_s, int length, unsigned long long *mlid );
+
+/*
+ * The server for an mlid that has already been parsed, a single masked
+ * table load whatever the number of servers.
+ */
+static inline const storage_config_t *#{func_name}_mlid( unsigned long long mlid )
+{
+    return #{func_name}_table[mlid & STORAGE_SERVER_MASK];
+}
+
 #endif
 _H
   dot_h.write( content )
@@ -83,16 +127,146 @@ _chunk
 
   content.puts( chunks.join("    ,\n") )
   
-  content.puts <<_footer
+  content.puts <<_table
    ,
    { .host = NULL }
 };
 
+const storage_config_t * const #{func_name}_table[STORAGE_SERVER_COUNT] = {
+_table
+
+  # storage_servers[idx] was given bitmask idx above, so the table is in that order
+  entries = (0...opts[:count]).map { |masked| "    /* mask #{"0x%02x" % masked} */ &(storage_servers[#{masked}])" }
+  content.puts( entries.join(",\n") )
+
+  content.puts <<_footer
+};
+
+/*
+ * The digit scan and parse, as plain C.  This is what backend_for did before
+ * it went through SSE2 and SWAR below, it is kept as the reference those
+ * have to agree with ( route-bench --verify ).
+ *
+ * Puts the first number in the first length bytes of mlid_s in *mlid and
+ * returns 1, or returns 0 when there is no number.  Numbers too large for 64
+ * bits saturate the same way strtoull does.
+ */
+int #{func_name}_parse_scalar( const char *mlid_s, int length, unsigned long long *mlid )
+{
+    int i = 0;
+
+    *mlid = 0;
+
+    /* skip forward until we have a number */
+    while ( ( i < length ) && !isdigit( (unsigned char)mlid_s[i] ) ) {
+        i++;
+    }
+
+    if ( i == length ) {
+        return 0;
+    }
+
+    for ( ; ( i < length ) && isdigit( (unsigned char)mlid_s[i] ) ; i++ ) {
+        unsigned int digit = mlid_s[i] - '0';
+        if ( *mlid > ( ULLONG_MAX - digit ) / 10 ) {
+            *mlid = ULLONG_MAX;
+            break;
+        }
+        *mlid = ( *mlid * 10 ) + digit;
+    }
+    return 1;
+}
+
+#ifdef __SSE2__
+/*
+ * bit n set when s[n] is a digit, for the 16 bytes at s
+ */
+static inline unsigned int #{func_name}_digit_mask( const char *s )
+{
+    __m128i v = _mm_sub_epi8( _mm_loadu_si128( (const __m128i*)s ), _mm_set1_epi8( '0' ) );
+    return _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_min_epu8( v, _mm_set1_epi8( 9 ) ), v ) );
+}
+#endif
+
+/*
+ * The first index from i on where s[i] is ( digits = 1 ) or is not
+ * ( digits = 0 ) a digit, or length.  16 bytes at a time while there are 16
+ * bytes left, never reading past length.
+ */
+static inline int #{func_name}_skip( const char *s, int i, int length, unsigned int digits )
+{
+#ifdef __SSE2__
+    for ( ; i + 16 <= length ; i += 16 ) {
+        unsigned int mask = #{func_name}_digit_mask( s + i );
+        if ( !digits ) {
+            mask = ~mask & 0xffff;
+        }
+        if ( 0 != mask ) {
+            return i + __builtin_ctz( mask );
+        }
+    }
+#endif
+    while ( ( i < length ) && ( (unsigned int)( (unsigned char)s[i] - '0' ) < 10 ) != digits ) {
+        i++;
+    }
+    return i;
+}
+
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/*
+ * 8 ascii digits to their value with three multiplies, pairs then quads
+ * then the whole, the first digit is the most significant
+ */
+static inline unsigned long long #{func_name}_swar8( const char *p )
+{
+    unsigned long long v;
+
+    memcpy( &v, p, 8 );
+    v = ( ( v & 0x0F0F0F0F0F0F0F0FULL ) * 2561 ) >> 8;
+    v = ( ( v & 0x00FF00FF00FF00FFULL ) * 6553601 ) >> 16;
+    return ( ( v & 0x0000FFFF0000FFFFULL ) * 42949672960001ULL ) >> 32;
+}
+#endif
+
+/*
+ * #{func_name}_parse_scalar, faster.  Any run of up to 19 digits fits in 64
+ * bits, those are right aligned behind '0's and parsed 8 at a time.  Longer
+ * runs can saturate and go through the scalar loop.
+ */
+int #{func_name}_parse( const char *mlid_s, int length, unsigned long long *mlid )
+{
+    int start = #{func_name}_skip( mlid_s, 0, length, 1 );
+    int stop;
+
+    if ( start == length ) {
+        *mlid = 0;
+        return 0;
+    }
+
+    stop = #{func_name}_skip( mlid_s, start, ( length - start > 20 ) ? start + 20 : length, 0 );
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if ( stop - start <= 19 ) {
+        char digits[24];
+        memset( digits, '0', sizeof( digits ) );
+        memcpy( digits + sizeof( digits ) - ( stop - start ), mlid_s + start, stop - start );
+        *mlid = #{func_name}_swar8( digits ) * 10000000000000000ULL +
+                #{func_name}_swar8( digits + 8 ) * 100000000ULL +
+                #{func_name}_swar8( digits + 16 );
+        return 1;
+    }
+#endif
+    return #{func_name}_parse_scalar( mlid_s + start, length - start, mlid );
+}
+
 /*
  * Given the input mlid as a string, and the length of that string,  return the 
  * storage config for the appropriate server. #{func_name} will use the first
  * item that looks like a number in the input string.
  *
+ * The input does not need to be NUL terminated, only the first length bytes
+ * are looked at.  Numbers too large for 64 bits saturate the same way
+ * strtoull does.
+ *
  * The value returned is a pointer to the information in memory, it should not
  * be freed or altered.
  *
@@ -100,39 +274,44 @@ _chunk
 
 const storage_config_t * #{func_name}( const char *mlid_s, int length )
 {
-    int i = 0;
-    const char *num_start = NULL;
-    unsigned long long mlid ;
-
-    /* skip forward until we have a number */
-    for ( i = 0 ; i < length ; i++ ) {
-        if ( isdigit( mlid_s[i] ) ) {
-            num_start = &(mlid_s[i]);
-            break;
-        }
-    }
+    unsigned long long mlid;
 
-    if ( NULL == num_start ) {
-        fprintf( stderr, "Unable to find an mlid in (%s)\\n", mlid_s );
+    if ( !#{func_name}_parse( mlid_s, length, &mlid ) ) {
+        fprintf( stderr, "Unable to find an mlid in (%.*s)\\n", length, mlid_s );
         return (storage_config_t*)NULL;
     }
 
-    mlid = strtoull( num_start, NULL, 10 );
-    if ( ( 0 == mlid ) && ( ( ERANGE == errno ) || ( EINVAL == errno ) ) ) {
-        fprintf( stderr, "ERROR : Invalid mlid string [%s].  It does not convert to a 64 bit number.\\n", num_start );
-        return (storage_config_t *)NULL;
-    }
+    return #{func_name}_mlid( mlid );
+}
 
-    for (i = 0 ; i < STORAGE_SERVER_COUNT; i++ ) {
-        unsigned long long mlid_used = mlid & storage_servers[i].bits_used_bitmask;
-        if ( mlid_used == storage_servers[i].bitmask ) {
-            return &(storage_servers[i]);
-        } 
+int #{func_name}_batch( const char * const *keys, const int *lengths, int count, int *shards )
+{
+    int routed = 0;
+    int i;
+
+    for ( i = 0 ; i < count ; i++ ) {
+        unsigned long long mlid;
+        if ( #{func_name}_parse( keys[i], lengths[i], &mlid ) ) {
+            shards[i] = (int)( mlid & STORAGE_SERVER_MASK );
+            routed   += 1;
+        } else {
+            shards[i] = -1;
+        }
     }
-    fprintf( stderr, "ERROR : No storage server backend found for mlid [%s]\\n", mlid_s );
-    return (storage_config_t *)NULL;
+    return routed;
 }
 _footer
   
   dot_c.write( content.string )
 end
+
+if opts[:map_file] then
+  File.open( opts[:map_file], "w+" ) do |map|
+    map.puts "# generated by generate-backend-for.rb, load with tch2tcr --map"
+    map.puts "version 1"
+    map.puts "serial #{Time.now.to_i}"
+    port_list.each_with_index do |port, idx|
+      map.puts "server #{"0x%02x" % idx} #{opts[:host]} #{port}"
+    end
+  end
+end
@@ -6,80 +6,495 @@
 #include <stdbool.h>
 #include <time.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
-void print_progress( FILE* file, time_t start_time, long long unsigned final, long long unsigned so_far );
+#include "tchscan.h"
+#include "tchpar.h"
+#include "profile.h"
 
-int main(int argc, char **argv)
+/*
+ * Scan benchmark.  Runs the same database through each scan engine, with and
+ * without inflating deflated values, and reports the cost of each as JSON so
+ * the engine can be picked per host type.
+ *
+ *   tc        tchdbopen + tchdbiternext3, what the tools used to do
+ *   buffered  tchscan with large pread windows
+ *   mmap      tchscan over a mapping of the whole file
+ *   uring     tchscan with io_uring read ahead ( HAVE_LIBURING builds only )
+ *
+ * With --threads N the tchscan engines split the record region between N
+ * threads with tchpar, the tc engine is always a single thread.
+ *
+ * With --cold the file is dropped from the page cache with
+ * POSIX_FADV_DONTNEED before every run.  --polite, --direct and --rate set
+ * up the tchscan engines to leave the page cache alone ( see tchscan_io_t ),
+ * which is how to measure what a business hours scan will cost.
+ */
+
+#define ENGINE_TC -1
+
+void print_json_string( FILE* out, const char* s );
+
+/*
+ * --profile, each run's threads are named after the engine and whether it
+ * inflates, so repeats of one combination add up together
+ */
+static profile_t *profile       = NULL;
+static int        phase_read    = 0;
+static int        phase_inflate = 0;
+
+typedef struct result {
+  const char *engine;
+  int         threads;
+  bool        inflate;
+  uint64_t    records;
+  uint64_t    bytes;           /* size of the record region scanned */
+  uint64_t    value_bytes;     /* value bytes handed out, after inflating */
+  double      seconds;
+  double      user_cpu;
+  double      sys_cpu;
+  long        minor_faults;
+  long        major_faults;
+  bool        ok;
+} result_t;
+
+static double now_seconds( void )
 {
-  TCHDB *hdb;
-  TCXSTR *key;
-  TCXSTR *value;
-  int      ecode;
-  uint64_t total = 0;
-  uint64_t count = 0;
-  uint64_t  left = 0;
-  double     rps = 0.0;
-  time_t   start = time(NULL);
-  time_t     now;
-  double    dur;
-  double    pct;
- 
-  if ( argc < 3 ) {
-    fprintf( stderr, "Usage: %s database.hdb\n", argv[0]);
-    exit(1);
-  }
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ( ts.tv_nsec / 1e9 );
+}
 
-  hdb = tchdbnew();
+static double tv_seconds( struct timeval tv )
+{
+  return tv.tv_sec + ( tv.tv_usec / 1e6 );
+}
 
-  /* open the database */
-  if(!tchdbopen(hdb, argv[1], HDBOREADER | HDBONOLCK )){
-    ecode = tchdbecode(hdb);
-    fprintf(stderr, "open error: %s\n", tchdberrmsg(ecode));
-    tchdbdel( hdb );
-    exit(1);
+void drop_cache( const char* path )
+{
+  int fd = open( path, O_RDONLY );
+  if ( -1 == fd ) {
+    fprintf( stderr, "open error on %s : %s\n", path, strerror( errno ));
+    return;
   }
-
-  total = tchdbrnum( hdb );
-  printf("Database contains %llu records\n", total );
-  ecode = posix_fadvise( hdb->fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+  fdatasync( fd );
+  int ecode = posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
   if ( 0 != ecode ) {
     fprintf( stderr, "Returned %d, %s\n", ecode, strerror( ecode ));
   }
+  close( fd );
+}
+
+bool scan_tc( const char* path, bool inflate, result_t* res, const char* label )
+{
+  TCHDB            *hdb = tchdbnew();
+  TCXSTR           *key;
+  TCXSTR           *value;
+  int               ecode;
+  profile_thread_t *pt;
+  uint64_t          begin;
 
-  /* muck with the deflate flag */
+  if ( !tchdbopen( hdb, path, HDBOREADER | HDBONOLCK ) ) {
+    ecode = tchdbecode( hdb );
+    fprintf( stderr, "open error: %s\n", tchdberrmsg( ecode ));
+    tchdbdel( hdb );
+    return false;
+  }
+  posix_fadvise( hdb->fd, 0, 0, POSIX_FADV_SEQUENTIAL );
 
-  /* printf("before hdb->opts = %d\n", hdb->opts); */
-  /* hdb->zmode = false; */
-  /* hdb->opts = hdb->opts & ( ~HDBTDEFLATE );  */
-  /* printf(" after hdb->opts = %d\n", hdb->opts); */
+  /* hand back the stored bytes instead of inflating them */
+  if ( !inflate ) {
+    hdb->zmode = false;
+    hdb->opts  = hdb->opts & ( ~HDBTDEFLATE );
+  }
 
-  /* traverse the records */
   tchdbiterinit( hdb );
-
   key   = tcxstrnew();
   value = tcxstrnew();
 
+  // tchdbiternext3 inflates as it reads, so it is all read here
+  pt    = profile_thread( profile, label );
+  begin = profile_begin( pt, phase_read );
   while( tchdbiternext3( hdb, key, value ) ) {
-    count++;
-    if (( count % 10000 ) == 0 ) {
-        print_progress( stdout, start, total, count );  
-    }
+    profile_end( pt, phase_read, begin );
+    res->records     += 1;
+    res->value_bytes += tcxstrsize( value );
+    begin = profile_begin( pt, phase_read );
   }
+  profile_thread_stop( pt );
   tcxstrdel( key );
   tcxstrdel( value );
 
-  now = time(NULL);
-  rps = ( count / ( (float)now - (float)start ) );
-  printf("Final %llu / %llu records at %f rps\n", count, total, rps);
+  tchdbclose( hdb );
+  tchdbdel( hdb );
+  return true;
+}
 
-  /* close the database */
-  if (!tchdbclose( hdb ) ) {
-    ecode = tchdbecode( hdb );
-    fprintf( stderr, "close error: %s\n", tchdberrmsg( ecode ) );
+/*
+ * per thread state of scan_parallel
+ */
+typedef struct scan_thread {
+  z_stream  zs;
+  char     *buf;
+  int       buf_size;
+  bool      inflate;
+  uint64_t  value_bytes;
+  profile_thread_t *profile;
+} __attribute__(( aligned( 64 ) )) scan_thread_t;
+
+bool count_record( const tchscan_rec_t* rec, int thread, void* ctx )
+{
+  scan_thread_t *st = &(((scan_thread_t*)ctx)[thread]);
+
+  if ( st->inflate ) {
+    uint64_t begin = profile_begin( st->profile, phase_inflate );
+    int      size  = tchscan_inflate( &(st->zs), rec->val_buf, rec->val_size, &(st->buf), &(st->buf_size) );
+    profile_end( st->profile, phase_inflate, begin );
+    if ( size < 0 ) {
+      fprintf( stderr, "inflate error : record at offset %llu\n", (long long unsigned)rec->offset );
+      return true;
+    }
+    st->value_bytes += size;
+  } else {
+    st->value_bytes += rec->val_size;
   }
-  
+  return true;
+}
 
-  tchdbdel( hdb );
-  exit(0);
+/*
+ * O_DIRECT only makes sense for the buffered engines, leave it off for mmap
+ */
+tchscan_io_t engine_io( const tchscan_io_t* io, int engine )
+{
+  tchscan_io_t eio = *io;
+  eio.direct = io->direct && ( TCHSCAN_MMAP != engine );
+  return eio;
 }
 
+bool scan_parallel( const char* path, int engine, uint64_t window, int threads, const tchscan_io_t* io,
+                    bool inflate, result_t* res, const char* label )
+{
+  tchpar_t      *par = tchpar_new( path, threads, engine, window );
+  scan_thread_t *st  = NULL;
+  tchscan_io_t   eio = engine_io( io, engine );
+  int64_t        records;
+
+  if ( NULL == par ) {
+    return false;
+  }
+  tchpar_set_io( par, &eio );
+
+  inflate = inflate && ( par->ranges[0].scan->hdr.options & TCH_OPT_DEFLATE );
+  if ( 0 != posix_memalign( (void**)&st, 64, threads * sizeof( scan_thread_t ) ) ) {
+    tchpar_destroy( par );
+    return false;
+  }
+  memset( st, 0, threads * sizeof( scan_thread_t ) );
+  for ( int i = 0 ; i < threads ; i++ ) {
+    // the reads happen inside tchpar, between the callbacks, so they show up as (other)
+    st[i].inflate = inflate;
+    st[i].profile = profile_thread( profile, label );
+    if ( inflate ) {
+      inflateInit2( &(st[i].zs), -15 );
+      st[i].buf_size = 64 * 1024;
+      st[i].buf      = malloc( st[i].buf_size );
+    }
+  }
+
+  if ( tchpar_start( par, 0, count_record, st ) ) {
+    records = tchpar_finish( par );
+  } else {
+    records = -1;
+  }
+
+  for ( int i = 0 ; i < threads ; i++ ) {
+    profile_thread_stop( st[i].profile );
+    res->value_bytes += st[i].value_bytes;
+    if ( inflate ) {
+      inflateEnd( &(st[i].zs) );
+      free( st[i].buf );
+    }
+  }
+  free( st );
+  tchpar_destroy( par );
+
+  if ( records < 0 ) {
+    return false;
+  }
+  res->records = records;
+  return true;
+}
+
+bool scan_raw( const char* path, int engine, uint64_t window, const tchscan_io_t* io, bool inflate, result_t* res,
+               const char* label )
+{
+  tchscan_t        *scan = tchscan_open_engine( path, engine, window );
+  tchscan_rec_t     rec;
+  tchscan_io_t      eio  = engine_io( io, engine );
+  z_stream          zs;
+  int               buf_size = 64 * 1024;
+  char             *buf = NULL;
+  profile_thread_t *pt;
+  uint64_t          begin;
+
+  if ( NULL == scan ) {
+    return false;
+  }
+  tchscan_set_io( scan, &eio );
+
+  inflate = inflate && ( scan->hdr.options & TCH_OPT_DEFLATE );
+  if ( inflate ) {
+    memset( &zs, 0, sizeof( zs ) );
+    inflateInit2( &zs, -15 );
+    buf = malloc( buf_size );
+  }
+
+  pt    = profile_thread( profile, label );
+  begin = profile_begin( pt, phase_read );
+  while ( tchscan_next( scan, &rec ) ) {
+    profile_end( pt, phase_read, begin );
+    res->records += 1;
+    if ( inflate ) {
+      int size;
+      begin = profile_begin( pt, phase_inflate );
+      size  = tchscan_inflate( &zs, rec.val_buf, rec.val_size, &buf, &buf_size );
+      profile_end( pt, phase_inflate, begin );
+      if ( size < 0 ) {
+        fprintf( stderr, "inflate error : record at offset %llu\n", (long long unsigned)rec.offset );
+      } else {
+        res->value_bytes += size;
+      }
+    } else {
+      res->value_bytes += rec.val_size;
+    }
+    begin = profile_begin( pt, phase_read );
+  }
+  profile_thread_stop( pt );
+
+  if ( inflate ) {
+    inflateEnd( &zs );
+    free( buf );
+  }
+  tchscan_close( scan );
+  return true;
+}
+
+void run_one( const char* path, int engine, uint64_t window, int threads, const tchscan_io_t* io,
+              bool inflate, bool cold, result_t* res )
+{
+  struct rusage before, after;
+  double        start;
+  char          label[32];
+
+  if ( cold ) {
+    drop_cache( path );
+  }
+
+  snprintf( label, sizeof( label ), "%s x%d inflate %s", res->engine, threads, inflate ? "on" : "off" );
+
+  getrusage( RUSAGE_SELF, &before );
+  start = now_seconds();
+
+  if ( ENGINE_TC == engine ) {
+    res->ok = scan_tc( path, inflate, res, label );
+  } else if ( threads > 1 ) {
+    res->ok = scan_parallel( path, engine, window, threads, io, inflate, res, label );
+  } else {
+    res->ok = scan_raw( path, engine, window, io, inflate, res, label );
+  }
+
+  res->seconds = now_seconds() - start;
+  getrusage( RUSAGE_SELF, &after );
+
+  res->user_cpu     = tv_seconds( after.ru_utime ) - tv_seconds( before.ru_utime );
+  res->sys_cpu      = tv_seconds( after.ru_stime ) - tv_seconds( before.ru_stime );
+  res->minor_faults = after.ru_minflt - before.ru_minflt;
+  res->major_faults = after.ru_majflt - before.ru_majflt;
+}
+
+void print_result( FILE* out, const result_t* res, bool last )
+{
+  double ns_per_record = res->records ? ( res->seconds * 1e9 ) / res->records : 0.0;
+  double mb_per_sec    = res->seconds > 0 ? ( res->bytes / 1048576.0 ) / res->seconds : 0.0;
+
+  fprintf( out, "    { \"engine\": \"%s\", \"threads\": %d, \"inflate\": %s, \"ok\": %s, \"records\": %llu, \"bytes\": %llu, "
+                "\"value_bytes\": %llu, \"seconds\": %.6f, \"ns_per_record\": %.2f, \"mb_per_sec\": %.2f, "
+                "\"user_cpu\": %.6f, \"sys_cpu\": %.6f, \"minor_faults\": %ld, \"major_faults\": %ld }%s\n",
+           res->engine, res->threads, res->inflate ? "true" : "false", res->ok ? "true" : "false",
+           (long long unsigned)res->records, (long long unsigned)res->bytes,
+           (long long unsigned)res->value_bytes, res->seconds, ns_per_record, mb_per_sec,
+           res->user_cpu, res->sys_cpu, res->minor_faults, res->major_faults, last ? "" : "," );
+}
+
+void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options] database.hdb\n", name );
+  fprintf( stderr, "  -e, --engines LIST   comma separated from tc,buffered,mmap,uring ( default all built in )\n" );
+  fprintf( stderr, "  -z, --inflate MODE   off, on or both ( default both )\n" );
+  fprintf( stderr, "  -c, --cold           drop the file from the page cache before each run\n" );
+  fprintf( stderr, "  -w, --window BYTES   read window of the buffered engines ( default %d )\n", TCHSCAN_WINDOW_SIZE );
+  fprintf( stderr, "  -p, --polite         drop pages from the page cache behind the scan\n" );
+  fprintf( stderr, "  -d, --direct         O_DIRECT reads for the buffered engines\n" );
+  fprintf( stderr, "  -l, --rate BYTES     scan at most BYTES per second\n" );
+  fprintf( stderr, "  -t, --threads N      scan threads for the tchscan engines ( default 1 )\n" );
+  fprintf( stderr, "  -r, --repeat N       run every combination N times ( default 1 )\n" );
+  fprintf( stderr, "  -o, --output FILE    write the JSON to FILE instead of stdout\n" );
+  fprintf( stderr, "  -f, --profile        print where each run's time went to stderr at the end\n" );
+  fprintf( stderr, "  -E, --trace FILE     and write the timed spans to FILE as a Chrome trace\n" );
+}
+
+int main(int argc, char **argv)
+{
+  char        engine_list[256] = "tc,buffered,mmap,uring";
+  const char *inflate_mode     = "both";
+  const char *output_path      = NULL;
+  bool        cold             = false;
+  uint64_t    window           = TCHSCAN_WINDOW_SIZE;
+  int         repeat           = 1;
+  int         threads          = 1;
+  tchscan_io_t io              = { false, false, 0 };
+  int         engines[8];
+  int         engine_count     = 0;
+  FILE       *out              = stdout;
+  bool        profiling        = false;
+  const char *trace_path       = NULL;
+  int         opt;
+
+  struct option long_options[] = {
+    { "engines", required_argument, NULL, 'e' },
+    { "inflate", required_argument, NULL, 'z' },
+    { "cold",    no_argument,       NULL, 'c' },
+    { "window",  required_argument, NULL, 'w' },
+    { "polite",  no_argument,       NULL, 'p' },
+    { "direct",  no_argument,       NULL, 'd' },
+    { "rate",    required_argument, NULL, 'l' },
+    { "threads", required_argument, NULL, 't' },
+    { "repeat",  required_argument, NULL, 'r' },
+    { "output",  required_argument, NULL, 'o' },
+    { "profile", no_argument,       NULL, 'f' },
+    { "trace",   required_argument, NULL, 'E' },
+    { NULL,      0,                 NULL,  0  }
+  };
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "e:z:cpdl:w:t:r:o:fE:", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'e': snprintf( engine_list, sizeof( engine_list ), "%s", optarg ); break;
+      case 'z': inflate_mode   = optarg; break;
+      case 'c': cold           = true; break;
+      case 'w': window         = strtoull( optarg, NULL, 0 ); break;
+      case 'p': io.drop_behind = true; break;
+      case 'd': io.direct      = true; break;
+      case 'l': io.rate        = strtoull( optarg, NULL, 0 ); break;
+      case 't': threads        = atoi( optarg ); break;
+      case 'r': repeat         = atoi( optarg ); break;
+      case 'o': output_path    = optarg; break;
+      case 'f': profiling      = true; break;
+      case 'E': trace_path     = optarg; break;
+      default :
+        usage( argv[0] );
+        exit(1);
+    }
+  }
+
+  if ( optind >= argc ) {
+    usage( argv[0] );
+    exit(1);
+  }
+
+  for ( char *name = strtok( engine_list, "," ) ; NULL != name && engine_count < 8 ; name = strtok( NULL, "," ) ) {
+    if ( 0 == strcmp( name, "tc" ) ) {
+      engines[engine_count++] = ENGINE_TC;
+    } else if ( -1 != tchscan_engine_named( name ) ) {
+      engines[engine_count++] = tchscan_engine_named( name );
+    } else {
+      fprintf( stderr, "Skipping engine %s, unknown or not built in\n", name );
+    }
+  }
+
+  bool inflate_off = ( 0 == strcmp( inflate_mode, "off" ) || 0 == strcmp( inflate_mode, "both" ) );
+  bool inflate_on  = ( 0 == strcmp( inflate_mode, "on" )  || 0 == strcmp( inflate_mode, "both" ) );
+
+  // only for the header, and a mapping would pin pages --polite is meant to drop
+  tchscan_t *info = tchscan_open_engine( argv[optind], TCHSCAN_BUFFERED, 4096 );
+  if ( NULL == info ) {
+    exit(1);
+  }
+
+  // the results say what was done, and a file that was never deflated has nothing to inflate
+  if ( inflate_on && !( info->hdr.options & TCH_OPT_DEFLATE ) ) {
+    fprintf( stderr, "%s is not deflated, every run is inflate off\n", info->path );
+    inflate_on  = false;
+    inflate_off = true;
+  }
+
+  if ( NULL != output_path && NULL == ( out = fopen( output_path, "w" ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", output_path, strerror( errno ));
+    exit(1);
+  }
+
+  if ( profiling || NULL != trace_path ) {
+    profile       = profile_new( "iterdb", PROFILE_SAMPLE_EVERY, trace_path );
+    phase_read    = profile_phase( profile, "read" );
+    phase_inflate = profile_phase( profile, "inflate" );
+  }
+
+  int       total   = engine_count * ( inflate_off + inflate_on ) * repeat;
+  int       done    = 0;
+  result_t *results = (result_t*)calloc( total > 0 ? total : 1, sizeof( result_t ) );
+
+  for ( int r = 0 ; r < repeat ; r++ ) {
+    for ( int e = 0 ; e < engine_count ; e++ ) {
+      for ( int z = 0 ; z < 2 ; z++ ) {
+        if ( ( 0 == z && !inflate_off ) || ( 1 == z && !inflate_on ) ) {
+          continue;
+        }
+        result_t *res = &(results[done++]);
+        res->engine  = ( ENGINE_TC == engines[e] ) ? "tc" : tchscan_engine_name( engines[e] );
+        res->threads = ( ENGINE_TC == engines[e] || threads < 1 ) ? 1 : threads;
+        res->inflate = ( 1 == z );
+        res->bytes   = info->end - info->hdr.first_record;
+
+        run_one( info->path, engines[e], window, res->threads, &io, res->inflate, cold, res );
+
+        fprintf( stderr, " %-8s x%-3d inflate %-3s : %12llu records in %8.3fs, %10.2f ns/record, %8.2f MB/s\n",
+                 res->engine, res->threads, res->inflate ? "on" : "off", (long long unsigned)res->records, res->seconds,
+                 res->records ? ( res->seconds * 1e9 ) / res->records : 0.0,
+                 res->seconds > 0 ? ( res->bytes / 1048576.0 ) / res->seconds : 0.0 );
+      }
+    }
+  }
+
+  fprintf( out, "{\n" );
+  fprintf( out, "  \"file\": " );
+  print_json_string( out, info->path );
+  fprintf( out, ",\n" );
+  fprintf( out, "  \"file_size\": %llu,\n", (long long unsigned)info->file_size );
+  fprintf( out, "  \"record_number\": %llu,\n", (long long unsigned)info->hdr.record_number );
+  fprintf( out, "  \"deflate\": %s,\n", ( info->hdr.options & TCH_OPT_DEFLATE ) ? "true" : "false" );
+  fprintf( out, "  \"cache\": \"%s\",\n", cold ? "cold" : "warm" );
+  fprintf( out, "  \"window\": %llu,\n", (long long unsigned)window );
+  fprintf( out, "  \"drop_behind\": %s,\n", io.drop_behind ? "true" : "false" );
+  fprintf( out, "  \"direct\": %s,\n", io.direct ? "true" : "false" );
+  fprintf( out, "  \"rate\": %llu,\n", (long long unsigned)io.rate );
+  fprintf( out, "  \"results\": [\n" );
+  for ( int i = 0 ; i < done ; i++ ) {
+    print_result( out, &(results[i]), i == done - 1 );
+  }
+  fprintf( out, "  ]\n}\n" );
+
+  if ( stdout != out ) {
+    fclose( out );
+  }
+  if ( NULL != profile ) {
+    profile_report( profile, stderr );
+    profile_destroy( profile );
+  }
+  free( results );
+  tchscan_close( info );
+  exit(0);
+}
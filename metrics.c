@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "metrics.h"
+
+static double now_seconds( void )
+{
+  return metrics_now() / 1e9;
+}
+
+metrics_t* metrics_new( const char* name, int capacity )
+{
+  metrics_t *m = (metrics_t*)calloc( 1, sizeof( metrics_t ) );
+
+  snprintf( m->name, sizeof( m->name ), "%s", name );
+  m->capacity = ( capacity > 0 ) ? capacity : 1;
+  m->slots    = (metrics_slot_t**)calloc( m->capacity, sizeof( metrics_slot_t* ) );
+  m->start    = now_seconds();
+  return m;
+}
+
+int metrics_counter( metrics_t* m, const char* name )
+{
+  if ( m->counter_count == METRICS_MAX ) {
+    fprintf( stderr, "metrics: more than %d counters, %s is not counted\n", METRICS_MAX, name );
+    exit(1);
+  }
+  m->counter_names[m->counter_count] = name;
+  return m->counter_count++;
+}
+
+int metrics_histogram( metrics_t* m, const char* name )
+{
+  if ( m->hist_count == METRICS_MAX ) {
+    fprintf( stderr, "metrics: more than %d histograms, %s is not kept\n", METRICS_MAX, name );
+    exit(1);
+  }
+  m->hist_names[m->hist_count] = name;
+  return m->hist_count++;
+}
+
+metrics_slot_t* metrics_slot( metrics_t* m )
+{
+  metrics_slot_t *slot;
+  int             i;
+
+  if ( NULL == m ) {
+    return NULL;
+  }
+  if ( ( i = __atomic_fetch_add( &(m->slot_count), 1, __ATOMIC_RELAXED ) ) >= m->capacity ) {
+    return NULL;
+  }
+  if ( 0 != posix_memalign( (void**)&slot, 64, sizeof( metrics_slot_t ) ) ) {
+    return NULL;
+  }
+  memset( slot, 0, sizeof( metrics_slot_t ) );
+  // the reporting thread skips a slot it finds still NULL
+  __atomic_store_n( &(m->slots[i]), slot, __ATOMIC_RELEASE );
+  return slot;
+}
+
+bool metrics_output( metrics_t* m, const char* json_path, const char* prom_path )
+{
+  if ( NULL != json_path && NULL == ( m->json = fopen( json_path, "a" ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", json_path, strerror( errno ) );
+    return false;
+  }
+  if ( NULL != prom_path ) {
+    m->prom_path = strdup( prom_path );
+    m->prom_tmp  = (char*)malloc( strlen( prom_path ) + 5 );
+    sprintf( m->prom_tmp, "%s.tmp", prom_path );
+  }
+  return true;
+}
+
+/*
+ * sum every slot into the reporting side copies
+ */
+static void metrics_collect( metrics_t* m )
+{
+  int slots = __atomic_load_n( &(m->slot_count), __ATOMIC_RELAXED );
+
+  if ( slots > m->capacity ) {
+    slots = m->capacity;
+  }
+  memset( m->totals, 0, sizeof( m->totals ) );
+  memset( m->hist_totals, 0, sizeof( m->hist_totals ) );
+  memset( m->hist_sums, 0, sizeof( m->hist_sums ) );
+
+  for ( int s = 0 ; s < slots ; s++ ) {
+    metrics_slot_t *slot = __atomic_load_n( &(m->slots[s]), __ATOMIC_ACQUIRE );
+    if ( NULL == slot ) {
+      continue;
+    }
+    for ( int c = 0 ; c < m->counter_count ; c++ ) {
+      m->totals[c] += __atomic_load_n( &(slot->counters[c]), __ATOMIC_RELAXED );
+    }
+    for ( int h = 0 ; h < m->hist_count ; h++ ) {
+      m->hist_sums[h] += __atomic_load_n( &(slot->hist_sum[h]), __ATOMIC_RELAXED );
+      for ( int b = 0 ; b < METRICS_HIST_BUCKETS ; b++ ) {
+        m->hist_totals[h][b] += __atomic_load_n( &(slot->hist[h][b]), __ATOMIC_RELAXED );
+      }
+    }
+  }
+}
+
+uint64_t metrics_percentile( metrics_t* m, int hist, double pct )
+{
+  uint64_t total = 0;
+  uint64_t seen  = 0;
+
+  for ( int b = 0 ; b < METRICS_HIST_BUCKETS ; b++ ) {
+    total += m->hist_totals[hist][b];
+  }
+  if ( 0 == total ) {
+    return 0;
+  }
+  for ( int b = 0 ; b < METRICS_HIST_BUCKETS ; b++ ) {
+    seen += m->hist_totals[hist][b];
+    if ( seen >= total * pct ) {
+      return 1ULL << b;
+    }
+  }
+  return 1ULL << ( METRICS_HIST_BUCKETS - 1 );
+}
+
+uint64_t metrics_total( metrics_t* m, int counter )
+{
+  return m->totals[counter];
+}
+
+static uint64_t hist_count( metrics_t* m, int hist )
+{
+  uint64_t count = 0;
+  for ( int b = 0 ; b < METRICS_HIST_BUCKETS ; b++ ) {
+    count += m->hist_totals[hist][b];
+  }
+  return count;
+}
+
+static void metrics_write_json( metrics_t* m, double now )
+{
+  FILE *f = m->json;
+
+  fprintf( f, "{\"name\":\"%s\",\"time\":%.3f,\"elapsed\":%.3f", m->name, (double)time( NULL ), now - m->start );
+  for ( int c = 0 ; c < m->counter_count ; c++ ) {
+    fprintf( f, ",\"%s\":{\"total\":%llu,\"rate\":%.2f,\"ewma\":%.2f}", m->counter_names[c],
+             (long long unsigned)m->totals[c], m->rates[c].rate, m->rates[c].ewma );
+  }
+  for ( int h = 0 ; h < m->hist_count ; h++ ) {
+    uint64_t count = hist_count( m, h );
+    fprintf( f, ",\"%s_us\":{\"count\":%llu,\"mean\":%.2f,\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"p999\":%.2f}",
+             m->hist_names[h], (long long unsigned)count, count ? m->hist_sums[h] / 1e3 / count : 0.0,
+             metrics_percentile( m, h, 0.50 ) / 1e3, metrics_percentile( m, h, 0.90 ) / 1e3,
+             metrics_percentile( m, h, 0.99 ) / 1e3, metrics_percentile( m, h, 0.999 ) / 1e3 );
+  }
+  fprintf( f, "}\n" );
+  fflush( f );
+}
+
+static void metrics_write_prom( metrics_t* m )
+{
+  FILE *f;
+
+  if ( NULL == ( f = fopen( m->prom_tmp, "w" ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", m->prom_tmp, strerror( errno ) );
+    return;
+  }
+  for ( int c = 0 ; c < m->counter_count ; c++ ) {
+    const char *name = m->counter_names[c];
+    fprintf( f, "# TYPE %s_%s_total counter\n", m->name, name );
+    fprintf( f, "%s_%s_total %llu\n", m->name, name, (long long unsigned)m->totals[c] );
+    fprintf( f, "# TYPE %s_%s_rate gauge\n", m->name, name );
+    fprintf( f, "%s_%s_rate{window=\"%ds\"} %.2f\n", m->name, name, METRICS_WINDOW, m->rates[c].rate );
+    fprintf( f, "%s_%s_rate{window=\"ewma\"} %.2f\n", m->name, name, m->rates[c].ewma );
+  }
+  for ( int h = 0 ; h < m->hist_count ; h++ ) {
+    const char *name  = m->hist_names[h];
+    uint64_t    count = 0;
+    fprintf( f, "# TYPE %s_%s_seconds histogram\n", m->name, name );
+    for ( int b = 0 ; b < METRICS_HIST_BUCKETS ; b++ ) {
+      count += m->hist_totals[h][b];
+      fprintf( f, "%s_%s_seconds_bucket{le=\"%g\"} %llu\n", m->name, name, ( 1ULL << b ) / 1e9, (long long unsigned)count );
+    }
+    fprintf( f, "%s_%s_seconds_bucket{le=\"+Inf\"} %llu\n", m->name, name, (long long unsigned)count );
+    fprintf( f, "%s_%s_seconds_sum %.9f\n", m->name, name, m->hist_sums[h] / 1e9 );
+    fprintf( f, "%s_%s_seconds_count %llu\n", m->name, name, (long long unsigned)count );
+  }
+  if ( 0 != fclose( f ) || 0 != rename( m->prom_tmp, m->prom_path ) ) {
+    fprintf( stderr, "write error on %s : %s\n", m->prom_path, strerror( errno ) );
+  }
+}
+
+bool metrics_tick( metrics_t* m, bool force )
+{
+  double now  = now_seconds();
+  int    ring = METRICS_WINDOW + 1;
+  int    pos  = m->samples % ring;
+
+  if ( m->samples > 0 && !force && now - m->sample_times[( m->samples - 1 ) % ring] < 1.0 ) {
+    return false;
+  }
+
+  metrics_collect( m );
+  m->sample_times[pos] = now;
+  for ( int c = 0 ; c < m->counter_count ; c++ ) {
+    metrics_rate_t *r = &(m->rates[c]);
+    r->samples[pos] = m->totals[c];
+    if ( m->samples > 0 ) {
+      int    prev   = ( m->samples - 1 ) % ring;
+      int    oldest = ( m->samples < ring ) ? 0 : ( m->samples + 1 ) % ring;
+      double dt     = now - m->sample_times[prev];
+      double span   = now - m->sample_times[oldest];
+      if ( dt > 0 ) {
+        double instant = ( r->samples[pos] - r->samples[prev] ) / dt;
+        // dt / ( window + dt ) instead of 1 - exp( -dt / window ), close enough and no libm
+        r->ewma = ( 1 == m->samples ) ? instant : r->ewma + ( instant - r->ewma ) * dt / ( METRICS_WINDOW + dt );
+      }
+      if ( span > 0 ) {
+        r->rate = ( r->samples[pos] - r->samples[oldest] ) / span;
+      }
+    } else if ( now > m->start ) {
+      r->rate = r->ewma = m->totals[c] / ( now - m->start );
+    }
+  }
+  m->samples += 1;
+
+  if ( NULL != m->json ) {
+    metrics_write_json( m, now );
+  }
+  if ( NULL != m->prom_path ) {
+    metrics_write_prom( m );
+  }
+  return true;
+}
+
+void metrics_progress( metrics_t* m, FILE* file, int counter, long long unsigned final, long long unsigned so_far )
+{
+  print_progress_line( &(m->line), file, time( NULL ), final, so_far, m->rates[counter].rate, m->rates[counter].ewma );
+}
+
+void metrics_destroy( metrics_t* m )
+{
+  if ( NULL == m ) {
+    return;
+  }
+  metrics_tick( m, true );
+  if ( NULL != m->json ) {
+    fclose( m->json );
+  }
+  for ( int s = 0 ; s < m->capacity && s < m->slot_count ; s++ ) {
+    free( m->slots[s] );
+  }
+  free( m->slots );
+  free( m->prom_path );
+  free( m->prom_tmp );
+  free( m );
+}
@@ -0,0 +1,170 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * Counters and latency histograms for the long running tools, readable
+ * while they run.
+ *
+ * Every thread that counts something claims a slot of its own with
+ * metrics_slot and only ever adds to that one, so counting is a plain store
+ * with no lock and no shared cache line.  A slot may also be shared by
+ * threads that already serialize on a lock of their own, tcrpipe gives one
+ * to each backend.  The one reporting thread sums the slots when it calls
+ * metrics_tick, at most once a second, and keeps for each counter:
+ *
+ *   the total
+ *   the rate over the last METRICS_WINDOW seconds
+ *   an exponentially weighted rate with a METRICS_WINDOW second time constant
+ *
+ * and for each histogram the count, sum and log2 nanosecond buckets from
+ * which the percentiles come.
+ *
+ * Each tick can append a JSON object to a JSON lines file and rewrite a
+ * Prometheus text exposition file ( through a rename, so a textfile
+ * collector never sees half of it ).  metrics_progress prints the old
+ * print_progress line from the same numbers.
+ */
+
+#define METRICS_MAX            16      /* counters, and histograms             */
+#define METRICS_HIST_BUCKETS   40      /* bucket b is under 2^b ns, ~9 minutes  */
+#define METRICS_WINDOW         10      /* seconds                              */
+
+typedef struct metrics_slot {
+  uint64_t counters[METRICS_MAX];
+  uint64_t hist_sum[METRICS_MAX];      /* nanoseconds */
+  uint64_t hist[METRICS_MAX][METRICS_HIST_BUCKETS];
+} __attribute__(( aligned( 64 ) )) metrics_slot_t;
+
+typedef struct metrics_rate {
+  uint64_t samples[METRICS_WINDOW + 1];  /* totals a second or more apart, ring */
+  double   rate;                         /* over the window                    */
+  double   ewma;
+} metrics_rate_t;
+
+/*
+ * What print_progress_line remembers between two lines, zeroed to start
+ */
+typedef struct progress_line {
+  time_t last_now;
+  time_t last_done_at;
+  char   now_buf[32];
+  char   time_buf[32];
+} progress_line_t;
+
+typedef struct metrics {
+  char             name[64];             /* prefix of the Prometheus names    */
+  int              capacity;
+  int              slot_count;
+  metrics_slot_t **slots;
+
+  int              counter_count;
+  const char      *counter_names[METRICS_MAX];
+  int              hist_count;
+  const char      *hist_names[METRICS_MAX];
+
+  // only the reporting thread touches these
+  double           start;
+  double           sample_times[METRICS_WINDOW + 1];
+  int              samples;              /* taken so far                      */
+  uint64_t         totals[METRICS_MAX];
+  metrics_rate_t   rates[METRICS_MAX];
+  uint64_t         hist_totals[METRICS_MAX][METRICS_HIST_BUCKETS];
+  uint64_t         hist_sums[METRICS_MAX];
+  FILE            *json;
+  char            *prom_path;
+  char            *prom_tmp;
+  progress_line_t  line;
+} metrics_t;
+
+/*
+ * name prefixes the Prometheus metric names, capacity is the most slots that
+ * will ever be claimed
+ */
+extern metrics_t* metrics_new( const char* name, int capacity );
+
+/*
+ * Register a counter or histogram and return its id, before any slot is
+ * claimed.  names are not copied.
+ */
+extern int metrics_counter( metrics_t* m, const char* name );
+extern int metrics_histogram( metrics_t* m, const char* name );
+
+/*
+ * A slot for one thread ( or one lock ) to count into, or NULL if the
+ * capacity is used up or m is NULL, in which case counting into it does
+ * nothing.
+ */
+extern metrics_slot_t* metrics_slot( metrics_t* m );
+
+/*
+ * Append a JSON line every tick to json_path, rewrite prom_path every tick,
+ * either may be NULL.
+ */
+extern bool metrics_output( metrics_t* m, const char* json_path, const char* prom_path );
+
+/*
+ * Take a sample if a second has gone by since the last one, or if force is
+ * set, and write the outputs.  Returns whether it sampled.
+ */
+extern bool metrics_tick( metrics_t* m, bool force );
+
+extern uint64_t metrics_total( metrics_t* m, int counter );
+
+/*
+ * upper bound in nanoseconds of the bucket holding the pct'th percentile
+ */
+extern uint64_t metrics_percentile( metrics_t* m, int hist, double pct );
+
+/*
+ * The print_progress line for so_far of final, with the rate over the
+ * window of counter and the finish time from its weighted rate.
+ */
+extern void metrics_progress( metrics_t* m, FILE* file, int counter, long long unsigned final, long long unsigned so_far );
+
+/*
+ * A last forced tick, then close the outputs and free everything.
+ */
+extern void metrics_destroy( metrics_t* m );
+
+/*
+ * in print_progress.c, the progress line given the rates
+ */
+extern void print_progress_line( progress_line_t* line, FILE* file, time_t now, long long unsigned final,
+                                 long long unsigned so_far, double rate, double eta_rate );
+
+static inline uint64_t metrics_now( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Only one thread ever writes a slot at a time, so a relaxed load and store
+ * is all it takes for the reporting thread to see whole values.
+ */
+static inline void metrics_add( metrics_slot_t* slot, int counter, uint64_t n )
+{
+  if ( NULL != slot ) {
+    __atomic_store_n( &(slot->counters[counter]), slot->counters[counter] + n, __ATOMIC_RELAXED );
+  }
+}
+
+static inline void metrics_observe( metrics_slot_t* slot, int hist, uint64_t ns )
+{
+  if ( NULL != slot ) {
+    int b = ( 0 == ns ) ? 0 : 64 - __builtin_clzll( ns );
+    if ( b >= METRICS_HIST_BUCKETS ) {
+      b = METRICS_HIST_BUCKETS - 1;
+    }
+    __atomic_store_n( &(slot->hist[hist][b]), slot->hist[hist][b] + 1, __ATOMIC_RELAXED );
+    __atomic_store_n( &(slot->hist_sum[hist]), slot->hist_sum[hist] + ns, __ATOMIC_RELAXED );
+  }
+}
+
+#endif
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "numparse.h"
+
+#if defined( __SSE2__ ) && defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NUMPARSE_FAST 1
+#endif
+
+#ifdef NUMPARSE_FAST
+/*
+ * bit n set when s[n] is a digit, for the 16 bytes at s
+ */
+static inline unsigned int numparse_digit_mask( const char* s )
+{
+  __m128i v = _mm_sub_epi8( _mm_loadu_si128( (const __m128i*)s ), _mm_set1_epi8( '0' ) );
+  return _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_min_epu8( v, _mm_set1_epi8( 9 ) ), v ) );
+}
+
+/*
+ * the n ( 1 to 8 ) digits at p, which has 8 bytes readable, shifted up so
+ * the bytes in front of them are zero and then converted pairs, quads, whole
+ */
+static inline uint64_t numparse_swar( const char* p, int n )
+{
+  uint64_t v;
+
+  memcpy( &v, p, 8 );
+  v <<= 8 * ( 8 - n );
+  v = ( ( v & 0x0F0F0F0F0F0F0F0FULL ) * 2561 ) >> 8;
+  v = ( ( v & 0x00FF00FF00FF00FFULL ) * 6553601 ) >> 16;
+  return ( ( v & 0x0000FFFF0000FFFFULL ) * 42949672960001ULL ) >> 32;
+}
+#endif
+
+/*
+ * the first newline from p on, or end
+ */
+static inline const char* numparse_newline( const char* p, const char* end )
+{
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8( '\n' );
+  for ( ; p + 16 <= end ; p += 16 ) {
+    unsigned int mask = _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)p ), nl ) );
+    if ( 0 != mask ) {
+      return p + __builtin_ctz( mask );
+    }
+  }
+#endif
+  while ( p < end && '\n' != *p ) {
+    p++;
+  }
+  return p;
+}
+
+uint64_t numparse_count_lines( const char* p, const char* end )
+{
+  uint64_t count = 0;
+
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8( '\n' );
+  for ( ; p + 16 <= end ; p += 16 ) {
+    count += __builtin_popcount( _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)p ), nl ) ) );
+  }
+#endif
+  for ( ; p < end ; p++ ) {
+    count += ( '\n' == *p );
+  }
+  return count;
+}
+
+uint64_t numparse_buffer( const char* p, const char* end, uint64_t first_line,
+                          uint64_t* values, uint64_t* lines )
+{
+  uint64_t count = 0;
+  uint64_t line  = first_line;
+
+  while ( p < end ) {
+    uint64_t value  = 0;
+    bool     number = false;
+    bool     done   = false;
+
+    while ( p < end && ( ' ' == *p || '\t' == *p ) ) {
+      p++;
+    }
+
+#ifdef NUMPARSE_FAST
+    if ( p + 16 <= end ) {
+      unsigned int stops = ~numparse_digit_mask( p ) & 0xffff;
+      int          n     = ( 0 != stops ) ? __builtin_ctz( stops ) : 16;
+      if ( n < 16 ) {
+        if ( n > 8 ) {
+          value = numparse_swar( p, n - 8 ) * 100000000ULL + numparse_swar( p + n - 8, 8 );
+        } else if ( n > 0 ) {
+          value = numparse_swar( p, n );
+        }
+        number = ( n > 0 );
+        done   = true;
+        p     += n;
+      }
+    }
+#endif
+    if ( !done ) {
+      for ( ; p < end && (unsigned int)( *p - '0' ) < 10 ; p++ ) {
+        unsigned int digit = *p - '0';
+        if ( value > ( UINT64_MAX - digit ) / 10 ) {
+          value = UINT64_MAX;
+        } else {
+          value = ( value * 10 ) + digit;
+        }
+        number = true;
+      }
+    }
+
+    if ( number ) {
+      values[count] = value;
+      if ( NULL != lines ) {
+        lines[count] = line;
+      }
+      count += 1;
+    }
+
+    // nearly always the newline is right behind the digits
+    if ( p < end && '\n' != *p ) {
+      p = numparse_newline( p, end );
+    }
+    if ( p < end ) {
+      p += 1;
+    }
+    line += 1;
+  }
+  return count;
+}
+
+bool numparse_file( numparse_t* parsed, const char* path, bool want_lines )
+{
+  struct stat  st;
+  const char  *mem;
+  uint64_t     total;
+  int          fd;
+
+  memset( parsed, 0, sizeof( *parsed ) );
+  if ( -1 == ( fd = open( path, O_RDONLY ) ) || 0 != fstat( fd, &st ) ) {
+    fprintf( stderr, "open error on %s : %s\n", path, strerror( errno ) );
+    return false;
+  }
+  if ( 0 == st.st_size ) {
+    close( fd );
+    parsed->values = (uint64_t*)malloc( sizeof( uint64_t ) );
+    parsed->lines  = want_lines ? (uint64_t*)malloc( sizeof( uint64_t ) ) : NULL;
+    return true;
+  }
+  mem = (const char*)mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  if ( MAP_FAILED == mem ) {
+    fprintf( stderr, "error mapping %s : %s\n", path, strerror( errno ) );
+    close( fd );
+    return false;
+  }
+  madvise( (void*)mem, st.st_size, MADV_SEQUENTIAL );
+  close( fd );
+
+  // a value a line at most, so counting the lines first sizes the arrays exactly
+  total              = numparse_count_lines( mem, mem + st.st_size );
+  parsed->line_count = total + ( ( '\n' != mem[st.st_size - 1] ) ? 1 : 0 );
+  parsed->values     = (uint64_t*)malloc( ( total + 1 ) * sizeof( uint64_t ) );
+  if ( want_lines ) {
+    parsed->lines = (uint64_t*)malloc( ( total + 1 ) * sizeof( uint64_t ) );
+  }
+  if ( NULL == parsed->values || ( want_lines && NULL == parsed->lines ) ) {
+    fprintf( stderr, "out of memory for the %llu lines of %s\n", (long long unsigned)parsed->line_count, path );
+    munmap( (void*)mem, st.st_size );
+    numparse_free( parsed );
+    return false;
+  }
+
+  parsed->count = numparse_buffer( mem, mem + st.st_size, 1, parsed->values, parsed->lines );
+  munmap( (void*)mem, st.st_size );
+  return true;
+}
+
+void numparse_free( numparse_t* parsed )
+{
+  free( parsed->values );
+  free( parsed->lines );
+  memset( parsed, 0, sizeof( *parsed ) );
+}
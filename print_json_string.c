@@ -0,0 +1,21 @@
+#include <stdio.h>
+
+/*
+ * s as a JSON string, with quotes, backslashes and control characters
+ * escaped, for the paths the tools print as given
+ */
+void print_json_string( FILE* out, const char* s )
+{
+  fputc( '"', out );
+  for ( ; '\0' != *s ; s++ ) {
+    if ( '"' == *s || '\\' == *s ) {
+      fputc( '\\', out );
+      fputc( *s, out );
+    } else if ( (unsigned char)*s < 0x20 ) {
+      fprintf( out, "\\u%04x", (unsigned char)*s );
+    } else {
+      fputc( *s, out );
+    }
+  }
+  fputc( '"', out );
+}
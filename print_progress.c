@@ -2,34 +2,43 @@
 #include <string.h>
 #include <stdio.h>
 
-void print_progress( FILE* file, time_t start_time, long long unsigned final, long long unsigned so_far )
-{
-  time_t now  = time(NULL);
-  if ( now > start_time ) {
-    long long unsigned left = final - so_far;
-    double         rate = ( so_far / (double)difftime(now, start_time));
-    time_t      done_at = (time_t)(now + ( left / rate ));
-    double percent_done = ( so_far / (double) final ) * 100;
-    struct tm *the_time = localtime( &done_at);
+#include "metrics.h"
 
-    char time_buf[32];
-    char now_buf[32];
-    char format_buf[128] = " %s : [%10llu / %10llu] %10.2lf per second, %6.2lf%% done, finishing at %s";  
-    int eol_char_idx = strlen( format_buf );
-
-    if ( so_far >= final ) {
-      format_buf[eol_char_idx] = '\n';
-    } else {
-      format_buf[eol_char_idx] = '\r';
-    }
-    format_buf[ eol_char_idx + 1 ] = '\0';
+/*
+ * The human progress line.  rate is shown, eta_rate is what the finish time
+ * is worked out from, metrics_progress passes the windowed and the weighted
+ * rate where print_progress only has the average since start_time.  The
+ * time strings are kept in line and only formatted again when the second
+ * changes, so each thread that prints wants its own.
+ */
+void print_progress_line( progress_line_t* line, FILE* file, time_t now, long long unsigned final,
+                          long long unsigned so_far, double rate, double eta_rate )
+{
+  struct tm tm;
+  long long unsigned left = ( final > so_far ) ? final - so_far : 0;
+  double percent_done     = ( final > 0 ) ? ( so_far / (double) final ) * 100 : 100.0;
+  time_t done_at          = ( eta_rate > 0 ) ? (time_t)(now + ( left / eta_rate )) : now;
 
-    strftime( time_buf, 256, "%Y-%m-%d %H:%M:%S", the_time );
-    strftime( now_buf, 256, "%Y-%m-%d %H:%M:%S", localtime( &now ));
+  if ( now != line->last_now || '\0' == line->now_buf[0] ) {
+    strftime( line->now_buf, sizeof( line->now_buf ), "%Y-%m-%d %H:%M:%S", localtime_r( &now, &tm ));
+    line->last_now = now;
+  }
+  if ( done_at != line->last_done_at || '\0' == line->time_buf[0] ) {
+    strftime( line->time_buf, sizeof( line->time_buf ), "%Y-%m-%d %H:%M:%S", localtime_r( &done_at, &tm ));
+    line->last_done_at = done_at;
+  }
 
-    fprintf(file , format_buf, now_buf, so_far, final, rate, percent_done, time_buf );
+  fprintf( file, " %s : [%10llu / %10llu] %10.2lf per second, %6.2lf%% done, finishing at %s%c",
+           line->now_buf, so_far, final, rate, percent_done, line->time_buf, ( so_far >= final ) ? '\n' : '\r' );
+  fflush(file);
+}
 
-    fflush(file);
+void print_progress( FILE* file, time_t start_time, long long unsigned final, long long unsigned so_far )
+{
+  time_t now  = time(NULL);
+  if ( now > start_time ) {
+    progress_line_t line = { 0 };
+    double          rate = ( so_far / (double)difftime(now, start_time));
+    print_progress_line( &line, file, now, final, so_far, rate, rate );
   }
 }
-
@@ -0,0 +1,243 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "profile.h"
+
+/*
+ * the least time between two clock reads, which is in every timed call
+ */
+static double profile_clock_cost( void )
+{
+  uint64_t least = UINT64_MAX;
+
+  for ( int i = 0 ; i < 1000 ; i++ ) {
+    uint64_t a = profile_now();
+    uint64_t b = profile_now();
+    if ( b - a < least ) {
+      least = b - a;
+    }
+  }
+  return least;
+}
+
+profile_t* profile_new( const char* name, int sample_every, const char* trace_path )
+{
+  profile_t *p = (profile_t*)calloc( 1, sizeof( profile_t ) );
+  uint64_t   every = 1;
+
+  while ( every < (uint64_t)sample_every ) {
+    every <<= 1;
+  }
+  snprintf( p->name, sizeof( p->name ), "%s", name );
+  p->sample_mask     = every - 1;
+  p->clock_ns        = profile_clock_cost();
+  p->start           = profile_now();
+  p->trace_path      = ( NULL != trace_path ) ? strdup( trace_path ) : NULL;
+  p->thread_capacity = 16;
+  p->threads         = (profile_thread_t**)calloc( p->thread_capacity, sizeof( profile_thread_t* ) );
+  pthread_mutex_init( &(p->lock), NULL );
+  return p;
+}
+
+int profile_phase( profile_t* p, const char* name )
+{
+  if ( p->phase_count == PROFILE_MAX_PHASES ) {
+    fprintf( stderr, "profile: more than %d phases, %s is not timed\n", PROFILE_MAX_PHASES, name );
+    exit(1);
+  }
+  p->phase_names[p->phase_count] = name;
+  return p->phase_count++;
+}
+
+profile_thread_t* profile_thread( profile_t* p, const char* name )
+{
+  profile_thread_t *t;
+
+  if ( NULL == p ) {
+    return NULL;
+  }
+  if ( 0 != posix_memalign( (void**)&t, 64, sizeof( profile_thread_t ) ) ) {
+    fprintf( stderr, "profile: out of memory\n" );
+    exit(1);
+  }
+  memset( t, 0, sizeof( profile_thread_t ) );
+  snprintf( t->name, sizeof( t->name ), "%s", name );
+  t->sample_mask = p->sample_mask;
+  t->countdown   = 1;
+  t->start       = profile_now();
+  if ( NULL != p->trace_path &&
+       NULL == ( t->events = (profile_event_t*)malloc( PROFILE_TRACE_EVENTS * sizeof( profile_event_t ) ) ) ) {
+    fprintf( stderr, "profile: out of memory for the trace of %s\n", name );
+    exit(1);
+  }
+
+  pthread_mutex_lock( &(p->lock) );
+  if ( p->thread_count == p->thread_capacity ) {
+    p->thread_capacity *= 2;
+    p->threads = (profile_thread_t**)realloc( p->threads, p->thread_capacity * sizeof( profile_thread_t* ) );
+  }
+  t->tid    = p->thread_count + 1;
+  t->random = ( 2463534242U + t->tid * 2654435761U ) | 1;
+  p->threads[p->thread_count++] = t;
+  pthread_mutex_unlock( &(p->lock) );
+
+  return t;
+}
+
+void profile_thread_stop( profile_thread_t* t )
+{
+  if ( NULL != t ) {
+    t->stop = profile_now();
+  }
+}
+
+/*
+ * sum of the threads named name, into stats, returns how many there were and
+ * the thread seconds they had between being claimed and stopping, or now
+ */
+static int profile_group( profile_t* p, const char* name, uint64_t now, profile_stats_t* stats, double* wall,
+                          uint64_t* warm_calls )
+{
+  int threads = 0;
+
+  memset( stats, 0, PROFILE_MAX_PHASES * sizeof( profile_stats_t ) );
+  memset( warm_calls, 0, PROFILE_MAX_PHASES * sizeof( uint64_t ) );
+  *wall = 0;
+  for ( int i = 0 ; i < p->thread_count ; i++ ) {
+    profile_thread_t *t = p->threads[i];
+    if ( 0 != strcmp( t->name, name ) ) {
+      continue;
+    }
+    for ( int ph = 0 ; ph < p->phase_count ; ph++ ) {
+      stats[ph].calls   += t->stats[ph].calls;
+      stats[ph].warm_ns += t->stats[ph].warm_ns;
+      stats[ph].sampled += t->stats[ph].sampled;
+      stats[ph].ns      += t->stats[ph].ns;
+      warm_calls[ph]    += ( t->stats[ph].calls < t->sample_mask + 1 ) ? t->stats[ph].calls : t->sample_mask + 1;
+    }
+    *wall   += ( ( t->stop ? t->stop : now ) - t->start ) / 1e9;
+    threads += 1;
+  }
+  return threads;
+}
+
+void profile_report( profile_t* p, FILE* file )
+{
+  uint64_t now = profile_now();
+
+  fprintf( file, "Profile of %s, %.3f seconds, 1 in %llu calls timed, %.0fns per clock read taken off\n",
+           p->name, ( now - p->start ) / 1e9, (long long unsigned)( p->sample_mask + 1 ), p->clock_ns );
+
+  for ( int i = 0 ; i < p->thread_count ; i++ ) {
+    profile_stats_t stats[PROFILE_MAX_PHASES];
+    uint64_t        warm_calls[PROFILE_MAX_PHASES];
+    double          wall;
+    double          accounted = 0;
+    int             threads;
+    bool            seen      = false;
+
+    // each name is reported where it first shows up
+    for ( int j = 0 ; j < i ; j++ ) {
+      if ( 0 == strcmp( p->threads[j]->name, p->threads[i]->name ) ) {
+        seen = true;
+        break;
+      }
+    }
+    if ( seen ) {
+      continue;
+    }
+
+    threads = profile_group( p, p->threads[i]->name, now, stats, &wall, warm_calls );
+    fprintf( file, "  %s ( %d thread%s, %.3f thread seconds )\n",
+             p->threads[i]->name, threads, ( 1 == threads ) ? "" : "s", wall );
+    fprintf( file, "    %-12s %14s %12s %7s %12s\n", "phase", "calls", "seconds", "share", "us per call" );
+
+    for ( int ph = 0 ; ph < p->phase_count ; ph++ ) {
+      double seconds;
+      double per_call;
+
+      if ( 0 == stats[ph].calls ) {
+        continue;
+      }
+      // the warm calls as timed, the rest at the mean of the ones sampled
+      seconds = stats[ph].warm_ns - p->clock_ns * warm_calls[ph];
+      if ( stats[ph].sampled > 0 ) {
+        seconds += ( stats[ph].ns / (double)stats[ph].sampled - p->clock_ns ) * ( stats[ph].calls - warm_calls[ph] );
+      }
+      if ( seconds < 0 ) {
+        seconds = 0;
+      }
+      per_call   = seconds / stats[ph].calls;
+      seconds   /= 1e9;
+      accounted += seconds;
+      fprintf( file, "    %-12s %14llu %12.3f %6.2f%% %12.3f\n", p->phase_names[ph],
+               (long long unsigned)stats[ph].calls, seconds,
+               ( wall > 0 ) ? seconds / wall * 100 : 0.0, per_call / 1e3 );
+    }
+    if ( wall > accounted ) {
+      fprintf( file, "    %-12s %14s %12.3f %6.2f%%\n", "(other)", "", wall - accounted,
+               ( wall - accounted ) / wall * 100 );
+    }
+  }
+}
+
+static bool profile_write_trace( profile_t* p )
+{
+  FILE    *f;
+  bool     first   = true;
+  uint64_t dropped = 0;
+
+  if ( NULL == ( f = fopen( p->trace_path, "w" ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", p->trace_path, strerror( errno ) );
+    return false;
+  }
+
+  // timestamps are microseconds since profile_new, which is all the viewers need
+  fprintf( f, "{\"traceEvents\":[\n" );
+  for ( int i = 0 ; i < p->thread_count ; i++ ) {
+    profile_thread_t *t = p->threads[i];
+
+    fprintf( f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+             first ? "" : ",\n", t->tid, t->name, t->tid );
+    first = false;
+    for ( uint64_t e = 0 ; e < t->event_count ; e++ ) {
+      profile_event_t *ev = &(t->events[e]);
+      fprintf( f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+               p->phase_names[ev->phase], t->tid,
+               ( ev->start - p->start ) / 1e3, ev->duration / 1e3 );
+    }
+    dropped += t->events_dropped;
+  }
+  fprintf( f, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"tool\":\"%s\",\"sample_every\":%llu,\"dropped\":%llu}}\n",
+           p->name, (long long unsigned)( p->sample_mask + 1 ), (long long unsigned)dropped );
+
+  if ( 0 != fclose( f ) ) {
+    fprintf( stderr, "write error on %s : %s\n", p->trace_path, strerror( errno ) );
+    return false;
+  }
+  if ( dropped > 0 ) {
+    fprintf( stderr, "profile: %llu spans past %d per thread were left out of %s\n",
+             (long long unsigned)dropped, PROFILE_TRACE_EVENTS, p->trace_path );
+  }
+  return true;
+}
+
+void profile_destroy( profile_t* p )
+{
+  if ( NULL == p ) {
+    return;
+  }
+  if ( NULL != p->trace_path ) {
+    profile_write_trace( p );
+  }
+  for ( int i = 0 ; i < p->thread_count ; i++ ) {
+    free( p->threads[i]->events );
+    free( p->threads[i] );
+  }
+  free( p->threads );
+  free( p->trace_path );
+  pthread_mutex_destroy( &(p->lock) );
+  free( p );
+}
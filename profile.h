@@ -0,0 +1,170 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * Where the time goes, by phase, for --profile.
+ *
+ * A tool names its phases ( read, parse, route, write, ... ) with
+ * profile_phase and every thread that runs them claims a profile_thread of
+ * its own.  profile_begin and profile_end go around each phase.  Every call
+ * is counted but past the first few only about one in sample_every is
+ * timed, with CLOCK_MONOTONIC_RAW, so a phase of a few hundred nanoseconds
+ * does not pay for two clock reads each time round.  The gaps between timed
+ * calls are random, a fixed stride lines up with anything periodic in the
+ * loop ( a read window refilled every so many records ) and times only the
+ * slow or only the fast calls.  The report scales the sampled time up by
+ * calls / sampled, the first calls are added as they are since they are
+ * the cold ones, and takes off what reading the clock adds to each.
+ *
+ * With a trace file every timed call is also kept as a span and written at
+ * the end in the Chrome trace event format, which chrome://tracing and
+ * Perfetto load, one row per thread, so it shows which phases overlap.
+ */
+
+#define PROFILE_MAX_PHASES    16
+#define PROFILE_SAMPLE_EVERY  16           /* what the tools time one call in */
+#define PROFILE_TRACE_EVENTS  ( 1 << 18 )  /* spans kept per thread, the rest are only counted */
+
+typedef struct profile_stats {
+  uint64_t calls;
+  uint64_t warm_ns;                       /* in the first sample_every calls, all timed */
+  uint64_t sampled;                       /* timed calls after those                    */
+  uint64_t ns;                            /* in the sampled calls                       */
+} profile_stats_t;
+
+typedef struct profile_event {
+  uint64_t start;                         /* ns */
+  uint32_t duration;                      /* ns */
+  uint32_t phase;
+} profile_event_t;
+
+typedef struct profile_thread {
+  profile_stats_t  stats[PROFILE_MAX_PHASES];
+  uint64_t         sample_mask;
+  uint32_t         countdown;             /* calls until the next one timed */
+  uint32_t         random;                /* xorshift state for the gaps    */
+  profile_event_t *events;                /* NULL without a trace file */
+  uint64_t         event_count;
+  uint64_t         events_dropped;
+  uint64_t         start;                 /* when the thread was claimed */
+  uint64_t         stop;                  /* profile_thread_stop, or 0    */
+  int              tid;
+  char             name[32];
+} __attribute__(( aligned( 64 ) )) profile_thread_t;
+
+typedef struct profile {
+  char               name[64];
+  uint64_t           sample_mask;
+  uint64_t           start;
+  double             clock_ns;            /* what one timed call adds by being timed */
+  char              *trace_path;
+
+  int                phase_count;
+  const char        *phase_names[PROFILE_MAX_PHASES];
+
+  pthread_mutex_t    lock;                /* guards the threads list */
+  int                thread_count;
+  int                thread_capacity;
+  profile_thread_t **threads;
+} profile_t;
+
+/*
+ * sample_every is rounded up to a power of two, trace_path may be NULL
+ */
+extern profile_t* profile_new( const char* name, int sample_every, const char* trace_path );
+
+/*
+ * Register a phase and return its id, before any thread is claimed.  names
+ * are not copied.
+ */
+extern int profile_phase( profile_t* p, const char* name );
+
+/*
+ * Per thread phase counts for the calling thread, NULL if p is NULL in which
+ * case timing into it does nothing.  Threads of the same name are added
+ * together in the report.
+ */
+extern profile_thread_t* profile_thread( profile_t* p, const char* name );
+
+/*
+ * The thread is done, its wall clock time stops here instead of at the
+ * report.
+ */
+extern void profile_thread_stop( profile_thread_t* t );
+
+/*
+ * The summary: per thread name, each phase's calls, estimated seconds, share
+ * of the wall clock time of those threads and mean time per call, and what
+ * is left over.  Only call it once the threads have stopped.
+ */
+extern void profile_report( profile_t* p, FILE* file );
+
+/*
+ * Write the trace file if there is one, and free everything.
+ */
+extern void profile_destroy( profile_t* p );
+
+static inline uint64_t profile_now( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Returns the start time of a sampled call, 0 for one that is only counted.
+ * The first sample_every calls of a phase are all timed, so a phase that
+ * only runs a few times is not scaled up from one cold call.
+ */
+static inline uint64_t profile_begin( profile_thread_t* t, int phase )
+{
+  if ( NULL == t ) {
+    return 0;
+  }
+  if ( t->stats[phase].calls++ > t->sample_mask ) {
+    if ( --t->countdown > 0 ) {
+      return 0;
+    }
+    // a gap of 1 .. 2 * sample_every - 1, sample_every on average
+    t->random   ^= t->random << 13;
+    t->random   ^= t->random >> 17;
+    t->random   ^= t->random << 5;
+    t->countdown = 1 + t->random % ( 2 * t->sample_mask + 1 );
+  }
+  return profile_now();
+}
+
+static inline void profile_end( profile_thread_t* t, int phase, uint64_t start )
+{
+  uint64_t duration;
+
+  if ( 0 == start ) {
+    return;
+  }
+  duration = profile_now() - start;
+  if ( t->stats[phase].calls <= t->sample_mask + 1 ) {
+    t->stats[phase].warm_ns += duration;
+  } else {
+    t->stats[phase].sampled += 1;
+    t->stats[phase].ns      += duration;
+  }
+
+  if ( NULL != t->events ) {
+    if ( t->event_count < PROFILE_TRACE_EVENTS ) {
+      profile_event_t *e = &(t->events[t->event_count++]);
+      e->start    = start;
+      e->duration = ( duration > UINT32_MAX ) ? UINT32_MAX : (uint32_t)duration;
+      e->phase    = phase;
+    } else {
+      t->events_dropped += 1;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "backend_for.h"
+
+/*
+ * Time how long backend_for takes to route a key, against the linear scan
+ * over storage_servers it used to do, for whatever backend_for.c this is
+ * built with.  bench-route.sh builds it for several server counts so the
+ * numbers can be put side by side:
+ *
+ *   scalar mlid string to server, through backend_for_parse_scalar
+ *   route  mlid string to server, parse included ( backend_for )
+ *   batch  the same through backend_for_batch, 256 keys a call
+ *   table  parsed mlid to server ( backend_for_mlid )
+ *   linear parsed mlid to server, the old scan
+ *
+ * The keys are "mlid:<digits>" like the ones in the databases, random, so the
+ * servers are hit in no particular order.
+ *
+ * --verify N instead throws N random keys, runs of digits of every length,
+ * leading zeros, numbers around 2^64 and keys with no number at all, at both
+ * backend_for_batch and backend_for_parse_scalar and fails on the first one
+ * they route differently.
+ */
+
+#define KEY_COUNT   ( 1024 * 1024 )
+#define ROUNDS      10
+#define KEY_SIZE    32
+#define BATCH_SIZE  256
+#define FUZZ_SIZE   64
+
+/*
+ * what backend_for did before the table, kept here as the baseline
+ */
+static const storage_config_t *route_linear( unsigned long long mlid )
+{
+    int i;
+    for ( i = 0 ; NULL != storage_servers[i].host ; i++ ) {
+        if ( ( mlid & storage_servers[i].bits_used_bitmask ) == storage_servers[i].bitmask ) {
+            return &(storage_servers[i]);
+        }
+    }
+    return NULL;
+}
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * a small xorshift, rand() does not give enough bits for an mlid
+ */
+static uint64_t next_random( uint64_t* state )
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/*
+ * a random key for --verify into buf, returns its length
+ */
+static int fuzz_key( uint64_t* state, char* buf )
+{
+    static const char *edges[] = { "18446744073709551615", "18446744073709551616",
+                                   "9999999999999999999", "10000000000000000000",
+                                   "00000000000000000000000042", "0" };
+    static const char  noise[] = "mlid:-_/ x\x7f\x80\xff/09:";
+    int length = next_random( state ) % FUZZ_SIZE;
+    int i      = 0;
+
+    while ( i < length ) {
+        uint64_t r   = next_random( state );
+        int      run = 1 + ( r >> 8 ) % 24;
+        switch ( r % 4 ) {
+            case 0:   /* a run of digits */
+                for ( int j = 0 ; j < run && i < length ; j++ ) {
+                    buf[i++] = '0' + next_random( state ) % 10;
+                }
+                break;
+            case 1:   /* a number that is hard to get right */
+                for ( const char *e = edges[( r >> 16 ) % 6] ; *e && i < length ; e++ ) {
+                    buf[i++] = *e;
+                }
+                break;
+            case 2:   /* characters either side of the digits */
+                for ( int j = 0 ; j < run && i < length ; j++ ) {
+                    buf[i++] = noise[next_random( state ) % ( sizeof( noise ) - 1 )];
+                }
+                break;
+            default:  /* anything */
+                buf[i++] = (char)( r >> 24 );
+                break;
+        }
+    }
+    return length;
+}
+
+/*
+ * backend_for_batch against backend_for_parse_scalar on count random keys,
+ * a batch at a time
+ */
+static bool verify( uint64_t seed, long long count )
+{
+    char       *buf = malloc( BATCH_SIZE * FUZZ_SIZE );
+    const char *keys[BATCH_SIZE];
+    int         lengths[BATCH_SIZE];
+    int         shards[BATCH_SIZE];
+    long long   done = 0;
+
+    while ( done < count ) {
+        int n = ( count - done < BATCH_SIZE ) ? count - done : BATCH_SIZE;
+        for ( int i = 0 ; i < n ; i++ ) {
+            // each key at the very end of its slot so a read past length is a different key's byte
+            char tmp[FUZZ_SIZE];
+            lengths[i] = fuzz_key( &seed, tmp );
+            keys[i]    = buf + i * FUZZ_SIZE + FUZZ_SIZE - lengths[i];
+            memcpy( (char*)keys[i], tmp, lengths[i] );
+        }
+        backend_for_batch( keys, lengths, n, shards );
+        for ( int i = 0 ; i < n ; i++ ) {
+            unsigned long long mlid;
+            int expected = backend_for_parse_scalar( keys[i], lengths[i], &mlid ) ? (int)( mlid & STORAGE_SERVER_MASK ) : -1;
+            if ( expected != shards[i] ) {
+                fprintf( stderr, "Mismatch on key %lld (", done + i );
+                for ( int j = 0 ; j < lengths[i] ; j++ ) {
+                    fprintf( stderr, "%02x", (unsigned char)keys[i][j] );
+                }
+                fprintf( stderr, ") : batch %d, scalar %d\n", shards[i], expected );
+                free( buf );
+                return false;
+            }
+        }
+        done += n;
+    }
+    free( buf );
+    printf( "servers %4d  %lld keys, batch and scalar agree\n", STORAGE_SERVER_COUNT, count );
+    return true;
+}
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [options]\n", name );
+    fprintf( stderr, "  -n, --keys N     number of keys ( default %d )\n", KEY_COUNT );
+    fprintf( stderr, "  -r, --rounds N   passes over the keys for each timing ( default %d )\n", ROUNDS );
+    fprintf( stderr, "  -s, --seed N     random seed\n" );
+    fprintf( stderr, "  -v, --verify N   check the batch parse against the scalar one on N random keys\n" );
+}
+
+int main( int argc, char** argv )
+{
+    int                 count  = KEY_COUNT;
+    int                 rounds = ROUNDS;
+    uint64_t            seed   = 88172645463325252ULL;
+    char               *keys;
+    int                *lengths;
+    unsigned long long *mlids;
+    long long           fuzz   = 0;
+    unsigned long long  sink   = 0;
+    double              start;
+    double              scalar_ns, route_ns, batch_ns, table_ns, linear_ns;
+    int                 opt;
+
+    struct option long_options[] = {
+        { "keys",   required_argument, NULL, 'n' },
+        { "rounds", required_argument, NULL, 'r' },
+        { "seed",   required_argument, NULL, 's' },
+        { "verify", required_argument, NULL, 'v' },
+        { NULL,     0,                 NULL,  0  }
+    };
+
+    while ( -1 != ( opt = getopt_long( argc, argv, "n:r:s:v:", long_options, NULL ) ) ) {
+        switch ( opt ) {
+            case 'n': count  = atoi( optarg ); break;
+            case 'r': rounds = atoi( optarg ); break;
+            case 's': seed   = strtoull( optarg, NULL, 0 ) | 1; break;
+            case 'v': fuzz   = strtoll( optarg, NULL, 0 ); break;
+            default :
+                usage( argv[0] );
+                exit(1);
+        }
+    }
+
+    if ( count < 1 || rounds < 1 ) {
+        usage( argv[0] );
+        exit(1);
+    }
+
+    if ( fuzz > 0 ) {
+        exit( verify( seed, fuzz ) ? 0 : 1 );
+    }
+
+    keys    = malloc( (size_t)count * KEY_SIZE );
+    lengths = malloc( count * sizeof( int ) );
+    mlids   = malloc( count * sizeof( unsigned long long ) );
+    if ( NULL == keys || NULL == lengths || NULL == mlids ) {
+        fprintf( stderr, "Failure allocating %d keys\n", count );
+        exit(1);
+    }
+
+    for ( int i = 0 ; i < count ; i++ ) {
+        // 1 to 15 digits, most of them long like the real ones
+        unsigned long long mlid = next_random( &seed ) % 1000000000000000ULL;
+        if ( 0 == ( i & 7 ) ) {
+            mlid %= 100000;
+        }
+        mlids[i]   = mlid;
+        lengths[i] = snprintf( keys + (size_t)i * KEY_SIZE, KEY_SIZE, "mlid:%llu", mlid );
+    }
+
+    // the table and the scan have to agree before their times mean anything
+    for ( int i = 0 ; i < count ; i++ ) {
+        const storage_config_t *conf = backend_for( keys + (size_t)i * KEY_SIZE, lengths[i] );
+        if ( conf != route_linear( mlids[i] ) || conf != backend_for_mlid( mlids[i] ) ) {
+            fprintf( stderr, "Routing mismatch for %.*s\n", lengths[i], keys + (size_t)i * KEY_SIZE );
+            exit(1);
+        }
+    }
+
+    start = now();
+    for ( int r = 0 ; r < rounds ; r++ ) {
+        for ( int i = 0 ; i < count ; i++ ) {
+            unsigned long long mlid;
+            backend_for_parse_scalar( keys + (size_t)i * KEY_SIZE, lengths[i], &mlid );
+            sink += backend_for_mlid( mlid )->port;
+        }
+    }
+    scalar_ns = ( now() - start ) * 1e9 / ( (double)count * rounds );
+
+    start = now();
+    for ( int r = 0 ; r < rounds ; r++ ) {
+        for ( int i = 0 ; i < count ; i++ ) {
+            sink += backend_for( keys + (size_t)i * KEY_SIZE, lengths[i] )->port;
+        }
+    }
+    route_ns = ( now() - start ) * 1e9 / ( (double)count * rounds );
+
+    start = now();
+    for ( int r = 0 ; r < rounds ; r++ ) {
+        for ( int i = 0 ; i < count ; i += BATCH_SIZE ) {
+            const char *batch[BATCH_SIZE];
+            int         shards[BATCH_SIZE];
+            int         n = ( count - i < BATCH_SIZE ) ? count - i : BATCH_SIZE;
+            for ( int j = 0 ; j < n ; j++ ) {
+                batch[j] = keys + (size_t)( i + j ) * KEY_SIZE;
+            }
+            backend_for_batch( batch, lengths + i, n, shards );
+            for ( int j = 0 ; j < n ; j++ ) {
+                sink += storage_servers[shards[j]].port;
+            }
+        }
+    }
+    batch_ns = ( now() - start ) * 1e9 / ( (double)count * rounds );
+
+    start = now();
+    for ( int r = 0 ; r < rounds ; r++ ) {
+        for ( int i = 0 ; i < count ; i++ ) {
+            sink += backend_for_mlid( mlids[i] )->port;
+        }
+    }
+    table_ns = ( now() - start ) * 1e9 / ( (double)count * rounds );
+
+    start = now();
+    for ( int r = 0 ; r < rounds ; r++ ) {
+        for ( int i = 0 ; i < count ; i++ ) {
+            sink += route_linear( mlids[i] )->port;
+        }
+    }
+    linear_ns = ( now() - start ) * 1e9 / ( (double)count * rounds );
+
+    printf( "servers %4d  scalar %7.2f  route %7.2f  batch %7.2f  table %7.2f  linear %7.2f ns/key  ( %llu )\n",
+            STORAGE_SERVER_COUNT, scalar_ns, route_ns, batch_ns, table_ns, linear_ns, sink & 0xff );
+
+    free( keys );
+    free( lengths );
+    free( mlids );
+    exit(0);
+}
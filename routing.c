@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "routing.h"
+
+static routing_t* routing_new( uint64_t serial, int count )
+{
+  routing_t *map = (routing_t*)calloc( 1, sizeof( routing_t ) );
+
+  map->serial  = serial;
+  map->count   = count;
+  map->mask    = count - 1;
+  map->servers = (routing_server_t*)calloc( count, sizeof( routing_server_t ) );
+  map->table   = (int*)malloc( count * sizeof( int ) );
+  for ( int i = 0 ; i < count ; i++ ) {
+    map->servers[i].port = -1;
+    map->table[i]        = -1;
+  }
+  return map;
+}
+
+void routing_free( routing_t* map )
+{
+  if ( NULL != map ) {
+    free( map->servers );
+    free( map->table );
+    free( map );
+  }
+}
+
+routing_t* routing_compiled( void )
+{
+  routing_t *map = routing_new( 0, STORAGE_SERVER_COUNT );
+
+  for ( int i = 0 ; i < STORAGE_SERVER_COUNT ; i++ ) {
+    routing_server_t *server = &(map->servers[storage_servers[i].bitmask & map->mask]);
+    snprintf( server->host, sizeof( server->host ), "%s", storage_servers[i].host );
+    server->port = storage_servers[i].port;
+  }
+  return map;
+}
+
+/*
+ * the server lines are collected before the count is known
+ */
+typedef struct routing_line {
+  unsigned long long slot;
+  char               host[256];
+  int                port;
+  int                line;
+} routing_line_t;
+
+routing_t* routing_load( const char* path )
+{
+  FILE           *file;
+  char            buf[1024];
+  int             line    = 0;
+  int             version = -1;
+  uint64_t        serial  = 0;
+  routing_line_t *lines   = NULL;
+  int             count   = 0;
+  routing_t      *map     = NULL;
+  bool            ok      = true;
+
+  if ( NULL == ( file = fopen( path, "r" ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", path, strerror( errno ) );
+    return NULL;
+  }
+
+  lines = (routing_line_t*)malloc( ROUTING_MAX_SERVERS * sizeof( routing_line_t ) );
+
+  while ( ok && NULL != fgets( buf, sizeof( buf ), file ) ) {
+    char               word[16];
+    char               host[256];
+    unsigned long long number;
+    int                port;
+    char              *hash;
+
+    line += 1;
+    if ( NULL != ( hash = strchr( buf, '#' ) ) ) {
+      *hash = '\0';
+    }
+    if ( 1 != sscanf( buf, "%15s", word ) ) {
+      continue;
+    }
+
+    if ( version < 0 && 0 != strcmp( word, "version" ) ) {
+      fprintf( stderr, "routing map %s line %d : the first line has to be the version\n", path, line );
+      ok = false;
+    } else if ( 0 == strcmp( word, "version" ) ) {
+      if ( 2 != sscanf( buf, "%15s %d", word, &version ) || version < 1 ) {
+        fprintf( stderr, "routing map %s line %d : bad version\n", path, line );
+        ok = false;
+      } else if ( version > ROUTING_VERSION ) {
+        fprintf( stderr, "routing map %s is version %d, this program reads up to %d\n", path, version, ROUTING_VERSION );
+        ok = false;
+      }
+    } else if ( 0 == strcmp( word, "serial" ) ) {
+      if ( 2 != sscanf( buf, "%15s %llu", word, &number ) ) {
+        fprintf( stderr, "routing map %s line %d : bad serial\n", path, line );
+        ok = false;
+      } else {
+        serial = number;
+      }
+    } else if ( 0 == strcmp( word, "server" ) ) {
+      char slot[32];
+      char *end;
+      if ( 4 != sscanf( buf, "%15s %31s %255s %d", word, slot, host, &port ) || port <= 0 || port > 65535 ) {
+        fprintf( stderr, "routing map %s line %d : expected server MASK HOST PORT\n", path, line );
+        ok = false;
+      } else if ( count == ROUTING_MAX_SERVERS ) {
+        fprintf( stderr, "routing map %s line %d : more than %d servers\n", path, line, ROUTING_MAX_SERVERS );
+        ok = false;
+      } else {
+        lines[count].slot = strtoull( slot, &end, 0 );
+        if ( '\0' != *end ) {
+          fprintf( stderr, "routing map %s line %d : bad mask %s\n", path, line, slot );
+          ok = false;
+        }
+        snprintf( lines[count].host, sizeof( lines[count].host ), "%s", host );
+        lines[count].port = port;
+        lines[count].line = line;
+        count += 1;
+      }
+    } else {
+      fprintf( stderr, "routing map %s line %d : unknown %s\n", path, line, word );
+      ok = false;
+    }
+  }
+
+  if ( ok && ferror( file ) ) {
+    fprintf( stderr, "read error on %s : %s\n", path, strerror( errno ) );
+    ok = false;
+  }
+  fclose( file );
+
+  if ( ok && ( 0 == count || 0 != ( count & ( count - 1 ) ) ) ) {
+    fprintf( stderr, "routing map %s has %d servers, it needs a power of 2\n", path, count );
+    ok = false;
+  }
+
+  if ( ok ) {
+    map = routing_new( serial, count );
+    for ( int i = 0 ; ok && i < count ; i++ ) {
+      routing_server_t *server = &(map->servers[lines[i].slot & map->mask]);
+      if ( lines[i].slot >= (unsigned long long)count ) {
+        fprintf( stderr, "routing map %s line %d : mask 0x%02llx is not below %d\n", path, lines[i].line, lines[i].slot, count );
+        ok = false;
+      } else if ( -1 != server->port ) {
+        fprintf( stderr, "routing map %s line %d : mask 0x%02llx is given twice\n", path, lines[i].line, lines[i].slot );
+        ok = false;
+      } else {
+        snprintf( server->host, sizeof( server->host ), "%s", lines[i].host );
+        server->port = lines[i].port;
+      }
+    }
+    // count lines with every slot below count and none twice covers every slot
+    if ( !ok ) {
+      routing_free( map );
+      map = NULL;
+    }
+  }
+
+  free( lines );
+  return map;
+}
+
+routing_domain_t* routing_domain_new( int readers, routing_t* map )
+{
+  routing_domain_t *domain = (routing_domain_t*)calloc( 1, sizeof( routing_domain_t ) );
+
+  domain->current = map;
+  domain->readers = ( readers > 0 ) ? readers : 1;
+  if ( 0 != posix_memalign( (void**)&(domain->reader), 64, domain->readers * sizeof( routing_reader_t ) ) ) {
+    free( domain );
+    return NULL;
+  }
+  memset( domain->reader, 0, domain->readers * sizeof( routing_reader_t ) );
+  return domain;
+}
+
+void routing_publish( routing_domain_t* domain, routing_t* map )
+{
+  routing_t *old = __atomic_exchange_n( &(domain->current), map, __ATOMIC_SEQ_CST );
+
+  // a reader that has seen this epoch loaded current after the exchange
+  old->retired_epoch = __atomic_add_fetch( &(domain->epoch), 1, __ATOMIC_SEQ_CST );
+  old->retired_next  = domain->retired;
+  domain->retired    = old;
+}
+
+int routing_reclaim( routing_domain_t* domain )
+{
+  uint64_t    oldest = UINT64_MAX;
+  routing_t **link   = &(domain->retired);
+  int         freed  = 0;
+
+  for ( int i = 0 ; i < domain->readers ; i++ ) {
+    uint64_t epoch = __atomic_load_n( &(domain->reader[i].epoch), __ATOMIC_ACQUIRE );
+    if ( epoch < oldest ) {
+      oldest = epoch;
+    }
+  }
+
+  while ( NULL != *link ) {
+    routing_t *map = *link;
+    if ( map->retired_epoch <= oldest ) {
+      *link = map->retired_next;
+      routing_free( map );
+      freed += 1;
+    } else {
+      link = &(map->retired_next);
+    }
+  }
+  return freed;
+}
+
+void routing_domain_destroy( routing_domain_t* domain )
+{
+  while ( NULL != domain->retired ) {
+    routing_t *map  = domain->retired;
+    domain->retired = map->retired_next;
+    routing_free( map );
+  }
+  routing_free( domain->current );
+  free( domain->reader );
+  free( domain );
+}
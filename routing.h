@@ -0,0 +1,147 @@
+#ifndef __ROUTING_H__
+#define __ROUTING_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "backend_for.h"
+
+/*
+ * Routing maps loaded at run time, so a change of hosts, ports or shard count
+ * does not need generate-backend-for.rb and a rebuild.  Without a map file
+ * the tools fall back to the servers compiled into backend_for.c.
+ *
+ * The file is plain text, # starts a comment:
+ *
+ *   version 1                   format of the file, must come first
+ *   serial 20120314             any number, printed when the map is loaded
+ *   server 0x00 host-a 11000    one line per masked mlid value
+ *   server 0x01 host-b 11002
+ *   ...
+ *
+ * There has to be a power of 2 of server lines, one for every value of
+ * mlid & ( count - 1 ).  The same host and port may own several of them.
+ *
+ * A routing_domain_t publishes a map to reader threads RCU style: readers
+ * load the current pointer with no lock, route with it, and say they are
+ * done with it by calling routing_quiescent between records.  A new map is
+ * swapped in with one atomic store, and the old one is only freed by
+ * routing_reclaim once every reader has passed a quiescent point after the
+ * swap or gone offline for good.  The readers never wait for the writer.
+ */
+
+#define ROUTING_VERSION     1
+#define ROUTING_MAX_SERVERS 4096
+
+typedef struct routing_server {
+  char  host[256];
+  int   port;
+} routing_server_t;
+
+typedef struct routing {
+  uint64_t          serial;        /* from the file, 0 for the compiled in map  */
+  int               count;         /* a power of 2                              */
+  uint64_t          mask;          /* count - 1                                 */
+  routing_server_t *servers;       /* indexed by mlid & mask                    */
+  int              *table;         /* indexed by mlid & mask, the owner's index
+                                      in whatever the caller sends to, filled in
+                                      by the caller before routing_publish     */
+
+  struct routing   *retired_next;  /* on the domain's retired list              */
+  uint64_t          retired_epoch; /* readers have to reach this to free it     */
+} routing_t;
+
+typedef struct routing_reader {
+  uint64_t epoch;                  /* last epoch this reader was quiescent in   */
+} __attribute__(( aligned( 64 ) )) routing_reader_t;
+
+typedef struct routing_domain {
+  routing_t        *current;
+  uint64_t          epoch;         /* bumped by every routing_publish           */
+  int               readers;
+  routing_reader_t *reader;
+  routing_t        *retired;       /* swapped out, not yet freed                */
+} routing_domain_t;
+
+/*
+ * Read a map file.  Prints what is wrong with it and returns NULL if it
+ * cannot be used.
+ */
+extern routing_t* routing_load( const char* path );
+
+/*
+ * The servers compiled in from backend_for.c as a map.
+ */
+extern routing_t* routing_compiled( void );
+
+extern void routing_free( routing_t* map );
+
+/*
+ * The slot ( mlid & mask ) of the key, or -1 when there is no mlid in it.
+ */
+static inline int routing_slot( const routing_t* map, const char* kbuf, int ksiz )
+{
+  unsigned long long mlid;
+
+  if ( !backend_for_parse( kbuf, ksiz, &mlid ) ) {
+    return -1;
+  }
+  return (int)( mlid & map->mask );
+}
+
+/*
+ * A domain for readers 0 .. readers - 1, publishing map.
+ */
+extern routing_domain_t* routing_domain_new( int readers, routing_t* map );
+
+/*
+ * The map to route with.  It stays valid until the reader next calls
+ * routing_quiescent.
+ */
+static inline const routing_t* routing_current( routing_domain_t* domain )
+{
+  return __atomic_load_n( &(domain->current), __ATOMIC_ACQUIRE );
+}
+
+/*
+ * reader holds no pointer from routing_current any more.  true when a map
+ * has been published since its last quiescent point, so a reader can let go
+ * of anything it kept because of the old one.
+ */
+static inline bool routing_quiescent( routing_domain_t* domain, int reader )
+{
+  uint64_t epoch = __atomic_load_n( &(domain->epoch), __ATOMIC_ACQUIRE );
+
+  if ( domain->reader[reader].epoch != epoch ) {
+    __atomic_store_n( &(domain->reader[reader].epoch), epoch, __ATOMIC_RELEASE );
+    return true;
+  }
+  return false;
+}
+
+/*
+ * reader will not route again, routing_reclaim stops waiting for it.  Called
+ * by the reader itself or by any thread once the reader has finished.
+ */
+static inline void routing_offline( routing_domain_t* domain, int reader )
+{
+  __atomic_store_n( &(domain->reader[reader].epoch), UINT64_MAX, __ATOMIC_RELEASE );
+}
+
+/*
+ * Make map the current one and retire the one it replaces.  Only one thread
+ * may publish and reclaim.
+ */
+extern void routing_publish( routing_domain_t* domain, routing_t* map );
+
+/*
+ * Free the retired maps no reader can still be using, returns how many.
+ */
+extern int routing_reclaim( routing_domain_t* domain );
+
+/*
+ * Frees the current map and any retired ones, the readers must be done.
+ */
+extern void routing_domain_destroy( routing_domain_t* domain );
+
+#endif
@@ -7,11 +7,26 @@
 #include <stdbool.h>
 #include <time.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <zlib.h>
+#include <signal.h>
 #include "backend_for.h"
+#include "routing.h"
+#include "tchscan.h"
+#include "tchpar.h"
+#include "checkpoint.h"
+#include "tcrpipe.h"
+#include "metrics.h"
+#include "profile.h"
 
-#define PROGRESS_FILE "./progress.txt"
-
-void print_progress( FILE* file, time_t start_time, long long unsigned final, long long unsigned so_far );
+#define PROGRESS_FILE       "./progress.txt"
+#define CHECKPOINT_INTERVAL 10
+#define SUMMARY_INTERVAL    10
+#define BATCH_RECORDS       1000
+#define MAX_INFLIGHT        4
+#define TARGET_LATENCY_MS   100
+#define SCAN_THREADS        1
 
 TCHDB *init_src_hdb( char *path )
 {
@@ -35,108 +50,687 @@ TCHDB *init_src_hdb( char *path )
     return hdb;
 }
 
-void dest_rdbs_destroy( ) {
-    for( int i = 0 ; i < STORAGE_SERVER_COUNT ; i++ ) {
-        if ( NULL != storage_servers[i].rdb ) {
-            tcrdbclose( storage_servers[i].rdb );
-            tcrdbdel( storage_servers[i].rdb );
-        }
+tcrpipe_t        *dest_pipe  = NULL;
+routing_domain_t *routes     = NULL;
+const char       *map_path   = NULL;  /* --map, reloaded on SIGHUP */
+uint64_t          scanned_to = 0;     /* source offset everything before has been handed over */
+
+/*
+ * records and bytes handed to the pipe and records the tyrants accepted,
+ * with how long reading a source record, inflating it and sending its batch
+ * took.  --raw on one thread splits the read into the wait for the disk, io,
+ * and everything else, parse.  One slot per scan thread, tcrpipe has its
+ * own per backend.
+ */
+metrics_t        *metrics          = NULL;
+metrics_slot_t  **producer_metrics = NULL;
+int               m_records, m_bytes, m_sent;
+int               h_read, h_io, h_parse, h_inflate, h_write;
+
+/*
+ * --profile, one "scan" thread per producer, NULL without it.  The senders
+ * in tcrpipe claim their own.
+ */
+profile_t         *profile          = NULL;
+profile_thread_t **producer_profile = NULL;
+int                p_read, p_inflate, p_route, p_send, p_putlist;
+
+static volatile sig_atomic_t reload_requested = 0;
+
+static void on_sighup( int sig )
+{
+    (void)sig;
+    reload_requested = 1;
+}
+
+void dest_pipe_destroy( ) {
+    if ( NULL != dest_pipe ) {
+        tcrpipe_finish( dest_pipe );
+        tcrpipe_destroy( dest_pipe );
+        dest_pipe = NULL;
+    }
+    if ( NULL != routes ) {
+        routing_domain_destroy( routes );
+        routes = NULL;
     }
     return;
 }
 
-bool dest_rdbs_create( ) 
+/*
+ * fill in the pipe backend of every slot of map, connecting to the servers
+ * the pipe does not have yet
+ */
+bool routes_bind( routing_t *map )
 {
-    for( int i = 0 ; i < STORAGE_SERVER_COUNT ; i++ ) {
-        TCRDB *rdb = tcrdbnew();
-        if ( tcrdbopen( rdb, storage_servers[i].host, storage_servers[i].port ) ) {
-            storage_servers[i].rdb = rdb;
-            printf("Connected to %s:%d\n", storage_servers[i].host, storage_servers[i].port );
-        } else {
-            int ecode = tcrdbecode(rdb);
-	        fprintf(stderr, "open error on %s:%d : %s\n", storage_servers[i].host, storage_servers[i].port, tcrdberrmsg( ecode ) );
-            tcrdbdel( rdb );
-            dest_rdbs_destroy( );
+    for ( int i = 0 ; i < map->count ; i++ ) {
+        int connected = dest_pipe->backend_count;
+        if ( -1 == ( map->table[i] = tcrpipe_add( dest_pipe, map->servers[i].host, map->servers[i].port ) ) ) {
             return false;
         }
+        if ( dest_pipe->backend_count > connected ) {
+            printf("Connected to %s:%d\n", map->servers[i].host, map->servers[i].port );
+        }
     }
     return true;
 }
 
-void save_progress( uint64_t count )
+/*
+ * The map from --map, or the one compiled in from backend_for.c
+ */
+routing_t *routes_load( )
+{
+    routing_t *map = ( NULL != map_path ) ? routing_load( map_path ) : routing_compiled( );
+
+    if ( NULL != map ) {
+        if ( NULL != map_path ) {
+            printf( "Routing map %s serial %llu, %d servers\n", map_path, (long long unsigned)map->serial, map->count );
+        } else {
+            printf( "Compiled in routing, %d servers\n", map->count );
+        }
+    }
+    return map;
+}
+
+/*
+ * On SIGHUP read --map again and swap it in, the scan threads pick it up
+ * with their next record.  A map that does not load or connect is dropped
+ * and the current one stays.
+ */
+void routes_reload( )
 {
-    FILE *progress_file = fopen( PROGRESS_FILE, "w+" );
-    if ( progress_file ) {
-        fprintf( progress_file, "%llu\n", count );
-        fclose( progress_file );
+    routing_t *map;
+
+    reload_requested = 0;
+    if ( NULL == map_path ) {
+        printf( "\nSIGHUP without --map, keeping the compiled in routing\n" );
+        return;
+    }
+
+    printf( "\n" );
+    if ( NULL == ( map = routes_load( ) ) || !routes_bind( map ) ) {
+        fprintf( stderr, "Keeping routing map serial %llu\n", (long long unsigned)routing_current( routes )->serial );
+        routing_free( map );
+        return;
+    }
+    routing_publish( routes, map );
+}
+
+bool dest_pipe_create( int producers, int batch_records, int max_inflight, double target_latency )
+{
+    routing_t *map;
+
+    if ( NULL == ( map = routes_load( ) ) ) {
+        return false;
+    }
+
+    // room for whatever a reloaded map brings in
+    dest_pipe = tcrpipe_new( ROUTING_MAX_SERVERS, producers, batch_records, max_inflight, target_latency );
+    tcrpipe_set_metrics( dest_pipe, metrics, m_sent, h_write );
+    tcrpipe_set_profile( dest_pipe, profile, p_putlist );
+    routes    = routing_domain_new( producers, map );
+    if ( NULL == routes ) {
+        routing_free( map );
+        dest_pipe_destroy( );
+        return false;
+    }
+    if ( !routes_bind( map ) ) {
+        dest_pipe_destroy( );
+        return false;
+    }
+    signal( SIGHUP, on_sighup );
+    return true;
+}
+
+/*
+ * hand one record to the pipeline of the tyrant that owns it, producer is the
+ * scan thread handing it over
+ */
+void forward_record( int producer, uint64_t offset, const char *kbuf, int ksiz, const char *vbuf, int vsiz )
+{
+    const routing_t  *map   = routing_current( routes );
+    profile_thread_t *pt    = producer_profile[producer];
+    uint64_t          begin = profile_begin( pt, p_route );
+    int               slot  = routing_slot( map, kbuf, ksiz );
+
+    profile_end( pt, p_route, begin );
+    if ( slot < 0 ) {
+        fprintf( stderr, "Unable to find an mlid in (%.*s)\n", ksiz, kbuf );
     } else {
-        fprintf( stderr, "open error on %s for count %llu : %s\n", PROGRESS_FILE, count, strerror( errno ) );
+        // blocks while the backend's queue is full, so this is where back pressure shows
+        begin = profile_begin( pt, p_send );
+        tcrpipe_put( dest_pipe, producer, map->table[slot], offset, kbuf, ksiz, vbuf, vsiz );
+        profile_end( pt, p_send, begin );
+        metrics_add( producer_metrics[producer], m_records, 1 );
+        metrics_add( producer_metrics[producer], m_bytes, ksiz + vsiz );
+    }
+    // the new map may have dropped or re-pointed a backend this producer has
+    // a batch half filled for, one that would never fill up and so hold the
+    // checkpoint back, everything it is filling goes out as it is
+    if ( routing_quiescent( routes, producer ) ) {
+        tcrpipe_flush( dest_pipe, producer );
     }
-    return;
 }
 
+/*
+ * The checkpoint only moves as far as the tyrants have acknowledged, every
+ * SUMMARY_INTERVAL seconds the state of each backend is printed as well.
+ */
+void report_progress( uint64_t total, uint64_t count, checkpoint_t *cp, uint64_t scan_offset )
+{
+    static time_t last_summary = 0;
+    time_t now = time(NULL);
+
+    scanned_to = scan_offset;
+    if ( reload_requested ) {
+        routes_reload( );
+    }
+    routing_reclaim( routes );
+    metrics_tick( metrics, false );
+    metrics_progress( metrics, stdout, m_records, total, count );
+    checkpoint_update( cp, tcrpipe_safe_offset( dest_pipe, scan_offset ), count );
+
+    if ( now - last_summary >= SUMMARY_INTERVAL ) {
+        printf( "\n" );
+        tcrpipe_summary( dest_pipe, stdout );
+        last_summary = now;
+    }
+}
 
-void iterate_over( TCHDB *hdb )
+/*
+ * hdb->iter is the offset of the next record the iterator will return, so it
+ * doubles as the resume point.
+ */
+bool iterate_over( TCHDB *hdb, checkpoint_t *cp, uint64_t resume_offset, uint64_t count )
 {
 
   TCXSTR *key   = tcxstrnew();
   TCXSTR *value = tcxstrnew();
 
   tchdbiterinit( hdb );
+  if ( resume_offset > 0 ) {
+    hdb->iter = resume_offset;
+  }
 
-  time_t   start = time(NULL);
-  uint64_t count = 0;
   uint64_t total = tchdbrnum( hdb );
 
-  const storage_config_t* backend;
-
   printf("Database contains %llu records\n", total );
 
   /* traverse the records */
+  uint64_t offset = hdb->iter;
+  uint64_t read_start = metrics_now();
+  uint64_t begin      = profile_begin( producer_profile[0], p_read );
   while( tchdbiternext3( hdb, key, value ) ) {
+    profile_end( producer_profile[0], p_read, begin );
+    metrics_observe( producer_metrics[0], h_read, metrics_now() - read_start );
     count++;
-    backend = backend_for( (const char*)tcxstrptr( key ), tcxstrsize( key ) );
-
-    if ( !tcrdbputnr( backend->rdb, tcxstrptr( key ), tcxstrsize( key ), tcxstrptr( value ), tcxstrsize( value ) ) ) {
-        int ecode = tcrdbecode( backend->rdb );
-        fprintf( stderr, "putkeep error : %s\n", tcrdberrmsg( ecode ) );
-    }
+    forward_record( 0, offset, tcxstrptr( key ), tcxstrsize( key ), tcxstrptr( value ), tcxstrsize( value ) );
+    offset = hdb->iter;
     if (( count % 10000 ) == 0 ) {
-        print_progress( stdout, start, total, count );  
-        save_progress( count );
+        report_progress( total, count, cp, offset );
     }
+    read_start = metrics_now();
+    begin      = profile_begin( producer_profile[0], p_read );
   }
   tcxstrdel( key );
   tcxstrdel( value );
-  print_progress( stdout, start, total, count );  
+  report_progress( total, count, cp, offset );
+  return true;
+}
+
+/*
+ * elapsed of reading one record, less what the scanner spent waiting on a
+ * read for it, is parsing.  With the mmap engine that includes the page
+ * faults, there is no read to wait on.
+ */
+void observe_read( metrics_slot_t *slot, tchscan_t *scan, uint64_t elapsed, uint64_t *read_ns )
+{
+    uint64_t waited = scan->read_ns - *read_ns;
+
+    metrics_observe( slot, h_read, elapsed );
+    if ( waited > 0 ) {
+        metrics_observe( slot, h_io, waited );
+    }
+    metrics_observe( slot, h_parse, ( elapsed > waited ) ? elapsed - waited : 0 );
+    *read_ns = scan->read_ns;
 }
 
+/*
+ * Same as iterate_over, but walking the records of the source file directly
+ * instead of through tchdbiternext3.  Keys and values are sent straight out of
+ * the mapping.  Deflated values are inflated into a single reused buffer
+ * unless keep_compressed is set, in which case the stored bytes are sent as
+ * is and the destination is expected to be a database with its deflate
+ * option turned off ( see keep_compressed in tchsplit.c ).
+ */
+bool iterate_raw( tchscan_t *scan, bool keep_compressed, checkpoint_t *cp, uint64_t count )
+{
+  tchscan_rec_t rec;
+  z_stream       zs;
+  bool      inflate = ( scan->hdr.options & TCH_OPT_DEFLATE ) && !keep_compressed;
+  int      buf_size = 64 * 1024;
+  char         *buf = NULL;
+
+  uint64_t total = scan->hdr.record_number;
+
+  if ( inflate ) {
+    memset( &zs, 0, sizeof( zs ) );
+    inflateInit2( &zs, -15 );
+    buf = malloc( buf_size );
+  }
+
+  printf("Database contains %llu records\n", total );
 
+  uint64_t read_start = metrics_now();
+  uint64_t read_ns    = scan->read_ns;
+  uint64_t begin      = profile_begin( producer_profile[0], p_read );
+  while( tchscan_next( scan, &rec ) ) {
+    uint64_t read_stop = metrics_now();
+    profile_end( producer_profile[0], p_read, begin );
+    observe_read( producer_metrics[0], scan, read_stop - read_start, &read_ns );
+    count++;
+    if ( inflate ) {
+      begin    = profile_begin( producer_profile[0], p_inflate );
+      int size = tchscan_inflate( &zs, rec.val_buf, rec.val_size, &buf, &buf_size );
+      profile_end( producer_profile[0], p_inflate, begin );
+      metrics_observe( producer_metrics[0], h_inflate, metrics_now() - read_stop );
+      if ( size < 0 ) {
+        // the checkpoint stays before the record, a resume tries it again
+        fprintf( stderr, "inflate error : record at offset %llu\n", (long long unsigned)rec.offset );
+        inflateEnd( &zs );
+        free( buf );
+        report_progress( total, count - 1, cp, rec.offset );
+        return false;
+      }
+      forward_record( 0, rec.offset, rec.key_buf, rec.key_size, buf, size );
+    } else {
+      forward_record( 0, rec.offset, rec.key_buf, rec.key_size, rec.val_buf, rec.val_size );
+    }
+
+    if (( count % 10000 ) == 0 ) {
+        report_progress( total, count, cp, scan->offset );
+    }
+    read_start = metrics_now();
+    begin      = profile_begin( producer_profile[0], p_read );
+  }
+
+  if ( inflate ) {
+    inflateEnd( &zs );
+    free( buf );
+  }
+  report_progress( total, count, cp, scan->offset );
+  return true;
+}
+
+/*
+ * per scan thread inflate state for iterate_parallel
+ */
+typedef struct scan_thread {
+  z_stream  zs;
+  char     *buf;
+  int       buf_size;
+  bool      inflate;
+  bool      failed;      /* a value did not inflate, the scan was stopped */
+  bool      offline;     /* finished, see iterate_parallel */
+} __attribute__(( aligned( 64 ) )) scan_thread_t;
+
+bool forward_parallel( const tchscan_rec_t *rec, int thread, void *ctx )
+{
+  scan_thread_t *st = &(((scan_thread_t*)ctx)[thread]);
+
+  if ( st->inflate ) {
+    uint64_t begin         = profile_begin( producer_profile[thread], p_inflate );
+    uint64_t inflate_start = metrics_now();
+    int      size          = tchscan_inflate( &(st->zs), rec->val_buf, rec->val_size, &(st->buf), &(st->buf_size) );
+    metrics_observe( producer_metrics[thread], h_inflate, metrics_now() - inflate_start );
+    profile_end( producer_profile[thread], p_inflate, begin );
+    if ( size < 0 ) {
+      fprintf( stderr, "inflate error : record at offset %llu\n", (long long unsigned)rec->offset );
+      st->failed = true;
+      return false;
+    }
+    forward_record( thread, rec->offset, rec->key_buf, rec->key_size, st->buf, size );
+  } else {
+    forward_record( thread, rec->offset, rec->key_buf, rec->key_size, rec->val_buf, rec->val_size );
+  }
+  return true;
+}
+
+/*
+ * iterate_raw with the record region split between the threads of par, each
+ * one its own tcrpipe producer.  The checkpoint follows the low water mark
+ * of the threads, so a resume sends again whatever the faster threads had
+ * already sent beyond it.
+ */
+bool iterate_parallel( tchpar_t *par, bool keep_compressed, checkpoint_t *cp, uint64_t resume_offset, uint64_t count )
+{
+  tchscan_t     *scan    = par->ranges[0].scan;
+  bool           inflate = ( scan->hdr.options & TCH_OPT_DEFLATE ) && !keep_compressed;
+  scan_thread_t *threads = NULL;
+  int64_t        records;
+
+  uint64_t total = scan->hdr.record_number;
+
+  if ( 0 != posix_memalign( (void**)&threads, 64, par->nthreads * sizeof( scan_thread_t ) ) ) {
+    fprintf( stderr, "Failure allocating %d scan threads\n", par->nthreads );
+    return false;
+  }
+  memset( threads, 0, par->nthreads * sizeof( scan_thread_t ) );
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    threads[i].inflate = inflate;
+    if ( inflate ) {
+      inflateInit2( &(threads[i].zs), -15 );
+      threads[i].buf_size = 64 * 1024;
+      threads[i].buf      = malloc( threads[i].buf_size );
+    }
+  }
+
+  printf("Database contains %llu records, scanning with %d threads\n", total, par->nthreads );
+
+  if ( !tchpar_start( par, resume_offset, forward_parallel, threads ) ) {
+    free( threads );
+    return false;
+  }
+  while ( !tchpar_wait( par, 1.0 ) ) {
+    // a thread at the end of its range never routes again, so it can not hold
+    // up freeing old maps, and its last batches will not fill up either
+    for ( int i = 0 ; i < par->nthreads ; i++ ) {
+      if ( __atomic_load_n( &(par->ranges[i].done), __ATOMIC_ACQUIRE ) && !threads[i].offline ) {
+        routing_offline( routes, i );
+        tcrpipe_flush( dest_pipe, i );
+        threads[i].offline = true;
+      }
+    }
+    report_progress( total, count + tchpar_records( par ), cp, tchpar_low_water( par ) );
+  }
+  records = tchpar_finish( par );
+
+  bool failed = false;
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    failed = failed || threads[i].failed;
+    if ( inflate ) {
+      inflateEnd( &(threads[i].zs) );
+      free( threads[i].buf );
+    }
+  }
+  free( threads );
+
+  if ( records < 0 ) {
+    // the ranges did not line up, nothing past where this run started can be trusted
+    report_progress( total, count, cp, par->region_start );
+    return false;
+  }
+  if ( failed ) {
+    // the checkpoint stays before the record that did not inflate
+    report_progress( total, count + records, cp, tchpar_low_water( par ) );
+    return false;
+  }
+  report_progress( total, count + records, cp, par->region_end );
+  return true;
+}
+
+/*
+ * wait for every batch to be accepted before the final checkpoint, false if
+ * the scan did not finish or a tyrant did not take its batches
+ */
+bool finish_migration( checkpoint_t *cp, bool done )
+{
+  // the scan is over, the senders carry on until the last batch is accepted
+  for ( int i = 0 ; i < dest_pipe->producers ; i++ ) {
+    profile_thread_stop( producer_profile[i] );
+  }
+  if ( !tcrpipe_finish( dest_pipe ) ) {
+    done = false;
+  }
+  checkpoint_update( cp, tcrpipe_safe_offset( dest_pipe, scanned_to ), cp->count );
+  checkpoint_finish( cp, done );
+
+  printf( "Backends:\n" );
+  tcrpipe_summary( dest_pipe, stdout );
+  tcrpipe_destroy( dest_pipe );
+  dest_pipe = NULL;
+  routing_domain_destroy( routes );
+  routes = NULL;
+  metrics_destroy( metrics );
+  metrics = NULL;
+
+  if ( NULL != profile ) {
+    profile_report( profile, stdout );
+    profile_destroy( profile );
+    profile = NULL;
+  }
+  return done;
+}
+
+/*
+ * every counter and histogram is registered before the first slot goes out
+ */
+bool metrics_create( int producers, const char *json_path, const char *prom_path )
+{
+  metrics   = metrics_new( "tch2tcr", producers + ROUTING_MAX_SERVERS );
+  m_records = metrics_counter( metrics, "records" );
+  m_bytes   = metrics_counter( metrics, "bytes" );
+  m_sent    = metrics_counter( metrics, "sent" );
+  h_read    = metrics_histogram( metrics, "read" );
+  h_io      = metrics_histogram( metrics, "io" );
+  h_parse   = metrics_histogram( metrics, "parse" );
+  h_inflate = metrics_histogram( metrics, "inflate" );
+  h_write   = metrics_histogram( metrics, "write" );
+  if ( !metrics_output( metrics, json_path, prom_path ) ) {
+    return false;
+  }
+
+  producer_metrics = (metrics_slot_t**)calloc( producers, sizeof( metrics_slot_t* ) );
+  for ( int i = 0 ; i < producers ; i++ ) {
+    producer_metrics[i] = metrics_slot( metrics );
+  }
+  return true;
+}
+
+/*
+ * every phase is registered before the first thread is claimed, without
+ * --profile every producer_profile is NULL and timing into it does nothing
+ */
+void profile_create( int producers, bool profiling, const char *trace_path )
+{
+  if ( profiling || NULL != trace_path ) {
+    profile   = profile_new( "tch2tcr", PROFILE_SAMPLE_EVERY, trace_path );
+    p_read    = profile_phase( profile, "read" );
+    p_inflate = profile_phase( profile, "inflate" );
+    p_route   = profile_phase( profile, "route" );
+    p_send    = profile_phase( profile, "send" );
+    p_putlist = profile_phase( profile, "putlist" );
+  }
+
+  producer_profile = (profile_thread_t**)calloc( producers, sizeof( profile_thread_t* ) );
+  for ( int i = 0 ; i < producers ; i++ ) {
+    producer_profile[i] = profile_thread( profile, "scan" );
+  }
+}
+
+void usage( const char *name )
+{
+  fprintf( stderr, "Usage: %s [options] database.hdb\n", name );
+  fprintf( stderr, "  -r, --raw              read the source file directly instead of through tchdbiternext3\n" );
+  fprintf( stderr, "  -k, --keep-compressed  with --raw, send deflated values without inflating them\n" );
+  fprintf( stderr, "  -c, --checkpoint FILE  where to keep the resume checkpoint ( default %s )\n", PROGRESS_FILE );
+  fprintf( stderr, "  -i, --interval SECS    seconds between checkpoint writes ( default %d )\n", CHECKPOINT_INTERVAL );
+  fprintf( stderr, "  -R, --resume           continue from the offset in the checkpoint\n" );
+  fprintf( stderr, "  -b, --batch N          records per putlist batch ( default %d )\n", BATCH_RECORDS );
+  fprintf( stderr, "  -n, --inflight N       most batches in flight to one tyrant ( default %d )\n", MAX_INFLIGHT );
+  fprintf( stderr, "  -t, --target-latency MS  back off a tyrant when a batch takes longer ( default %d )\n", TARGET_LATENCY_MS );
+  fprintf( stderr, "  -T, --threads N        with --raw, scan the source with N threads ( default %d )\n", SCAN_THREADS );
+  fprintf( stderr, "  -p, --polite           with --raw, drop source pages from the page cache once sent\n" );
+  fprintf( stderr, "  -d, --direct           with --raw, read the source with O_DIRECT instead of mapping it\n" );
+  fprintf( stderr, "  -l, --rate BYTES       with --raw, scan at most BYTES of the source per second\n" );
+  fprintf( stderr, "  -m, --map FILE         route with this map instead of the compiled in one, reread on SIGHUP\n" );
+  fprintf( stderr, "  -j, --metrics FILE     append the counters and latencies to FILE as JSON lines every second\n" );
+  fprintf( stderr, "  -P, --prometheus FILE  keep FILE up to date in Prometheus text format\n" );
+  fprintf( stderr, "  -f, --profile          print where the time went in each thread at the end\n" );
+  fprintf( stderr, "  -E, --trace FILE       and write the timed spans to FILE as a Chrome trace\n" );
+}
 
 int main(int argc, char **argv)
 {
+  bool        raw             = false;
+  bool        keep_compressed = false;
+  bool        resume          = false;
+  const char *checkpoint_path = PROGRESS_FILE;
+  int         interval        = CHECKPOINT_INTERVAL;
+  uint64_t    resume_offset   = 0;
+  uint64_t    resume_count    = 0;
+  bool        done            = false;
+  int         batch_records   = BATCH_RECORDS;
+  int         max_inflight    = MAX_INFLIGHT;
+  int         target_latency  = TARGET_LATENCY_MS;
+  int         threads         = SCAN_THREADS;
+  tchscan_io_t io             = { false, false, 0 };
+  const char *json_path       = NULL;
+  const char *prom_path       = NULL;
+  bool        profiling       = false;
+  const char *trace_path      = NULL;
+  int         opt;
+  checkpoint_t cp;
+
+  struct option long_options[] = {
+    { "raw",             no_argument,       NULL, 'r' },
+    { "keep-compressed", no_argument,       NULL, 'k' },
+    { "checkpoint",      required_argument, NULL, 'c' },
+    { "interval",        required_argument, NULL, 'i' },
+    { "resume",          no_argument,       NULL, 'R' },
+    { "batch",           required_argument, NULL, 'b' },
+    { "inflight",        required_argument, NULL, 'n' },
+    { "target-latency",  required_argument, NULL, 't' },
+    { "threads",         required_argument, NULL, 'T' },
+    { "polite",          no_argument,       NULL, 'p' },
+    { "direct",          no_argument,       NULL, 'd' },
+    { "rate",            required_argument, NULL, 'l' },
+    { "map",             required_argument, NULL, 'm' },
+    { "metrics",         required_argument, NULL, 'j' },
+    { "prometheus",      required_argument, NULL, 'P' },
+    { "profile",         no_argument,       NULL, 'f' },
+    { "trace",           required_argument, NULL, 'E' },
+    { NULL,              0,                 NULL,  0  }
+  };
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "rkc:i:Rb:n:t:T:pdl:m:j:P:fE:", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'r': raw             = true; break;
+      case 'k': keep_compressed = true; break;
+      case 'c': checkpoint_path = optarg; break;
+      case 'i': interval        = atoi( optarg ); break;
+      case 'R': resume          = true; break;
+      case 'b': batch_records   = atoi( optarg ); break;
+      case 'n': max_inflight    = atoi( optarg ); break;
+      case 't': target_latency  = atoi( optarg ); break;
+      case 'T': threads         = atoi( optarg ); break;
+      case 'p': io.drop_behind  = true; break;
+      case 'd': io.direct       = true; break;
+      case 'l': io.rate         = strtoull( optarg, NULL, 0 ); break;
+      case 'm': map_path        = optarg; break;
+      case 'j': json_path       = optarg; break;
+      case 'P': prom_path       = optarg; break;
+      case 'f': profiling       = true; break;
+      case 'E': trace_path      = optarg; break;
+      default :
+        usage( argv[0] );
+        exit(1);
+    }
+  }
 
-  if ( argc < 2 ) {
-    fprintf( stderr, "Usage: %s database.hdb\n", argv[0]);
+  if ( optind >= argc ) {
+    usage( argv[0] );
     exit(1);
   }
-  
-  TCHDB   *hdb = init_src_hdb( argv[1] );
 
-  if (!dest_rdbs_create( )) {
+  if ( ( threads > 1 || io.drop_behind || io.direct || io.rate > 0 ) && !raw ) {
+    fprintf( stderr, "--threads, --polite, --direct and --rate need --raw\n" );
+    exit(1);
+  }
+
+  if ( !metrics_create( raw ? threads : 1, json_path, prom_path ) ) {
+    exit(1);
+  }
+  profile_create( raw ? threads : 1, profiling, trace_path );
+
+  if ( resume ) {
+    if ( !checkpoint_load( checkpoint_path, argv[optind], &resume_offset, &resume_count, &done ) ) {
+      exit(1);
+    }
+    if ( done ) {
+      printf( "Checkpoint %s says all %llu records were already sent\n", checkpoint_path, (long long unsigned)resume_count );
+      exit(0);
+    }
+    printf( "Resuming at offset %llu after %llu records\n", (long long unsigned)resume_offset, (long long unsigned)resume_count );
+  }
+
+  if ( raw ) {
+    // O_DIRECT needs the windowed reads, a mapping always goes through the page cache
+    int        engine = io.direct ? TCHSCAN_BUFFERED : TCHSCAN_MMAP;
+    tchscan_t *scan   = tchscan_open_engine( argv[optind], engine, 0 );
+    if ( NULL == scan || !tchscan_set_io( scan, &io ) ) {
+      exit( 1 );
+    }
+
+    if ( !keep_compressed && ( scan->hdr.options & ( TCH_OPT_BZIP2 | TCH_OPT_TCBS | TCH_OPT_EXCODEC ) ) ) {
+      fprintf( stderr, "Only deflate compressed sources can be inflated in raw mode, use --keep-compressed\n" );
+      tchscan_close( scan );
+      exit( 1 );
+    }
+    printf( "%s %s\n", io.direct ? "Opened" : "Mapped", scan->path );
+
+    if ( resume && !tchscan_seek( scan, resume_offset ) ) {
+      fprintf( stderr, "Checkpoint offset %llu is outside the records of %s\n", (long long unsigned)resume_offset, scan->path );
+      tchscan_close( scan );
+      exit( 1 );
+    }
+
+    if (!dest_pipe_create( threads, batch_records, max_inflight, target_latency / 1000.0 )) {
+      tchscan_close( scan );
+      exit( 1 );
+    }
+
+    if ( !checkpoint_start( &cp, checkpoint_path, scan->path, interval ) ) {
+      dest_pipe_destroy( );
+      tchscan_close( scan );
+      exit( 1 );
+    }
+
+    if ( threads > 1 ) {
+      tchpar_t *par = tchpar_new( scan->path, threads, engine, 0 );
+      if ( NULL == par || !tchpar_set_io( par, &io ) ) {
+        dest_pipe_destroy( );
+        checkpoint_finish( &cp, false );
+        tchscan_close( scan );
+        exit( 1 );
+      }
+      done = iterate_parallel( par, keep_compressed, &cp, resume ? resume_offset : 0, resume_count );
+      tchpar_destroy( par );
+    } else {
+      done = iterate_raw( scan, keep_compressed, &cp, resume_count );
+    }
+    done = finish_migration( &cp, done );
+
+    tchscan_close( scan );
+    exit( done ? 0 : 1 );
+  }
+
+  TCHDB   *hdb = init_src_hdb( argv[optind] );
+
+  if (!dest_pipe_create( 1, batch_records, max_inflight, target_latency / 1000.0 ) ||
+      !checkpoint_start( &cp, checkpoint_path, argv[optind], interval )) {
+      dest_pipe_destroy( );
       tchdbclose( hdb );
       tchdbdel( hdb );
       exit( 1 );
   }
 
-  iterate_over( hdb );
-
-  dest_rdbs_destroy( );
+  done = iterate_over( hdb, &cp, resume_offset, resume_count );
+  done = finish_migration( &cp, done );
 
   tchdbclose( hdb );
   tchdbdel( hdb );
 
-  exit(0);
+  exit( done ? 0 : 1 );
 
 }
 
@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "tchbf.h"
+#include "tchscan.h"
+#include "tchstream.h"
+
+/* from the Parquet split block Bloom filter, odd and well spread */
+static const uint32_t tchbf_salts[TCHBF_WORDS] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+static uint64_t double_bits( double d )
+{
+  uint64_t v;
+  memcpy( &v, &d, sizeof( v ) );
+  return v;
+}
+
+static double bits_double( uint64_t v )
+{
+  double d;
+  memcpy( &d, &v, sizeof( d ) );
+  return d;
+}
+
+static inline uint64_t tchbf_block_of( const tchbf_t* bloom, uint64_t hash )
+{
+  return ( ( hash >> 32 ) * bloom->block_count ) >> 32;
+}
+
+static inline void tchbf_mask( uint64_t hash, uint64_t* mask )
+{
+  for ( int i = 0 ; i < TCHBF_WORDS ; i++ ) {
+    mask[i] = 1ULL << ( ( (uint32_t)hash * tchbf_salts[i] ) >> 26 );
+  }
+}
+
+static inline bool tchbf_probe( const tchbf_block_t* block, const uint64_t* mask )
+{
+#ifdef __SSE2__
+  __m128i miss = _mm_setzero_si128();
+  for ( int i = 0 ; i < TCHBF_WORDS ; i += 2 ) {
+    __m128i m = _mm_loadu_si128( (const __m128i*)( mask + i ) );
+    __m128i w = _mm_load_si128( (const __m128i*)( block->words + i ) );
+    miss      = _mm_or_si128( miss, _mm_andnot_si128( w, m ) );
+  }
+  return 0xffff == _mm_movemask_epi8( _mm_cmpeq_epi8( miss, _mm_setzero_si128() ) );
+#else
+  uint64_t miss = 0;
+  for ( int i = 0 ; i < TCHBF_WORDS ; i++ ) {
+    miss |= mask[i] & ~block->words[i];
+  }
+  return 0 == miss;
+#endif
+}
+
+/*
+ * The false positive rate of blocks holding a mean of load keys each, the
+ * keys a block gets being Poisson
+ */
+static double tchbf_model_fpr( double load )
+{
+  double pmf   = exp( -load );
+  double fpr   = 0;
+  int    limit = (int)( load + 12 * sqrt( load ) + 20 );
+
+  for ( int j = 0 ; j <= limit ; j++ ) {
+    fpr += pmf * pow( 1.0 - pow( 63.0 / 64.0, j ), TCHBF_WORDS );
+    pmf *= load / ( j + 1 );
+  }
+  return fpr;
+}
+
+bool tchbf_path( const char* path, char* bf_path, size_t size )
+{
+  if ( snprintf( bf_path, size, "%s%s", path, TCHBF_SUFFIX ) >= (int)size ) {
+    fprintf( stderr, "Path of the filter of %s is too long\n", path );
+    return false;
+  }
+  return true;
+}
+
+tchbf_t* tchbf_new( uint64_t keys, double fpr )
+{
+  tchbf_t *bloom;
+  double   bits  = ( keys > 0 ? keys : 1 ) * -log( fpr ) / ( M_LN2 * M_LN2 );
+  uint64_t count = (uint64_t)ceil( bits / 512 );
+
+  // the textbook size is for bits spread over the whole array, but here the
+  // keys are spread over blocks and some get more than their share, so it
+  // grows until the model of that meets fpr
+  while ( count < UINT32_MAX && tchbf_model_fpr( keys / (double)count ) > fpr ) {
+    count += count / 32 + 1;
+  }
+
+  if ( NULL == ( bloom = (tchbf_t*)calloc( 1, sizeof( tchbf_t ) ) ) ) {
+    return NULL;
+  }
+
+  bloom->block_count = count;
+  bloom->fpr         = fpr;
+  bloom->fd          = -1;
+  if ( 0 != posix_memalign( (void**)&(bloom->blocks), 64, count * sizeof( tchbf_block_t ) ) ) {
+    free( bloom );
+    return NULL;
+  }
+  memset( bloom->blocks, 0, count * sizeof( tchbf_block_t ) );
+  return bloom;
+}
+
+/*
+ * splitmix64's finalizer, tchscan_key_hash is no more than a multiply and
+ * add a byte, its low bits barely change between similar keys
+ */
+uint64_t tchbf_hash( uint64_t key_hash )
+{
+  uint64_t z = key_hash + 0x9e3779b97f4a7c15ULL;
+  z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+  z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+  return z ^ ( z >> 31 );
+}
+
+void tchbf_add( tchbf_t* bloom, uint64_t hash )
+{
+  tchbf_block_t *block = &(bloom->blocks[tchbf_block_of( bloom, hash )]);
+  uint64_t       mask[TCHBF_WORDS];
+
+  tchbf_mask( hash, mask );
+  for ( int i = 0 ; i < TCHBF_WORDS ; i++ ) {
+    if ( mask[i] != ( __atomic_load_n( &(block->words[i]), __ATOMIC_RELAXED ) & mask[i] ) ) {
+      __atomic_fetch_or( &(block->words[i]), mask[i], __ATOMIC_RELAXED );
+    }
+  }
+  __atomic_fetch_add( &(bloom->keys), 1, __ATOMIC_RELAXED );
+}
+
+static uint64_t tchbf_key( const char* kbuf, uint32_t ksiz )
+{
+  uint8_t hash;
+  return tchbf_hash( tchscan_key_hash( kbuf, ksiz, &hash ) );
+}
+
+bool tchbf_maybe( const tchbf_t* bloom, const char* kbuf, uint32_t ksiz )
+{
+  uint64_t hash = tchbf_key( kbuf, ksiz );
+  uint64_t mask[TCHBF_WORDS];
+
+  tchbf_mask( hash, mask );
+  return tchbf_probe( &(bloom->blocks[tchbf_block_of( bloom, hash )]), mask );
+}
+
+void tchbf_query( const tchbf_t* bloom, const char* const* kbufs, const uint32_t* ksizs,
+                  uint64_t count, bool* maybe )
+{
+  uint64_t hashes[TCHBF_BATCH];
+  uint64_t blocks[TCHBF_BATCH];
+  uint64_t mask[TCHBF_WORDS];
+
+  for ( uint64_t start = 0 ; start < count ; start += TCHBF_BATCH ) {
+    uint64_t n = ( count - start < TCHBF_BATCH ) ? count - start : TCHBF_BATCH;
+
+    // every block of the batch is on its way in before the first is looked at
+    for ( uint64_t i = 0 ; i < n ; i++ ) {
+      hashes[i] = tchbf_key( kbufs[start + i], ksizs[start + i] );
+      blocks[i] = tchbf_block_of( bloom, hashes[i] );
+      __builtin_prefetch( &(bloom->blocks[blocks[i]]) );
+    }
+    for ( uint64_t i = 0 ; i < n ; i++ ) {
+      tchbf_mask( hashes[i], mask );
+      maybe[start + i] = tchbf_probe( &(bloom->blocks[blocks[i]]), mask );
+    }
+  }
+}
+
+/*
+ * A key not in the filter passes in a block when each of its eight bits
+ * is one of those already set in its word
+ */
+double tchbf_expected_fpr( const tchbf_t* bloom )
+{
+  double sum = 0;
+
+  for ( uint64_t b = 0 ; b < bloom->block_count ; b++ ) {
+    double p = 1.0;
+    for ( int i = 0 ; i < TCHBF_WORDS ; i++ ) {
+      p *= __builtin_popcountll( bloom->blocks[b].words[i] ) / 64.0;
+    }
+    sum += p;
+  }
+  return bloom->block_count ? sum / bloom->block_count : 0;
+}
+
+bool tchbf_write( tchbf_t* bloom, const char* path, const tchidx_stamp_t* stamp )
+{
+  uint8_t buf[TCHBF_HEADER_SIZE];
+  char    tmp_path[PATH_MAX+1];
+  int     fd;
+
+  memset( buf, 0, sizeof( buf ) );
+  memcpy( buf, TCHBF_MAGIC, strlen( TCHBF_MAGIC ) );
+  buf[8] = TCHBF_VERSION;
+  tchhdr_put_le( buf + 16, bloom->block_count, 8 );
+  tchhdr_put_le( buf + 24, bloom->keys, 8 );
+  tchhdr_put_le( buf + 32, double_bits( bloom->fpr ), 8 );
+  tchhdr_put_le( buf + 40, double_bits( tchbf_expected_fpr( bloom ) ), 8 );
+  tchhdr_put_le( buf + 48, stamp->size, 8 );
+  tchhdr_put_le( buf + 56, stamp->mtime, 8 );
+  tchhdr_put_le( buf + 64, stamp->mtime_ns, 8 );
+  tchhdr_put_le( buf + 72, stamp->record_number, 8 );
+  tchhdr_put_le( buf + 80, stamp->bucket_number, 8 );
+
+  snprintf( tmp_path, sizeof( tmp_path ), "%s.%d", path, (int)getpid() );
+  if ( -1 == ( fd = open( tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", tmp_path, strerror( errno ) );
+    return false;
+  }
+  if ( !tchstream_write_fully( fd, buf, sizeof( buf ) ) ||
+       !tchstream_write_fully( fd, bloom->blocks, bloom->block_count * sizeof( tchbf_block_t ) ) ||
+       0 != fsync( fd ) || 0 != close( fd ) || 0 != rename( tmp_path, path ) ) {
+    fprintf( stderr, "write error on %s : %s\n", tmp_path, strerror( errno ) );
+    unlink( tmp_path );
+    return false;
+  }
+  bloom->stamp = *stamp;
+  return true;
+}
+
+tchbf_t* tchbf_open( const char* path, const tchidx_stamp_t* stamp, const char** why )
+{
+  tchbf_t     *bloom = (tchbf_t*)calloc( 1, sizeof( tchbf_t ) );
+  struct stat  st;
+
+  if ( -1 == ( bloom->fd = open( path, O_RDONLY ) ) || 0 != fstat( bloom->fd, &st ) ) {
+    *why = ( ENOENT == errno ) ? "there is no filter" : strerror( errno );
+    tchbf_destroy( bloom );
+    return NULL;
+  }
+  bloom->map_size = st.st_size;
+  if ( bloom->map_size < TCHBF_HEADER_SIZE ||
+       MAP_FAILED == ( bloom->map = mmap( NULL, bloom->map_size, PROT_READ, MAP_SHARED, bloom->fd, 0 ) ) ) {
+    bloom->map = NULL;
+    *why       = "it is not a filter";
+    tchbf_destroy( bloom );
+    return NULL;
+  }
+  if ( 0 != memcmp( bloom->map, TCHBF_MAGIC, strlen( TCHBF_MAGIC ) ) || TCHBF_VERSION != bloom->map[8] ) {
+    *why = "it is not a filter, or not a version this reads";
+    tchbf_destroy( bloom );
+    return NULL;
+  }
+
+  bloom->block_count         = tchhdr_get_le( bloom->map + 16, 8 );
+  bloom->keys                = tchhdr_get_le( bloom->map + 24, 8 );
+  bloom->fpr                 = bits_double( tchhdr_get_le( bloom->map + 32, 8 ) );
+  bloom->stamp.size          = tchhdr_get_le( bloom->map + 48, 8 );
+  bloom->stamp.mtime         = tchhdr_get_le( bloom->map + 56, 8 );
+  bloom->stamp.mtime_ns      = tchhdr_get_le( bloom->map + 64, 8 );
+  bloom->stamp.record_number = tchhdr_get_le( bloom->map + 72, 8 );
+  bloom->stamp.bucket_number = tchhdr_get_le( bloom->map + 80, 8 );
+  bloom->blocks              = (tchbf_block_t*)( bloom->map + TCHBF_HEADER_SIZE );
+  if ( 0 == bloom->block_count ||
+       TCHBF_HEADER_SIZE + bloom->block_count * sizeof( tchbf_block_t ) != bloom->map_size ) {
+    *why = "it was cut off";
+    tchbf_destroy( bloom );
+    return NULL;
+  }
+  if ( NULL != stamp && 0 != memcmp( stamp, &(bloom->stamp), sizeof( *stamp ) ) ) {
+    *why = "it is stale, the database has changed since it was built";
+    tchbf_destroy( bloom );
+    return NULL;
+  }
+
+  madvise( bloom->map, bloom->map_size, MADV_RANDOM );
+  *why = NULL;
+  return bloom;
+}
+
+void tchbf_destroy( tchbf_t* bloom )
+{
+  if ( NULL == bloom ) {
+    return;
+  }
+  if ( NULL != bloom->map ) {
+    munmap( bloom->map, bloom->map_size );
+  } else {
+    free( bloom->blocks );
+  }
+  if ( -1 != bloom->fd ) {
+    close( bloom->fd );
+  }
+  free( bloom );
+}
@@ -0,0 +1,111 @@
+#ifndef __TCHBF_H__
+#define __TCHBF_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "tchidx.h"
+
+/*
+ * A blocked Bloom filter of the keys of a hash database, kept next to it so
+ * "is this key in that shard" can be answered no without opening the shard.
+ *
+ * The filter is an array of 64 byte blocks, one cache line each.  A key
+ * only ever touches one block: the top half of its hash picks the block and
+ * the bottom half, times eight odd salts, one bit in each of the block's
+ * eight 64 bit words.  A probe is one cache line, and with SSE2 four 16 byte
+ * ands and compares.  The batch query works out every key's block first and
+ * prefetches them all before probing any, so the cache misses overlap.
+ *
+ * The hash is tchscan_key_hash mixed, so a filter can be built from a
+ * tchidx index as well as from a scan, and adding is atomic, so any tchpar
+ * callback can add the keys it sees, tchstat --bloom does in its pass.
+ *
+ * file, header of 128 bytes then the blocks:
+ *
+ *    0  magic             8 bytes  "TCHBLOOM"
+ *    8  version           1 byte
+ *   16  block count       8 bytes
+ *   24  key count         8 bytes
+ *   32  asked for rate    8 bytes  false positive rate, a double
+ *   40  expected rate     8 bytes  for the keys added, a double
+ *   48  stamp            40 bytes  tchidx_stamp_t of the database
+ *
+ * Mapped and used as it is, little endian like the index.
+ */
+
+#define TCHBF_MAGIC        "TCHBLOOM"
+#define TCHBF_VERSION      1
+#define TCHBF_HEADER_SIZE  128
+#define TCHBF_SUFFIX       ".bloom"
+#define TCHBF_WORDS        8          /* 64 bit words a block, one bit set in each a key */
+#define TCHBF_FPR          0.01
+#define TCHBF_BATCH        64         /* keys a batch query prefetches ahead */
+
+typedef struct tchbf_block {
+  uint64_t words[TCHBF_WORDS];
+} __attribute__(( aligned( 64 ) )) tchbf_block_t;
+
+typedef struct tchbf {
+  tchbf_block_t  *blocks;
+  uint64_t        block_count;
+  uint64_t        keys;                 /* added, or in the file         */
+  double          fpr;                  /* asked for                     */
+  tchidx_stamp_t  stamp;
+
+  int             fd;                   /* of the file when it is mapped */
+  uint8_t        *map;
+  uint64_t        map_size;
+} tchbf_t;
+
+/*
+ * The filter next to the database at path, path with TCHBF_SUFFIX.  Prints
+ * why and returns false if that does not fit in size.
+ */
+extern bool tchbf_path( const char* path, char* bf_path, size_t size );
+
+/*
+ * An empty filter sized for keys keys at false positive rate fpr, NULL when
+ * there is no memory for it
+ */
+extern tchbf_t* tchbf_new( uint64_t keys, double fpr );
+
+/*
+ * The hash a key is added and looked up by, from tchscan_key_hash of it
+ */
+extern uint64_t tchbf_hash( uint64_t key_hash );
+
+/*
+ * Add a key by tchbf_hash, safe from any number of threads at once
+ */
+extern void tchbf_add( tchbf_t* bloom, uint64_t hash );
+
+extern bool tchbf_maybe( const tchbf_t* bloom, const char* kbuf, uint32_t ksiz );
+
+/*
+ * For each of the count keys, maybe[i] false if it is certainly not in the
+ * database and true if it may be
+ */
+extern void tchbf_query( const tchbf_t* bloom, const char* const* kbufs, const uint32_t* ksizs,
+                         uint64_t count, bool* maybe );
+
+/*
+ * The false positive rate of the filter with the keys it has
+ */
+extern double tchbf_expected_fpr( const tchbf_t* bloom );
+
+/*
+ * Write the filter for the database stamped stamp to path, through a
+ * temporary file renamed over it.  Prints why and returns false on failure.
+ */
+extern bool tchbf_write( tchbf_t* bloom, const char* path, const tchidx_stamp_t* stamp );
+
+/*
+ * Map the filter at path.  NULL with why if it is not one or, when stamp is
+ * not NULL, if it was built for a database with another stamp.
+ */
+extern tchbf_t* tchbf_open( const char* path, const tchidx_stamp_t* stamp, const char** why );
+
+extern void tchbf_destroy( tchbf_t* bloom );
+
+#endif
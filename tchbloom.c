@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "tchhdr.h"
+#include "tchscan.h"
+#include "tchpar.h"
+#include "tchidx.h"
+#include "tchbf.h"
+
+/*
+ * Build and ask the Bloom filter sidecar of a hash database, see tchbf.h.
+ *
+ *   tchbloom build db.tch             writes db.tch.bloom, from db.tch.idx
+ *                                     when tchindex has built a valid one,
+ *                                     else from a parallel scan
+ *   tchbloom query db.tch key ...     no or maybe for each key, from the
+ *                                     arguments or else a line each on stdin
+ *
+ * A query reads the database's header to check the filter is not stale and
+ * nothing else of it, a no never opens more than that.
+ */
+
+#define BLOOM_THREADS  4
+
+void print_progress( FILE* file, time_t start_time, long long unsigned final, long long unsigned so_far );
+
+static bool bloom_add( const tchscan_rec_t* rec, int thread, void* ctx )
+{
+  uint8_t hash;
+
+  (void)thread;
+  tchbf_add( (tchbf_t*)ctx, tchbf_hash( tchscan_key_hash( rec->key_buf, rec->key_size, &hash ) ) );
+  return true;
+}
+
+int bloom_build( const char* path, const char* bf_path, double fpr, int threads, bool force, bool quiet )
+{
+  tchscan_t      *scan;
+  tchidx_t       *idx;
+  tchbf_t        *bloom;
+  tchidx_stamp_t  before, after;
+  const char     *why;
+  const char     *source;
+  char            idx_path[PATH_MAX+1];
+  char            default_path[PATH_MAX+1];
+
+  if ( NULL == ( scan = tchscan_open( path ) ) ) {
+    return 1;
+  }
+  if ( ( scan->hdr.flags & TCH_FLAG_OPEN ) && !force ) {
+    fprintf( stderr, "%s is marked open, something may be writing it, --force to build anyway\n", scan->path );
+    return 1;
+  }
+  if ( NULL == bf_path ) {
+    if ( !tchbf_path( scan->path, default_path, sizeof( default_path ) ) ) {
+      return 1;
+    }
+    bf_path = default_path;
+  }
+  if ( !tchidx_stamp_path( scan->path, &before ) ) {
+    return 1;
+  }
+
+  if ( !tchidx_path( scan->path, idx_path, sizeof( idx_path ) ) ) {
+    return 1;
+  }
+  if ( NULL != ( idx = tchidx_open( idx_path, scan, &why ) ) ) {
+    // the index has every key's hash, the records need not be read at all
+    source = idx_path;
+    bloom  = tchbf_new( idx->count, fpr );
+    for ( uint64_t i = 0 ; NULL != bloom && i < idx->count ; i++ ) {
+      tchbf_add( bloom, tchbf_hash( idx->entries[i].hash ) );
+    }
+    tchidx_close( idx );
+  } else {
+    tchpar_t *par;
+    time_t    start = time( NULL );
+
+    if ( !quiet ) {
+      fprintf( stderr, "Not using %s, %s, scanning the records\n", idx_path, why );
+    }
+    source = scan->path;
+    if ( NULL == ( bloom = tchbf_new( scan->hdr.record_number, fpr ) ) ||
+         NULL == ( par = tchpar_new( scan->path, threads, TCHSCAN_MMAP, 0 ) ) ||
+         !tchpar_start( par, 0, bloom_add, bloom ) ) {
+      return 1;
+    }
+    while ( !tchpar_wait( par, 1.0 ) ) {
+      if ( !quiet ) {
+        print_progress( stderr, start, scan->hdr.record_number, tchpar_records( par ) );
+      }
+    }
+    if ( tchpar_finish( par ) < 0 ) {
+      fprintf( stderr, "\nScanning %s failed\n", scan->path );
+      return 1;
+    }
+    tchpar_destroy( par );
+    if ( !quiet ) {
+      fprintf( stderr, "\n" );
+    }
+  }
+  if ( NULL == bloom ) {
+    fprintf( stderr, "Out of memory for the filter of %s\n", scan->path );
+    return 1;
+  }
+
+  // a database written to while it was read gets no filter
+  if ( !tchidx_stamp_path( scan->path, &after ) ) {
+    return 1;
+  }
+  if ( 0 != memcmp( &before, &after, sizeof( before ) ) ) {
+    fprintf( stderr, "%s changed while the filter was being built\n", scan->path );
+    return 1;
+  }
+  if ( !tchbf_write( bloom, bf_path, &before ) ) {
+    return 1;
+  }
+
+  fprintf( stdout, "Filtered %llu keys of %s from %s into %s\n", (long long unsigned)bloom->keys,
+           scan->path, source, bf_path );
+  fprintf( stdout, "  blocks           : %llu of 64 bytes, %.2f bits a key\n",
+           (long long unsigned)bloom->block_count,
+           bloom->keys ? bloom->block_count * 512.0 / bloom->keys : 0.0 );
+  fprintf( stdout, "  false positives  : %.4f%% expected, %.4f%% asked for\n",
+           tchbf_expected_fpr( bloom ) * 100, fpr * 100 );
+
+  tchbf_destroy( bloom );
+  tchscan_close( scan );
+  return 0;
+}
+
+static void bloom_answer( const tchbf_t* bloom, char** keys, uint32_t* sizes, bool* maybe, uint64_t count,
+                          uint64_t* absent )
+{
+  tchbf_query( bloom, (const char* const*)keys, sizes, count, maybe );
+  for ( uint64_t i = 0 ; i < count ; i++ ) {
+    fprintf( stdout, "%s\t%s\n", maybe[i] ? "maybe" : "no", keys[i] );
+    *absent += !maybe[i];
+  }
+}
+
+int bloom_query( const char* path, const char* bf_path, char** keys, int nkeys )
+{
+  tchbf_t        *bloom;
+  tchidx_stamp_t  stamp;
+  const char     *why;
+  char            default_path[PATH_MAX+1];
+  char           *batch[TCHBF_BATCH];
+  uint32_t        sizes[TCHBF_BATCH];
+  bool            maybe[TCHBF_BATCH];
+  uint64_t        asked  = 0;
+  uint64_t        absent = 0;
+
+  if ( NULL == bf_path ) {
+    if ( !tchbf_path( path, default_path, sizeof( default_path ) ) ) {
+      return 1;
+    }
+    bf_path = default_path;
+  }
+  if ( !tchidx_stamp_path( path, &stamp ) ) {
+    return 1;
+  }
+  if ( NULL == ( bloom = tchbf_open( bf_path, &stamp, &why ) ) ) {
+    fprintf( stderr, "Can not use %s, %s, tchbloom build %s first\n", bf_path, why, path );
+    return 1;
+  }
+
+  if ( nkeys > 0 ) {
+    for ( int i = 0 ; i < nkeys ; i += TCHBF_BATCH ) {
+      int n = ( nkeys - i < TCHBF_BATCH ) ? nkeys - i : TCHBF_BATCH;
+      for ( int j = 0 ; j < n ; j++ ) {
+        sizes[j] = strlen( keys[i + j] );
+      }
+      bloom_answer( bloom, keys + i, sizes, maybe, n, &absent );
+    }
+    asked = nkeys;
+  } else {
+    // getline so a key is never cut, each of the batch keeps its own buffer
+    size_t  capacity[TCHBF_BATCH];
+    ssize_t len;
+    int     n = 0;
+
+    memset( batch, 0, sizeof( batch ) );
+    memset( capacity, 0, sizeof( capacity ) );
+    for ( ;; ) {
+      bool done = ( -1 == ( len = getline( &(batch[n]), &(capacity[n]), stdin ) ) );
+      if ( !done ) {
+        while ( len > 0 && ( '\n' == batch[n][len - 1] || '\r' == batch[n][len - 1] ) ) {
+          batch[n][--len] = '\0';
+        }
+        sizes[n] = len;
+        n++;
+      }
+      if ( n == TCHBF_BATCH || ( done && n > 0 ) ) {
+        bloom_answer( bloom, batch, sizes, maybe, n, &absent );
+        asked += n;
+        n      = 0;
+      }
+      if ( done ) {
+        break;
+      }
+    }
+    for ( int i = 0 ; i < TCHBF_BATCH ; i++ ) {
+      free( batch[i] );
+    }
+  }
+
+  fprintf( stderr, "%llu of %llu keys are not in %s\n", (long long unsigned)absent, (long long unsigned)asked, path );
+  tchbf_destroy( bloom );
+  return 0;
+}
+
+void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options] build db.tch\n", name );
+  fprintf( stderr, "       %s [options] query db.tch [ key ... ]\n", name );
+  fprintf( stderr, "  -o, --filter FILE   the filter ( default the database's path with %s )\n", TCHBF_SUFFIX );
+  fprintf( stderr, "  -p, --fpr RATE      false positive rate to build for ( default %g )\n", TCHBF_FPR );
+  fprintf( stderr, "  -t, --threads N     threads scanning without an index ( default %d )\n", BLOOM_THREADS );
+  fprintf( stderr, "  -f, --force         build for a database that is marked open\n" );
+  fprintf( stderr, "  -q, --quiet         no progress on stderr\n" );
+  fprintf( stderr, "\n" );
+  fprintf( stderr, "  query prints no or maybe, a tab and the key, for each key.\n" );
+}
+
+int main( int argc, char** argv )
+{
+  const char *bf_path = NULL;
+  double      fpr     = TCHBF_FPR;
+  int         threads = BLOOM_THREADS;
+  bool        force   = false;
+  bool        quiet   = false;
+  const char *command;
+  int         opt;
+
+  struct option long_options[] = {
+    { "filter",  required_argument, NULL, 'o' },
+    { "fpr",     required_argument, NULL, 'p' },
+    { "threads", required_argument, NULL, 't' },
+    { "force",   no_argument,       NULL, 'f' },
+    { "quiet",   no_argument,       NULL, 'q' },
+    { NULL,      0,                 NULL,  0  }
+  };
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "o:p:t:fq", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'o': bf_path = optarg; break;
+      case 'p': fpr     = atof( optarg ); break;
+      case 't': threads = atoi( optarg ); break;
+      case 'f': force   = true; break;
+      case 'q': quiet   = true; break;
+      default :
+        usage( argv[0] );
+        exit(1);
+    }
+  }
+
+  if ( optind + 2 > argc || threads < 1 || fpr < 1e-6 || fpr >= 1 ) {
+    usage( argv[0] );
+    exit(1);
+  }
+  command = argv[optind];
+
+  if ( 0 == strcmp( command, "build" ) && optind + 2 == argc ) {
+    exit( bloom_build( argv[optind + 1], bf_path, fpr, threads, force, quiet ) );
+  } else if ( 0 == strcmp( command, "query" ) ) {
+    exit( bloom_query( argv[optind + 1], bf_path, argv + optind + 2, argc - optind - 2 ) );
+  }
+  usage( argv[0] );
+  exit(1);
+}
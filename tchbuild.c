@@ -0,0 +1,733 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tchbuild.h"
+#include "tchpar.h"
+#include "tchtune.h"
+
+#define TCHBUILD_PROGRESS  65536                /* records between progress lines */
+
+/*
+ * TCSETVNUMBUF from tcutil.h
+ */
+static int write_vary_int( uint8_t* p, uint32_t num )
+{
+  int len = 0;
+
+  if ( 0 == num ) {
+    p[0] = 0;
+    return 1;
+  }
+  while ( num > 0 ) {
+    int rem = num & 0x7f;
+    num >>= 7;
+    p[len++] = ( num > 0 ) ? (uint8_t)( -rem - 1 ) : (uint8_t)rem;
+  }
+  return len;
+}
+
+/*
+ * tcreckeycmp from tchdb.c, the shorter key is the smaller
+ */
+static int tchbuild_key_cmp( const char* abuf, uint32_t asiz, const char* bbuf, uint32_t bsiz )
+{
+  if ( asiz != bsiz ) {
+    return ( asiz > bsiz ) ? 1 : -1;
+  }
+  return memcmp( abuf, bbuf, asiz );
+}
+
+void tchbuild_options_init( tchbuild_options_t* o, int threads )
+{
+  memset( o, 0, sizeof( *o ) );
+  o->threads    = threads;
+  o->write_size = TCHBUILD_WRITE_SIZE;
+}
+
+bool tchbuild_option( tchbuild_options_t* o, int opt, const char* arg )
+{
+  switch ( opt ) {
+    case 't': o->threads        = atoi( arg ); break;
+    case 'd': o->io.direct      = true; break;
+    case 'P': o->io.drop_behind = true; break;
+    case 'w': o->write_size     = strtoull( arg, NULL, 0 ); break;
+    case 'f': o->force          = true; break;
+    case 'q': o->quiet          = true; break;
+    case 'j': o->json_path      = arg; break;
+    case 'J': o->prom_path      = arg; break;
+    default : return false;
+  }
+  return true;
+}
+
+bool tchbuild_options_valid( const tchbuild_options_t* o )
+{
+  return o->threads >= 1 && o->write_size >= TCHBUILD_ALIGN && 0 == o->write_size % TCHBUILD_ALIGN;
+}
+
+void tchbuild_usage( FILE* out, const tchbuild_options_t* defaults, const char* verb )
+{
+  fprintf( out, "  -t, --threads N     threads hashing the keys ( default %d )\n", defaults->threads );
+  fprintf( out, "  -d, --direct        read and write with O_DIRECT\n" );
+  fprintf( out, "  -P, --polite        keep both files out of the page cache\n" );
+  fprintf( out, "  -w, --write-size N  bytes per write ( default %llu )\n", (long long unsigned)defaults->write_size );
+  fprintf( out, "  -f, --force         %s a source that is marked open\n", verb );
+  fprintf( out, "  -q, --quiet         no progress on stderr\n" );
+  fprintf( out, "  -j, --metrics FILE  append the counters and write latencies to FILE as JSON lines every second\n" );
+  fprintf( out, "  -J, --prometheus FILE\n" );
+  fprintf( out, "                      keep FILE up to date in Prometheus text format\n" );
+}
+
+tchbuild_t* tchbuild_new( const char* path, const tchbuild_options_t* o )
+{
+  tchbuild_t *b = (tchbuild_t*)calloc( 1, sizeof( tchbuild_t ) );
+  int         fd;
+
+  b->io        = o->io;
+  b->engine    = o->io.direct ? TCHSCAN_BUFFERED : TCHSCAN_MMAP;
+  b->fd        = -1;
+  b->metrics   = metrics_new( "tchbuild", 1 );
+  b->m_hashed  = metrics_counter( b->metrics, "hashed" );
+  b->m_written = metrics_counter( b->metrics, "written" );
+  b->m_bytes   = metrics_counter( b->metrics, "bytes" );
+  b->h_write   = metrics_histogram( b->metrics, "write" );
+  b->counts    = metrics_slot( b->metrics );
+  if ( !metrics_output( b->metrics, o->json_path, o->prom_path ) ||
+       NULL == ( b->scan = tchscan_open_engine( path, b->engine, 0 ) ) || !tchscan_set_io( b->scan, &(o->io) ) ) {
+    tchbuild_destroy( b );
+    return NULL;
+  }
+  if ( ( b->scan->hdr.flags & TCH_FLAG_OPEN ) && !o->force ) {
+    fprintf( stderr, "%s is marked open, something may be writing it\n", b->scan->path );
+    tchbuild_destroy( b );
+    return NULL;
+  }
+
+  // the scanner's descriptor may be O_DIRECT, which a 256 byte read is not fit for
+  if ( -1 == ( fd = open( b->scan->path, O_RDONLY ) ) ||
+       sizeof( b->src_header ) != pread( fd, b->src_header, sizeof( b->src_header ), 0 ) ) {
+    fprintf( stderr, "read error on %s : %s\n", b->scan->path, strerror( errno ) );
+    if ( -1 != fd ) {
+      close( fd );
+    }
+    tchbuild_destroy( b );
+    return NULL;
+  }
+  close( fd );
+
+  tchbuild_layout( b, -1, -1, -1, -1 );
+  return b;
+}
+
+bool tchbuild_layout( tchbuild_t* b, int64_t bnum, int apow, int fpow, int large )
+{
+  tchhdr_t *hdr = &(b->hdr);
+
+  *hdr = b->scan->hdr;
+  if ( bnum > 0 ) {
+    hdr->bucket_number = bnum;
+  }
+  if ( apow >= 0 ) {
+    hdr->alignment_pow = apow;
+  }
+  if ( fpow >= 0 ) {
+    hdr->free_block_pow = fpow;
+  }
+  if ( large >= 0 ) {
+    hdr->options = large ? ( hdr->options | TCH_OPT_LARGE ) : ( hdr->options & ~TCH_OPT_LARGE );
+  }
+  if ( hdr->bucket_number > UINT32_MAX || hdr->alignment_pow > TCHTUNE_MAX_APOW ||
+       hdr->free_block_pow > TCHTUNE_MAX_FPOW ) {
+    fprintf( stderr, "bnum %llu, apow %d, fpow %d is not a layout tchbuild can make\n",
+             (long long unsigned)hdr->bucket_number, hdr->alignment_pow, hdr->free_block_pow );
+    return false;
+  }
+  hdr->bytes_per    = ( hdr->options & TCH_OPT_LARGE ) ? sizeof( uint64_t ) : sizeof( uint32_t );
+  hdr->first_record = tchtune_first_record( hdr->bucket_number, hdr->alignment_pow, hdr->free_block_pow,
+                                            hdr->options & TCH_OPT_LARGE );
+  b->align_mask     = ( 1ULL << hdr->alignment_pow ) - 1;
+  return true;
+}
+
+static bool tchbuild_part_grow( tchbuild_part_t* part )
+{
+  uint64_t capacity = part->capacity ? part->capacity * 2 : 64 * 1024;
+
+  part->src_offset = (uint64_t*)realloc( part->src_offset, capacity * sizeof( uint64_t ) );
+  part->bucket     = (uint32_t*)realloc( part->bucket,     capacity * sizeof( uint32_t ) );
+  part->size       = (uint32_t*)realloc( part->size,       capacity * sizeof( uint32_t ) );
+  part->hash       = (uint8_t*) realloc( part->hash,       capacity * sizeof( uint8_t ) );
+  part->capacity   = capacity;
+  return ( NULL != part->src_offset && NULL != part->bucket && NULL != part->size && NULL != part->hash );
+}
+
+static bool tchbuild_hash_record( const tchscan_rec_t* rec, int thread, void* ctx )
+{
+  tchbuild_t      *b    = (tchbuild_t*)ctx;
+  tchbuild_part_t *part = &(b->parts[thread]);
+  uint8_t          vnum[5];
+  uint8_t          hash;
+  uint64_t         key_hash;
+  uint64_t         n    = part->count;
+
+  if ( n == part->capacity && !tchbuild_part_grow( part ) ) {
+    fprintf( stderr, "\nOut of memory for %llu records in thread %d\n", (long long unsigned)n, thread );
+    return false;
+  }
+  key_hash = tchscan_key_hash( rec->key_buf, rec->key_size, &hash );
+  __atomic_fetch_add( &(b->src_chains[key_hash % b->scan->hdr.bucket_number]), 1, __ATOMIC_RELAXED );
+
+  part->src_offset[n] = rec->offset;
+  part->bucket[n]     = key_hash % b->hdr.bucket_number;
+  part->hash[n]       = hash;
+  part->size[n]       = 4 + 2 * b->hdr.bytes_per + write_vary_int( vnum, rec->key_size ) +
+                        write_vary_int( vnum, rec->val_size ) + rec->key_size + rec->val_size;
+  part->record_bytes += rec->length;
+  part->padding      += rec->pad_size;
+  part->count         = n + 1;
+  return true;
+}
+
+bool tchbuild_hash( tchbuild_t* b, int threads, bool quiet )
+{
+  tchpar_t *par;
+  int64_t   records;
+  uint64_t  n      = 0;
+  uint64_t  hashed = 0;
+
+  if ( NULL == ( par = tchpar_new( b->scan->path, threads, b->engine, 0 ) ) || !tchpar_set_io( par, &(b->io) ) ) {
+    return false;
+  }
+  if ( NULL == ( b->src_chains = (uint32_t*)calloc( b->scan->hdr.bucket_number, sizeof( uint32_t ) ) ) ||
+       0 != posix_memalign( (void**)&(b->parts), 64, par->nthreads * sizeof( tchbuild_part_t ) ) ) {
+    fprintf( stderr, "Out of memory for the buckets of %s\n", b->scan->path );
+    tchpar_destroy( par );
+    return false;
+  }
+  memset( b->parts, 0, par->nthreads * sizeof( tchbuild_part_t ) );
+
+  if ( !tchpar_start( par, 0, tchbuild_hash_record, b ) ) {
+    tchpar_destroy( par );
+    return false;
+  }
+  while ( !tchpar_wait( par, 1.0 ) ) {
+    uint64_t so_far = tchpar_records( par );
+    metrics_add( b->counts, b->m_hashed, so_far - hashed );
+    hashed = so_far;
+    metrics_tick( b->metrics, false );
+    if ( !quiet ) {
+      metrics_progress( b->metrics, stderr, b->m_hashed, b->scan->hdr.record_number, so_far );
+    }
+  }
+  if ( ( records = tchpar_finish( par ) ) < 0 || par->stop ) {
+    fprintf( stderr, "\nHashing the keys of %s failed\n", b->scan->path );
+    tchpar_destroy( par );
+    return false;
+  }
+  metrics_add( b->counts, b->m_hashed, records - hashed );
+  metrics_tick( b->metrics, true );
+  if ( (uint64_t)records > UINT32_MAX - 1 ) {
+    fprintf( stderr, "\n%lld records, the links only have 32 bits\n", (long long)records );
+    tchpar_destroy( par );
+    return false;
+  }
+
+  // the threads' records one after the other are the records in file order
+  b->count      = records;
+  b->src_offset = (uint64_t*)malloc( ( records + 1 ) * sizeof( uint64_t ) );
+  b->bucket     = (uint32_t*)malloc( ( records + 1 ) * sizeof( uint32_t ) );
+  b->size       = (uint32_t*)malloc( ( records + 1 ) * sizeof( uint32_t ) );
+  b->hash       = (uint8_t*) malloc( ( records + 1 ) * sizeof( uint8_t ) );
+  if ( NULL == b->src_offset || NULL == b->bucket || NULL == b->size || NULL == b->hash ) {
+    fprintf( stderr, "\nOut of memory for %lld records\n", (long long)records );
+    tchpar_destroy( par );
+    return false;
+  }
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    tchbuild_part_t *part = &(b->parts[i]);
+
+    memcpy( b->src_offset + n, part->src_offset, part->count * sizeof( uint64_t ) );
+    memcpy( b->bucket + n,     part->bucket,     part->count * sizeof( uint32_t ) );
+    memcpy( b->size + n,       part->size,       part->count * sizeof( uint32_t ) );
+    memcpy( b->hash + n,       part->hash,       part->count * sizeof( uint8_t ) );
+    n                   += part->count;
+    b->src_record_bytes += part->record_bytes;
+    b->src_padding      += part->padding;
+    b->free_blocks      += par->ranges[i].free_blocks;
+    b->skipped_bytes    += par->ranges[i].skipped_bytes;
+    free( part->src_offset );
+    free( part->bucket );
+    free( part->size );
+    free( part->hash );
+  }
+  free( b->parts );
+  b->parts = NULL;
+
+  tchpar_destroy( par );
+  return true;
+}
+
+/*
+ * the key of record n, copied so reading another does not move it
+ */
+static bool tchbuild_key( tchbuild_t* b, uint64_t n, char** buf, uint32_t* buf_size, uint32_t* key_size )
+{
+  tchscan_rec_t rec;
+
+  if ( !tchscan_read_at( b->scan, b->src_offset[n], &rec ) ) {
+    fprintf( stderr, "Can not read back the record at %llu\n", (long long unsigned)b->src_offset[n] );
+    return false;
+  }
+  if ( rec.key_size > *buf_size ) {
+    *buf_size = rec.key_size;
+    *buf      = realloc( *buf, *buf_size );
+  }
+  memcpy( *buf, rec.key_buf, rec.key_size );
+  *key_size = rec.key_size;
+  return true;
+}
+
+/*
+ * Walk the tree of record n's bucket the way tchdbput does and hang it where
+ * the walk falls off.  0 for a repeated key, -1 for a failure, else the
+ * depth it went in at.
+ */
+static int64_t tchbuild_place( tchbuild_t* b, uint64_t n )
+{
+  uint32_t *link     = &(b->heads[b->bucket[n]]);
+  bool      have_key = false;
+  uint32_t  key_size = 0;
+  int64_t   depth    = 1;
+
+  while ( 0 != *link ) {
+    uint32_t      node = *link - 1;
+    int           cmp;
+    tchscan_rec_t other;
+
+    if ( b->hash[n] != b->hash[node] ) {
+      cmp = ( b->hash[n] > b->hash[node] ) ? 1 : -1;
+    } else {
+      if ( !have_key ) {
+        if ( !tchbuild_key( b, n, &(b->key_copy), &(b->key_copy_size), &key_size ) ) {
+          return -1;
+        }
+        have_key = true;
+      }
+      if ( !tchscan_read_at( b->scan, b->src_offset[node], &other ) ) {
+        fprintf( stderr, "Can not read back the record at %llu\n", (long long unsigned)b->src_offset[node] );
+        return -1;
+      }
+      cmp = tchbuild_key_cmp( b->key_copy, key_size, other.key_buf, other.key_size );
+    }
+
+    if ( cmp > 0 ) {
+      link = &(b->left[node]);
+    } else if ( cmp < 0 ) {
+      link = &(b->right[node]);
+    } else {
+      return 0;
+    }
+    depth += 1;
+  }
+  *link = n + 1;
+  return depth;
+}
+
+bool tchbuild_plan( tchbuild_t* b )
+{
+  uint64_t cursor = b->hdr.first_record;
+
+  b->new_offset = (uint64_t*)malloc( ( b->count + 1 ) * sizeof( uint64_t ) );
+  b->left       = (uint32_t*)calloc( b->count + 1, sizeof( uint32_t ) );
+  b->right      = (uint32_t*)calloc( b->count + 1, sizeof( uint32_t ) );
+  b->heads      = (uint32_t*)calloc( b->hdr.bucket_number, sizeof( uint32_t ) );
+  if ( NULL == b->new_offset || NULL == b->left || NULL == b->right || NULL == b->heads ) {
+    fprintf( stderr, "Out of memory for the trees of %llu records\n", (long long unsigned)b->count );
+    return false;
+  }
+
+  for ( uint64_t n = 0 ; n < b->count ; n++ ) {
+    int64_t  depth = tchbuild_place( b, n );
+    uint64_t rsiz  = ( b->size[n] + b->align_mask ) & ~b->align_mask;
+
+    if ( depth < 0 ) {
+      return false;
+    }
+    if ( 0 == depth ) {
+      b->new_offset[n]  = 0;
+      b->duplicates    += 1;
+      continue;
+    }
+    b->new_offset[n]  = cursor;
+    b->new_padding   += rsiz - b->size[n];
+    b->depth_sum     += depth;
+    if ( (uint64_t)depth > b->depth_max ) {
+      b->depth_max = depth;
+    }
+    cursor += rsiz;
+  }
+  b->file_size = cursor;
+
+  if ( !( b->hdr.options & TCH_OPT_LARGE ) && ( b->file_size >> b->hdr.alignment_pow ) > UINT32_MAX ) {
+    fprintf( stderr, "The copy would be %llu bytes, more than 32 bit links reach at apow %d, "
+                     "it needs the large option or a bigger apow\n",
+             (long long unsigned)b->file_size, b->hdr.alignment_pow );
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Write out the whole buffer, or with final what is left of it, always from
+ * an offset and of a length that are multiples of TCHBUILD_ALIGN, which the
+ * final write is padded to and the file cut back from after.
+ */
+static bool tchbuild_flush( tchbuild_t* b, bool final )
+{
+  uint64_t size = b->buf_used;
+  uint64_t done = 0;
+
+  if ( final ) {
+    size = ( size + TCHBUILD_ALIGN - 1 ) & ~(uint64_t)( TCHBUILD_ALIGN - 1 );
+    memset( b->buf + b->buf_used, 0, size - b->buf_used );
+  }
+  while ( done < size ) {
+    uint64_t start = metrics_now();
+    ssize_t  w     = pwrite( b->fd, b->buf + done, size - done, b->written + done );
+    metrics_observe( b->counts, b->h_write, metrics_now() - start );
+    if ( w < 0 ) {
+      if ( EINTR == errno ) { continue; }
+      fprintf( stderr, "\nwrite error at %llu : %s\n", (long long unsigned)( b->written + done ), strerror( errno ) );
+      return false;
+    }
+    done += w;
+  }
+  metrics_add( b->counts, b->m_bytes, b->buf_used );
+
+  // start this write back and wait for the one before, then drop it from the cache
+  if ( b->io.drop_behind && !b->direct ) {
+    sync_file_range( b->fd, b->written, size, SYNC_FILE_RANGE_WRITE );
+    if ( b->last_flush_size > 0 ) {
+      sync_file_range( b->fd, b->last_flush, b->last_flush_size,
+                       SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+      posix_fadvise( b->fd, b->last_flush, b->last_flush_size, POSIX_FADV_DONTNEED );
+    }
+    b->last_flush      = b->written;
+    b->last_flush_size = size;
+  }
+
+  b->written  += b->buf_used;
+  b->buf_used  = 0;
+  return true;
+}
+
+/*
+ * len bytes of data, or of zeros for NULL
+ */
+static bool tchbuild_put( tchbuild_t* b, const void* data, uint64_t len )
+{
+  const uint8_t *p = (const uint8_t*)data;
+
+  while ( len > 0 ) {
+    uint64_t n = b->buf_size - b->buf_used;
+    if ( n > len ) {
+      n = len;
+    }
+    if ( NULL == p ) {
+      memset( b->buf + b->buf_used, 0, n );
+    } else {
+      memcpy( b->buf + b->buf_used, p, n );
+      p += n;
+    }
+    b->buf_used += n;
+    len         -= n;
+    if ( b->buf_used == b->buf_size && !tchbuild_flush( b, false ) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool tchbuild_write_all( tchbuild_t* b, bool quiet )
+{
+  int           bytes_per = b->hdr.bytes_per;
+  uint8_t       header[TCH_HEADER_SIZE];
+  uint8_t       entry[8];
+  uint8_t       rh[32];
+  tchscan_rec_t rec;
+  uint64_t      n         = 0;
+
+  // the source's header, magic, version and opaque region kept, with the new layout
+  memcpy( header, b->src_header, TCH_HEADER_SIZE );
+  header[33] = 0;
+  header[34] = b->hdr.alignment_pow;
+  header[35] = b->hdr.free_block_pow;
+  header[36] = b->hdr.options;
+  tchhdr_put_le( header + 40, b->hdr.bucket_number, 8 );
+  tchhdr_put_le( header + 48, b->count - b->duplicates, 8 );
+  tchhdr_put_le( header + 56, b->file_size, 8 );
+  tchhdr_put_le( header + 64, b->hdr.first_record, 8 );
+  if ( !tchbuild_put( b, header, TCH_HEADER_SIZE ) ) {
+    return false;
+  }
+
+  for ( uint64_t i = 0 ; i < b->hdr.bucket_number ; i++ ) {
+    uint64_t off = b->heads[i] ? b->new_offset[b->heads[i] - 1] : 0;
+    tchhdr_put_le( entry, off >> b->hdr.alignment_pow, bytes_per );
+    if ( !tchbuild_put( b, entry, bytes_per ) ) {
+      return false;
+    }
+  }
+  // the free block pool is empty, zeros up to the first record
+  if ( !tchbuild_put( b, NULL, b->hdr.first_record - b->written - b->buf_used ) ) {
+    return false;
+  }
+
+  tchscan_seek( b->scan, b->scan->hdr.first_record );
+  while ( tchscan_next( b->scan, &rec ) ) {
+    uint64_t left, right, pad;
+    int      hsiz;
+
+    if ( n >= b->count || rec.offset != b->src_offset[n] ) {
+      fprintf( stderr, "\nThe source changed after it was hashed, at %llu\n", (long long unsigned)rec.offset );
+      return false;
+    }
+    if ( 0 == b->new_offset[n] ) {
+      n += 1;
+      continue;
+    }
+
+    left  = b->left[n]  ? b->new_offset[b->left[n] - 1]  : 0;
+    right = b->right[n] ? b->new_offset[b->right[n] - 1] : 0;
+    pad   = ( ( b->size[n] + b->align_mask ) & ~b->align_mask ) - b->size[n];
+
+    rh[0] = TCH_MAGIC_DATA_BLOCK;
+    rh[1] = b->hash[n];
+    tchhdr_put_le( rh + 2, left >> b->hdr.alignment_pow, bytes_per );
+    tchhdr_put_le( rh + 2 + bytes_per, right >> b->hdr.alignment_pow, bytes_per );
+    tchhdr_put_le( rh + 2 + 2 * bytes_per, pad, 2 );
+    hsiz  = 4 + 2 * bytes_per;
+    hsiz += write_vary_int( rh + hsiz, rec.key_size );
+    hsiz += write_vary_int( rh + hsiz, rec.val_size );
+
+    if ( b->written + b->buf_used != b->new_offset[n] ||
+         !tchbuild_put( b, rh, hsiz ) ||
+         !tchbuild_put( b, rec.key_buf, rec.key_size ) ||
+         !tchbuild_put( b, rec.val_buf, rec.val_size ) ||
+         !tchbuild_put( b, NULL, pad ) ) {
+      return false;
+    }
+    n += 1;
+    metrics_add( b->counts, b->m_written, 1 );
+
+    if ( 0 == n % TCHBUILD_PROGRESS ) {
+      metrics_tick( b->metrics, false );
+      if ( !quiet ) {
+        metrics_progress( b->metrics, stderr, b->m_written, b->count, n );
+      }
+    }
+  }
+  if ( n != b->count ) {
+    fprintf( stderr, "\nThe source changed after it was hashed, %llu records then %llu\n",
+             (long long unsigned)b->count, (long long unsigned)n );
+    return false;
+  }
+
+  if ( !tchbuild_flush( b, true ) ) {
+    return false;
+  }
+  if ( 0 != ftruncate( b->fd, b->file_size ) || 0 != fsync( b->fd ) ) {
+    fprintf( stderr, "\nerror finishing the copy : %s\n", strerror( errno ) );
+    return false;
+  }
+  return true;
+}
+
+bool tchbuild_write( tchbuild_t* b, const char* path, uint64_t write_size, bool quiet )
+{
+  int         direct = b->io.direct ? O_DIRECT : 0;
+  struct stat src_st, dst_st;
+
+  // never over the source, so it is only truncated once it is known not to be
+  if ( -1 == ( b->fd = open( path, O_WRONLY | O_CREAT | direct, 0644 ) ) &&
+       !( direct && EINVAL == errno && -1 != ( b->fd = open( path, O_WRONLY | O_CREAT, 0644 ) ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", path, strerror( errno ) );
+    return false;
+  }
+  fstat( b->scan->fd, &src_st );
+  fstat( b->fd, &dst_st );
+  if ( src_st.st_dev == dst_st.st_dev && src_st.st_ino == dst_st.st_ino ) {
+    fprintf( stderr, "%s is the source\n", path );
+    close( b->fd );
+    b->fd = -1;
+    return false;
+  }
+  if ( 0 != ftruncate( b->fd, 0 ) ) {
+    fprintf( stderr, "truncate error on %s : %s\n", path, strerror( errno ) );
+    return false;
+  }
+
+  b->direct   = ( fcntl( b->fd, F_GETFL ) & O_DIRECT ) ? true : false;
+  b->buf_size = write_size;
+  if ( 0 != posix_memalign( (void**)&(b->buf), TCHBUILD_ALIGN, b->buf_size ) ) {
+    fprintf( stderr, "Out of memory for a %llu byte write buffer\n", (long long unsigned)b->buf_size );
+    return false;
+  }
+  posix_fadvise( b->fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+  if ( !tchbuild_write_all( b, quiet ) ) {
+    fprintf( stderr, "%s is incomplete and removed\n", path );
+    close( b->fd );
+    b->fd = -1;
+    unlink( path );
+    return false;
+  }
+  if ( 0 != close( b->fd ) ) {
+    b->fd = -1;
+    fprintf( stderr, "close error on %s : %s\n", path, strerror( errno ) );
+    return false;
+  }
+  b->fd = -1;
+  return true;
+}
+
+/*
+ * the longest chain and the mean chain a hit lands in, from records per bucket
+ */
+static void tchbuild_chains( const uint32_t* chains, uint64_t bnum, uint64_t records, uint64_t* max, double* mean )
+{
+  uint64_t squares = 0;
+
+  *max = 0;
+  for ( uint64_t i = 0 ; i < bnum ; i++ ) {
+    squares += (uint64_t)chains[i] * chains[i];
+    if ( chains[i] > *max ) {
+      *max = chains[i];
+    }
+  }
+  *mean = records ? squares / (double)records : 0;
+}
+
+static double tchbuild_seconds_since( const struct timespec* start )
+{
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return ( now.tv_sec - start->tv_sec ) + ( now.tv_nsec - start->tv_nsec ) / 1e9;
+}
+
+void tchbuild_report( tchbuild_t* b, double hash_seconds, double plan_seconds, double write_seconds, FILE* out )
+{
+  const tchhdr_t *src     = &(b->scan->hdr);
+  uint64_t        records = b->count - b->duplicates;
+  uint32_t       *chains  = (uint32_t*)calloc( b->hdr.bucket_number, sizeof( uint32_t ) );
+  uint64_t        src_max, new_max;
+  double          src_mean, new_mean;
+
+  for ( uint64_t n = 0 ; NULL != chains && n < b->count ; n++ ) {
+    if ( 0 != b->new_offset[n] ) {
+      chains[b->bucket[n]] += 1;
+    }
+  }
+  tchbuild_chains( b->src_chains, src->bucket_number, b->count, &src_max, &src_mean );
+  if ( NULL != chains ) {
+    tchbuild_chains( chains, b->hdr.bucket_number, records, &new_max, &new_mean );
+  } else {
+    new_max  = 0;
+    new_mean = 0;
+  }
+  free( chains );
+
+  fprintf( out, "  records          : %llu", (long long unsigned)records );
+  if ( b->duplicates > 0 ) {
+    fprintf( out, " ( %llu repeated keys left out )", (long long unsigned)b->duplicates );
+  }
+  fprintf( out, "\n" );
+  fprintf( out, "  layout           : bnum %llu -> %llu, apow %d -> %d, fpow %d -> %d%s\n",
+           (long long unsigned)src->bucket_number, (long long unsigned)b->hdr.bucket_number,
+           src->alignment_pow, b->hdr.alignment_pow, src->free_block_pow, b->hdr.free_block_pow,
+           ( ( src->options ^ b->hdr.options ) & TCH_OPT_LARGE ) ?
+             ( ( b->hdr.options & TCH_OPT_LARGE ) ? ", now large" : ", no longer large" ) : "" );
+  fprintf( out, "  load             : %.3f -> %.3f\n",
+           b->count / (double)src->bucket_number, records / (double)b->hdr.bucket_number );
+  fprintf( out, "  chains           : longest %llu -> %llu, a hit lands in %.2f -> %.2f\n",
+           (long long unsigned)src_max, (long long unsigned)new_max, src_mean, new_mean );
+  fprintf( out, "  trees            : deepest %llu, a hit %.2f deep\n",
+           (long long unsigned)b->depth_max, records ? b->depth_sum / (double)records : 0.0 );
+  fprintf( out, "  free blocks      : %llu left behind, %llu bytes not parsed\n",
+           (long long unsigned)b->free_blocks, (long long unsigned)b->skipped_bytes );
+  fprintf( out, "  bytes            : %llu -> %llu\n",
+           (long long unsigned)b->scan->file_size, (long long unsigned)b->file_size );
+  fprintf( out, "  reclaimed        : %lld bytes ( %.2f%% )\n",
+           (long long)( b->scan->file_size - b->file_size ),
+           b->scan->file_size ? ( (double)b->scan->file_size - b->file_size ) * 100 / b->scan->file_size : 0.0 );
+  fprintf( out, "    free space     : %llu\n",
+           (long long unsigned)( b->scan->end - src->first_record - b->src_record_bytes ) );
+  fprintf( out, "    padding        : %lld ( %llu -> %llu )\n", (long long)( b->src_padding - b->new_padding ),
+           (long long unsigned)b->src_padding, (long long unsigned)b->new_padding );
+  fprintf( out, "    bucket array   : %lld ( with the header and free pool, %llu -> %llu )\n",
+           (long long)( src->first_record - b->hdr.first_record ),
+           (long long unsigned)src->first_record, (long long unsigned)b->hdr.first_record );
+  fprintf( out, "  seconds          : %.2f hashing, %.2f planning, %.2f writing, %.1f MB/s written\n",
+           hash_seconds, plan_seconds, write_seconds, write_seconds > 0 ? b->file_size / write_seconds / 1e6 : 0.0 );
+}
+
+void tchbuild_destroy( tchbuild_t* b )
+{
+  if ( NULL == b ) {
+    return;
+  }
+  if ( -1 != b->fd ) {
+    close( b->fd );
+  }
+  if ( NULL != b->scan ) {
+    tchscan_close( b->scan );
+  }
+  free( b->parts );
+  free( b->src_chains );
+  free( b->src_offset );
+  free( b->bucket );
+  free( b->size );
+  free( b->hash );
+  free( b->new_offset );
+  free( b->left );
+  free( b->right );
+  free( b->heads );
+  free( b->key_copy );
+  free( b->buf );
+  metrics_destroy( b->metrics );
+  free( b );
+}
+
+bool tchbuild_run( tchbuild_t* b, const char* path, const tchbuild_options_t* o, const char* done )
+{
+  struct timespec start;
+  double          hash_seconds, plan_seconds, write_seconds;
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  if ( !tchbuild_hash( b, o->threads, o->quiet ) ) {
+    return false;
+  }
+  hash_seconds = tchbuild_seconds_since( &start );
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  if ( !tchbuild_plan( b ) ) {
+    return false;
+  }
+  plan_seconds = tchbuild_seconds_since( &start );
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  if ( !tchbuild_write( b, path, o->write_size, o->quiet ) ) {
+    return false;
+  }
+  write_seconds = tchbuild_seconds_since( &start );
+
+  fprintf( stdout, "%s%s %s into %s\n", o->quiet ? "" : "\n", done, b->scan->path, path );
+  tchbuild_report( b, hash_seconds, plan_seconds, write_seconds, stdout );
+  return true;
+}
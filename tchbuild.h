@@ -0,0 +1,190 @@
+#ifndef __TCHBUILD_H__
+#define __TCHBUILD_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "tchhdr.h"
+#include "tchscan.h"
+#include "metrics.h"
+
+/*
+ * Build a hash database file from the live records of another, with a
+ * layout of its own, without tchdbput.  tchcompact and tchrehash are this
+ * with different defaults, they only parse the layout and hand the rest to
+ * tchbuild_run.
+ *
+ *   tchbuild_hash   tchpar threads hash every key for the new bucket array
+ *                   and work out each record's size in the copy, reading the
+ *                   source once
+ *   tchbuild_plan   in memory, in file order, each record is given its offset
+ *                   in the copy and put in the tree of its bucket, the tree
+ *                   tchdbput would build putting the records in that order:
+ *                   a greater hash byte goes left, then a greater key by
+ *                   tcreckeycmp.  Keys are only read back from the source to
+ *                   break a tie on the hash byte.
+ *   tchbuild_write  reading the source again, the header, the bucket array,
+ *                   an empty free block pool and the records with their new
+ *                   links go out through one buffer in large aligned writes.
+ *                   Values are copied as they are stored, deflated or not.
+ *
+ * Between them about 33 bytes a record are kept in memory.  Nothing may
+ * write to the source while it is being read, the second read has to find
+ * the same records as the first.
+ */
+
+#define TCHBUILD_WRITE_SIZE  ( 8 * 1024 * 1024 )
+#define TCHBUILD_ALIGN       4096               /* of the writes, for O_DIRECT */
+
+/*
+ * The options tchcompact and tchrehash both take, TCHBUILD_GETOPT and
+ * TCHBUILD_LONG_OPTIONS go into their own getopt_long arguments and
+ * tchbuild_option takes whatever their switch does not.
+ */
+typedef struct tchbuild_options {
+  int           threads;                        /* hashing the keys         */
+  bool          force;                          /* a source marked open     */
+  bool          quiet;                          /* no progress on stderr    */
+  uint64_t      write_size;
+  tchscan_io_t  io;
+  const char   *json_path;                      /* --metrics                */
+  const char   *prom_path;                      /* --prometheus             */
+} tchbuild_options_t;
+
+#define TCHBUILD_GETOPT  "t:dPw:fqj:J:"
+
+#define TCHBUILD_LONG_OPTIONS                              \
+    { "threads",    required_argument, NULL, 't' },      \
+    { "direct",     no_argument,       NULL, 'd' },      \
+    { "polite",     no_argument,       NULL, 'P' },      \
+    { "write-size", required_argument, NULL, 'w' },      \
+    { "force",      no_argument,       NULL, 'f' },      \
+    { "quiet",      no_argument,       NULL, 'q' },      \
+    { "metrics",    required_argument, NULL, 'j' },      \
+    { "prometheus", required_argument, NULL, 'J' }
+
+typedef struct tchbuild_part {                  /* one hashing thread's records, in file order */
+  uint64_t  count;
+  uint64_t  capacity;
+  uint64_t *src_offset;
+  uint32_t *bucket;
+  uint32_t *size;                               /* in the copy, before padding */
+  uint8_t  *hash;
+  uint64_t  record_bytes;                       /* in the source, padding included */
+  uint64_t  padding;
+} __attribute__(( aligned( 64 ) )) tchbuild_part_t;
+
+typedef struct tchbuild {
+  tchscan_t       *scan;                        /* the source, for the write and read backs */
+  tchhdr_t         hdr;                         /* of the copy                              */
+  uint8_t          src_header[TCH_HEADER_SIZE]; /* as it is on disk                         */
+  uint64_t         align_mask;
+  int              engine;
+  tchscan_io_t     io;
+
+  /* records hashed and written, bytes written and how long each write took,
+     for the progress lines, and --metrics and --prometheus through
+     metrics_output.  The hashing threads are counted by tchpar, the thread
+     waiting on them adds what they did to counts.                          */
+  metrics_t       *metrics;
+  metrics_slot_t  *counts;
+  int              m_hashed;
+  int              m_written;
+  int              m_bytes;
+  int              h_write;
+
+  /* tchbuild_hash, records by their order in the source, links are order + 1 */
+  tchbuild_part_t *parts;
+  uint32_t        *src_chains;                  /* records per bucket of the source         */
+  uint64_t         count;
+  uint64_t        *src_offset;
+  uint32_t        *bucket;
+  uint32_t        *size;
+  uint8_t         *hash;
+  uint64_t         src_record_bytes;
+  uint64_t         src_padding;
+  uint64_t         free_blocks;
+  uint64_t         skipped_bytes;
+
+  /* tchbuild_plan */
+  uint64_t        *new_offset;                  /* 0 for a repeated key that is left out    */
+  uint32_t        *left;
+  uint32_t        *right;
+  uint32_t        *heads;                       /* root of each bucket's tree               */
+  uint64_t         duplicates;
+  uint64_t         new_padding;
+  uint64_t         file_size;
+  uint64_t         depth_max;                   /* of the new trees                         */
+  uint64_t         depth_sum;
+  char            *key_copy;
+  uint32_t         key_copy_size;
+
+  /* tchbuild_write */
+  int              fd;
+  bool             direct;
+  uint8_t         *buf;
+  uint64_t         buf_size;
+  uint64_t         buf_used;
+  uint64_t         written;                     /* file offset of buf[0]                    */
+  uint64_t         last_flush;                  /* and of the flush before, for drop_behind */
+  uint64_t         last_flush_size;
+} tchbuild_t;
+
+extern void tchbuild_options_init( tchbuild_options_t* o, int threads );
+
+/*
+ * Take opt from TCHBUILD_GETOPT, false for any other
+ */
+extern bool tchbuild_option( tchbuild_options_t* o, int opt, const char* arg );
+
+/*
+ * Whether the options go together, after getopt_long is done
+ */
+extern bool tchbuild_options_valid( const tchbuild_options_t* o );
+
+/*
+ * The usage lines of the options, verb is what the tool does to a source
+ */
+extern void tchbuild_usage( FILE* out, const tchbuild_options_t* defaults, const char* verb );
+
+/*
+ * Open the source with the mmap engine, or the buffered one for --direct,
+ * and set up a copy laid out just like it.  A source marked open is refused
+ * unless --force.  Prints the reason and returns NULL on failure.
+ */
+extern tchbuild_t* tchbuild_new( const char* path, const tchbuild_options_t* o );
+
+/*
+ * The layout of the copy, -1 for any of them keeps the source's
+ */
+extern bool tchbuild_layout( tchbuild_t* b, int64_t bnum, int apow, int fpow, int large );
+
+extern bool tchbuild_hash( tchbuild_t* b, int threads, bool quiet );
+extern bool tchbuild_plan( tchbuild_t* b );
+
+/*
+ * Write the copy to path, which must not be the source, and fsync it.  A
+ * copy that could not be finished is removed.
+ */
+extern bool tchbuild_write( tchbuild_t* b, const char* path, uint64_t write_size, bool quiet );
+
+/*
+ * What the copy is against the source: layout, chains and bytes, a line
+ * each under the tool's own first line.
+ */
+extern void tchbuild_report( tchbuild_t* b, double hash_seconds, double plan_seconds, double write_seconds,
+                             FILE* out );
+
+/*
+ * Hash, plan and write the copy to path, then print done, what was done
+ * ( "Compacted" ), and the report.  Prints the reason and returns false on
+ * failure.
+ */
+extern bool tchbuild_run( tchbuild_t* b, const char* path, const tchbuild_options_t* o, const char* done );
+
+extern void tchbuild_destroy( tchbuild_t* b );
+
+#endif
@@ -1,8 +1,6 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <tcutil.h>
-#include <tchdb.h>
 #include <stdbool.h>
 #include <string.h>
 #include <time.h>
@@ -12,8 +10,15 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
+#include <getopt.h>
 
 #include "sglib.h"
+#include "tchhdr.h"
+#include "tchscan.h"
+#include "tchpar.h"
+#include "tchidx.h"
+#include "profile.h"
+#include "metrics.h"
 
 /*
  * node for holding offset information and for correlating data
@@ -82,74 +87,53 @@ typedef struct db_meta {
   rbtree*  offset_tree;
   rbtree*  record_tree;
 
-} db_meta_t;
-
-void print_progress( FILE* file, time_t start_time, long long unsigned final, long long unsigned so_far )
-{
-  time_t now  = time(NULL);
-  if ( now > start_time ) {
-    long long unsigned left = final - so_far;
-    double         rate = ( so_far / (double)difftime(now, start_time));
-    time_t      done_at = (time_t)(now + ( left / rate ));
-    double percent_done = ( so_far / (double) final ) * 100;
-    struct tm *the_time = localtime( &done_at);
-
-    char time_buf[32];
-    char format_buf[128] = " [%10llu / %10llu] %10.2lf per second, %6.2lf%% done, finishing at %s";  
-    int eol_char_idx = strlen( format_buf );
-
-    if ( so_far >= final ) {
-      format_buf[eol_char_idx] = '\n';
-    } else {
-      format_buf[eol_char_idx] = '\r';
-    }
-    format_buf[ eol_char_idx + 1 ] = '\0';
+  profile_thread_t *profile;     /* NULL unless --profile */
+  int      phase_bucket_read;
+  int      phase_record_read;
+  int      phase_tree;
+
+  metrics_t      *metrics;       /* for the progress lines and --metrics */
+  metrics_slot_t *counts;
+  int      m_buckets;
+  int      m_bytes;              /* of the record region walked          */
+  int      h_bucket_read;
+  int      h_record_read;
+  int      m_values;             /* --deep, inflated by the workers      */
+  int      h_inflate;
+  int      m_keys;               /* --index, looked up                   */
+  int      h_index_read;
 
-    strftime( time_buf, 256, "%Y-%m-%d %H:%M:%S", the_time );
-
-    fprintf(file , format_buf, so_far, final, rate, percent_done, time_buf );
-
-    fflush(file);
-  }
-}
+} db_meta_t;
 
 db_meta_t* dbmeta_new( const char* dbfilename )
 {
-  TCHDB     *hdb;
   db_meta_t *dbmeta;
-  int       errnum;
+  tchhdr_t   hdr;
 
   dbmeta = (db_meta_t*)calloc( 1, sizeof( db_meta_t ));
 
   realpath( dbfilename, dbmeta->dbpath );
 
-  hdb = tchdbnew();
+  if ( -1 == ( dbmeta->fd = open( dbmeta->dbpath, O_RDONLY) ) ) {
+    fprintf(stderr, "Failure opening file [%s] : %s\n", dbmeta->dbpath, strerror( errno ));
+    exit(1);
+  }
 
-  if ( !tchdbopen( hdb, dbmeta->dbpath , HDBOREADER )) {
-    errnum = tchdbecode( hdb );
-    fprintf( stderr, "Failure opening database [%s] : %s\n", dbmeta->dbpath, tchdberrmsg( errnum ));
-    tchdbdel( hdb );
+  if ( !tchhdr_read( dbmeta->fd, &hdr ) ) {
+    fprintf( stderr, "Failure opening database [%s] : %s\n", dbmeta->dbpath, tchhdr_error( errno ));
     exit( 1 );
   }
 
-  dbmeta->bucket_count  = hdb->bnum;
-  dbmeta->bucket_offset = 256; /* HDBHEADSIZ from tchdb.c */
-  dbmeta->bytes_per     = (hdb->opts & HDBTLARGE) ? sizeof(uint64_t) : sizeof(uint32_t);
+  dbmeta->bucket_count  = hdr.bucket_number;
+  dbmeta->bucket_offset = TCH_HEADER_SIZE;
+  dbmeta->bytes_per     = hdr.bytes_per;
 
-  dbmeta->record_count  = tchdbrnum( hdb );
-  dbmeta->record_offset = hdb->frec;
-  dbmeta->alignment_pow = hdb->apow;
+  dbmeta->record_count  = hdr.record_number;
+  dbmeta->record_offset = hdr.first_record;
+  dbmeta->alignment_pow = hdr.alignment_pow;
   dbmeta->offset_tree   = NULL;
   dbmeta->record_tree   = NULL;
 
-  tchdbclose( hdb );
-  tchdbdel( hdb );
-
-  if ( -1 == ( dbmeta->fd = open( dbmeta->dbpath, O_RDONLY) ) ) {
-    fprintf(stderr, "Failure opening file [%s] : %s\n", dbmeta->dbpath, strerror( errno ));
-    exit(1);
-  }
-
   return dbmeta;
 }
 
@@ -198,14 +182,18 @@ void add_offset_to_tree_unless_exists( rbtree** tree, uint64_t offset, int64_t b
 void dbmeta_populate_offset_tree( db_meta_t* dbmeta )
 {
   uint64_t i;
-  time_t   start = time(NULL);
 
   lseek64( dbmeta->fd, dbmeta->bucket_offset, SEEK_SET ); 
   fprintf( stderr, "Traversing bucket section to find record offsets : \n" );
 
   for( i = 0 ; i < dbmeta->bucket_count ; i++ ) {
     uint64_t offset = 0LL;
+    uint64_t  begin = profile_begin( dbmeta->profile, dbmeta->phase_bucket_read );
+    uint64_t  start = metrics_now();
     int           b = read( dbmeta->fd, &offset, dbmeta->bytes_per);
+    metrics_observe( dbmeta->counts, dbmeta->h_bucket_read, metrics_now() - start );
+    profile_end( dbmeta->profile, dbmeta->phase_bucket_read, begin );
+    metrics_add( dbmeta->counts, dbmeta->m_buckets, 1 );
 
     if ( b != dbmeta->bytes_per ) {
       fprintf(stderr, "read the wrong number of bytes (%d)\n", b );
@@ -214,14 +202,20 @@ void dbmeta_populate_offset_tree( db_meta_t* dbmeta )
     /* if the value is > 0 then we have a number so do something with it */
     if ( offset > 0 ) {
       offset = offset << dbmeta->alignment_pow;
+      begin  = profile_begin( dbmeta->profile, dbmeta->phase_tree );
       add_offset_to_tree_unless_exists( &(dbmeta->offset_tree), offset, i );
+      profile_end( dbmeta->profile, dbmeta->phase_tree, begin );
     }
 
-    if ( i % 1000000 == 0 ) { print_progress( stderr, start, dbmeta->bucket_count, i ); }
+    if ( i % 1000000 == 0 ) {
+      metrics_tick( dbmeta->metrics, false );
+      metrics_progress( dbmeta->metrics, stderr, dbmeta->m_buckets, dbmeta->bucket_count, i );
+    }
 
  }
 
- print_progress( stderr, start, dbmeta->bucket_count, i );
+ metrics_tick( dbmeta->metrics, true );
+ metrics_progress( dbmeta->metrics, stderr, dbmeta->m_buckets, dbmeta->bucket_count, i );
  fprintf( stderr, "Found %llu buckets with offsets\n", (long long unsigned)sglib_rbtree_len( dbmeta->offset_tree ));
  return;
 }
@@ -317,7 +311,6 @@ bool dbmeta_read_one_rec( db_meta_t *dbmeta, tcrec* rec )
 
 bool dbmeta_populate_record_tree( db_meta_t* dbmeta )
 {
-  time_t   start = time(NULL);
   off_t   offset;
   uint64_t data_blocks = 0;
   uint64_t free_blocks = 0;
@@ -328,14 +321,21 @@ bool dbmeta_populate_record_tree( db_meta_t* dbmeta )
 
   while( offset < st.st_size ) {
 
-    tcrec new_rec;
+    tcrec    new_rec;
+    uint64_t begin = profile_begin( dbmeta->profile, dbmeta->phase_record_read );
+    uint64_t start = metrics_now();
+    bool     found_rec;
     new_rec.offset = offset;
 
     // read a record
-    if( !dbmeta_read_one_rec( dbmeta, &new_rec )) { 
+    found_rec = dbmeta_read_one_rec( dbmeta, &new_rec );
+    metrics_observe( dbmeta->counts, dbmeta->h_record_read, metrics_now() - start );
+    profile_end( dbmeta->profile, dbmeta->phase_record_read, begin );
+    if( !found_rec ) { 
       fprintf( stderr, "Unable to find a record at the file is finished\n");
       return false;
     } else {
+      metrics_add( dbmeta->counts, dbmeta->m_bytes, new_rec.offset + new_rec.length - offset );
       offset = new_rec.offset + new_rec.length;
     }
 
@@ -347,6 +347,7 @@ bool dbmeta_populate_record_tree( db_meta_t* dbmeta )
  
     if ( MAGIC_DATA_BLOCK == new_rec.magic ) {
 
+      begin = profile_begin( dbmeta->profile, dbmeta->phase_tree );
       if ( new_rec.offset > 0 ) {
 
         rbtree  find_me;
@@ -371,6 +372,7 @@ bool dbmeta_populate_record_tree( db_meta_t* dbmeta )
       if ( new_rec.right > 0 ) {
         add_offset_to_tree_unless_exists( &(dbmeta->offset_tree), new_rec.right, -1 );
       }
+      profile_end( dbmeta->profile, dbmeta->phase_tree, begin );
 
       data_blocks++;
     } else if ( MAGIC_FREE_BLOCK == new_rec.magic ) {
@@ -379,10 +381,14 @@ bool dbmeta_populate_record_tree( db_meta_t* dbmeta )
     } else {
       fprintf( stderr, "NO record found at offset %llu\n", (long long unsigned)new_rec.offset );
     }
-    if ( (data_blocks + free_blocks) % 10000 == 0 ) { print_progress( stderr, start, st.st_size, offset ); }
+    if ( (data_blocks + free_blocks) % 10000 == 0 ) {
+      metrics_tick( dbmeta->metrics, false );
+      metrics_progress( dbmeta->metrics, stderr, dbmeta->m_bytes, st.st_size, offset );
+    }
   }
 
-  print_progress( stderr, start, st.st_size, offset);
+  metrics_tick( dbmeta->metrics, true );
+  metrics_progress( dbmeta->metrics, stderr, dbmeta->m_bytes, st.st_size, offset );
 
   // if we are not at the end of the file, output the current file offset
   // with an appropriate message and return
@@ -425,17 +431,496 @@ void dbmeta_print_results( db_meta_t *dbmeta,  FILE* output )
   }
 }
 
+/*
+ * --deep : every value of a deflate database is inflated, by a pool of
+ * tchpar threads each reading a range of the file, so a flipped bit inside
+ * a compressed value is found here and not by a client.  The inflated bytes
+ * are thrown away as they come, a worker only ever has its budget of memory,
+ * zlib's state and window included, however big a value inflates to.
+ */
+#define DEEP_THREADS       4
+#define DEEP_BUDGET        ( 1024 * 1024 )     /* bytes per worker            */
+#define DEEP_MIN_OUT       4096                /* least left for the output   */
+#define DEEP_WINDOW        ( 1 << 15 )         /* inflate's window, raw -15   */
+#define DEEP_MAX_FAILURES  100                 /* kept per worker, the rest counted */
+#define DEEP_KEY_SHOWN     64                  /* bytes of a failed key kept  */
+
+typedef struct deep_failure {
+  uint64_t    offset;
+  uint32_t    key_size;
+  char        key[DEEP_KEY_SHOWN];
+  const char *reason;
+} deep_failure_t;
+
+typedef struct deep_worker {
+  z_stream        zs;
+  uint8_t        *arena;                      /* the budget, zlib is given its memory from it */
+  uint64_t        arena_used;
+  uint64_t        arena_limit;                /* where the output starts     */
+  uint8_t        *out;
+  uint64_t        out_size;
+
+  uint64_t        values;
+  uint64_t        stored_bytes;
+  uint64_t        inflated_bytes;
+  uint64_t        largest;                    /* inflated                    */
+  uint64_t        failed;
+  metrics_slot_t *counts;
+  int             m_values;
+  int             h_inflate;
+  int             kept;
+  deep_failure_t  failures[DEEP_MAX_FAILURES];
+} __attribute__(( aligned( 64 ) )) deep_worker_t;
+
+typedef struct deep_check {
+  int             nthreads;
+  uint64_t        budget;
+  deep_worker_t  *workers;
+} deep_check_t;
+
+static voidpf deep_zalloc( voidpf opaque, uInt items, uInt size )
+{
+  deep_worker_t *w   = (deep_worker_t*)opaque;
+  uint64_t       len = ( (uint64_t)items * size + 15 ) & ~15ULL;
+
+  if ( w->arena_used + len > w->arena_limit ) {
+    return Z_NULL;
+  }
+  w->arena_used += len;
+  return w->arena + w->arena_used - len;
+}
+
+static void deep_zfree( voidpf opaque, voidpf address )
+{
+  // the arena goes as a whole at the end
+  (void)opaque;
+  (void)address;
+}
+
+/*
+ * NULL if the value inflates, else why not
+ */
+static const char* deep_inflate( deep_worker_t* w, const char* vbuf, uint32_t vsiz, uint64_t* inflated )
+{
+  int rv;
+
+  inflateReset( &(w->zs) );
+  w->zs.next_in  = (Bytef*)vbuf;
+  w->zs.avail_in = vsiz;
+  *inflated      = 0;
+
+  do {
+    w->zs.next_out  = w->out;
+    w->zs.avail_out = w->out_size;
+    rv              = inflate( &(w->zs), Z_NO_FLUSH );
+    *inflated      += w->out_size - w->zs.avail_out;
+    if ( Z_BUF_ERROR == rv && 0 == w->zs.avail_in ) {
+      return "truncated";
+    }
+    if ( Z_OK != rv && Z_STREAM_END != rv ) {
+      return ( NULL != w->zs.msg ) ? w->zs.msg : "inflate error";
+    }
+  } while ( Z_STREAM_END != rv );
+
+  if ( 0 != w->zs.avail_in ) {
+    return "bytes after the end of the stream";
+  }
+  return NULL;
+}
+
+static bool deep_check_record( const tchscan_rec_t* rec, int thread, void* ctx )
+{
+  deep_check_t  *dc = (deep_check_t*)ctx;
+  deep_worker_t *w  = &(dc->workers[thread]);
+  const char    *reason;
+  uint64_t       inflated;
+  uint64_t       start = metrics_now();
+
+  reason             = deep_inflate( w, rec->val_buf, rec->val_size, &inflated );
+  metrics_observe( w->counts, w->h_inflate, metrics_now() - start );
+  metrics_add( w->counts, w->m_values, 1 );
+  w->values         += 1;
+  w->stored_bytes   += rec->val_size;
+  w->inflated_bytes += inflated;
+  if ( inflated > w->largest ) {
+    w->largest = inflated;
+  }
+
+  if ( NULL != reason ) {
+    w->failed += 1;
+    if ( w->kept < DEEP_MAX_FAILURES ) {
+      deep_failure_t *f = &(w->failures[w->kept++]);
+      f->offset   = rec->offset;
+      f->key_size = rec->key_size;
+      f->reason   = reason;
+      memcpy( f->key, rec->key_buf, rec->key_size < DEEP_KEY_SHOWN ? rec->key_size : DEEP_KEY_SHOWN );
+    }
+  }
+  return true;
+}
+
+/*
+ * prints why and returns false if the worker can not inflate in budget bytes,
+ * with nothing left to free
+ */
+static bool deep_worker_init( deep_worker_t* w, uint64_t budget )
+{
+  memset( w, 0, sizeof( deep_worker_t ) );
+  if ( NULL == ( w->arena = (uint8_t*)malloc( budget ) ) ) {
+    fprintf( stderr, "Out of memory for a budget of %llu bytes\n", (long long unsigned)budget );
+    return false;
+  }
+  // zlib may have all of the budget while it sets up, the window comes later
+  w->arena_limit = budget;
+  w->zs.zalloc   = deep_zalloc;
+  w->zs.zfree    = deep_zfree;
+  w->zs.opaque   = w;
+  if ( Z_OK != inflateInit2( &(w->zs), -15 ) ) {
+    fprintf( stderr, "A budget of %llu bytes is too small to inflate in\n", (long long unsigned)budget );
+    free( w->arena );
+    return false;
+  }
+  if ( w->arena_used + DEEP_WINDOW + DEEP_MIN_OUT > budget ) {
+    fprintf( stderr, "A budget of %llu bytes is too small to inflate in\n", (long long unsigned)budget );
+    inflateEnd( &(w->zs) );
+    free( w->arena );
+    return false;
+  }
+  // and the output gets what is left after the window
+  w->out_size    = ( budget - w->arena_used - DEEP_WINDOW ) & ~15ULL;
+  w->arena_limit = budget - w->out_size;
+  w->out         = w->arena + w->arena_limit;
+  return true;
+}
+
+/*
+ * the first count workers of dc were set up, and the worker array
+ */
+static void deep_workers_free( deep_check_t* dc, int count )
+{
+  for ( int i = 0 ; i < count ; i++ ) {
+    inflateEnd( &(dc->workers[i].zs) );
+    free( dc->workers[i].arena );
+  }
+  free( dc->workers );
+}
+
+/*
+ * the first bytes of a key of key_size bytes, any that are not printable as
+ * \xNN
+ */
+static void check_print_key( FILE* out, const char* key, uint32_t key_size )
+{
+  uint32_t shown = key_size < DEEP_KEY_SHOWN ? key_size : DEEP_KEY_SHOWN;
+
+  fputc( '"', out );
+  for ( uint32_t i = 0 ; i < shown ; i++ ) {
+    unsigned char c = key[i];
+    if ( c < 0x20 || c > 0x7e || '"' == c || '\\' == c ) {
+      fprintf( out, "\\x%02x", c );
+    } else {
+      fputc( c, out );
+    }
+  }
+  fputc( '"', out );
+  if ( shown < key_size ) {
+    fprintf( out, "... ( %u bytes )", key_size );
+  }
+}
+
+static int deep_failure_cmp( const void* a, const void* b )
+{
+  const deep_failure_t *fa = (const deep_failure_t*)a;
+  const deep_failure_t *fb = (const deep_failure_t*)b;
+  return ( fa->offset < fb->offset ) ? -1 : ( fa->offset > fb->offset ) ? 1 : 0;
+}
+
+/*
+ * the number of values that did not inflate, -1 if the check could not run
+ */
+int64_t dbmeta_deep_check( db_meta_t* dbmeta, int nthreads, uint64_t budget, FILE* output )
+{
+  deep_check_t    dc;
+  tchpar_t       *par;
+  tchhdr_t        hdr;
+  deep_worker_t   total;
+  deep_failure_t *failures;
+  int64_t         records;
+  uint64_t        skipped = 0;
+  int             kept    = 0;
+
+  if ( !tchhdr_load( dbmeta->dbpath, &hdr ) ) {
+    fprintf( stderr, "Failure reading the header of %s : %s\n", dbmeta->dbpath, tchhdr_error( errno ) );
+    return -1;
+  }
+  if ( !( hdr.options & TCH_OPT_DEFLATE ) ) {
+    fprintf( output, "Values are not deflated, there is nothing to inflate\n" );
+    return 0;
+  }
+  if ( NULL == ( par = tchpar_new( dbmeta->dbpath, nthreads, TCHSCAN_MMAP, 0 ) ) ) {
+    return -1;
+  }
+
+  dc.nthreads = par->nthreads;
+  dc.budget   = budget;
+  if ( 0 != posix_memalign( (void**)&(dc.workers), 64, dc.nthreads * sizeof( deep_worker_t ) ) ) {
+    fprintf( stderr, "Out of memory for %d workers\n", dc.nthreads );
+    tchpar_destroy( par );
+    return -1;
+  }
+  for ( int i = 0 ; i < dc.nthreads ; i++ ) {
+    if ( !deep_worker_init( &(dc.workers[i]), budget ) ) {
+      deep_workers_free( &dc, i );
+      tchpar_destroy( par );
+      return -1;
+    }
+    dc.workers[i].counts    = metrics_slot( dbmeta->metrics );
+    dc.workers[i].m_values  = dbmeta->m_values;
+    dc.workers[i].h_inflate = dbmeta->h_inflate;
+  }
+
+  fprintf( stderr, "Inflating every value with %d threads of %llu bytes each : \n",
+           dc.nthreads, (long long unsigned)budget );
+  if ( !tchpar_start( par, 0, deep_check_record, &dc ) ) {
+    deep_workers_free( &dc, dc.nthreads );
+    tchpar_destroy( par );
+    return -1;
+  }
+  while ( !tchpar_wait( par, 1.0 ) ) {
+    metrics_tick( dbmeta->metrics, false );
+    metrics_progress( dbmeta->metrics, stderr, dbmeta->m_values, hdr.record_number, tchpar_records( par ) );
+  }
+  if ( ( records = tchpar_finish( par ) ) < 0 ) {
+    fprintf( stderr, "\nThe scan of %s failed\n", dbmeta->dbpath );
+    deep_workers_free( &dc, dc.nthreads );
+    tchpar_destroy( par );
+    return -1;
+  }
+  metrics_tick( dbmeta->metrics, true );
+  metrics_progress( dbmeta->metrics, stderr, dbmeta->m_values, hdr.record_number, records );
+  fprintf( stderr, "\n" );
+
+  memset( &total, 0, sizeof( total ) );
+  if ( NULL == ( failures = (deep_failure_t*)malloc( dc.nthreads * DEEP_MAX_FAILURES * sizeof( deep_failure_t ) ) ) ) {
+    fprintf( stderr, "Out of memory for the failures of %d workers\n", dc.nthreads );
+    deep_workers_free( &dc, dc.nthreads );
+    tchpar_destroy( par );
+    return -1;
+  }
+  for ( int i = 0 ; i < dc.nthreads ; i++ ) {
+    deep_worker_t *w = &(dc.workers[i]);
+
+    total.values         += w->values;
+    total.stored_bytes   += w->stored_bytes;
+    total.inflated_bytes += w->inflated_bytes;
+    total.failed         += w->failed;
+    skipped              += par->ranges[i].skipped_bytes;
+    if ( w->largest > total.largest ) {
+      total.largest = w->largest;
+    }
+    memcpy( failures + kept, w->failures, w->kept * sizeof( deep_failure_t ) );
+    kept += w->kept;
+  }
+  qsort( failures, kept, sizeof( deep_failure_t ), deep_failure_cmp );
+
+  fprintf( output, "Inflated %llu values, %llu bytes stored to %llu, the largest %llu\n",
+           (long long unsigned)total.values, (long long unsigned)total.stored_bytes,
+           (long long unsigned)total.inflated_bytes, (long long unsigned)total.largest );
+  if ( skipped > 0 ) {
+    fprintf( output, "Skipped %llu bytes that do not parse as records, their values were not inflated\n",
+             (long long unsigned)skipped );
+  }
+  fprintf( output, "Found %llu values that do not inflate\n", (long long unsigned)total.failed );
+  for ( int i = 0 ; i < kept ; i++ ) {
+    fprintf( output, "  offset %llu key ", (long long unsigned)failures[i].offset );
+    check_print_key( output, failures[i].key, failures[i].key_size );
+    fprintf( output, " : %s\n", failures[i].reason );
+  }
+  if ( (uint64_t)kept < total.failed ) {
+    fprintf( output, "  and %llu more, the first %d of each thread are listed\n",
+             (long long unsigned)( total.failed - kept ), DEEP_MAX_FAILURES );
+  }
+
+  deep_workers_free( &dc, dc.nthreads );
+  free( failures );
+  tchpar_destroy( par );
+  return total.failed;
+}
+
+/*
+ * --index : every key of a valid tchindex index is looked up through the
+ * bucket array and the record trees, the way tchdbget does, and has to land
+ * on the record the index has for it.  A record that is in the file but that
+ * no lookup reaches is lost to the clients, however the offsets add up.
+ */
+#define INDEX_MAX_SHOWN  100                   /* keys listed, the rest counted */
+
+/*
+ * the number of indexed keys a lookup does not find where the index has
+ * them, -1 if the check could not run
+ */
+int64_t dbmeta_index_check( db_meta_t* dbmeta, FILE* output )
+{
+  tchscan_t     *scan;
+  tchidx_t      *idx;
+  tchscan_rec_t  rec, found;
+  const char    *why;
+  char           idx_path[PATH_MAX+1];
+  uint64_t       unread    = 0;
+  uint64_t       missing   = 0;
+  uint64_t       elsewhere = 0;
+  uint64_t       i;
+
+  if ( NULL == ( scan = tchscan_open( dbmeta->dbpath ) ) ) {
+    return -1;
+  }
+  if ( !tchidx_path( scan->path, idx_path, sizeof( idx_path ) ) ) {
+    tchscan_close( scan );
+    return -1;
+  }
+  if ( NULL == ( idx = tchidx_open( idx_path, scan, &why ) ) ) {
+    fprintf( stderr, "Can not use %s, %s, tchindex build %s first\n", idx_path, why, scan->path );
+    tchscan_close( scan );
+    return -1;
+  }
+
+  fprintf( stderr, "Looking up the %llu keys of %s : \n", (long long unsigned)idx->count, idx_path );
+  for ( i = 0 ; i < idx->count ; i++ ) {
+    const tchidx_entry_t *e = &(idx->entries[i]);
+    bool                  shown    = ( unread + missing + elsewhere < INDEX_MAX_SHOWN );
+    uint64_t              start    = metrics_now();
+    bool                  found_at = tchscan_read_at( scan, e->offset, &rec );
+
+    metrics_observe( dbmeta->counts, dbmeta->h_index_read, metrics_now() - start );
+    metrics_add( dbmeta->counts, dbmeta->m_keys, 1 );
+    if ( !found_at || TCH_MAGIC_DATA_BLOCK != rec.magic ||
+         rec.key_size != e->key_size ) {
+      if ( shown ) {
+        fprintf( output, "  offset %llu : the index has a record there, the file does not\n",
+                 (long long unsigned)e->offset );
+      }
+      unread += 1;
+    } else if ( !tchscan_lookup( scan, rec.key_buf, rec.key_size, &found ) ) {
+      if ( shown ) {
+        fprintf( output, "  offset %llu key ", (long long unsigned)e->offset );
+        check_print_key( output, rec.key_buf, rec.key_size );
+        fprintf( output, " : not found through bucket %llu\n",
+                 (long long unsigned)( e->hash % scan->hdr.bucket_number ) );
+      }
+      missing += 1;
+    } else if ( found.offset != e->offset ) {
+      if ( shown ) {
+        fprintf( output, "  offset %llu key ", (long long unsigned)e->offset );
+        check_print_key( output, rec.key_buf, rec.key_size );
+        fprintf( output, " : a lookup finds the copy at %llu\n", (long long unsigned)found.offset );
+      }
+      elsewhere += 1;
+    }
+    if ( i % 100000 == 0 ) {
+      metrics_tick( dbmeta->metrics, false );
+      metrics_progress( dbmeta->metrics, stderr, dbmeta->m_keys, idx->count, i );
+    }
+  }
+  metrics_tick( dbmeta->metrics, true );
+  metrics_progress( dbmeta->metrics, stderr, dbmeta->m_keys, idx->count, i );
+  fprintf( stderr, "\n" );
+
+  fprintf( output, "Looked up %llu indexed keys, %llu not found, %llu found at another record, "
+                   "%llu index entries with no record\n",
+           (long long unsigned)idx->count, (long long unsigned)missing, (long long unsigned)elsewhere,
+           (long long unsigned)unread );
+  if ( unread + missing + elsewhere > INDEX_MAX_SHOWN ) {
+    fprintf( output, "  the first %d are listed\n", INDEX_MAX_SHOWN );
+  }
+
+  tchidx_close( idx );
+  tchscan_close( scan );
+  return unread + missing + elsewhere;
+}
+
+static void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options] database.tch\n", name );
+  fprintf( stderr, "  -f, --profile          print where the time went at the end\n" );
+  fprintf( stderr, "  -E, --trace FILE       and write the timed spans to FILE as a Chrome trace\n" );
+  fprintf( stderr, "  -j, --metrics FILE     append the counters and latencies to FILE as JSON lines every second\n" );
+  fprintf( stderr, "  -P, --prometheus FILE  keep FILE up to date in Prometheus text format\n" );
+  fprintf( stderr, "  -d, --deep             then inflate every value of a deflate database\n" );
+  fprintf( stderr, "  -t, --threads N        threads inflating ( default %d )\n", DEEP_THREADS );
+  fprintf( stderr, "  -m, --memory N         bytes each of them may use, zlib included ( default %d )\n", DEEP_BUDGET );
+  fprintf( stderr, "  -i, --index            then look every key of the tchindex index up through the buckets\n" );
+  exit(1);
+}
+
 int main( int argc, char **argv )
 {
 
-  db_meta_t *dbmeta;
+  db_meta_t  *dbmeta;
+  profile_t  *profile    = NULL;
+  bool        profiling  = false;
+  const char *trace_path = NULL;
+  const char *json_path  = NULL;
+  const char *prom_path  = NULL;
+  bool        deep       = false;
+  bool        lookups    = false;
+  int         threads    = DEEP_THREADS;
+  uint64_t    budget     = DEEP_BUDGET;
+  int64_t     failed     = 0;
+  int64_t     lost       = 0;
+  int         opt;
+
+  static struct option long_options[] = {
+    { "profile",    no_argument,       NULL, 'f' },
+    { "trace",      required_argument, NULL, 'E' },
+    { "metrics",    required_argument, NULL, 'j' },
+    { "prometheus", required_argument, NULL, 'P' },
+    { "deep",       no_argument,       NULL, 'd' },
+    { "threads",    required_argument, NULL, 't' },
+    { "memory",     required_argument, NULL, 'm' },
+    { "index",      no_argument,       NULL, 'i' },
+    { NULL,         0,                 NULL, 0   }
+  };
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "fE:j:P:dt:m:i", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'f': profiling  = true; break;
+      case 'E': trace_path = optarg; break;
+      case 'j': json_path  = optarg; break;
+      case 'P': prom_path  = optarg; break;
+      case 'd': deep       = true; break;
+      case 't': threads    = atoi( optarg ); break;
+      case 'm': budget     = strtoull( optarg, NULL, 0 ); break;
+      case 'i': lookups    = true; break;
+      default : usage( argv[0] );
+    }
+  }
 
-  if ( argc < 2 ) {
-    fprintf(stderr, "Usage: %s database.tch\n", argv[0] );
-    exit(1);
+  if ( optind >= argc || threads < 1 ) {
+    usage( argv[0] );
   }
 
-  dbmeta = dbmeta_new( argv[1] );
+  dbmeta = dbmeta_new( argv[optind] );
+  if ( profiling || NULL != trace_path ) {
+    profile                   = profile_new( "tchcheck", PROFILE_SAMPLE_EVERY, trace_path );
+    dbmeta->phase_bucket_read = profile_phase( profile, "bucket read" );
+    dbmeta->phase_record_read = profile_phase( profile, "record read" );
+    dbmeta->phase_tree        = profile_phase( profile, "tree" );
+    dbmeta->profile           = profile_thread( profile, "check" );
+  }
+  // the --deep workers count into a slot each
+  dbmeta->metrics       = metrics_new( "tchcheck", 1 + threads );
+  dbmeta->m_buckets     = metrics_counter( dbmeta->metrics, "buckets" );
+  dbmeta->m_bytes       = metrics_counter( dbmeta->metrics, "bytes" );
+  dbmeta->h_bucket_read = metrics_histogram( dbmeta->metrics, "bucket_read" );
+  dbmeta->h_record_read = metrics_histogram( dbmeta->metrics, "record_read" );
+  dbmeta->m_values      = metrics_counter( dbmeta->metrics, "values" );
+  dbmeta->h_inflate     = metrics_histogram( dbmeta->metrics, "inflate" );
+  dbmeta->m_keys        = metrics_counter( dbmeta->metrics, "keys" );
+  dbmeta->h_index_read  = metrics_histogram( dbmeta->metrics, "index_read" );
+  if ( !metrics_output( dbmeta->metrics, json_path, prom_path ) ) {
+    exit(1);
+  }
+  dbmeta->counts        = metrics_slot( dbmeta->metrics );
   fprintf( stdout, "Database            : %s\n",   dbmeta->dbpath );
   fprintf( stdout, "  number of buckets : %llu\n", (long long unsigned)dbmeta->bucket_count );
   fprintf( stdout, "  offset of buckets : %llu\n", (long long unsigned)dbmeta->bucket_offset );
@@ -447,9 +932,20 @@ int main( int argc, char **argv )
   dbmeta_populate_offset_tree( dbmeta );
   dbmeta_populate_record_tree( dbmeta );
   dbmeta_print_results( dbmeta, stdout );
+  if ( deep && ( failed = dbmeta_deep_check( dbmeta, threads, budget, stdout ) ) < 0 ) {
+    exit(1);
+  }
+  if ( lookups && ( lost = dbmeta_index_check( dbmeta, stdout ) ) < 0 ) {
+    exit(1);
+  }
+  if ( NULL != profile ) {
+    profile_report( profile, stdout );
+    profile_destroy( profile );
+  }
 
   // report all the elements in each tree that still exist.
+  metrics_destroy( dbmeta->metrics );
   dbmeta_free( dbmeta );
 
-  exit(0);
+  exit( failed + lost > 0 ? 1 : 0 );
 }
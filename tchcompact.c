@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+
+#include "tchhdr.h"
+#include "tchscan.h"
+#include "tchtune.h"
+#include "tchbuild.h"
+
+/*
+ * Rewrite a hash database offline into a new file with no free blocks, no
+ * padding past the alignment and a bucket array sized for the records it
+ * has, without going through tchdbput.
+ *
+ *   tchcompact old.tch new.tch
+ *
+ * The keys are hashed by --threads threads reading the source in parallel,
+ * then the record trees are worked out in memory and the copy goes out in
+ * one sequential write, see tchbuild.h.  Values are copied as they are
+ * stored, deflated ones are not touched.
+ *
+ * Nothing else may have the source open for writing, it has to be the same
+ * records in both reads.
+ */
+
+#define COMPACT_THREADS  4
+#define COMPACT_GROWTH   1.0                    /* a compacted shard is sized for what it has */
+
+void usage( const char* name, const tchbuild_options_t* defaults )
+{
+  fprintf( stderr, "Usage: %s [options] source.tch compact.tch\n", name );
+  fprintf( stderr, "  -b, --bnum N        buckets in the copy ( default tchstat --advise's for the records )\n" );
+  fprintf( stderr, "  -g, --growth F      that many buckets for F times the records ( default %.1f )\n", COMPACT_GROWTH );
+  fprintf( stderr, "  -a, --apow N        2^N byte alignment ( default the source's )\n" );
+  fprintf( stderr, "  -p, --fpow N        2^N free pool entries ( default the source's )\n" );
+  fprintf( stderr, "  -l, --large         64 bit offsets\n" );
+  fprintf( stderr, "  -L, --no-large      32 bit offsets\n" );
+  tchbuild_usage( stderr, defaults, "compact" );
+  exit(1);
+}
+
+int main( int argc, char** argv )
+{
+  tchbuild_options_t o;
+  tchbuild_options_t defaults;
+  long long          bnum   = -1;
+  double             growth = COMPACT_GROWTH;
+  int                apow   = -1;
+  int                fpow   = -1;
+  int                large  = -1;
+  tchbuild_t        *b;
+  int                opt;
+
+  struct option long_options[] = {
+    { "bnum",       required_argument, NULL, 'b' },
+    { "growth",     required_argument, NULL, 'g' },
+    { "apow",       required_argument, NULL, 'a' },
+    { "fpow",       required_argument, NULL, 'p' },
+    { "large",      no_argument,       NULL, 'l' },
+    { "no-large",   no_argument,       NULL, 'L' },
+    TCHBUILD_LONG_OPTIONS,
+    { NULL,         0,                 NULL,  0  }
+  };
+
+  tchbuild_options_init( &defaults, COMPACT_THREADS );
+  o = defaults;
+  while ( -1 != ( opt = getopt_long( argc, argv, "b:g:a:p:lL" TCHBUILD_GETOPT, long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'b': bnum   = atoll( optarg ); break;
+      case 'g': growth = atof( optarg ); break;
+      case 'a': apow   = atoi( optarg ); break;
+      case 'p': fpow   = atoi( optarg ); break;
+      case 'l': large  = 1; break;
+      case 'L': large  = 0; break;
+      default :
+        if ( !tchbuild_option( &o, opt, optarg ) ) {
+          usage( argv[0], &defaults );
+        }
+    }
+  }
+
+  if ( optind + 2 != argc || growth <= 0 || !tchbuild_options_valid( &o ) ) {
+    usage( argv[0], &defaults );
+  }
+
+  if ( NULL == ( b = tchbuild_new( argv[optind], &o ) ) ) {
+    exit(1);
+  }
+  if ( bnum <= 0 ) {
+    bnum = tchtune_bnum( b->scan->hdr.record_number, growth );
+  }
+  if ( !tchbuild_layout( b, bnum, apow, fpow, large ) ||
+       !tchbuild_run( b, argv[optind + 1], &o, "Compacted" ) ) {
+    exit(1);
+  }
+
+  tchbuild_destroy( b );
+  exit(0);
+}
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "tchscan.h"
+#include "tchpar.h"
+#include "tchstream.h"
+
+/*
+ * Export the live records of a hash database as a tchstream ( see
+ * tchstream.h ) to a file or stdout.  Free blocks, padding and the bucket
+ * array are left behind, only keys and values go out.
+ *
+ *   tchdump -c db.tch | ssh otherhost tchload copy.tch
+ *
+ * With --threads the record region is split with tchpar, each thread fills
+ * its own block and only takes the output lock to write a whole block, so
+ * the records of a multi threaded dump are not in file order.
+ *
+ * --polite, --direct and --rate keep a dump from pushing the live data of
+ * the host out of the page cache ( see tchscan_io_t ).
+ */
+
+#define SCAN_THREADS 1
+
+void print_progress( FILE* file, time_t start_time, long long unsigned final, long long unsigned so_far );
+
+typedef struct dump {
+  int              fd;
+  bool             checksum;
+  bool             inflate;
+  pthread_mutex_t  write_lock;
+  bool             failed;
+  uint64_t         bytes;          /* stream bytes written */
+} dump_t;
+
+typedef struct dump_thread {
+  dump_t            *dump;
+  tchstream_block_t  block;
+  z_stream           zs;
+  char              *buf;
+  int                buf_size;
+  uint64_t           inflate_errors;
+} __attribute__(( aligned( 64 ) )) dump_thread_t;
+
+bool dump_write_block( dump_t* dump, tchstream_block_t* block )
+{
+  int64_t written;
+
+  pthread_mutex_lock( &(dump->write_lock) );
+  if ( dump->failed ) {
+    pthread_mutex_unlock( &(dump->write_lock) );
+    return false;
+  }
+  if ( -1 == ( written = tchstream_block_write( dump->fd, block, dump->checksum ) ) ) {
+    fprintf( stderr, "write error : %s\n", strerror( errno ) );
+    dump->failed = true;
+  } else {
+    dump->bytes += written;
+  }
+  pthread_mutex_unlock( &(dump->write_lock) );
+  return !dump->failed;
+}
+
+bool dump_record( const tchscan_rec_t* rec, int thread, void* ctx )
+{
+  dump_thread_t *dt   = &(((dump_thread_t*)ctx)[thread]);
+  const char    *vbuf = rec->val_buf;
+  int            vsiz = rec->val_size;
+
+  if ( dt->dump->inflate ) {
+    if ( 0 > ( vsiz = tchscan_inflate( &(dt->zs), rec->val_buf, rec->val_size, &(dt->buf), &(dt->buf_size) ) ) ) {
+      fprintf( stderr, "inflate error : record at offset %llu\n", (long long unsigned)rec->offset );
+      dt->inflate_errors += 1;
+      return true;
+    }
+    vbuf = dt->buf;
+  }
+
+  int added = tchstream_block_add( &(dt->block), rec->key_buf, rec->key_size, vbuf, vsiz );
+
+  // a block's length is 4 bytes, so one that would pass it goes out first
+  if ( -1 == added && dt->block.records > 0 ) {
+    if ( !dump_write_block( dt->dump, &(dt->block) ) ) {
+      return false;
+    }
+    added = tchstream_block_add( &(dt->block), rec->key_buf, rec->key_size, vbuf, vsiz );
+  }
+  if ( -1 == added ) {
+    fprintf( stderr, "record at offset %llu does not fit in a block\n", (long long unsigned)rec->offset );
+    pthread_mutex_lock( &(dt->dump->write_lock) );
+    dt->dump->failed = true;
+    pthread_mutex_unlock( &(dt->dump->write_lock) );
+    return false;
+  }
+  if ( 1 == added ) {
+    return dump_write_block( dt->dump, &(dt->block) );
+  }
+  return true;
+}
+
+void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options] database.hdb\n", name );
+  fprintf( stderr, "  -o, --output FILE      write the stream to FILE instead of stdout\n" );
+  fprintf( stderr, "  -c, --checksum         crc32 every block\n" );
+  fprintf( stderr, "  -k, --keep-compressed  write deflated values as they are stored\n" );
+  fprintf( stderr, "  -b, --block-size BYTES size of the blocks ( default %d )\n", TCHSTREAM_BLOCK_SIZE );
+  fprintf( stderr, "  -T, --threads N        scan with N threads ( default %d )\n", SCAN_THREADS );
+  fprintf( stderr, "  -p, --polite           drop pages from the page cache behind the scan\n" );
+  fprintf( stderr, "  -d, --direct           read with O_DIRECT instead of mapping the file\n" );
+  fprintf( stderr, "  -l, --rate BYTES       read at most BYTES of the database per second\n" );
+  fprintf( stderr, "  -q, --quiet            no progress on stderr\n" );
+}
+
+int main( int argc, char** argv )
+{
+  const char        *output_path     = NULL;
+  bool               keep_compressed = false;
+  bool               quiet           = false;
+  uint64_t           block_size      = TCHSTREAM_BLOCK_SIZE;
+  int                threads         = SCAN_THREADS;
+  tchscan_io_t       io              = { false, false, 0 };
+  dump_t             dump;
+  dump_thread_t     *dts             = NULL;
+  tchstream_header_t hdr;
+  tchpar_t          *par;
+  tchhdr_t          *src;
+  int64_t            records;
+  uint64_t           inflate_errors  = 0;
+  int                opt;
+
+  struct option long_options[] = {
+    { "output",          required_argument, NULL, 'o' },
+    { "checksum",        no_argument,       NULL, 'c' },
+    { "keep-compressed", no_argument,       NULL, 'k' },
+    { "block-size",      required_argument, NULL, 'b' },
+    { "threads",         required_argument, NULL, 'T' },
+    { "polite",          no_argument,       NULL, 'p' },
+    { "direct",          no_argument,       NULL, 'd' },
+    { "rate",            required_argument, NULL, 'l' },
+    { "quiet",           no_argument,       NULL, 'q' },
+    { NULL,              0,                 NULL,  0  }
+  };
+
+  memset( &dump, 0, sizeof( dump ) );
+  dump.fd = STDOUT_FILENO;
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "o:ckb:T:pdl:q", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'o': output_path     = optarg; break;
+      case 'c': dump.checksum   = true; break;
+      case 'k': keep_compressed = true; break;
+      case 'b': block_size      = strtoull( optarg, NULL, 0 ); break;
+      case 'T': threads         = atoi( optarg ); break;
+      case 'p': io.drop_behind  = true; break;
+      case 'd': io.direct       = true; break;
+      case 'l': io.rate         = strtoull( optarg, NULL, 0 ); break;
+      case 'q': quiet           = true; break;
+      default :
+        usage( argv[0] );
+        exit(1);
+    }
+  }
+
+  if ( optind >= argc || threads < 1 ) {
+    usage( argv[0] );
+    exit(1);
+  }
+
+  par = tchpar_new( argv[optind], threads, io.direct ? TCHSCAN_BUFFERED : TCHSCAN_MMAP, 0 );
+  if ( NULL == par || !tchpar_set_io( par, &io ) ) {
+    exit(1);
+  }
+  src = &(par->ranges[0].scan->hdr);
+
+  if ( src->options & ( TCH_OPT_BZIP2 | TCH_OPT_TCBS | TCH_OPT_EXCODEC ) ) {
+    fprintf( stderr, "Only deflate compressed databases can be dumped\n" );
+    tchpar_destroy( par );
+    exit(1);
+  }
+
+  if ( NULL != output_path && 0 != strcmp( output_path, "-" ) ) {
+    if ( -1 == ( dump.fd = open( output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) ) {
+      fprintf( stderr, "open error on %s : %s\n", output_path, strerror( errno ));
+      tchpar_destroy( par );
+      exit(1);
+    }
+  } else if ( isatty( STDOUT_FILENO ) ) {
+    fprintf( stderr, "Not writing a binary stream to a terminal, use --output or a pipe\n" );
+    tchpar_destroy( par );
+    exit(1);
+  }
+
+  dump.inflate = ( src->options & TCH_OPT_DEFLATE ) && !keep_compressed;
+  pthread_mutex_init( &(dump.write_lock), NULL );
+
+  memset( &hdr, 0, sizeof( hdr ) );
+  hdr.flags          = ( dump.checksum ? TCHSTREAM_CHECKSUM : 0 ) |
+                       ( ( src->options & TCH_OPT_DEFLATE ) && keep_compressed ? TCHSTREAM_DEFLATED : 0 );
+  hdr.alignment_pow  = src->alignment_pow;
+  hdr.free_block_pow = src->free_block_pow;
+  hdr.options        = src->options;
+  hdr.bucket_number  = src->bucket_number;
+  hdr.record_number  = src->record_number;
+
+  if ( !tchstream_write_header( dump.fd, &hdr ) ) {
+    fprintf( stderr, "write error : %s\n", strerror( errno ) );
+    exit(1);
+  }
+  dump.bytes = TCHSTREAM_HEADER_SIZE;
+
+  if ( 0 != posix_memalign( (void**)&dts, 64, threads * sizeof( dump_thread_t ) ) ) {
+    fprintf( stderr, "Failure allocating %d dump threads\n", threads );
+    exit(1);
+  }
+  memset( dts, 0, threads * sizeof( dump_thread_t ) );
+  for ( int i = 0 ; i < threads ; i++ ) {
+    dts[i].dump = &dump;
+    tchstream_block_init( &(dts[i].block), block_size );
+    if ( dump.inflate ) {
+      inflateInit2( &(dts[i].zs), -15 );
+      dts[i].buf_size = 64 * 1024;
+      dts[i].buf      = malloc( dts[i].buf_size );
+    }
+  }
+
+  time_t start = time(NULL);
+  if ( !tchpar_start( par, 0, dump_record, dts ) ) {
+    exit(1);
+  }
+  while ( !tchpar_wait( par, 1.0 ) ) {
+    if ( !quiet ) {
+      print_progress( stderr, start, src->record_number, tchpar_records( par ) );
+    }
+  }
+  records = tchpar_finish( par );
+
+  // the partly filled blocks, then the end marker
+  for ( int i = 0 ; i < threads ; i++ ) {
+    dump_write_block( &dump, &(dts[i].block) );
+    tchstream_block_free( &(dts[i].block) );
+    inflate_errors += dts[i].inflate_errors;
+    if ( dump.inflate ) {
+      inflateEnd( &(dts[i].zs) );
+      free( dts[i].buf );
+    }
+  }
+  free( dts );
+
+  if ( records < 0 || dump.failed || inflate_errors > 0 ) {
+    // no end block, so a reader knows this stream is incomplete
+    fprintf( stderr, "\nDump of %s failed\n", par->path );
+    if ( inflate_errors > 0 ) {
+      fprintf( stderr, "%llu records could not be inflated and are not in it\n", (long long unsigned)inflate_errors );
+    }
+    tchpar_destroy( par );
+    exit(1);
+  }
+  if ( !tchstream_write_end( dump.fd ) ) {
+    fprintf( stderr, "write error : %s\n", strerror( errno ) );
+    exit(1);
+  }
+  if ( STDOUT_FILENO != dump.fd && 0 != close( dump.fd ) ) {
+    fprintf( stderr, "close error on %s : %s\n", output_path, strerror( errno ));
+    exit(1);
+  }
+  dump.bytes += 8;
+
+  if ( !quiet ) {
+    fprintf( stderr, "\nDumped %llu records, %llu bytes from %s\n",
+             (long long unsigned)records, (long long unsigned)dump.bytes, par->path );
+  }
+
+  pthread_mutex_destroy( &(dump.write_lock) );
+  tchpar_destroy( par );
+  exit(0);
+}
@@ -0,0 +1,97 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tchhdr.h"
+
+bool tchhdr_read_any( int fd, tchhdr_t* hdr )
+{
+  uint8_t buf[TCH_HEADER_SIZE];
+
+  errno = 0;
+  if ( TCH_HEADER_SIZE != pread( fd, buf, TCH_HEADER_SIZE, 0 ) ) {
+    if ( 0 == errno ) { errno = EINVAL; }
+    return false;
+  }
+
+  if ( 0 != memcmp( buf, TCH_MAGIC, strlen( TCH_MAGIC ) ) ) {
+    errno = EINVAL;
+    return false;
+  }
+
+  memcpy( hdr->magic, buf, 32 );
+  hdr->magic[32]      = '\0';
+  hdr->db_type        = buf[32];
+  hdr->flags          = buf[33];
+  hdr->alignment_pow  = buf[34];
+  hdr->free_block_pow = buf[35];
+  hdr->options        = buf[36];
+  hdr->bucket_number  = tchhdr_get_le( buf + 40, 8 );
+  hdr->record_number  = tchhdr_get_le( buf + 48, 8 );
+  hdr->file_size      = tchhdr_get_le( buf + 56, 8 );
+  hdr->first_record   = tchhdr_get_le( buf + 64, 8 );
+  hdr->bytes_per      = ( hdr->options & TCH_OPT_LARGE ) ? sizeof( uint64_t ) : sizeof( uint32_t );
+
+  return true;
+}
+
+bool tchhdr_read( int fd, tchhdr_t* hdr )
+{
+  if ( !tchhdr_read_any( fd, hdr ) ) {
+    return false;
+  }
+
+  // the bucket array has to fit between the header and the first record
+  if ( TCH_TYPE_HASH != hdr->db_type || 0 == hdr->bucket_number ||
+       hdr->alignment_pow > TCH_MAX_APOW || hdr->free_block_pow > TCH_MAX_FPOW ||
+       hdr->first_record < TCH_HEADER_SIZE ||
+       hdr->bucket_number > ( hdr->first_record - TCH_HEADER_SIZE ) / hdr->bytes_per ) {
+    errno = EINVAL;
+    return false;
+  }
+  return true;
+}
+
+bool tchhdr_load( const char* path, tchhdr_t* hdr )
+{
+  int  fd;
+  bool ok;
+  int  saved;
+
+  if ( -1 == ( fd = open( path, O_RDONLY ) ) ) {
+    return false;
+  }
+  ok    = tchhdr_read( fd, hdr );
+  saved = errno;
+  close( fd );
+  errno = saved;
+  return ok;
+}
+
+const char* tchhdr_error( int err )
+{
+  return ( EINVAL == err ) ? "not a hash database" : strerror( err );
+}
+
+const char* tchhdr_type_name( uint8_t db_type )
+{
+  switch ( db_type ) {
+    case TCH_TYPE_HASH  : return "hash";
+    case TCH_TYPE_BTREE : return "btree";
+    case TCH_TYPE_FIXED : return "fixed";
+    case TCH_TYPE_TABLE : return "table";
+    default             : return "unknown";
+  }
+}
+
+uint64_t tchhdr_bucket_bytes( const tchhdr_t* hdr )
+{
+  return hdr->bucket_number * hdr->bytes_per;
+}
+
+uint64_t tchhdr_free_pool_bytes( const tchhdr_t* hdr )
+{
+  uint64_t pool_start = TCH_HEADER_SIZE + tchhdr_bucket_bytes( hdr );
+  return ( hdr->first_record > pool_start ) ? hdr->first_record - pool_start : 0;
+}
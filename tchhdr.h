@@ -0,0 +1,128 @@
+#ifndef __TCHHDR_H__
+#define __TCHHDR_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * The fixed 256 byte header at the front of every Tokyo Cabinet hash
+ * database, read straight from the file so that none of the tools need to go
+ * through tchdbopen just to find out where things are.
+ *
+ * layout ( all numbers little endian ), see tcrecords.rb for the bindata
+ * version of the same thing:
+ *
+ *    0  magic             32 bytes
+ *   32  database type      1 byte
+ *   33  additional flags   1 byte
+ *   34  alignment power    1 byte
+ *   35  free block power   1 byte
+ *   36  options            1 byte
+ *   40  bucket number      8 bytes
+ *   48  record number      8 bytes
+ *   56  file size          8 bytes
+ *   64  first record       8 bytes
+ *  128  opaque           128 bytes
+ */
+
+#define TCH_HEADER_SIZE  256          /* HDBHEADSIZ from tchdb.c */
+#define TCH_MAGIC        "ToKyO CaBiNeT"
+#define TCH_MAX_APOW     16           /* HDBMAXAPOW */
+#define TCH_MAX_FPOW     20           /* HDBMAXFPOW */
+
+enum {                                /* database type byte, TCDBT*       */
+  TCH_TYPE_HASH   = 0,
+  TCH_TYPE_BTREE  = 1,                /* a B+ tree keeps its pages in a hash database */
+  TCH_TYPE_FIXED  = 2,
+  TCH_TYPE_TABLE  = 3
+};
+
+enum {                                /* additional flags, HDBF*          */
+  TCH_FLAG_OPEN   = 0x01,             /* open for writing, or not closed cleanly */
+  TCH_FLAG_FATAL  = 0x02              /* a fatal error was hit while open        */
+};
+
+enum {                                /* options byte, same bits as HDBT* */
+  TCH_OPT_LARGE   = 0x01,
+  TCH_OPT_DEFLATE = 0x02,
+  TCH_OPT_BZIP2   = 0x04,
+  TCH_OPT_TCBS    = 0x08,
+  TCH_OPT_EXCODEC = 0x10
+};
+
+typedef struct tchhdr {
+  char     magic[33];            /* NUL terminated copy of the magic bytes      */
+  uint8_t  db_type;
+  uint8_t  flags;
+  uint8_t  alignment_pow;        /* power of 2 for calculating offsets         */
+  uint8_t  free_block_pow;
+  uint8_t  options;
+  uint64_t bucket_number;
+  uint64_t record_number;
+  uint64_t file_size;
+  uint64_t first_record;         /* offset in the file of the first record     */
+
+  short    bytes_per;            /* bytes per 'file address', this is 4 or 8   */
+} tchhdr_t;
+
+/*
+ * Read and decode the header of the open database file fd.  Returns false
+ * and sets errno ( EINVAL for something that is not a hash database ) on
+ * failure.  A B+ tree or table database has the same magic but not hash
+ * records, and a bucket number of 0 or an alignment or free block power
+ * tchdb.c would never write means it is not a header at all, so both are
+ * refused.
+ */
+extern bool tchhdr_read( int fd, tchhdr_t* hdr );
+
+/*
+ * tchhdr_read that only checks the magic, for reporting on any kind of
+ * Tokyo Cabinet file.  Nothing past the header should be read on the
+ * strength of it.
+ */
+extern bool tchhdr_read_any( int fd, tchhdr_t* hdr );
+
+/*
+ * tchhdr_read of the file at path, opened and closed again.  Takes no lock,
+ * which is the point, a writer may have it open.
+ */
+extern bool tchhdr_load( const char* path, tchhdr_t* hdr );
+
+/*
+ * strerror for the errno tchhdr_read and tchhdr_load leave behind
+ */
+extern const char* tchhdr_error( int err );
+
+/*
+ * "hash", "btree", "fixed", "table" or "unknown"
+ */
+extern const char* tchhdr_type_name( uint8_t db_type );
+
+/*
+ * The bytes of the bucket array, and of the free block pool between it and
+ * the first record.
+ */
+extern uint64_t tchhdr_bucket_bytes( const tchhdr_t* hdr );
+extern uint64_t tchhdr_free_pool_bytes( const tchhdr_t* hdr );
+
+/*
+ * bytes long little endian numbers, the way the header, the bucket array
+ * and every sidecar file the tools write keep them
+ */
+static inline void tchhdr_put_le( uint8_t* p, uint64_t v, int bytes )
+{
+  for ( int i = 0 ; i < bytes ; i++ ) {
+    p[i] = (uint8_t)( v >> ( 8 * i ) );
+  }
+}
+
+static inline uint64_t tchhdr_get_le( const uint8_t* p, int bytes )
+{
+  uint64_t v = 0;
+  for ( int i = bytes - 1 ; i >= 0 ; i-- ) {
+    v = ( v << 8 ) | p[i];
+  }
+  return v;
+}
+
+#endif
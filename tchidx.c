@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tchidx.h"
+#include "tchstream.h"
+
+static int entry_cmp( const void* a, const void* b )
+{
+  const tchidx_entry_t *x = (const tchidx_entry_t*)a;
+  const tchidx_entry_t *y = (const tchidx_entry_t*)b;
+
+  if ( x->hash != y->hash ) {
+    return ( x->hash > y->hash ) - ( x->hash < y->hash );
+  }
+  return ( x->offset > y->offset ) - ( x->offset < y->offset );
+}
+
+bool tchidx_path( const char* path, char* idx_path, size_t size )
+{
+  if ( snprintf( idx_path, size, "%s%s", path, TCHIDX_SUFFIX ) >= (int)size ) {
+    fprintf( stderr, "Path of the index of %s is too long\n", path );
+    return false;
+  }
+  return true;
+}
+
+void tchidx_stamp( const struct stat* st, const tchhdr_t* hdr, tchidx_stamp_t* stamp )
+{
+  stamp->size          = st->st_size;
+  stamp->mtime         = st->st_mtim.tv_sec;
+  stamp->mtime_ns      = st->st_mtim.tv_nsec;
+  stamp->record_number = hdr->record_number;
+  stamp->bucket_number = hdr->bucket_number;
+}
+
+bool tchidx_stamp_path( const char* path, tchidx_stamp_t* stamp )
+{
+  struct stat st;
+  tchhdr_t    hdr;
+
+  if ( 0 != stat( path, &st ) || !tchhdr_load( path, &hdr ) ) {
+    fprintf( stderr, "Failure reading %s : %s\n", path, tchhdr_error( errno ) );
+    return false;
+  }
+  tchidx_stamp( &st, &hdr, stamp );
+  return true;
+}
+
+bool tchidx_write( const char* idx_path, const tchidx_stamp_t* stamp, tchidx_entry_t* entries, uint64_t count )
+{
+  uint8_t buf[TCHIDX_HEADER_SIZE];
+  char    tmp_path[PATH_MAX+1];
+  int     fd;
+
+  qsort( entries, count, sizeof( tchidx_entry_t ), entry_cmp );
+
+  memset( buf, 0, sizeof( buf ) );
+  memcpy( buf, TCHIDX_MAGIC, strlen( TCHIDX_MAGIC ) );
+  buf[8] = TCHIDX_VERSION;
+  tchhdr_put_le( buf + 16, count, 8 );
+  tchhdr_put_le( buf + 24, stamp->size, 8 );
+  tchhdr_put_le( buf + 32, stamp->mtime, 8 );
+  tchhdr_put_le( buf + 40, stamp->mtime_ns, 8 );
+  tchhdr_put_le( buf + 48, stamp->record_number, 8 );
+  tchhdr_put_le( buf + 56, stamp->bucket_number, 8 );
+
+  // readers either see the old index or the whole new one
+  snprintf( tmp_path, sizeof( tmp_path ), "%s.%d", idx_path, (int)getpid() );
+  if ( -1 == ( fd = open( tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", tmp_path, strerror( errno ) );
+    return false;
+  }
+  if ( !tchstream_write_fully( fd, buf, sizeof( buf ) ) ||
+       !tchstream_write_fully( fd, entries, count * sizeof( tchidx_entry_t ) ) ||
+       0 != fsync( fd ) || 0 != close( fd ) || 0 != rename( tmp_path, idx_path ) ) {
+    fprintf( stderr, "write error on %s : %s\n", tmp_path, strerror( errno ) );
+    unlink( tmp_path );
+    return false;
+  }
+  return true;
+}
+
+tchidx_t* tchidx_open( const char* idx_path, const tchscan_t* scan, const char** why )
+{
+  tchidx_t      *idx;
+  tchidx_stamp_t now;
+  struct stat    st;
+
+  if ( 0 != fstat( scan->fd, &st ) ) {
+    *why = strerror( errno );
+    return NULL;
+  }
+  tchidx_stamp( &st, &(scan->hdr), &now );
+
+  if ( NULL == ( idx = (tchidx_t*)calloc( 1, sizeof( tchidx_t ) ) ) ) {
+    *why = "out of memory";
+    return NULL;
+  }
+  idx->fd = -1;
+  if ( -1 == ( idx->fd = open( idx_path, O_RDONLY ) ) || 0 != fstat( idx->fd, &st ) ) {
+    *why = ( ENOENT == errno ) ? "there is no index" : strerror( errno );
+    tchidx_close( idx );
+    return NULL;
+  }
+  idx->map_size = st.st_size;
+  if ( idx->map_size < TCHIDX_HEADER_SIZE ||
+       MAP_FAILED == ( idx->map = mmap( NULL, idx->map_size, PROT_READ, MAP_SHARED, idx->fd, 0 ) ) ) {
+    idx->map = NULL;
+    *why     = "it is not an index";
+    tchidx_close( idx );
+    return NULL;
+  }
+  if ( 0 != memcmp( idx->map, TCHIDX_MAGIC, strlen( TCHIDX_MAGIC ) + 1 ) || TCHIDX_VERSION != idx->map[8] ) {
+    *why = "it is not an index, or not a version this reads";
+    tchidx_close( idx );
+    return NULL;
+  }
+
+  idx->count               = tchhdr_get_le( idx->map + 16, 8 );
+  idx->stamp.size          = tchhdr_get_le( idx->map + 24, 8 );
+  idx->stamp.mtime         = tchhdr_get_le( idx->map + 32, 8 );
+  idx->stamp.mtime_ns      = tchhdr_get_le( idx->map + 40, 8 );
+  idx->stamp.record_number = tchhdr_get_le( idx->map + 48, 8 );
+  idx->stamp.bucket_number = tchhdr_get_le( idx->map + 56, 8 );
+  idx->entries             = (const tchidx_entry_t*)( idx->map + TCHIDX_HEADER_SIZE );
+  if ( TCHIDX_HEADER_SIZE + idx->count * sizeof( tchidx_entry_t ) != idx->map_size ) {
+    *why = "it was cut off";
+    tchidx_close( idx );
+    return NULL;
+  }
+  if ( 0 != memcmp( &now, &(idx->stamp), sizeof( now ) ) ) {
+    *why = "it is stale, the database has changed since it was built";
+    tchidx_close( idx );
+    return NULL;
+  }
+
+  madvise( (void*)idx->map, idx->map_size, MADV_RANDOM );
+  *why = NULL;
+  return idx;
+}
+
+uint64_t tchidx_find( const tchidx_t* idx, uint64_t hash )
+{
+  uint64_t lo = 0;
+  uint64_t hi = idx->count;
+
+  while ( lo < hi ) {
+    uint64_t mid = lo + ( hi - lo ) / 2;
+    if ( idx->entries[mid].hash < hash ) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return ( lo < idx->count && idx->entries[lo].hash == hash ) ? lo : idx->count;
+}
+
+bool tchidx_get( const tchidx_t* idx, tchscan_t* scan, const char* kbuf, uint32_t ksiz, tchscan_rec_t* rec )
+{
+  uint8_t  hash_byte;
+  uint64_t hash = tchscan_key_hash( kbuf, ksiz, &hash_byte );
+
+  for ( uint64_t i = tchidx_find( idx, hash ) ; i < idx->count && idx->entries[i].hash == hash ; i++ ) {
+    if ( idx->entries[i].key_size != ksiz ) {
+      continue;
+    }
+    if ( tchscan_read_at( scan, idx->entries[i].offset, rec ) &&
+         rec->key_size == ksiz && 0 == memcmp( rec->key_buf, kbuf, ksiz ) ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void tchidx_close( tchidx_t* idx )
+{
+  if ( NULL == idx ) {
+    return;
+  }
+  if ( NULL != idx->map ) {
+    munmap( (void*)idx->map, idx->map_size );
+  }
+  if ( -1 != idx->fd ) {
+    close( idx->fd );
+  }
+  free( idx );
+}
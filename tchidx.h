@@ -0,0 +1,109 @@
+#ifndef __TCHIDX_H__
+#define __TCHIDX_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "tchscan.h"
+
+/*
+ * The sidecar key index tchindex builds next to a hash database.  It says
+ * where every record is without a walk of the bucket array and the record
+ * trees.
+ *
+ * header, 64 bytes:
+ *
+ *    0  magic             8 bytes  "TCHIDX\0\0"
+ *    8  version           1 byte
+ *   16  entry count       8 bytes
+ *   24  source size       8 bytes  \
+ *   32  source mtime      8 bytes   | the stamp, from stat of the source
+ *   40  source mtime ns   8 bytes   | when the build started, and from its
+ *   48  record number     8 bytes  /  header
+ *   56  bucket number     8 bytes
+ *
+ * then one 24 byte tchidx_entry_t per record, sorted by key hash and then
+ * offset.  The key hash is tchscan_key_hash, before the modulo, so it does
+ * not change with the bucket number and two databases' indexes merge in
+ * the same order.  The file is mapped and used as it is, so numbers are
+ * in the byte order of the host, little endian everywhere this runs.
+ *
+ * An index is only used when the stamp still matches the source, anything
+ * that writes the source changes its mtime and the index is ignored until
+ * it is built again.
+ */
+
+#define TCHIDX_MAGIC        "TCHIDX"
+#define TCHIDX_VERSION      1
+#define TCHIDX_HEADER_SIZE  64
+#define TCHIDX_SUFFIX       ".idx"
+
+typedef struct tchidx_entry {
+  uint64_t hash;              /* tchscan_key_hash of the key   */
+  uint64_t offset;            /* direct offset of the record   */
+  uint32_t key_size;
+  uint32_t val_size;          /* as stored, deflated or not    */
+} tchidx_entry_t;
+
+typedef struct tchidx_stamp {
+  uint64_t size;
+  uint64_t mtime;
+  uint64_t mtime_ns;
+  uint64_t record_number;
+  uint64_t bucket_number;
+} tchidx_stamp_t;
+
+typedef struct tchidx {
+  int                   fd;
+  const uint8_t        *map;
+  uint64_t              map_size;
+  tchidx_stamp_t        stamp;
+  uint64_t              count;
+  const tchidx_entry_t *entries;
+} tchidx_t;
+
+/*
+ * The index next to the database at path, path with TCHIDX_SUFFIX.  Prints
+ * why and returns false if that does not fit in size.
+ */
+extern bool tchidx_path( const char* path, char* idx_path, size_t size );
+
+/*
+ * The stamp of a database from a stat of it and its header
+ */
+extern void tchidx_stamp( const struct stat* st, const tchhdr_t* hdr, tchidx_stamp_t* stamp );
+
+/*
+ * tchidx_stamp of the database at path as it is now, prints why and returns
+ * false if it can not be read
+ */
+extern bool tchidx_stamp_path( const char* path, tchidx_stamp_t* stamp );
+
+/*
+ * Sort count entries and write them out as an index with stamp, through a
+ * temporary file renamed over idx_path.  Prints why and returns false on
+ * failure.
+ */
+extern bool tchidx_write( const char* idx_path, const tchidx_stamp_t* stamp, tchidx_entry_t* entries, uint64_t count );
+
+/*
+ * Map the index at idx_path if it is one and its stamp matches the database
+ * open in scan.  Otherwise NULL, with why saying what is wrong with it.
+ */
+extern tchidx_t* tchidx_open( const char* idx_path, const tchscan_t* scan, const char** why );
+
+/*
+ * The position of the first entry for hash, count if there is none
+ */
+extern uint64_t tchidx_find( const tchidx_t* idx, uint64_t hash );
+
+/*
+ * Look key up in the database through the index, reading only the records
+ * with the same key hash.  false if it is not there.
+ */
+extern bool tchidx_get( const tchidx_t* idx, tchscan_t* scan, const char* kbuf, uint32_t ksiz, tchscan_rec_t* rec );
+
+extern void tchidx_close( tchidx_t* idx );
+
+#endif
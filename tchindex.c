@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tchhdr.h"
+#include "tchscan.h"
+#include "tchpar.h"
+#include "tchidx.h"
+#include "tchbf.h"
+
+/*
+ * Build and use the sidecar key index of a hash database, see tchidx.h.
+ *
+ *   tchindex build db.tch             one parallel pass, writes db.tch.idx
+ *                                     and with --bloom db.tch.bloom as well
+ *   tchindex get db.tch key ...       the values of the keys, one read of a
+ *                                     record each through a valid index, a
+ *                                     walk of the bucket trees without one
+ *   tchindex diff a.tch b.tch         the keys only in a, only in b and with
+ *                                     different values, merging the two
+ *                                     indexes in key hash order
+ *
+ * The records are found by the index alone, neither the bucket array nor
+ * the trees are read.
+ */
+
+#define INDEX_THREADS  4
+
+void print_progress( FILE* file, time_t start_time, long long unsigned final, long long unsigned so_far );
+
+typedef struct index_part {                     /* one thread's entries */
+  tchidx_entry_t *entries;
+  uint64_t        count;
+  uint64_t        capacity;
+} __attribute__(( aligned( 64 ) )) index_part_t;
+
+/*
+ * keys as they are, with \xNN for the bytes that are not printable
+ */
+static void print_key( FILE* out, const char* kbuf, uint32_t ksiz )
+{
+  for ( uint32_t i = 0 ; i < ksiz ; i++ ) {
+    unsigned char c = kbuf[i];
+    if ( c < 0x20 || c > 0x7e || '\\' == c ) {
+      fprintf( out, "\\x%02x", c );
+    } else {
+      fputc( c, out );
+    }
+  }
+}
+
+static bool index_add( const tchscan_rec_t* rec, int thread, void* ctx )
+{
+  index_part_t   *part = &(((index_part_t*)ctx)[thread]);
+  tchidx_entry_t *e;
+  uint8_t         hash;
+
+  if ( part->count == part->capacity ) {
+    part->capacity = part->capacity ? part->capacity * 2 : 64 * 1024;
+    if ( NULL == ( part->entries = realloc( part->entries, part->capacity * sizeof( tchidx_entry_t ) ) ) ) {
+      fprintf( stderr, "\nOut of memory for %llu entries in thread %d\n", (long long unsigned)part->count, thread );
+      return false;
+    }
+  }
+  e           = &(part->entries[part->count++]);
+  e->hash     = tchscan_key_hash( rec->key_buf, rec->key_size, &hash );
+  e->offset   = rec->offset;
+  e->key_size = rec->key_size;
+  e->val_size = rec->val_size;
+  return true;
+}
+
+int index_build( const char* path, const char* idx_path, int threads, bool bloom, bool force, bool quiet )
+{
+  tchscan_t      *scan;
+  tchpar_t       *par;
+  index_part_t   *parts;
+  tchidx_entry_t *entries;
+  tchidx_stamp_t  before, after;
+  struct stat     st;
+  time_t          start = time( NULL );
+  int64_t         records;
+  uint64_t        n     = 0;
+  char            default_path[PATH_MAX+1];
+
+  if ( NULL == ( scan = tchscan_open( path ) ) ) {
+    return 1;
+  }
+  if ( ( scan->hdr.flags & TCH_FLAG_OPEN ) && !force ) {
+    fprintf( stderr, "%s is marked open, something may be writing it, --force to index it anyway\n", scan->path );
+    return 1;
+  }
+  if ( NULL == idx_path ) {
+    if ( !tchidx_path( scan->path, default_path, sizeof( default_path ) ) ) {
+      return 1;
+    }
+    idx_path = default_path;
+  }
+  if ( 0 != fstat( scan->fd, &st ) ) {
+    fprintf( stderr, "Failure reading %s : %s\n", scan->path, strerror( errno ) );
+    return 1;
+  }
+  tchidx_stamp( &st, &(scan->hdr), &before );
+
+  if ( NULL == ( par = tchpar_new( scan->path, threads, TCHSCAN_MMAP, 0 ) ) ) {
+    return 1;
+  }
+  if ( NULL == ( parts = (index_part_t*)calloc( par->nthreads, sizeof( index_part_t ) ) ) ) {
+    fprintf( stderr, "Out of memory for %d threads\n", par->nthreads );
+    return 1;
+  }
+  if ( !tchpar_start( par, 0, index_add, parts ) ) {
+    return 1;
+  }
+  while ( !tchpar_wait( par, 1.0 ) ) {
+    if ( !quiet ) {
+      print_progress( stderr, start, scan->hdr.record_number, tchpar_records( par ) );
+    }
+  }
+  if ( ( records = tchpar_finish( par ) ) < 0 || par->stop ) {
+    fprintf( stderr, "\nIndexing %s failed\n", scan->path );
+    return 1;
+  }
+
+  // the threads' entries one after the other, in the first one's array
+  entries = parts[0].entries;
+  if ( NULL == ( entries = realloc( entries, ( records + 1 ) * sizeof( tchidx_entry_t ) ) ) ) {
+    fprintf( stderr, "\nOut of memory for %lld entries\n", (long long)records );
+    return 1;
+  }
+  n = parts[0].count;
+  for ( int i = 1 ; i < par->nthreads ; i++ ) {
+    memcpy( entries + n, parts[i].entries, parts[i].count * sizeof( tchidx_entry_t ) );
+    n += parts[i].count;
+    free( parts[i].entries );
+  }
+
+  // a database written to while it was read gets no index
+  if ( 0 != fstat( scan->fd, &st ) || !tchhdr_read( scan->fd, &(scan->hdr) ) ) {
+    fprintf( stderr, "\nFailure reading %s again : %s\n", scan->path, tchhdr_error( errno ) );
+    return 1;
+  }
+  tchidx_stamp( &st, &(scan->hdr), &after );
+  if ( 0 != memcmp( &before, &after, sizeof( before ) ) ) {
+    fprintf( stderr, "\n%s changed while it was being indexed\n", scan->path );
+    return 1;
+  }
+  if ( !tchidx_write( idx_path, &before, entries, n ) ) {
+    return 1;
+  }
+  if ( bloom ) {
+    tchbf_t *bf = tchbf_new( n, TCHBF_FPR );
+    char     bf_path[PATH_MAX+1];
+
+    if ( !tchbf_path( scan->path, bf_path, sizeof( bf_path ) ) ) {
+      return 1;
+    }
+    for ( uint64_t i = 0 ; NULL != bf && i < n ; i++ ) {
+      tchbf_add( bf, tchbf_hash( entries[i].hash ) );
+    }
+    if ( NULL == bf || !tchbf_write( bf, bf_path, &before ) ) {
+      return 1;
+    }
+    tchbf_destroy( bf );
+  }
+
+  fprintf( stdout, "%sIndexed %llu records of %s in %s, %llu bytes\n", quiet ? "" : "\n",
+           (long long unsigned)n, scan->path, idx_path,
+           (long long unsigned)( TCHIDX_HEADER_SIZE + n * sizeof( tchidx_entry_t ) ) );
+  if ( n != scan->hdr.record_number ) {
+    fprintf( stdout, "  the header says %llu records\n", (long long unsigned)scan->hdr.record_number );
+  }
+
+  free( entries );
+  free( parts );
+  tchpar_destroy( par );
+  tchscan_close( scan );
+  return 0;
+}
+
+int index_get( const char* path, const char* idx_path, char** keys, int nkeys, bool raw )
+{
+  tchscan_t     *scan;
+  tchidx_t      *idx;
+  tchscan_rec_t  rec;
+  z_stream       zs;
+  char          *buf      = NULL;
+  int            buf_size = 4096;
+  int            missing  = 0;
+  const char    *why;
+  char           default_path[PATH_MAX+1];
+
+  if ( NULL == ( scan = tchscan_open( path ) ) ) {
+    return 1;
+  }
+  if ( NULL == idx_path ) {
+    if ( !tchidx_path( scan->path, default_path, sizeof( default_path ) ) ) {
+      return 1;
+    }
+    idx_path = default_path;
+  }
+  if ( NULL == ( idx = tchidx_open( idx_path, scan, &why ) ) ) {
+    fprintf( stderr, "Not using %s, %s, walking the buckets\n", idx_path, why );
+  }
+
+  raw = raw || !( scan->hdr.options & TCH_OPT_DEFLATE );
+  if ( !raw ) {
+    memset( &zs, 0, sizeof( zs ) );
+    inflateInit2( &zs, -15 );
+    buf = (char*)malloc( buf_size );
+  }
+
+  for ( int i = 0 ; i < nkeys ; i++ ) {
+    uint32_t ksiz  = strlen( keys[i] );
+    bool     found = ( NULL != idx ) ? tchidx_get( idx, scan, keys[i], ksiz, &rec )
+                                     : tchscan_lookup( scan, keys[i], ksiz, &rec );
+    int      size;
+
+    if ( !found ) {
+      fprintf( stderr, "%s not found\n", keys[i] );
+      missing += 1;
+      continue;
+    }
+    if ( raw ) {
+      fwrite( rec.val_buf, 1, rec.val_size, stdout );
+    } else if ( ( size = tchscan_inflate( &zs, rec.val_buf, rec.val_size, &buf, &buf_size ) ) < 0 ) {
+      fprintf( stderr, "%s at %llu does not inflate\n", keys[i], (long long unsigned)rec.offset );
+      missing += 1;
+      continue;
+    } else {
+      fwrite( buf, 1, size, stdout );
+    }
+    fputc( '\n', stdout );
+  }
+
+  if ( !raw ) {
+    inflateEnd( &zs );
+    free( buf );
+  }
+  tchidx_close( idx );
+  tchscan_close( scan );
+  return missing > 0 ? 1 : 0;
+}
+
+typedef struct index_side {
+  tchscan_t *scan;
+  tchidx_t  *idx;
+  uint64_t   at;                                /* next entry           */
+  uint64_t   run_end;                           /* past the same hash   */
+  bool      *matched;                           /* of the run, for b    */
+} index_side_t;
+
+static bool index_diff_open( index_side_t* side, const char* path )
+{
+  const char *why;
+  char        idx_path[PATH_MAX+1];
+
+  memset( side, 0, sizeof( *side ) );
+  if ( NULL == ( side->scan = tchscan_open( path ) ) ) {
+    return false;
+  }
+  if ( !tchidx_path( side->scan->path, idx_path, sizeof( idx_path ) ) ) {
+    return false;
+  }
+  if ( NULL == ( side->idx = tchidx_open( idx_path, side->scan, &why ) ) ) {
+    fprintf( stderr, "Can not use %s, %s, tchindex build %s first\n", idx_path, why, path );
+    return false;
+  }
+  return true;
+}
+
+static void index_diff_print( char mark, index_side_t* side, uint64_t i )
+{
+  tchscan_rec_t rec;
+
+  if ( !tchscan_read_at( side->scan, side->idx->entries[i].offset, &rec ) ) {
+    fprintf( stderr, "Can not read the record at %llu of %s\n",
+             (long long unsigned)side->idx->entries[i].offset, side->scan->path );
+    return;
+  }
+  fprintf( stdout, "%c\t", mark );
+  print_key( stdout, rec.key_buf, rec.key_size );
+  fputc( '\n', stdout );
+}
+
+/*
+ * Merge the indexes of a and b, keys are compared in key hash order and
+ * only read from the databases for entries with the same hash.  Values are
+ * compared as they are stored.
+ */
+int index_diff( const char* path_a, const char* path_b )
+{
+  index_side_t a, b;
+  uint64_t     only_a = 0, only_b = 0, differ = 0, same = 0;
+  uint64_t     matched_size = 0;
+
+  if ( !index_diff_open( &a, path_a ) || !index_diff_open( &b, path_b ) ) {
+    return 2;
+  }
+
+  while ( a.at < a.idx->count || b.at < b.idx->count ) {
+    uint64_t ha = ( a.at < a.idx->count ) ? a.idx->entries[a.at].hash : UINT64_MAX;
+    uint64_t hb = ( b.at < b.idx->count ) ? b.idx->entries[b.at].hash : UINT64_MAX;
+
+    if ( a.at < a.idx->count && ( b.at == b.idx->count || ha < hb ) ) {
+      index_diff_print( '-', &a, a.at++ );
+      only_a += 1;
+      continue;
+    }
+    if ( a.at == a.idx->count || hb < ha ) {
+      index_diff_print( '+', &b, b.at++ );
+      only_b += 1;
+      continue;
+    }
+
+    // the same hash on both sides, almost always one key each
+    for ( a.run_end = a.at ; a.run_end < a.idx->count && a.idx->entries[a.run_end].hash == ha ; a.run_end++ );
+    for ( b.run_end = b.at ; b.run_end < b.idx->count && b.idx->entries[b.run_end].hash == hb ; b.run_end++ );
+    if ( b.run_end - b.at > matched_size ) {
+      matched_size = b.run_end - b.at;
+      b.matched    = (bool*)realloc( b.matched, matched_size * sizeof( bool ) );
+    }
+    memset( b.matched, 0, ( b.run_end - b.at ) * sizeof( bool ) );
+
+    for ( uint64_t i = a.at ; i < a.run_end ; i++ ) {
+      tchscan_rec_t ra, rb;
+      bool          found = false;
+
+      if ( !tchscan_read_at( a.scan, a.idx->entries[i].offset, &ra ) ) {
+        fprintf( stderr, "Can not read the record at %llu of %s\n",
+                 (long long unsigned)a.idx->entries[i].offset, a.scan->path );
+        return 2;
+      }
+      for ( uint64_t j = b.at ; j < b.run_end && !found ; j++ ) {
+        if ( b.matched[j - b.at] || b.idx->entries[j].key_size != ra.key_size ||
+             !tchscan_read_at( b.scan, b.idx->entries[j].offset, &rb ) ||
+             0 != memcmp( ra.key_buf, rb.key_buf, ra.key_size ) ) {
+          continue;
+        }
+        found                = true;
+        b.matched[j - b.at]  = true;
+        if ( ra.val_size == rb.val_size && 0 == memcmp( ra.val_buf, rb.val_buf, ra.val_size ) ) {
+          same += 1;
+        } else {
+          index_diff_print( '~', &a, i );
+          differ += 1;
+        }
+      }
+      if ( !found ) {
+        index_diff_print( '-', &a, i );
+        only_a += 1;
+      }
+    }
+    for ( uint64_t j = b.at ; j < b.run_end ; j++ ) {
+      if ( !b.matched[j - b.at] ) {
+        index_diff_print( '+', &b, j );
+        only_b += 1;
+      }
+    }
+    a.at = a.run_end;
+    b.at = b.run_end;
+  }
+
+  fprintf( stderr, "%llu keys only in %s, %llu only in %s, %llu with different values, %llu the same\n",
+           (long long unsigned)only_a, a.scan->path, (long long unsigned)only_b, b.scan->path,
+           (long long unsigned)differ, (long long unsigned)same );
+
+  free( b.matched );
+  tchidx_close( a.idx );
+  tchidx_close( b.idx );
+  tchscan_close( a.scan );
+  tchscan_close( b.scan );
+  return ( only_a + only_b + differ > 0 ) ? 1 : 0;
+}
+
+void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options] build db.tch\n", name );
+  fprintf( stderr, "       %s [options] get db.tch key ...\n", name );
+  fprintf( stderr, "       %s diff a.tch b.tch\n", name );
+  fprintf( stderr, "  -o, --index FILE    the index ( default the database's path with %s )\n", TCHIDX_SUFFIX );
+  fprintf( stderr, "  -t, --threads N     threads reading the database for build ( default %d )\n", INDEX_THREADS );
+  fprintf( stderr, "  -b, --bloom         build writes the tchbloom filter too\n" );
+  fprintf( stderr, "  -f, --force         build for a database that is marked open\n" );
+  fprintf( stderr, "  -r, --raw           get prints values as stored, without inflating them\n" );
+  fprintf( stderr, "  -q, --quiet         no progress on stderr\n" );
+  fprintf( stderr, "\n" );
+  fprintf( stderr, "  diff prints -, + or ~ and a tab before each key only in a, only in b or with\n" );
+  fprintf( stderr, "  a different value, and exits 1 if there are any.\n" );
+}
+
+int main( int argc, char** argv )
+{
+  const char *idx_path = NULL;
+  int         threads  = INDEX_THREADS;
+  bool        bloom    = false;
+  bool        force    = false;
+  bool        raw      = false;
+  bool        quiet    = false;
+  const char *command;
+  int         opt;
+
+  struct option long_options[] = {
+    { "index",   required_argument, NULL, 'o' },
+    { "threads", required_argument, NULL, 't' },
+    { "bloom",   no_argument,       NULL, 'b' },
+    { "force",   no_argument,       NULL, 'f' },
+    { "raw",     no_argument,       NULL, 'r' },
+    { "quiet",   no_argument,       NULL, 'q' },
+    { NULL,      0,                 NULL,  0  }
+  };
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "o:t:bfrq", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'o': idx_path = optarg; break;
+      case 't': threads  = atoi( optarg ); break;
+      case 'b': bloom    = true; break;
+      case 'f': force    = true; break;
+      case 'r': raw      = true; break;
+      case 'q': quiet    = true; break;
+      default :
+        usage( argv[0] );
+        exit(1);
+    }
+  }
+
+  if ( optind + 2 > argc || threads < 1 ) {
+    usage( argv[0] );
+    exit(1);
+  }
+  command = argv[optind];
+
+  if ( 0 == strcmp( command, "build" ) && optind + 2 == argc ) {
+    exit( index_build( argv[optind + 1], idx_path, threads, bloom, force, quiet ) );
+  } else if ( 0 == strcmp( command, "get" ) && optind + 3 <= argc ) {
+    exit( index_get( argv[optind + 1], idx_path, argv + optind + 2, argc - optind - 2, raw ) );
+  } else if ( 0 == strcmp( command, "diff" ) && optind + 3 == argc ) {
+    exit( index_diff( argv[optind + 1], argv[optind + 2] ) );
+  }
+  usage( argv[0] );
+  exit(1);
+}
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "tchhdr.h"
+
+/*
+ * The header of every database named, straight from the first 256 bytes of
+ * the file without a tchdbopen, so it takes no lock and costs one small
+ * read whatever the size of the file.  The files are read by --threads
+ * threads at once, which is what matters across thousands of them on
+ * spinning or network disks, and reported in the order given, as a table or
+ * as one JSON object a line.
+ *
+ * What examine.rb printed, plus the sizes that follow from it: the load
+ * factor ( records per bucket ), the bucket array and free block pool bytes,
+ * and whether the size on disk is the one the header has.
+ */
+
+#define INFO_THREADS 16
+
+void print_json_string( FILE* out, const char* s );
+
+typedef struct info {
+  const char *path;
+  tchhdr_t    hdr;
+  uint64_t    disk_size;        /* from fstat                    */
+  int         error;            /* errno, 0 if the header was read */
+} info_t;
+
+typedef struct info_run {
+  info_t   *infos;
+  uint64_t  count;
+  uint64_t  next;               /* the next file to read         */
+} info_run_t;
+
+void info_read( info_t* info )
+{
+  struct stat st;
+  int         fd;
+
+  if ( -1 == ( fd = open( info->path, O_RDONLY ) ) ) {
+    info->error = errno;
+    return;
+  }
+  if ( !tchhdr_read_any( fd, &(info->hdr) ) || -1 == fstat( fd, &st ) ) {
+    info->error = errno;
+  } else {
+    info->disk_size = st.st_size;
+  }
+  close( fd );
+}
+
+void* info_thread( void* arg )
+{
+  info_run_t *run = (info_run_t*)arg;
+  uint64_t    i;
+
+  while ( ( i = __atomic_fetch_add( &(run->next), 1, __ATOMIC_RELAXED ) ) < run->count ) {
+    info_read( &(run->infos[i]) );
+  }
+  return NULL;
+}
+
+/*
+ * the "1.0:911" after the magic words, library and format version
+ */
+void info_version( const tchhdr_t* hdr, char* buf, size_t size )
+{
+  const char *p = hdr->magic + strlen( TCH_MAGIC );
+  size_t      n = 0;
+
+  while ( '\n' == *p ) {
+    p++;
+  }
+  while ( '\0' != p[n] && '\n' != p[n] && n + 1 < size ) {
+    buf[n] = p[n];
+    n++;
+  }
+  buf[n] = '\0';
+}
+
+void info_options( uint8_t options, char* buf, size_t size )
+{
+  snprintf( buf, size, "%s%s%s%s%s",
+            ( options & TCH_OPT_LARGE )   ? "L" : "-",
+            ( options & TCH_OPT_DEFLATE ) ? "D" : "-",
+            ( options & TCH_OPT_BZIP2 )   ? "B" : "-",
+            ( options & TCH_OPT_TCBS )    ? "T" : "-",
+            ( options & TCH_OPT_EXCODEC ) ? "X" : "-" );
+}
+
+double info_load( const tchhdr_t* hdr )
+{
+  return ( hdr->bucket_number > 0 ) ? hdr->record_number / (double)hdr->bucket_number : 0.0;
+}
+
+void print_table_header( FILE* out )
+{
+  fprintf( out, "%-6s %-11s %-11s %-5s %4s %4s %14s %14s %7s %14s %14s %14s  %s\n",
+           "type", "version", "flags", "opts", "apow", "fpow", "buckets", "records", "load",
+           "bucket bytes", "first record", "size", "path" );
+}
+
+void print_table_row( FILE* out, const info_t* info )
+{
+  const tchhdr_t *hdr = &(info->hdr);
+  char            version[16];
+  char            options[8];
+  char            flags[16];
+
+  if ( 0 != info->error ) {
+    fprintf( out, "%-6s %-11s %-11s %-5s %4s %4s %14s %14s %7s %14s %14s %14s  %s ( %s )\n",
+             "-", "-", "-", "-", "-", "-", "-", "-", "-", "-", "-", "-", info->path,
+             tchhdr_error( info->error ) );
+    return;
+  }
+
+  info_version( hdr, version, sizeof( version ) );
+  info_options( hdr->options, options, sizeof( options ) );
+  snprintf( flags, sizeof( flags ), "%s%s%s",
+            ( hdr->flags & TCH_FLAG_OPEN )  ? "open" : "",
+            ( ( hdr->flags & TCH_FLAG_OPEN ) && ( hdr->flags & TCH_FLAG_FATAL ) ) ? "," : "",
+            ( hdr->flags & TCH_FLAG_FATAL ) ? "FATAL" : "" );
+
+  fprintf( out, "%-6s %-11s %-11s %-5s %4d %4d %14llu %14llu %7.3f %14llu %14llu %14llu  %s%s\n",
+           tchhdr_type_name( hdr->db_type ), version, ( '\0' == flags[0] ) ? "-" : flags, options,
+           hdr->alignment_pow, hdr->free_block_pow,
+           (long long unsigned)hdr->bucket_number, (long long unsigned)hdr->record_number, info_load( hdr ),
+           (long long unsigned)tchhdr_bucket_bytes( hdr ), (long long unsigned)hdr->first_record,
+           (long long unsigned)info->disk_size, info->path,
+           ( info->disk_size != hdr->file_size ) ? " ( size on disk differs from the header )" : "" );
+}
+
+void print_json_row( FILE* out, const info_t* info )
+{
+  const tchhdr_t *hdr = &(info->hdr);
+  char            version[16];
+
+  fprintf( out, "{\"path\":" );
+  print_json_string( out, info->path );
+  if ( 0 != info->error ) {
+    fprintf( out, ",\"error\":\"%s\"}\n", tchhdr_error( info->error ) );
+    return;
+  }
+
+  info_version( hdr, version, sizeof( version ) );
+  fprintf( out, ",\"type\":\"%s\",\"version\":\"%s\",\"open\":%s,\"fatal\":%s"
+                ",\"large\":%s,\"deflate\":%s,\"bzip2\":%s,\"tcbs\":%s,\"excodec\":%s"
+                ",\"alignment_pow\":%d,\"free_block_pow\":%d,\"bucket_number\":%llu,\"record_number\":%llu"
+                ",\"load_factor\":%.4f,\"bucket_bytes\":%llu,\"free_pool_bytes\":%llu,\"first_record\":%llu"
+                ",\"file_size\":%llu,\"disk_size\":%llu}\n",
+           tchhdr_type_name( hdr->db_type ), version,
+           ( hdr->flags & TCH_FLAG_OPEN )      ? "true" : "false",
+           ( hdr->flags & TCH_FLAG_FATAL )     ? "true" : "false",
+           ( hdr->options & TCH_OPT_LARGE )    ? "true" : "false",
+           ( hdr->options & TCH_OPT_DEFLATE )  ? "true" : "false",
+           ( hdr->options & TCH_OPT_BZIP2 )    ? "true" : "false",
+           ( hdr->options & TCH_OPT_TCBS )     ? "true" : "false",
+           ( hdr->options & TCH_OPT_EXCODEC )  ? "true" : "false",
+           hdr->alignment_pow, hdr->free_block_pow,
+           (long long unsigned)hdr->bucket_number, (long long unsigned)hdr->record_number, info_load( hdr ),
+           (long long unsigned)tchhdr_bucket_bytes( hdr ), (long long unsigned)tchhdr_free_pool_bytes( hdr ),
+           (long long unsigned)hdr->first_record, (long long unsigned)hdr->file_size,
+           (long long unsigned)info->disk_size );
+}
+
+/*
+ * one path a line, from FILE or from stdin for "-", for more files than
+ * fit on a command line
+ */
+bool read_path_list( const char* list_path, const char*** paths, uint64_t* count, uint64_t* capacity )
+{
+  FILE   *f    = ( 0 == strcmp( list_path, "-" ) ) ? stdin : fopen( list_path, "r" );
+  char   *line = NULL;
+  size_t  size = 0;
+  ssize_t len;
+
+  if ( NULL == f ) {
+    fprintf( stderr, "open error on %s : %s\n", list_path, strerror( errno ) );
+    return false;
+  }
+  while ( -1 != ( len = getline( &line, &size, f ) ) ) {
+    while ( len > 0 && ( '\n' == line[len - 1] || '\r' == line[len - 1] ) ) {
+      line[--len] = '\0';
+    }
+    if ( 0 == len ) {
+      continue;
+    }
+    if ( *count == *capacity ) {
+      *capacity = ( *capacity > 0 ) ? *capacity * 2 : 1024;
+      *paths    = (const char**)realloc( *paths, *capacity * sizeof( const char* ) );
+    }
+    (*paths)[(*count)++] = strdup( line );
+  }
+  free( line );
+  if ( stdin != f ) {
+    fclose( f );
+  }
+  return true;
+}
+
+void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options] database.tch ...\n", name );
+  fprintf( stderr, "  -j, --json             one JSON object a line instead of the table\n" );
+  fprintf( stderr, "  -f, --files-from FILE  also the paths in FILE, one a line, - for stdin\n" );
+  fprintf( stderr, "  -t, --threads N        read N headers at once ( default %d )\n", INFO_THREADS );
+}
+
+int main( int argc, char** argv )
+{
+  const char **paths     = NULL;
+  uint64_t     count     = 0;
+  uint64_t     capacity  = 0;
+  const char  *list_path = NULL;
+  bool         json      = false;
+  int          threads   = INFO_THREADS;
+  uint64_t     failed    = 0;
+  uint64_t     records   = 0;
+  uint64_t     bytes     = 0;
+  uint64_t     dirty     = 0;
+  info_run_t   run;
+  pthread_t   *tids;
+  int          opt;
+
+  struct option long_options[] = {
+    { "json",       no_argument,       NULL, 'j' },
+    { "files-from", required_argument, NULL, 'f' },
+    { "threads",    required_argument, NULL, 't' },
+    { NULL,         0,                 NULL,  0  }
+  };
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "jf:t:", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'j': json      = true; break;
+      case 'f': list_path = optarg; break;
+      case 't': threads   = atoi( optarg ); break;
+      default :
+        usage( argv[0] );
+        exit(1);
+    }
+  }
+
+  for ( int i = optind ; i < argc ; i++ ) {
+    if ( count == capacity ) {
+      capacity = ( capacity > 0 ) ? capacity * 2 : 1024;
+      paths    = (const char**)realloc( paths, capacity * sizeof( const char* ) );
+    }
+    paths[count++] = argv[i];
+  }
+  if ( NULL != list_path && !read_path_list( list_path, &paths, &count, &capacity ) ) {
+    exit(1);
+  }
+  if ( 0 == count || threads < 1 ) {
+    usage( argv[0] );
+    exit(1);
+  }
+
+  run.infos = (info_t*)calloc( count, sizeof( info_t ) );
+  run.count = count;
+  run.next  = 0;
+  for ( uint64_t i = 0 ; i < count ; i++ ) {
+    run.infos[i].path = paths[i];
+  }
+
+  if ( (uint64_t)threads > count ) {
+    threads = count;
+  }
+  tids = (pthread_t*)calloc( threads, sizeof( pthread_t ) );
+  for ( int i = 1 ; i < threads ; i++ ) {
+    pthread_create( &(tids[i]), NULL, info_thread, &run );
+  }
+  info_thread( &run );
+  for ( int i = 1 ; i < threads ; i++ ) {
+    pthread_join( tids[i], NULL );
+  }
+
+  if ( !json ) {
+    print_table_header( stdout );
+  }
+  for ( uint64_t i = 0 ; i < count ; i++ ) {
+    info_t *info = &(run.infos[i]);
+    if ( json ) {
+      print_json_row( stdout, info );
+    } else {
+      print_table_row( stdout, info );
+    }
+    if ( 0 != info->error ) {
+      failed += 1;
+      continue;
+    }
+    records += info->hdr.record_number;
+    bytes   += info->disk_size;
+    if ( info->hdr.flags & ( TCH_FLAG_OPEN | TCH_FLAG_FATAL ) ) {
+      dirty += 1;
+    }
+  }
+
+  fprintf( stderr, "%llu files, %llu records, %llu bytes, %llu open or fatal, %llu unreadable\n",
+           (long long unsigned)count, (long long unsigned)records, (long long unsigned)bytes,
+           (long long unsigned)dirty, (long long unsigned)failed );
+
+  free( tids );
+  free( run.infos );
+  exit( ( failed > 0 ) ? 1 : 0 );
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tcutil.h>
+#include <tchdb.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "tchhdr.h"
+#include "tchstream.h"
+
+/*
+ * Build a fresh hash database from a tchdump stream on stdin or a file.
+ *
+ * This is the quickest way in we have through the library: the database is
+ * created truncated, with no locking, tuned like the source was ( or as
+ * given ), with the whole bucket array in the mapped region and every record
+ * written with tchdbputasync.  Values that were dumped still deflated are
+ * stored as is with the same keep_compressed trick tchsplit uses, so they
+ * are not inflated and deflated again.
+ */
+
+void print_progress( FILE* file, time_t start_time, long long unsigned final, long long unsigned so_far );
+
+TCHDB* load_open_db( const char* path, const tchstream_header_t* hdr, int64_t bnum, int apow, int fpow, int64_t xmsiz )
+{
+  TCHDB   *hdb = tchdbnew();
+  uint64_t bucket_bytes;
+
+  if ( bnum <= 0 ) {
+    bnum = hdr->bucket_number;
+  }
+  if ( apow < 0 ) {
+    apow = hdr->alignment_pow;
+  }
+  if ( fpow < 0 ) {
+    fpow = hdr->free_block_pow;
+  }
+
+  // the bucket array lives in the mapped region, never go through pread for it
+  bucket_bytes = TCH_HEADER_SIZE + bnum * ( ( hdr->options & HDBTLARGE ) ? 8 : 4 );
+  if ( xmsiz <= 0 ) {
+    xmsiz = ( bucket_bytes > 64 * 1024 * 1024 ) ? bucket_bytes + 64 * 1024 * 1024 : 64 * 1024 * 1024;
+  }
+
+  tchdbtune( hdb, bnum, apow, fpow, hdr->options );
+  tchdbsetxmsiz( hdb, xmsiz );
+
+  if ( !tchdbopen( hdb, path, HDBOWRITER | HDBOCREAT | HDBOTRUNC | HDBONOLCK ) ) {
+    int ecode = tchdbecode( hdb );
+    fprintf( stderr, "open error on %s : %s\n", path, tchdberrmsg( ecode ));
+    tchdbdel( hdb );
+    return NULL;
+  }
+
+  if ( hdr->flags & TCHSTREAM_DEFLATED ) {
+    hdb->zmode = false;
+    hdb->opts  = hdb->opts & ( ~HDBTDEFLATE );
+  }
+  return hdb;
+}
+
+bool load_close_db( TCHDB* hdb, const tchstream_header_t* hdr )
+{
+  bool ok;
+
+  // put the deflate option back so the header written on close has it
+  if ( hdr->flags & TCHSTREAM_DEFLATED ) {
+    hdb->zmode = true;
+    hdb->opts  = hdb->opts | HDBTDEFLATE;
+  }
+  if ( !( ok = tchdbclose( hdb ) ) ) {
+    int ecode = tchdbecode( hdb );
+    fprintf( stderr, "close error : %s\n", tchdberrmsg( ecode ));
+  }
+  tchdbdel( hdb );
+  return ok;
+}
+
+void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options] new.tch\n", name );
+  fprintf( stderr, "  -i, --input FILE     read the stream from FILE instead of stdin\n" );
+  fprintf( stderr, "  -b, --bnum N         bucket number ( default that of the source )\n" );
+  fprintf( stderr, "  -a, --apow N         alignment power ( default that of the source )\n" );
+  fprintf( stderr, "  -f, --fpow N         free block pool power ( default that of the source )\n" );
+  fprintf( stderr, "  -x, --xmsiz BYTES    size of the mapped region ( default the bucket array + 64MB )\n" );
+  fprintf( stderr, "  -q, --quiet          no progress on stderr\n" );
+}
+
+int main( int argc, char** argv )
+{
+  const char         *input_path = NULL;
+  int64_t             bnum       = 0;
+  int                 apow       = -1;
+  int                 fpow       = -1;
+  int64_t             xmsiz      = 0;
+  bool                quiet      = false;
+  int                 fd         = STDIN_FILENO;
+  tchstream_reader_t  reader;
+  TCHDB              *hdb;
+  const char         *kbuf;
+  const char         *vbuf;
+  uint32_t            ksiz;
+  uint32_t            vsiz;
+  int                 rv;
+  int                 opt;
+
+  struct option long_options[] = {
+    { "input", required_argument, NULL, 'i' },
+    { "bnum",  required_argument, NULL, 'b' },
+    { "apow",  required_argument, NULL, 'a' },
+    { "fpow",  required_argument, NULL, 'f' },
+    { "xmsiz", required_argument, NULL, 'x' },
+    { "quiet", no_argument,       NULL, 'q' },
+    { NULL,    0,                 NULL,  0  }
+  };
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "i:b:a:f:x:q", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'i': input_path = optarg; break;
+      case 'b': bnum       = strtoll( optarg, NULL, 0 ); break;
+      case 'a': apow       = atoi( optarg ); break;
+      case 'f': fpow       = atoi( optarg ); break;
+      case 'x': xmsiz      = strtoll( optarg, NULL, 0 ); break;
+      case 'q': quiet      = true; break;
+      default :
+        usage( argv[0] );
+        exit(1);
+    }
+  }
+
+  if ( optind >= argc ) {
+    usage( argv[0] );
+    exit(1);
+  }
+
+  if ( NULL != input_path && 0 != strcmp( input_path, "-" ) ) {
+    if ( -1 == ( fd = open( input_path, O_RDONLY ) ) ) {
+      fprintf( stderr, "open error on %s : %s\n", input_path, strerror( errno ));
+      exit(1);
+    }
+    posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+  }
+
+  if ( !tchstream_reader_open( &reader, fd ) ) {
+    exit(1);
+  }
+
+  if ( NULL == ( hdb = load_open_db( argv[optind], &(reader.hdr), bnum, apow, fpow, xmsiz ) ) ) {
+    exit(1);
+  }
+
+  time_t start = time(NULL);
+  while ( 1 == ( rv = tchstream_next( &reader, &kbuf, &ksiz, &vbuf, &vsiz ) ) ) {
+    if ( !tchdbputasync( hdb, kbuf, ksiz, vbuf, vsiz ) ) {
+      int ecode = tchdbecode( hdb );
+      fprintf( stderr, "\nput error : %s\n", tchdberrmsg( ecode ));
+      rv = -1;
+      break;
+    }
+    if ( !quiet && 0 == ( reader.records % 100000 ) ) {
+      print_progress( stderr, start, reader.hdr.record_number, reader.records );
+    }
+  }
+
+  if ( !load_close_db( hdb, &(reader.hdr) ) ) {
+    rv = -1;
+  }
+  if ( -1 == rv ) {
+    fprintf( stderr, "\nLoad into %s failed after %llu records\n", argv[optind], (long long unsigned)reader.records );
+    exit(1);
+  }
+
+  if ( !quiet ) {
+    fprintf( stderr, "\nLoaded %llu records in %llu blocks, %llu bytes into %s\n",
+             (long long unsigned)reader.records, (long long unsigned)reader.blocks,
+             (long long unsigned)reader.bytes, argv[optind] );
+  }
+
+  tchstream_reader_close( &reader );
+  if ( STDIN_FILENO != fd ) {
+    close( fd );
+  }
+  exit(0);
+}
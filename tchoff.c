@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tchhdr.h"
+#include "tchoff.h"
+#include "tchstream.h"
+
+static int put_varint( uint8_t* p, uint64_t v )
+{
+  int n = 0;
+  while ( v >= 0x80 ) {
+    p[n++] = (uint8_t)( v | 0x80 );
+    v >>= 7;
+  }
+  p[n++] = (uint8_t)v;
+  return n;
+}
+
+/*
+ * returns the bytes consumed or 0 if it runs past end
+ */
+static int get_varint( const uint8_t* p, const uint8_t* end, uint64_t* v )
+{
+  uint64_t num   = 0;
+  int      shift = 0;
+
+  for ( int n = 0 ; p + n < end && n < 10 ; n++ ) {
+    num |= (uint64_t)( p[n] & 0x7f ) << shift;
+    if ( 0 == ( p[n] & 0x80 ) ) {
+      *v = num;
+      return n + 1;
+    }
+    shift += 7;
+  }
+  return 0;
+}
+
+static int entry_cmp( const void* a, const void* b )
+{
+  uint64_t x = ((const tchoff_entry_t*)a)->offset;
+  uint64_t y = ((const tchoff_entry_t*)b)->offset;
+  return ( x > y ) - ( x < y );
+}
+
+static int index_cmp( const void* a, const void* b )
+{
+  uint64_t x = ((const tchoff_index_t*)a)->first_bucket;
+  uint64_t y = ((const tchoff_index_t*)b)->first_bucket;
+  return ( x > y ) - ( x < y );
+}
+
+bool tchoff_write_header( int fd, uint8_t alignment_pow, uint64_t bucket_number )
+{
+  uint8_t buf[TCHOFF_HEADER_SIZE];
+
+  memset( buf, 0, sizeof( buf ) );
+  memcpy( buf, TCHOFF_MAGIC, strlen( TCHOFF_MAGIC ) );
+  buf[8] = TCHOFF_VERSION;
+  buf[9] = alignment_pow;
+  tchhdr_put_le( buf + 16, bucket_number, 8 );
+  return tchstream_write_fully( fd, buf, sizeof( buf ) );
+}
+
+uint64_t tchoff_encode_block( uint8_t* out, uint64_t first_bucket, tchoff_entry_t* entries,
+                              uint32_t count, uint8_t alignment_pow )
+{
+  uint8_t  *p    = out + TCHOFF_FRAME_SIZE;
+  uint64_t  last = 0;
+
+  qsort( entries, count, sizeof( tchoff_entry_t ), entry_cmp );
+  for ( uint32_t i = 0 ; i < count ; i++ ) {
+    uint64_t units = entries[i].offset >> alignment_pow;
+    p   += put_varint( p, units - last );
+    p   += put_varint( p, entries[i].bucket - first_bucket );
+    last = units;
+  }
+
+  tchhdr_put_le( out, first_bucket, 8 );
+  tchhdr_put_le( out + 8, count, 4 );
+  tchhdr_put_le( out + 12, p - ( out + TCHOFF_FRAME_SIZE ), 4 );
+  return p - out;
+}
+
+bool tchoff_write_index( int fd, tchoff_index_t* index, uint64_t blocks, uint64_t pos )
+{
+  uint8_t  buf[TCHOFF_INDEX_SIZE];
+  uint64_t entries = 0;
+
+  qsort( index, blocks, sizeof( tchoff_index_t ), index_cmp );
+  for ( uint64_t b = 0 ; b < blocks ; b++ ) {
+    tchhdr_put_le( buf, index[b].first_bucket, 8 );
+    tchhdr_put_le( buf + 8, index[b].pos, 8 );
+    tchhdr_put_le( buf + 16, index[b].count, 4 );
+    tchhdr_put_le( buf + 20, index[b].size, 4 );
+    if ( !tchstream_write_fully( fd, buf, TCHOFF_INDEX_SIZE ) ) {
+      return false;
+    }
+    entries += index[b].count;
+  }
+
+  tchhdr_put_le( buf, pos, 8 );
+  tchhdr_put_le( buf + 8, blocks, 8 );
+  tchhdr_put_le( buf + 16, entries, 8 );
+  return tchstream_write_fully( fd, buf, TCHOFF_TRAILER_SIZE );
+}
+
+bool tchoff_open( tchoff_reader_t* reader, const char* path )
+{
+  uint8_t     buf[TCHOFF_HEADER_SIZE];
+  uint8_t    *raw;
+  struct stat st;
+  uint64_t    pos;
+
+  memset( reader, 0, sizeof( *reader ) );
+  if ( -1 == ( reader->fd = open( path, O_RDONLY ) ) || 0 != fstat( reader->fd, &st ) ) {
+    fprintf( stderr, "open error on %s : %s\n", path, strerror( errno ) );
+    return false;
+  }
+
+  if ( TCHOFF_HEADER_SIZE != pread( reader->fd, buf, TCHOFF_HEADER_SIZE, 0 ) ||
+       0 != memcmp( buf, TCHOFF_MAGIC, strlen( TCHOFF_MAGIC ) + 1 ) ||
+       st.st_size < TCHOFF_HEADER_SIZE + TCHOFF_TRAILER_SIZE ) {
+    fprintf( stderr, "ERROR: %s is not a gen-offsets binary file\n", path );
+    close( reader->fd );
+    return false;
+  }
+  if ( buf[8] > TCHOFF_VERSION ) {
+    fprintf( stderr, "ERROR: %s is version %d, newer than this reader ( %d )\n", path, buf[8], TCHOFF_VERSION );
+    close( reader->fd );
+    return false;
+  }
+  reader->alignment_pow = buf[9];
+  reader->bucket_number = tchhdr_get_le( buf + 16, 8 );
+
+  if ( TCHOFF_TRAILER_SIZE != pread( reader->fd, buf, TCHOFF_TRAILER_SIZE, st.st_size - TCHOFF_TRAILER_SIZE ) ) {
+    fprintf( stderr, "read error on %s : %s\n", path, strerror( errno ) );
+    close( reader->fd );
+    return false;
+  }
+  pos             = tchhdr_get_le( buf, 8 );
+  reader->blocks  = tchhdr_get_le( buf + 8, 8 );
+  reader->entries = tchhdr_get_le( buf + 16, 8 );
+  // the block count first, so a garbage one can not wrap the sum below
+  if ( reader->blocks > (uint64_t)( st.st_size - TCHOFF_HEADER_SIZE - TCHOFF_TRAILER_SIZE ) / TCHOFF_INDEX_SIZE ||
+       pos < TCHOFF_HEADER_SIZE ||
+       pos + reader->blocks * TCHOFF_INDEX_SIZE + TCHOFF_TRAILER_SIZE != (uint64_t)st.st_size ) {
+    fprintf( stderr, "ERROR: %s was cut off, the index is not where the trailer says\n", path );
+    close( reader->fd );
+    return false;
+  }
+
+  raw           = (uint8_t*)malloc( reader->blocks * TCHOFF_INDEX_SIZE + 1 );
+  reader->index = (tchoff_index_t*)malloc( reader->blocks * sizeof( tchoff_index_t ) + 1 );
+  reader->buf   = (uint8_t*)malloc( TCHOFF_MAX_PAYLOAD );
+  if ( NULL == raw || NULL == reader->index || NULL == reader->buf ) {
+    fprintf( stderr, "ERROR: out of memory for the index of %s\n", path );
+    free( raw );
+    tchoff_close( reader );
+    return false;
+  }
+  if ( (ssize_t)( reader->blocks * TCHOFF_INDEX_SIZE ) != pread( reader->fd, raw, reader->blocks * TCHOFF_INDEX_SIZE, pos ) ) {
+    fprintf( stderr, "read error on %s : %s\n", path, strerror( errno ) );
+    free( raw );
+    tchoff_close( reader );
+    return false;
+  }
+  for ( uint64_t b = 0 ; b < reader->blocks ; b++ ) {
+    const uint8_t  *p  = raw + b * TCHOFF_INDEX_SIZE;
+    tchoff_index_t *ix = &(reader->index[b]);
+    ix->first_bucket = tchhdr_get_le( p, 8 );
+    ix->pos          = tchhdr_get_le( p + 8, 8 );
+    ix->count        = (uint32_t)tchhdr_get_le( p + 16, 4 );
+    ix->size         = (uint32_t)tchhdr_get_le( p + 20, 4 );
+    // every block has to sit between the header and the index
+    if ( ix->count > TCHOFF_BLOCK_BUCKETS || ix->size > TCHOFF_MAX_PAYLOAD || ix->pos < TCHOFF_HEADER_SIZE ||
+         ix->pos > pos || pos - ix->pos < TCHOFF_FRAME_SIZE + (uint64_t)ix->size ) {
+      fprintf( stderr, "ERROR: %s has a corrupt index entry for block %llu\n", path, (long long unsigned)b );
+      free( raw );
+      tchoff_close( reader );
+      return false;
+    }
+  }
+  free( raw );
+  return true;
+}
+
+bool tchoff_read_block( tchoff_reader_t* reader, uint64_t b, tchoff_entry_t* entries )
+{
+  tchoff_index_t *ix = &(reader->index[b]);
+  const uint8_t  *p;
+  const uint8_t  *end;
+  uint64_t        units = 0;
+  uint32_t        i;
+
+  if ( ix->count > TCHOFF_BLOCK_BUCKETS || ix->size > TCHOFF_MAX_PAYLOAD ||
+       (ssize_t)ix->size != pread( reader->fd, reader->buf, ix->size, ix->pos + TCHOFF_FRAME_SIZE ) ) {
+    fprintf( stderr, "ERROR: block %llu is short\n", (long long unsigned)b );
+    return false;
+  }
+
+  p   = reader->buf;
+  end = reader->buf + ix->size;
+  for ( i = 0 ; i < ix->count ; i++ ) {
+    uint64_t delta;
+    uint64_t bucket;
+    int      step;
+    if ( 0 == ( step = get_varint( p, end, &delta ) ) ) {
+      break;
+    }
+    p += step;
+    if ( 0 == ( step = get_varint( p, end, &bucket ) ) ) {
+      break;
+    }
+    p += step;
+    units            += delta;
+    entries[i].offset = units << reader->alignment_pow;
+    entries[i].bucket = ix->first_bucket + bucket;
+  }
+  if ( i != ix->count || p != end ) {
+    fprintf( stderr, "ERROR: block %llu is corrupt\n", (long long unsigned)b );
+    return false;
+  }
+  return true;
+}
+
+void tchoff_close( tchoff_reader_t* reader )
+{
+  free( reader->index );
+  free( reader->buf );
+  reader->index = NULL;
+  reader->buf   = NULL;
+  if ( -1 != reader->fd ) {
+    close( reader->fd );
+    reader->fd = -1;
+  }
+}
@@ -0,0 +1,105 @@
+#ifndef __TCHOFF_H__
+#define __TCHOFF_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * The binary bucket offset file gen-offsets --binary writes and
+ * check-offsets reads, the non empty entries of a hash database's bucket
+ * array.
+ *
+ * header, 32 bytes ( numbers little endian ):
+ *
+ *    0  magic             8 bytes  "TCHOFFS\0"
+ *    8  version           1 byte
+ *    9  alignment power   1 byte   of the database
+ *   16  bucket number     8 bytes
+ *
+ * then blocks, each covering TCHOFF_BLOCK_BUCKETS buckets ( fewer for the
+ * last one ), in no particular order:
+ *
+ *    first bucket         8 bytes
+ *    entry count          4 bytes
+ *    payload length       4 bytes
+ *    payload              [varint delta][varint bucket - first bucket] per entry
+ *
+ * The entries of a block are sorted by offset, and the delta is the offset
+ * in alignment units less the one before it ( 0 for the first ), LEB128 like
+ * tchstream.
+ *
+ * then the index, one 24 byte entry per block sorted by first bucket:
+ *
+ *    first bucket         8 bytes
+ *    position in file     8 bytes
+ *    entry count          4 bytes
+ *    payload length       4 bytes
+ *
+ * and a 24 byte trailer: the position of the index, the number of blocks and
+ * the number of entries, 8 bytes each.  Nothing needs a seek to write it,
+ * but reading it does.
+ */
+
+#define TCHOFF_MAGIC          "TCHOFFS"
+#define TCHOFF_VERSION        1
+#define TCHOFF_HEADER_SIZE    32
+#define TCHOFF_FRAME_SIZE     16
+#define TCHOFF_INDEX_SIZE     24
+#define TCHOFF_TRAILER_SIZE   24
+#define TCHOFF_BLOCK_BUCKETS  65536
+#define TCHOFF_MAX_PAYLOAD    ( TCHOFF_BLOCK_BUCKETS * 20 )   /* two 10 byte varints an entry */
+
+typedef struct tchoff_entry {
+  uint64_t offset;            /* file offset of the record, already shifted by the alignment */
+  uint64_t bucket;
+} tchoff_entry_t;
+
+typedef struct tchoff_index {
+  uint64_t first_bucket;
+  uint64_t pos;
+  uint32_t count;
+  uint32_t size;
+} tchoff_index_t;
+
+typedef struct tchoff_reader {
+  int             fd;
+  uint8_t         alignment_pow;
+  uint64_t        bucket_number;
+  tchoff_index_t *index;
+  uint64_t        blocks;
+  uint64_t        entries;
+  uint8_t        *buf;         /* one block's payload */
+} tchoff_reader_t;
+
+extern bool tchoff_write_header( int fd, uint8_t alignment_pow, uint64_t bucket_number );
+
+/*
+ * Sort count entries by offset and encode them as a block for the buckets
+ * from first_bucket on into out, which needs TCHOFF_FRAME_SIZE +
+ * TCHOFF_MAX_PAYLOAD bytes.  Returns the block's size.
+ */
+extern uint64_t tchoff_encode_block( uint8_t* out, uint64_t first_bucket, tchoff_entry_t* entries,
+                                     uint32_t count, uint8_t alignment_pow );
+
+/*
+ * Sort the index and write it and the trailer, pos is where the index
+ * starts in the file.
+ */
+extern bool tchoff_write_index( int fd, tchoff_index_t* index, uint64_t blocks, uint64_t pos );
+
+/*
+ * Open a file gen-offsets --binary wrote and read its index.  Prints why and
+ * returns false if it is not one.
+ */
+extern bool tchoff_open( tchoff_reader_t* reader, const char* path );
+
+/*
+ * Decode block b ( in bucket order ) into entries, which needs room for
+ * index[b].count of them.  They come back sorted by offset.  Returns false
+ * on a short or corrupt block, after printing why.
+ */
+extern bool tchoff_read_block( tchoff_reader_t* reader, uint64_t b, tchoff_entry_t* entries );
+
+extern void tchoff_close( tchoff_reader_t* reader );
+
+#endif
@@ -0,0 +1,319 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "tchpar.h"
+
+/*
+ * Does a run of well formed blocks start at offset?  The run may end early
+ * at the end of the record region.
+ */
+static bool tchpar_in_sync( tchscan_t* scan, uint64_t offset )
+{
+  uint64_t      align = 1ULL << scan->hdr.alignment_pow;
+  tchscan_rec_t rec;
+  uint8_t       hash;
+
+  for ( int i = 0 ; i < TCHPAR_SYNC_BLOCKS ; i++ ) {
+    if ( offset >= scan->end ) {
+      return true;
+    }
+    if ( !tchscan_read_at( scan, offset, &rec ) ) {
+      return false;
+    }
+    // every block starts on an alignment boundary, so every block is a multiple of it
+    if ( 0 != ( rec.length & ( align - 1 ) ) ) {
+      return false;
+    }
+    if ( TCH_MAGIC_DATA_BLOCK == rec.magic ) {
+      tchscan_bucket_for( scan->hdr.bucket_number, rec.key_buf, rec.key_size, &hash );
+      if ( hash != rec.hash ) {
+        return false;
+      }
+    }
+    offset += rec.length;
+  }
+  return true;
+}
+
+/*
+ * first aligned offset at or after nominal where a block starts
+ */
+static uint64_t tchpar_find_start( tchscan_t* scan, uint64_t nominal )
+{
+  uint64_t align  = 1ULL << scan->hdr.alignment_pow;
+  uint64_t offset = ( nominal + align - 1 ) & ~( align - 1 );
+
+  while ( offset < scan->end ) {
+    if ( tchpar_in_sync( scan, offset ) ) {
+      return offset;
+    }
+    offset += align;
+  }
+  return scan->end;
+}
+
+static void tchpar_scan_range( tchpar_range_t* range )
+{
+  tchpar_t      *par    = range->par;
+  tchscan_t     *scan   = range->scan;
+  uint64_t       align  = 1ULL << scan->hdr.alignment_pow;
+  uint64_t       offset = range->start;
+  tchscan_rec_t  rec;
+
+  while ( offset < range->limit && !par->stop ) {
+    if ( tchscan_read_at( scan, offset, &rec ) ) {
+      if ( TCH_MAGIC_DATA_BLOCK == rec.magic ) {
+        __atomic_store_n( &(range->cursor), offset, __ATOMIC_RELAXED );
+        if ( !par->callback( &rec, range->thread, par->ctx ) ) {
+          par->stop = true;
+        }
+        __atomic_store_n( &(range->records), range->records + 1, __ATOMIC_RELAXED );
+      } else {
+        int b = 64 - __builtin_clzll( rec.length );
+        range->free_blocks += 1;
+        range->free_bytes  += rec.length;
+        range->free_sizes[( b < TCHPAR_FREE_HIST ) ? b : TCHPAR_FREE_HIST - 1] += 1;
+      }
+      offset += rec.length;
+    } else {
+      uint64_t delta = align - ( offset % align );
+      offset              += delta;
+      range->skipped_bytes += delta;
+    }
+  }
+
+  // a range that ran to its end has handed over everything before its limit,
+  // one that was stopped only what is before the record it stopped at
+  if ( offset == range->limit ) {
+    __atomic_store_n( &(range->cursor), offset, __ATOMIC_RELAXED );
+  }
+  if ( !par->stop && offset != range->limit ) {
+    fprintf( stderr, "ERROR: thread %d of %s ran to %llu instead of stopping at %llu where thread %d started\n",
+             range->thread, par->path, (long long unsigned)offset,
+             (long long unsigned)range->limit, range->thread + 1 );
+    range->ok = false;
+  }
+}
+
+static void* tchpar_thread( void* arg )
+{
+  tchpar_range_t *range = (tchpar_range_t*)arg;
+  tchpar_t       *par   = range->par;
+
+  if ( range->thread > 0 ) {
+    range->start = tchpar_find_start( range->scan, range->start );
+  }
+  range->cursor = range->start;
+
+  // the limit of each range is the start the next thread found, and if not
+  // every thread could be started stop is set and there is nothing to scan
+  pthread_mutex_lock( &(par->lock) );
+  par->synced += 1;
+  pthread_cond_broadcast( &(par->synced_cond) );
+  while ( par->synced < par->nthreads && !par->stop ) {
+    pthread_cond_wait( &(par->synced_cond), &(par->lock) );
+  }
+  pthread_mutex_unlock( &(par->lock) );
+  range->limit = ( range->thread + 1 < par->nthreads ) ? par->ranges[range->thread + 1].start
+                                                       : par->region_end;
+  // a later thread can sync to the same block as an earlier one on a tiny region
+  if ( range->limit < range->start ) {
+    range->limit = range->start;
+  }
+
+  tchpar_scan_range( range );
+
+  pthread_mutex_lock( &(par->lock) );
+  __atomic_store_n( &(range->done), true, __ATOMIC_RELEASE );
+  par->finished += 1;
+  pthread_cond_broadcast( &(par->finished_cond) );
+  pthread_mutex_unlock( &(par->lock) );
+  return NULL;
+}
+
+tchpar_t* tchpar_new( const char* path, int nthreads, int engine, uint64_t window_size )
+{
+  tchpar_t *par = (tchpar_t*)calloc( 1, sizeof( tchpar_t ) );
+
+  par->nthreads = ( nthreads > 0 ) ? nthreads : 1;
+  par->engine   = engine;
+  if ( 0 != posix_memalign( (void**)&(par->ranges), 64, par->nthreads * sizeof( tchpar_range_t ) ) ) {
+    fprintf( stderr, "Failure allocating %d scan ranges\n", par->nthreads );
+    free( par );
+    return NULL;
+  }
+  memset( par->ranges, 0, par->nthreads * sizeof( tchpar_range_t ) );
+
+  pthread_mutex_init( &(par->lock), NULL );
+  pthread_cond_init( &(par->finished_cond), NULL );
+  pthread_cond_init( &(par->synced_cond), NULL );
+
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    tchpar_range_t *range = &(par->ranges[i]);
+    range->par    = par;
+    range->thread = i;
+    range->ok     = true;
+    if ( NULL == ( range->scan = tchscan_open_engine( path, engine, window_size ) ) ) {
+      tchpar_destroy( par );
+      return NULL;
+    }
+  }
+
+  snprintf( par->path, sizeof( par->path ), "%s", par->ranges[0].scan->path );
+  par->region_start = par->ranges[0].scan->hdr.first_record;
+  par->region_end   = par->ranges[0].scan->end;
+  return par;
+}
+
+bool tchpar_set_io( tchpar_t* par, const tchscan_io_t* io )
+{
+  tchscan_io_t per_thread = *io;
+  bool         ok         = true;
+
+  if ( io->rate > 0 ) {
+    per_thread.rate = ( io->rate / par->nthreads > 0 ) ? io->rate / par->nthreads : 1;
+  }
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    ok = tchscan_set_io( par->ranges[i].scan, &per_thread ) && ok;
+  }
+  return ok;
+}
+
+bool tchpar_start( tchpar_t* par, uint64_t start_offset, tchpar_callback_t callback, void* ctx )
+{
+  if ( 0 == start_offset ) {
+    start_offset = par->region_start;
+  }
+  if ( start_offset < par->region_start || start_offset > par->region_end ) {
+    fprintf( stderr, "ERROR: %llu is outside the record region of %s\n",
+             (long long unsigned)start_offset, par->path );
+    return false;
+  }
+
+  par->callback     = callback;
+  par->ctx          = ctx;
+  par->region_start = start_offset;
+
+  uint64_t span = par->region_end - start_offset;
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    par->ranges[i].start = start_offset + ( span / par->nthreads ) * i;
+  }
+
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    int rc = pthread_create( &(par->ranges[i].tid), NULL, tchpar_thread, &(par->ranges[i]) );
+    if ( 0 != rc ) {
+      fprintf( stderr, "Failure starting scan thread %d : %s\n", i, strerror( rc ));
+      pthread_mutex_lock( &(par->lock) );
+      par->stop = true;
+      pthread_cond_broadcast( &(par->synced_cond) );
+      pthread_mutex_unlock( &(par->lock) );
+      for ( int j = 0 ; j < i ; j++ ) {
+        pthread_join( par->ranges[j].tid, NULL );
+      }
+      return false;
+    }
+  }
+  par->started = true;
+  return true;
+}
+
+bool tchpar_wait( tchpar_t* par, double seconds )
+{
+  struct timespec deadline;
+  bool            all_done;
+
+  clock_gettime( CLOCK_REALTIME, &deadline );
+  deadline.tv_sec  += (time_t)seconds;
+  deadline.tv_nsec += (long)( ( seconds - (time_t)seconds ) * 1e9 );
+  if ( deadline.tv_nsec >= 1000000000L ) {
+    deadline.tv_sec  += 1;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock( &(par->lock) );
+  while ( par->finished < par->nthreads ) {
+    if ( ETIMEDOUT == pthread_cond_timedwait( &(par->finished_cond), &(par->lock), &deadline ) ) {
+      break;
+    }
+  }
+  all_done = ( par->finished == par->nthreads );
+  pthread_mutex_unlock( &(par->lock) );
+  return all_done;
+}
+
+uint64_t tchpar_records( tchpar_t* par )
+{
+  uint64_t records = 0;
+
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    records += __atomic_load_n( &(par->ranges[i].records), __ATOMIC_RELAXED );
+  }
+  return records;
+}
+
+uint64_t tchpar_low_water( tchpar_t* par )
+{
+  uint64_t low = par->region_end;
+
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    uint64_t cursor = __atomic_load_n( &(par->ranges[i].cursor), __ATOMIC_RELAXED );
+    if ( cursor < low ) {
+      low = cursor;
+    }
+  }
+  return ( low < par->region_start ) ? par->region_start : low;
+}
+
+int64_t tchpar_finish( tchpar_t* par )
+{
+  bool ok = true;
+
+  if ( !par->started ) {
+    return 0;
+  }
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    pthread_join( par->ranges[i].tid, NULL );
+    ok = ok && par->ranges[i].ok;
+  }
+  par->started = false;
+  return ok ? (int64_t)tchpar_records( par ) : -1;
+}
+
+void tchpar_destroy( tchpar_t* par )
+{
+  if ( NULL == par ) {
+    return;
+  }
+  if ( par->started ) {
+    par->stop = true;
+    tchpar_finish( par );
+  }
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    tchscan_close( par->ranges[i].scan );
+  }
+  pthread_mutex_destroy( &(par->lock) );
+  pthread_cond_destroy( &(par->finished_cond) );
+  pthread_cond_destroy( &(par->synced_cond) );
+  free( par->ranges );
+  free( par );
+}
+
+int64_t tch_parallel_foreach( const char* path, int nthreads, tchpar_callback_t callback, void* ctx )
+{
+  tchpar_t *par = tchpar_new( path, nthreads, TCHSCAN_MMAP, 0 );
+  int64_t   records;
+
+  if ( NULL == par ) {
+    return -1;
+  }
+  if ( !tchpar_start( par, 0, callback, ctx ) ) {
+    tchpar_destroy( par );
+    return -1;
+  }
+  records = tchpar_finish( par );
+  tchpar_destroy( par );
+  return records;
+}
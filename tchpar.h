@@ -0,0 +1,130 @@
+#ifndef __TCHPAR_H__
+#define __TCHPAR_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "tchscan.h"
+
+/*
+ * Parallel scan of the record region of a hash database.
+ *
+ * The region is cut into nthreads equal byte ranges.  Every thread but the
+ * first has to find where the first whole block at or after its nominal
+ * start is, which it does by trying each aligned offset until it finds a run
+ * of TCHPAR_SYNC_BLOCKS blocks that are all well formed, aligned, exactly
+ * adjacent and whose data records carry the hash byte of their own key.
+ * Values are arbitrary bytes so a stray 0xc8 inside one can look like a
+ * record header, but not four of them in a chain that also hash correctly.
+ * Each thread then scans from its own start up to where the next thread
+ * started, and has to land on that offset exactly, otherwise the partition
+ * was wrong and the scan reports failure.
+ *
+ * Each thread has its own scanner ( its own mapping or read windows ), its
+ * own counters on their own cache line and calls the callback directly, so
+ * nothing is shared on the per record path.
+ */
+
+#define TCHPAR_SYNC_BLOCKS 4
+#define TCHPAR_FREE_HIST   33      /* free block sizes, bucket b is under 2^b bytes */
+
+/*
+ * Called for every data record.  thread is 0 .. nthreads - 1 so callers can
+ * keep per thread state without locking.  rec is only valid for the duration
+ * of the call.  Returning false stops every thread.
+ */
+typedef bool (*tchpar_callback_t)( const tchscan_rec_t* rec, int thread, void* ctx );
+
+typedef struct tchpar_range {
+  struct tchpar   *par;
+  int              thread;
+  pthread_t        tid;
+  tchscan_t       *scan;
+
+  uint64_t         start;          /* first block this thread owns            */
+  uint64_t         limit;          /* where the next thread's range starts    */
+  uint64_t         cursor;         /* offset of the record being handed over,
+                                      the limit once the range is scanned     */
+  uint64_t         records;
+  uint64_t         free_blocks;
+  uint64_t         free_bytes;
+  uint64_t         free_sizes[TCHPAR_FREE_HIST];
+  uint64_t         skipped_bytes;
+  bool             done;
+  bool             ok;
+} __attribute__(( aligned( 64 ) )) tchpar_range_t;
+
+typedef struct tchpar {
+  char               path[PATH_MAX+1];
+  int                nthreads;
+  int                engine;
+  uint64_t           region_start;
+  uint64_t           region_end;
+
+  tchpar_range_t    *ranges;
+  tchpar_callback_t  callback;
+  void              *ctx;
+  volatile bool      stop;
+  bool               started;
+
+  pthread_mutex_t    lock;         /* guards synced and finished, only touched
+                                      once per thread at each end of its range */
+  pthread_cond_t     synced_cond;
+  int                synced;       /* threads that know their start           */
+  pthread_cond_t     finished_cond;
+  int                finished;
+} tchpar_t;
+
+/*
+ * Open nthreads scanners on path with the given engine ( see tchscan.h ).
+ * Prints the reason and returns NULL on failure.
+ */
+extern tchpar_t* tchpar_new( const char* path, int nthreads, int engine, uint64_t window_size );
+
+/*
+ * tchscan_set_io on every thread's scanner, io->rate is shared out between
+ * them.
+ */
+extern bool tchpar_set_io( tchpar_t* par, const tchscan_io_t* io );
+
+/*
+ * Start scanning every block at or after start_offset ( first_record when 0 )
+ * in the background.  Prints why and returns false if start_offset is not in
+ * the record region or not every thread could be started, in which case the
+ * ones that were have already been stopped and joined.
+ */
+extern bool tchpar_start( tchpar_t* par, uint64_t start_offset, tchpar_callback_t callback, void* ctx );
+
+/*
+ * Wait up to seconds for the scan to finish, true if it has.
+ */
+extern bool tchpar_wait( tchpar_t* par, double seconds );
+
+/*
+ * Records handed to the callback so far, over all threads.
+ */
+extern uint64_t tchpar_records( tchpar_t* par );
+
+/*
+ * The offset before which every record has been handed to the callback, the
+ * place a restart can pick up from.  After a callback stopped the scan that
+ * is before the record it stopped at.
+ */
+extern uint64_t tchpar_low_water( tchpar_t* par );
+
+/*
+ * Wait for every thread.  Returns the number of records handed to the
+ * callback, or -1 if a thread failed to line up with its neighbour.
+ */
+extern int64_t tchpar_finish( tchpar_t* par );
+
+extern void tchpar_destroy( tchpar_t* par );
+
+/*
+ * All of the above in one call, over the whole record region with the mmap
+ * engine.
+ */
+extern int64_t tch_parallel_foreach( const char* path, int nthreads, tchpar_callback_t callback, void* ctx );
+
+#endif
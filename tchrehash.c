@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+
+#include "tchhdr.h"
+#include "tchscan.h"
+#include "tchbuild.h"
+
+/*
+ * Give a hash database that has outgrown its bucket number a new one,
+ * offline and without a re-import through tchdbput.
+ *
+ *   tchrehash old.tch 4194301 new.tch
+ *
+ * Every key is read from the source and hashed again by --threads threads,
+ * each taking a range of the file, with tchscan_key_hash, the TC hash that
+ * bucket_idx_for_key in tcrecords.rb is.  That gives the record's bucket in
+ * the new array and its hash byte, the trees of the new buckets are built
+ * from them and the records are copied, key and value as they are stored,
+ * with their new links, see tchbuild.h.  The alignment, the free block pool
+ * and the options stay the source's, free blocks are left behind.
+ *
+ * That makes it tchcompact --bnum with the layout it would change pinned to
+ * the source's, tchbuild_run does the work for both.
+ */
+
+#define REHASH_THREADS  4
+
+void usage( const char* name, const tchbuild_options_t* defaults )
+{
+  fprintf( stderr, "Usage: %s [options] source.tch bnum rehashed.tch\n", name );
+  tchbuild_usage( stderr, defaults, "rehash" );
+  exit(1);
+}
+
+int main( int argc, char** argv )
+{
+  tchbuild_options_t o;
+  tchbuild_options_t defaults;
+  long long          bnum;
+  tchbuild_t        *b;
+  int                opt;
+
+  struct option long_options[] = {
+    TCHBUILD_LONG_OPTIONS,
+    { NULL, 0, NULL, 0 }
+  };
+
+  tchbuild_options_init( &defaults, REHASH_THREADS );
+  o = defaults;
+  while ( -1 != ( opt = getopt_long( argc, argv, TCHBUILD_GETOPT, long_options, NULL ) ) ) {
+    if ( !tchbuild_option( &o, opt, optarg ) ) {
+      usage( argv[0], &defaults );
+    }
+  }
+
+  if ( optind + 3 != argc || !tchbuild_options_valid( &o ) || ( bnum = atoll( argv[optind + 1] ) ) <= 0 ) {
+    usage( argv[0], &defaults );
+  }
+
+  // the alignment, the free block pool and the options stay the source's
+  if ( NULL == ( b = tchbuild_new( argv[optind], &o ) ) ||
+       !tchbuild_layout( b, bnum, -1, -1, -1 ) ||
+       !tchbuild_run( b, argv[optind + 2], &o, "Rehashed" ) ) {
+    exit(1);
+  }
+
+  tchbuild_destroy( b );
+  exit(0);
+}
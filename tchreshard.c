@@ -0,0 +1,600 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tcutil.h>
+#include <tchdb.h>
+#include <tcrdb.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "tchscan.h"
+#include "routing.h"
+#include "tcrpipe.h"
+#include "metrics.h"
+
+/*
+ * Move only the records whose owner changes between two routing maps.
+ *
+ *   tchreshard old.map new.map shard-00.tch shard-01.tch ...
+ *
+ * Every record of every shard is routed with both maps, and only those whose
+ * host:port differs are moved, either into DIR/<host>_<port>.tch with
+ * --output or straight to the new owners with --tyrants.  Without either it
+ * only reports what would move.  Going from 16 to 32 servers with the mask
+ * scheme moves half of every shard instead of copying all of it twice as a
+ * tchsplit does.
+ *
+ * A map of - is the routing compiled in from backend_for.c.  The shards are
+ * scanned --threads at a time.  Records moved are not deleted from the old
+ * shards.
+ */
+
+#define SCAN_THREADS   1
+#define BATCH_RECORDS  1000
+#define MAX_INFLIGHT   4
+
+/*
+ * where the moved records of one new owner go, and how many
+ */
+typedef struct reshard_dest {
+  const routing_server_t *server;
+  TCHDB                  *hdb;         /* --output         */
+  int                     backend;     /* --tyrants, pipe index */
+  bool                    receives;    /* some slot moves to it */
+  uint64_t                records;
+  uint64_t                bytes;
+} reshard_dest_t;
+
+typedef struct reshard {
+  routing_t        *old_map;
+  routing_t        *new_map;           /* table holds the dest index of each slot */
+  reshard_dest_t   *dests;
+  int               dest_count;
+
+  char            **shards;
+  int               shard_count;
+  int               next_shard;        /* the next one a thread picks up      */
+  int               threads;
+  tchscan_io_t      io;
+
+  const char       *output_dir;
+  bool              store_deflated;    /* --output to deflate databases, values as stored */
+  tcrpipe_t        *pipe;              /* --tyrants                            */
+
+  pthread_mutex_t   lock;              /* next_shard, the dest counts, failed */
+  bool              failed;
+
+  uint64_t          records;           /* scanned, updated as shards finish   */
+  uint64_t          bytes;
+  uint64_t          moved;
+  uint64_t          moved_bytes;
+  uint64_t          unroutable;
+  uint64_t          lost;              /* had to move but did not inflate     */
+  uint64_t          total;             /* records in all the shard headers    */
+
+  metrics_t        *metrics;           /* what the scan threads count, one slot
+                                          each, and tcrpipe one per backend   */
+  int               m_records;         /* scanned                              */
+  int               m_moved;
+  int               h_inflate;
+  int               h_write;           /* a put into an --output database, or a
+                                          tcrpipe_put that waited for room     */
+} reshard_t;
+
+typedef struct reshard_thread {
+  reshard_t      *reshard;
+  int             producer;
+  metrics_slot_t *counts;
+  z_stream        zs;
+  char           *buf;
+  int             buf_size;
+  uint64_t       *dest_records;        /* per dest counts of this thread      */
+  uint64_t       *dest_bytes;
+} reshard_thread_t;
+
+/*
+ * same host and port, so the record does not have to move
+ */
+static bool same_server( const routing_server_t* a, const routing_server_t* b )
+{
+  return a->port == b->port && 0 == strcmp( a->host, b->host );
+}
+
+/*
+ * One dest per distinct server of the new map, the new map's table points
+ * every slot at its dest.  Only the dests some record can move to are
+ * connected to or created.
+ */
+void reshard_plan_dests( reshard_t* reshard )
+{
+  routing_t *map  = reshard->new_map;
+  routing_t *old  = reshard->old_map;
+  int        span = ( map->count > old->count ) ? map->count : old->count;
+
+  reshard->dests      = (reshard_dest_t*)calloc( map->count, sizeof( reshard_dest_t ) );
+  reshard->dest_count = 0;
+  for ( int i = 0 ; i < map->count ; i++ ) {
+    int d;
+    for ( d = 0 ; d < reshard->dest_count ; d++ ) {
+      if ( same_server( reshard->dests[d].server, &(map->servers[i]) ) ) {
+        break;
+      }
+    }
+    if ( d == reshard->dest_count ) {
+      reshard->dests[d].server  = &(map->servers[i]);
+      reshard->dests[d].backend = -1;
+      reshard->dest_count      += 1;
+    }
+    map->table[i] = d;
+  }
+
+  // every pairing of an old and a new slot turns up in the low bits of some mlid
+  for ( int v = 0 ; v < span ; v++ ) {
+    if ( !same_server( &(old->servers[v & old->mask]), &(map->servers[v & map->mask]) ) ) {
+      reshard->dests[map->table[v & map->mask]].receives = true;
+    }
+  }
+}
+
+/*
+ * --output: a database per dest, tuned like the first shard, existing ones
+ * are added to
+ */
+bool reshard_open_outputs( reshard_t* reshard, const tchhdr_t* hdr )
+{
+  char path[PATH_MAX+1];
+
+  if ( 0 != mkdir( reshard->output_dir, 0755 ) && EEXIST != errno ) {
+    fprintf( stderr, "mkdir error on %s : %s\n", reshard->output_dir, strerror( errno ) );
+    return false;
+  }
+  reshard->store_deflated = ( hdr->options & TCH_OPT_DEFLATE );
+
+  for ( int d = 0 ; d < reshard->dest_count ; d++ ) {
+    reshard_dest_t *dest = &(reshard->dests[d]);
+    TCHDB          *hdb;
+
+    if ( !dest->receives ) {
+      continue;
+    }
+    hdb = tchdbnew();
+    snprintf( path, sizeof( path ), "%s/%s_%d.tch", reshard->output_dir, dest->server->host, dest->server->port );
+    tchdbsetmutex( hdb );
+    tchdbtune( hdb, hdr->bucket_number, hdr->alignment_pow, hdr->free_block_pow, hdr->options );
+    if ( !tchdbopen( hdb, path, HDBOWRITER | HDBOCREAT ) ) {
+      int ecode = tchdbecode( hdb );
+      fprintf( stderr, "open error on %s : %s\n", path, tchdberrmsg( ecode ));
+      tchdbdel( hdb );
+      return false;
+    }
+    if ( reshard->store_deflated != ( 0 != ( hdb->opts & HDBTDEFLATE ) ) ) {
+      fprintf( stderr, "%s %s the deflate option, the shards %s\n", path,
+               reshard->store_deflated ? "does not have" : "has", reshard->store_deflated ? "do" : "do not" );
+      tchdbclose( hdb );
+      tchdbdel( hdb );
+      return false;
+    }
+    // values go in as the shards store them, see tchsplit
+    if ( reshard->store_deflated ) {
+      hdb->zmode = false;
+      hdb->opts  = hdb->opts & ( ~HDBTDEFLATE );
+    }
+    dest->hdb = hdb;
+  }
+  return true;
+}
+
+bool reshard_close_outputs( reshard_t* reshard )
+{
+  bool ok = true;
+
+  for ( int d = 0 ; d < reshard->dest_count ; d++ ) {
+    TCHDB *hdb = reshard->dests[d].hdb;
+    if ( NULL == hdb ) {
+      continue;
+    }
+    if ( reshard->store_deflated ) {
+      hdb->zmode = true;
+      hdb->opts  = hdb->opts | HDBTDEFLATE;
+    }
+    if ( !tchdbclose( hdb ) ) {
+      int ecode = tchdbecode( hdb );
+      fprintf( stderr, "close error on %s : %s\n", tchdbpath( hdb ), tchdberrmsg( ecode ));
+      ok = false;
+    }
+    tchdbdel( hdb );
+    reshard->dests[d].hdb = NULL;
+  }
+  return ok;
+}
+
+/*
+ * --tyrants: connect to every new owner
+ */
+bool reshard_connect( reshard_t* reshard, int sent, int batch )
+{
+  reshard->pipe = tcrpipe_new( reshard->dest_count, reshard->threads, BATCH_RECORDS, MAX_INFLIGHT, 0.1 );
+  tcrpipe_set_metrics( reshard->pipe, reshard->metrics, sent, batch );
+  for ( int d = 0 ; d < reshard->dest_count ; d++ ) {
+    const routing_server_t *server = reshard->dests[d].server;
+    if ( !reshard->dests[d].receives ) {
+      continue;
+    }
+    if ( -1 == ( reshard->dests[d].backend = tcrpipe_add( reshard->pipe, server->host, server->port ) ) ) {
+      return false;
+    }
+    printf( "Connected to %s:%d\n", server->host, server->port );
+  }
+  return true;
+}
+
+/*
+ * Move what has to move out of one shard.  Values are inflated for the
+ * tyrants and for --output into databases without the deflate option.
+ */
+bool reshard_shard( reshard_thread_t* rt, const char* path )
+{
+  reshard_t     *reshard     = rt->reshard;
+  int            engine      = reshard->io.direct ? TCHSCAN_BUFFERED : TCHSCAN_MMAP;
+  tchscan_t     *scan        = tchscan_open_engine( path, engine, 0 );
+  tchscan_rec_t  rec;
+  bool           inflate;
+  bool           ok          = true;
+  uint64_t       records     = 0;
+  uint64_t       bytes       = 0;
+  uint64_t       moved       = 0;
+  uint64_t       moved_bytes = 0;
+  uint64_t       unroutable  = 0;
+  uint64_t       lost        = 0;
+
+  if ( NULL == scan || !tchscan_set_io( scan, &(reshard->io) ) ) {
+    if ( NULL != scan ) {
+      tchscan_close( scan );
+    }
+    return false;
+  }
+  if ( scan->hdr.options & ( TCH_OPT_BZIP2 | TCH_OPT_TCBS | TCH_OPT_EXCODEC ) ) {
+    fprintf( stderr, "Only deflate compressed shards can be resharded, %s is not\n", path );
+    tchscan_close( scan );
+    return false;
+  }
+  if ( NULL != reshard->output_dir && reshard->store_deflated != ( 0 != ( scan->hdr.options & TCH_OPT_DEFLATE ) ) ) {
+    fprintf( stderr, "%s does not have the same deflate option as the first shard\n", path );
+    tchscan_close( scan );
+    return false;
+  }
+  inflate = ( scan->hdr.options & TCH_OPT_DEFLATE ) && !reshard->store_deflated;
+
+  memset( rt->dest_records, 0, reshard->dest_count * sizeof( uint64_t ) );
+  memset( rt->dest_bytes, 0, reshard->dest_count * sizeof( uint64_t ) );
+
+  while ( ok && tchscan_next( scan, &rec ) ) {
+    int         old_slot = routing_slot( reshard->old_map, rec.key_buf, rec.key_size );
+    int         new_slot = routing_slot( reshard->new_map, rec.key_buf, rec.key_size );
+    const char *vbuf     = rec.val_buf;
+    int         vsiz     = rec.val_size;
+
+    records += 1;
+    bytes   += rec.key_size + rec.val_size;
+    metrics_add( rt->counts, reshard->m_records, 1 );
+
+    if ( old_slot < 0 ) {
+      unroutable += 1;
+      continue;
+    }
+    if ( same_server( &(reshard->old_map->servers[old_slot]), &(reshard->new_map->servers[new_slot]) ) ) {
+      continue;
+    }
+
+    int  d    = reshard->new_map->table[new_slot];
+    bool move = ( NULL != reshard->output_dir || NULL != reshard->pipe );
+
+    // a value that does not inflate can not be moved, and the shard fails
+    if ( move && inflate ) {
+      uint64_t inflate_start = metrics_now();
+      vsiz = tchscan_inflate( &(rt->zs), rec.val_buf, rec.val_size, &(rt->buf), &(rt->buf_size) );
+      metrics_observe( rt->counts, reshard->h_inflate, metrics_now() - inflate_start );
+      if ( 0 > vsiz ) {
+        fprintf( stderr, "inflate error : %s record at offset %llu\n", path, (long long unsigned)rec.offset );
+        lost += 1;
+        ok    = false;
+        continue;
+      }
+      vbuf = rt->buf;
+    }
+    moved               += 1;
+    moved_bytes         += rec.key_size + rec.val_size;
+    rt->dest_records[d] += 1;
+    rt->dest_bytes[d]   += rec.key_size + rec.val_size;
+    metrics_add( rt->counts, reshard->m_moved, 1 );
+
+    if ( !move ) {
+      continue;
+    }
+    uint64_t write_start = metrics_now();
+    if ( NULL != reshard->pipe ) {
+      tcrpipe_put( reshard->pipe, rt->producer, reshard->dests[d].backend, rec.offset,
+                   rec.key_buf, rec.key_size, vbuf, vsiz );
+    } else if ( !tchdbputasync( reshard->dests[d].hdb, rec.key_buf, rec.key_size, vbuf, vsiz ) ) {
+      int ecode = tchdbecode( reshard->dests[d].hdb );
+      fprintf( stderr, "put error on %s : %s\n", tchdbpath( reshard->dests[d].hdb ), tchdberrmsg( ecode ) );
+      ok = false;
+    }
+    metrics_observe( rt->counts, reshard->h_write, metrics_now() - write_start );
+  }
+
+  pthread_mutex_lock( &(reshard->lock) );
+  reshard->records     += records;
+  reshard->bytes       += bytes;
+  reshard->moved       += moved;
+  reshard->moved_bytes += moved_bytes;
+  reshard->unroutable  += unroutable;
+  reshard->lost        += lost;
+  for ( int d = 0 ; d < reshard->dest_count ; d++ ) {
+    reshard->dests[d].records += rt->dest_records[d];
+    reshard->dests[d].bytes   += rt->dest_bytes[d];
+  }
+  pthread_mutex_unlock( &(reshard->lock) );
+
+  tchscan_close( scan );
+  return ok;
+}
+
+void* reshard_thread( void* arg )
+{
+  reshard_thread_t *rt      = (reshard_thread_t*)arg;
+  reshard_t        *reshard = rt->reshard;
+
+  while ( 1 ) {
+    int shard;
+
+    pthread_mutex_lock( &(reshard->lock) );
+    shard = reshard->failed ? reshard->shard_count : reshard->next_shard++;
+    pthread_mutex_unlock( &(reshard->lock) );
+    if ( shard >= reshard->shard_count ) {
+      break;
+    }
+
+    if ( !reshard_shard( rt, reshard->shards[shard] ) ) {
+      pthread_mutex_lock( &(reshard->lock) );
+      reshard->failed = true;
+      pthread_mutex_unlock( &(reshard->lock) );
+    }
+  }
+  return NULL;
+}
+
+routing_t* reshard_load_map( const char* path )
+{
+  routing_t *map = ( 0 == strcmp( path, "-" ) ) ? routing_compiled( ) : routing_load( path );
+
+  if ( NULL != map ) {
+    printf( "%-30s serial %llu, %d servers\n", ( 0 == strcmp( path, "-" ) ) ? "compiled in" : path,
+            (long long unsigned)map->serial, map->count );
+  }
+  return map;
+}
+
+void reshard_report( reshard_t* reshard )
+{
+  uint64_t kept = reshard->bytes - reshard->moved_bytes;
+
+  printf( "\n" );
+  printf( "Shards scanned             : %15d\n", reshard->shard_count );
+  printf( "Records scanned            : %15llu  %15llu bytes\n", (long long unsigned)reshard->records,
+          (long long unsigned)reshard->bytes );
+  printf( "Records moved              : %15llu  %15llu bytes ( %.1f%% )\n", (long long unsigned)reshard->moved,
+          (long long unsigned)reshard->moved_bytes, reshard->bytes ? 100.0 * reshard->moved_bytes / reshard->bytes : 0.0 );
+  printf( "Records staying put        : %15llu  %15llu bytes not moved\n",
+          (long long unsigned)( reshard->records - reshard->moved - reshard->unroutable - reshard->lost ),
+          (long long unsigned)kept );
+  if ( reshard->unroutable > 0 ) {
+    printf( "Records without an mlid    : %15llu\n", (long long unsigned)reshard->unroutable );
+  }
+  if ( reshard->lost > 0 ) {
+    printf( "Values that did not inflate: %15llu  not moved, the shards they are in failed\n",
+            (long long unsigned)reshard->lost );
+  }
+  for ( int d = 0 ; d < reshard->dest_count ; d++ ) {
+    reshard_dest_t *dest = &(reshard->dests[d]);
+    if ( dest->records > 0 ) {
+      printf( "  to %s:%-5d %15llu records  %15llu bytes\n", dest->server->host, dest->server->port,
+              (long long unsigned)dest->records, (long long unsigned)dest->bytes );
+    }
+  }
+}
+
+void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options] old.map new.map shard.tch ...\n", name );
+  fprintf( stderr, "  ( a map of - is the routing compiled in )\n" );
+  fprintf( stderr, "  -o, --output DIR       put the moved records in DIR/<host>_<port>.tch\n" );
+  fprintf( stderr, "  -y, --tyrants          send the moved records to the tyrants of the new map\n" );
+  fprintf( stderr, "  -T, --threads N        scan N shards at once ( default %d )\n", SCAN_THREADS );
+  fprintf( stderr, "  -p, --polite           drop shard pages from the page cache behind the scan\n" );
+  fprintf( stderr, "  -d, --direct           read the shards with O_DIRECT instead of mapping them\n" );
+  fprintf( stderr, "  -l, --rate BYTES       read at most BYTES per second from each shard\n" );
+  fprintf( stderr, "  -q, --quiet            no progress on stderr\n" );
+  fprintf( stderr, "  -j, --metrics FILE     append the counters and latencies to FILE as JSON lines every second\n" );
+  fprintf( stderr, "  -P, --prometheus FILE  keep FILE up to date in Prometheus text format\n" );
+}
+
+int main( int argc, char** argv )
+{
+  reshard_t         reshard;
+  reshard_thread_t *rts;
+  pthread_t        *tids;
+  int               started   = 0;
+  bool              tyrants   = false;
+  bool              quiet     = false;
+  const char       *json_path = NULL;
+  const char       *prom_path = NULL;
+  bool              ok;
+  int               opt;
+
+  struct option long_options[] = {
+    { "output",     required_argument, NULL, 'o' },
+    { "tyrants",    no_argument,       NULL, 'y' },
+    { "threads",    required_argument, NULL, 'T' },
+    { "polite",     no_argument,       NULL, 'p' },
+    { "direct",     no_argument,       NULL, 'd' },
+    { "rate",       required_argument, NULL, 'l' },
+    { "quiet",      no_argument,       NULL, 'q' },
+    { "metrics",    required_argument, NULL, 'j' },
+    { "prometheus", required_argument, NULL, 'P' },
+    { NULL,         0,                 NULL,  0  }
+  };
+
+  memset( &reshard, 0, sizeof( reshard ) );
+  reshard.threads = SCAN_THREADS;
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "o:yT:pdl:qj:P:", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'o': reshard.output_dir     = optarg; break;
+      case 'y': tyrants                = true; break;
+      case 'T': reshard.threads        = atoi( optarg ); break;
+      case 'p': reshard.io.drop_behind = true; break;
+      case 'd': reshard.io.direct      = true; break;
+      case 'l': reshard.io.rate        = strtoull( optarg, NULL, 0 ); break;
+      case 'q': quiet                  = true; break;
+      case 'j': json_path              = optarg; break;
+      case 'P': prom_path              = optarg; break;
+      default :
+        usage( argv[0] );
+        exit(1);
+    }
+  }
+
+  if ( argc - optind < 3 || reshard.threads < 1 ) {
+    usage( argv[0] );
+    exit(1);
+  }
+  if ( tyrants && NULL != reshard.output_dir ) {
+    fprintf( stderr, "--output and --tyrants do not go together\n" );
+    exit(1);
+  }
+
+  if ( NULL == ( reshard.old_map = reshard_load_map( argv[optind] ) ) ||
+       NULL == ( reshard.new_map = reshard_load_map( argv[optind + 1] ) ) ) {
+    exit(1);
+  }
+  reshard.shards      = argv + optind + 2;
+  reshard.shard_count = argc - optind - 2;
+  if ( reshard.threads > reshard.shard_count ) {
+    reshard.threads = reshard.shard_count;
+  }
+  reshard_plan_dests( &reshard );
+
+  // every counter and histogram is registered before the first slot goes out
+  reshard.metrics   = metrics_new( "tchreshard", reshard.threads + reshard.dest_count );
+  reshard.m_records = metrics_counter( reshard.metrics, "records" );
+  reshard.m_moved   = metrics_counter( reshard.metrics, "moved" );
+  int m_sent        = metrics_counter( reshard.metrics, "sent" );
+  reshard.h_inflate = metrics_histogram( reshard.metrics, "inflate" );
+  reshard.h_write   = metrics_histogram( reshard.metrics, "write" );
+  int h_batch       = metrics_histogram( reshard.metrics, "batch" );
+  if ( !metrics_output( reshard.metrics, json_path, prom_path ) ) {
+    exit(1);
+  }
+
+  // the header of every shard up front, for the totals and the output tuning
+  for ( int i = 0 ; i < reshard.shard_count ; i++ ) {
+    tchscan_t *scan = tchscan_open_engine( reshard.shards[i], TCHSCAN_BUFFERED, 4096 );
+    if ( NULL == scan ) {
+      exit(1);
+    }
+    reshard.total += scan->hdr.record_number;
+    if ( 0 == i && NULL != reshard.output_dir && !reshard_open_outputs( &reshard, &(scan->hdr) ) ) {
+      exit(1);
+    }
+    tchscan_close( scan );
+  }
+  if ( tyrants && !reshard_connect( &reshard, m_sent, h_batch ) ) {
+    exit(1);
+  }
+
+  pthread_mutex_init( &(reshard.lock), NULL );
+  rts  = (reshard_thread_t*)calloc( reshard.threads, sizeof( reshard_thread_t ) );
+  tids = (pthread_t*)calloc( reshard.threads, sizeof( pthread_t ) );
+
+  for ( int i = 0 ; i < reshard.threads ; i++ ) {
+    rts[i].reshard      = &reshard;
+    rts[i].producer     = i;
+    rts[i].counts       = metrics_slot( reshard.metrics );
+    rts[i].buf_size     = 64 * 1024;
+    rts[i].buf          = malloc( rts[i].buf_size );
+    rts[i].dest_records = (uint64_t*)calloc( reshard.dest_count, sizeof( uint64_t ) );
+    rts[i].dest_bytes   = (uint64_t*)calloc( reshard.dest_count, sizeof( uint64_t ) );
+    inflateInit2( &(rts[i].zs), -15 );
+    int rc = pthread_create( &(tids[i]), NULL, reshard_thread, &(rts[i]) );
+    if ( 0 != rc ) {
+      // the threads already running stop after the shard they are on
+      fprintf( stderr, "Failure starting scan thread %d : %s\n", i, strerror( rc ) );
+      pthread_mutex_lock( &(reshard.lock) );
+      reshard.failed = true;
+      pthread_mutex_unlock( &(reshard.lock) );
+      inflateEnd( &(rts[i].zs) );
+      free( rts[i].buf );
+      free( rts[i].dest_records );
+      free( rts[i].dest_bytes );
+      break;
+    }
+    started += 1;
+  }
+
+  // the threads take the shards off the list, progress until they are gone
+  for ( int i = 0 ; i < started ; i++ ) {
+    struct timespec deadline;
+    do {
+      metrics_tick( reshard.metrics, false );
+      if ( !quiet ) {
+        metrics_progress( reshard.metrics, stderr, reshard.m_records, reshard.total,
+                          metrics_total( reshard.metrics, reshard.m_records ) );
+      }
+      clock_gettime( CLOCK_REALTIME, &deadline );
+      deadline.tv_sec += 1;
+    } while ( ETIMEDOUT == pthread_timedjoin_np( tids[i], NULL, &deadline ) );
+    inflateEnd( &(rts[i].zs) );
+    free( rts[i].buf );
+    free( rts[i].dest_records );
+    free( rts[i].dest_bytes );
+  }
+  metrics_tick( reshard.metrics, true );
+  if ( !quiet ) {
+    metrics_progress( reshard.metrics, stderr, reshard.m_records, reshard.total,
+                      metrics_total( reshard.metrics, reshard.m_records ) );
+  }
+  free( rts );
+  free( tids );
+
+  ok = !reshard.failed;
+  if ( NULL != reshard.pipe ) {
+    if ( !tcrpipe_finish( reshard.pipe ) ) {
+      ok = false;
+    }
+    printf( "\nBackends:\n" );
+    tcrpipe_summary( reshard.pipe, stdout );
+    tcrpipe_destroy( reshard.pipe );
+  }
+  if ( NULL != reshard.output_dir && !reshard_close_outputs( &reshard ) ) {
+    ok = false;
+  }
+
+  reshard_report( &reshard );
+  if ( !tyrants && NULL == reshard.output_dir ) {
+    printf( "Nothing was moved, give --output or --tyrants to move them\n" );
+  }
+
+  pthread_mutex_destroy( &(reshard.lock) );
+  metrics_destroy( reshard.metrics );
+  free( reshard.dests );
+  routing_free( reshard.old_map );
+  routing_free( reshard.new_map );
+  exit( ok ? 0 : 1 );
+}
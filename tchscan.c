@@ -0,0 +1,679 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <time.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "tchscan.h"
+
+#define TCHSCAN_ALIGN  4096          /* buffer and read alignment of the windows */
+
+/*
+ * TC variable length integer, see TCREADVNUMBUF in tcutil.h.  Returns the
+ * number of bytes consumed or 0 if it runs off the end of the buffer.
+ */
+static int read_vary_int( const uint8_t* p, const uint8_t* end, uint32_t* result )
+{
+  const uint8_t *start = p;
+  uint64_t         num = 0;
+  uint64_t        base = 1;
+
+  while ( p < end && ( p - start ) < 5 ) {
+    int8_t c = (int8_t)*(p++);
+    if ( c >= 0 ) {
+      num += ( c * base );
+      *result = (uint32_t)num;
+      return p - start;
+    }
+    num += ( base * ( c + 1 ) * -1 );
+    base <<= 7;
+  }
+  return 0;
+}
+
+static uint64_t read_le( const uint8_t* p, int bytes )
+{
+  uint64_t v = 0;
+  for ( int i = bytes - 1 ; i >= 0 ; i-- ) {
+    v = ( v << 8 ) | p[i];
+  }
+  return v;
+}
+
+/*
+ * pread until n bytes or the end of the file
+ */
+static int64_t read_fully( int fd, uint8_t* buf, uint64_t n, uint64_t offset )
+{
+  uint64_t got = 0;
+
+  while ( got < n ) {
+    ssize_t r = pread( fd, buf + got, n - got, offset + got );
+    if ( r < 0 ) {
+      if ( EINTR == errno ) { continue; }
+      return -1;
+    }
+    if ( 0 == r ) {
+      break;
+    }
+    got += r;
+    // short of an alignment boundary is the end of the file, and O_DIRECT
+    // would refuse the unaligned read it takes to find that out
+    if ( got < n && 0 != ( ( offset + got ) & ( TCHSCAN_ALIGN - 1 ) ) ) {
+      break;
+    }
+  }
+  return got;
+}
+
+#ifdef HAVE_LIBURING
+static void uring_submit_prefetch( tchscan_t* scan )
+{
+  struct io_uring     *ring = (struct io_uring*)scan->uring;
+  struct io_uring_sqe *sqe  = io_uring_get_sqe( ring );
+
+  if ( scan->win_end >= scan->file_size || NULL == sqe ) {
+    return;
+  }
+  io_uring_prep_read( sqe, scan->fd, scan->bufs[!scan->cur] + scan->window_size,
+                      scan->window_size, scan->win_end );
+  io_uring_submit( ring );
+  scan->prefetching = true;
+}
+
+static int64_t uring_wait_prefetch( tchscan_t* scan )
+{
+  struct io_uring     *ring = (struct io_uring*)scan->uring;
+  struct io_uring_cqe *cqe;
+  int64_t              res;
+
+  scan->prefetching = false;
+  if ( 0 != io_uring_wait_cqe( ring, &cqe ) ) {
+    return -1;
+  }
+  res = cqe->res;
+  io_uring_cqe_seen( ring, cqe );
+  return res;
+}
+#endif
+
+static double now_seconds( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ( ts.tv_nsec / 1e9 );
+}
+
+static uint64_t now_ns( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Called every TCHSCAN_IO_STEP bytes of progress: drop what is behind
+ * offset from the page cache and sleep if the scan is ahead of io.rate.
+ * Whatever the current window or record still needs is left alone.
+ */
+static void tchscan_io_step( tchscan_t* scan, uint64_t offset )
+{
+  uint64_t page = sysconf( _SC_PAGESIZE );
+
+  if ( scan->io.drop_behind ) {
+    uint64_t keep = ( TCHSCAN_MMAP == scan->engine ) ? offset : scan->win_start;
+    uint64_t upto = keep & ~( page - 1 );
+
+    // the first step only says where this scanner started, tchpar threads start mid file
+    if ( UINT64_MAX == scan->dropped_to ) {
+      scan->dropped_to = upto;
+    } else if ( upto > scan->dropped_to ) {
+      if ( NULL != scan->map ) {
+        madvise( (void*)( scan->map + scan->dropped_to ), upto - scan->dropped_to, MADV_DONTNEED );
+      }
+      posix_fadvise( scan->fd, scan->dropped_to, upto - scan->dropped_to, POSIX_FADV_DONTNEED );
+      scan->dropped_to = upto;
+    }
+  }
+
+  if ( scan->io.rate > 0 ) {
+    double now = now_seconds();
+    if ( 0.0 == scan->pace_start || offset < scan->pace_offset ) {
+      scan->pace_start  = now;
+      scan->pace_offset = offset;
+    } else {
+      double ahead = ( offset - scan->pace_offset ) / (double)scan->io.rate - ( now - scan->pace_start );
+      if ( ahead > 0.0 ) {
+        usleep( (useconds_t)( ahead * 1e6 ) );
+        scan->paused += ahead;
+      }
+    }
+  }
+
+  // slow rates are checked more often so the pauses stay short
+  uint64_t step = TCHSCAN_IO_STEP;
+  if ( scan->io.rate > 0 && scan->io.rate / 16 < step ) {
+    step = ( scan->io.rate / 16 > page ) ? scan->io.rate / 16 : page;
+  }
+  scan->io_mark = offset + step;
+}
+
+/*
+ * Windows of size bytes, keeping what is in the current one if it fits and
+ * otherwise starting over with an empty window.
+ */
+static bool tchscan_resize( tchscan_t* scan, uint64_t size )
+{
+  uint8_t *bufs[2] = { NULL, NULL };
+
+#ifdef HAVE_LIBURING
+  if ( scan->prefetching ) {
+    uring_wait_prefetch( scan );
+  }
+#endif
+
+  for ( int i = 0 ; i < 2 ; i++ ) {
+    if ( 0 != posix_memalign( (void**)&(bufs[i]), TCHSCAN_ALIGN, 2 * size ) ) {
+      if ( i > 0 ) {
+        free( bufs[0] );
+      }
+      return false;
+    }
+  }
+
+  if ( NULL != scan->win && scan->win_end - scan->win_start <= 2 * size ) {
+    memcpy( bufs[scan->cur], scan->win, scan->win_end - scan->win_start );
+    scan->win = bufs[scan->cur];
+  } else {
+    scan->win       = NULL;
+    scan->win_start = scan->win_end = 0;
+  }
+  free( scan->bufs[0] );
+  free( scan->bufs[1] );
+  scan->bufs[0]     = bufs[0];
+  scan->bufs[1]     = bufs[1];
+  scan->window_size = size;
+  return true;
+}
+
+/*
+ * Slide the window forward so it holds [offset, offset + len).  Whatever of
+ * that is already in the current window is carried over to the front of the
+ * spare buffer and the rest is read in behind it, so reads stay sequential
+ * and aligned.
+ */
+static bool tchscan_refill( tchscan_t* scan, uint64_t offset, uint64_t len )
+{
+  if ( len > scan->window_size ) {
+    uint64_t size = scan->window_size;
+    while ( size < len ) {
+      size *= 2;
+    }
+    if ( size > TCHSCAN_MAX_WINDOW && len <= TCHSCAN_MAX_WINDOW ) {
+      size = TCHSCAN_MAX_WINDOW;
+    }
+    if ( !tchscan_resize( scan, size ) ) {
+      fprintf( stderr, "ERROR: Failure allocating %llu byte windows for the record at %llu of %s\n",
+               (long long unsigned)size, (long long unsigned)offset, scan->path );
+      return false;
+    }
+  } else if ( scan->window_size > scan->window_base && len <= scan->window_base ) {
+    // back down once the record that needed the larger window is done with
+    tchscan_resize( scan, scan->window_base );
+  }
+
+  while ( offset + len > scan->win_end || offset < scan->win_start ) {
+    uint8_t *spare = scan->bufs[!scan->cur];
+    uint64_t tail  = 0;
+    uint64_t read_start;
+    int64_t  got   = -1;
+    uint64_t begin;
+
+    if ( NULL != scan->win && offset >= scan->win_start && offset <= scan->win_end ) {
+      tail       = scan->win_end - offset;
+      read_start = scan->win_end;
+      memcpy( spare + scan->window_size - tail, scan->win + ( offset - scan->win_start ), tail );
+    } else {
+      read_start = offset & ~( (uint64_t)TCHSCAN_ALIGN - 1 );
+    }
+
+    begin = now_ns();
+#ifdef HAVE_LIBURING
+    if ( scan->prefetching ) {
+      int64_t res = uring_wait_prefetch( scan );
+      if ( read_start == scan->win_end && res >= 0 ) {
+        got = res;
+        if ( (uint64_t)got < scan->window_size && read_start + got < scan->file_size ) {
+          int64_t more = read_fully( scan->fd, spare + scan->window_size + got,
+                                     scan->window_size - got, read_start + got );
+          got = ( more < 0 ) ? -1 : got + more;
+        }
+      }
+    }
+#endif
+    if ( got < 0 ) {
+      got = read_fully( scan->fd, spare + scan->window_size, scan->window_size, read_start );
+    }
+    scan->read_ns += now_ns() - begin;
+    if ( got < 0 ) {
+      fprintf( stderr, "ERROR: Failure reading %s at %llu, %s\n", scan->path,
+               (long long unsigned)read_start, strerror( errno ));
+      return false;
+    }
+
+    scan->bytes_read += got;
+    scan->cur         = !scan->cur;
+    scan->win         = spare + scan->window_size - tail;
+    scan->win_start   = read_start - tail;
+    scan->win_end     = read_start + got;
+
+#ifdef HAVE_LIBURING
+    if ( TCHSCAN_URING == scan->engine ) {
+      uring_submit_prefetch( scan );
+    }
+#endif
+
+    if ( 0 == got ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Pointer to the len bytes at offset, len must not run past the end of the
+ * record region.
+ */
+static inline const uint8_t* tchscan_view( tchscan_t* scan, uint64_t offset, uint64_t len )
+{
+  if ( offset >= scan->io_mark ) {
+    tchscan_io_step( scan, offset );
+  }
+  if ( TCHSCAN_MMAP == scan->engine ) {
+    return scan->map + offset;
+  }
+  if ( offset < scan->win_start || offset + len > scan->win_end ) {
+    if ( !tchscan_refill( scan, offset, len ) ) {
+      return NULL;
+    }
+  }
+  return scan->win + ( offset - scan->win_start );
+}
+
+/*
+ * A record of the buffered engines that does not fit the window.  Before the
+ * window grows for it its key has to give the hash byte of the header, and
+ * it has to fit in TCHSCAN_MAX_WINDOW.
+ */
+static bool tchscan_large_record( tchscan_t* scan, tchscan_rec_t* rec, uint64_t hsiz )
+{
+  const uint8_t *p;
+  uint8_t        hash;
+
+  if ( hsiz + rec->key_size > TCHSCAN_MAX_WINDOW ) {
+    return false;
+  }
+  if ( NULL == ( p = tchscan_view( scan, rec->offset, hsiz + rec->key_size ) ) ) {
+    return false;
+  }
+  tchscan_bucket_for( scan->hdr.bucket_number, (const char*)( p + hsiz ), rec->key_size, &hash );
+  if ( hash != rec->hash ) {
+    return false;
+  }
+  if ( hsiz + rec->key_size + rec->val_size > TCHSCAN_MAX_WINDOW ) {
+    fprintf( stderr, "ERROR: the record at %llu of %s is %llu bytes, more than the %d a window may grow to, stepping over it\n",
+             (long long unsigned)rec->offset, scan->path,
+             (long long unsigned)( hsiz + rec->key_size + rec->val_size ), TCHSCAN_MAX_WINDOW );
+    return false;
+  }
+  return true;
+}
+
+bool tchscan_read_at( tchscan_t* scan, uint64_t offset, tchscan_rec_t* rec )
+{
+  int         bytes_per = scan->hdr.bytes_per;
+  uint64_t    available;
+  uint64_t    hsiz;
+  const uint8_t     *p;
+  const uint8_t   *end;
+  int              step;
+
+  if ( offset >= scan->end ) {
+    return false;
+  }
+
+  // enough for the largest record header: magic, hash, left, right, padding size, two varints
+  available = scan->end - offset;
+  if ( available > (uint64_t)( 14 + 2 * bytes_per ) ) {
+    available = 14 + 2 * bytes_per;
+  }
+  if ( NULL == ( p = tchscan_view( scan, offset, available ) ) ) {
+    return false;
+  }
+  end = p + available;
+
+  rec->offset = offset;
+  rec->magic  = *p;
+
+  if ( TCH_MAGIC_DATA_BLOCK == rec->magic ) {
+    if ( available < (uint64_t)( 4 + 2 * bytes_per ) ) {
+      return false;
+    }
+    rec->hash     = p[1];
+    rec->left     = read_le( p + 2, bytes_per ) << scan->hdr.alignment_pow;
+    rec->right    = read_le( p + 2 + bytes_per, bytes_per ) << scan->hdr.alignment_pow;
+    rec->pad_size = (uint16_t)read_le( p + 2 + 2 * bytes_per, 2 );
+    hsiz          = 4 + 2 * bytes_per;
+
+    if ( 0 == ( step = read_vary_int( p + hsiz, end, &(rec->key_size) ) ) ) { return false; }
+    hsiz += step;
+    if ( 0 == ( step = read_vary_int( p + hsiz, end, &(rec->val_size) ) ) ) { return false; }
+    hsiz += step;
+
+    if ( scan->end - offset < hsiz + rec->key_size + rec->val_size ) {
+      return false;
+    }
+    if ( TCHSCAN_MMAP != scan->engine && hsiz + rec->key_size + rec->val_size > scan->window_size &&
+         !tchscan_large_record( scan, rec, hsiz ) ) {
+      return false;
+    }
+
+    // the whole record, which may move the window
+    if ( NULL == ( p = tchscan_view( scan, offset, hsiz + rec->key_size + rec->val_size ) ) ) {
+      return false;
+    }
+    rec->key_buf = (const char*)( p + hsiz );
+    rec->val_buf = (const char*)( p + hsiz + rec->key_size );
+    rec->length  = hsiz + rec->key_size + rec->val_size + rec->pad_size;
+    return true;
+
+  } else if ( TCH_MAGIC_FREE_BLOCK == rec->magic ) {
+    // the size of a free block is the size of the whole block
+    if ( available < 5 ) {
+      return false;
+    }
+    rec->length   = read_le( p + 1, 4 );
+    rec->key_buf  = rec->val_buf = NULL;
+    rec->key_size = rec->val_size = 0;
+    return ( rec->length >= 5 );
+  }
+
+  return false;
+}
+
+bool tchscan_next( tchscan_t* scan, tchscan_rec_t* rec )
+{
+  int align = 1 << scan->hdr.alignment_pow;
+
+  while ( scan->offset < scan->end ) {
+    if ( tchscan_read_at( scan, scan->offset, rec ) ) {
+      scan->offset += rec->length;
+      if ( TCH_MAGIC_DATA_BLOCK == rec->magic ) {
+        return true;
+      }
+      scan->free_blocks += 1;
+    } else {
+      // not a block we understand, skip to the next apow alignment and try again
+      uint64_t delta = align - ( scan->offset % align );
+      scan->offset        += delta;
+      scan->skipped_bytes += delta;
+    }
+  }
+  return false;
+}
+
+bool tchscan_seek( tchscan_t* scan, uint64_t offset )
+{
+  if ( offset < scan->hdr.first_record || offset > scan->end ) {
+    return false;
+  }
+  scan->offset = offset;
+  return true;
+}
+
+uint64_t tchscan_key_hash( const char* kbuf, int ksiz, uint8_t* hash )
+{
+  const uint8_t *kp = (const uint8_t*)kbuf;
+  const uint8_t *rp = kp + ksiz;
+  uint64_t      idx = 19780211;
+  uint32_t        h = 751;
+
+  while ( ksiz-- ) {
+    idx = idx * 37 + *(kp++);
+    h   = ( h * 31 ) ^ *(--rp);
+  }
+  *hash = (uint8_t)h;
+  return idx;
+}
+
+uint64_t tchscan_bucket_for( uint64_t bucket_number, const char* kbuf, int ksiz, uint8_t* hash )
+{
+  return tchscan_key_hash( kbuf, ksiz, hash ) % bucket_number;
+}
+
+/*
+ * a greater hash byte is to the left, then a greater key by tcreckeycmp,
+ * where the longer key is the greater
+ */
+bool tchscan_lookup( tchscan_t* scan, const char* kbuf, uint32_t ksiz, tchscan_rec_t* rec )
+{
+  const tchhdr_t *hdr = &(scan->hdr);
+  uint8_t         entry[8];
+  uint8_t         hash;
+  uint64_t        bucket = tchscan_bucket_for( hdr->bucket_number, kbuf, ksiz, &hash );
+  uint64_t        off;
+
+  if ( hdr->bytes_per != pread( scan->fd, entry, hdr->bytes_per, TCH_HEADER_SIZE + bucket * hdr->bytes_per ) ) {
+    return false;
+  }
+  off = tchhdr_get_le( entry, hdr->bytes_per ) << hdr->alignment_pow;
+
+  while ( 0 != off ) {
+    int cmp;
+
+    if ( !tchscan_read_at( scan, off, rec ) ) {
+      return false;
+    }
+    if ( hash != rec->hash ) {
+      cmp = ( hash > rec->hash ) ? 1 : -1;
+    } else if ( ksiz != rec->key_size ) {
+      cmp = ( ksiz > rec->key_size ) ? 1 : -1;
+    } else if ( 0 == ( cmp = memcmp( kbuf, rec->key_buf, ksiz ) ) ) {
+      return true;
+    }
+    off = ( cmp > 0 ) ? rec->left : rec->right;
+  }
+  return false;
+}
+
+int tchscan_inflate( z_stream* zs, const char* vbuf, int vsiz, char** buf, int* buf_size )
+{
+  int rv;
+
+  inflateReset( zs );
+  zs->next_in   = (Bytef*)vbuf;
+  zs->avail_in  = vsiz;
+  zs->next_out  = (Bytef*)*buf;
+  zs->avail_out = *buf_size;
+
+  while ( Z_STREAM_END != ( rv = inflate( zs, Z_FINISH ) ) ) {
+    if ( ( Z_BUF_ERROR != rv && Z_OK != rv ) || ( 0 != zs->avail_out ) ) {
+      return -1;
+    }
+    *buf_size *= 2;
+    *buf = realloc( *buf, *buf_size );
+    zs->next_out  = (Bytef*)( *buf + zs->total_out );
+    zs->avail_out = *buf_size - zs->total_out;
+  }
+  return zs->total_out;
+}
+
+bool tchscan_set_io( tchscan_t* scan, const tchscan_io_t* io )
+{
+  bool ok = true;
+
+  scan->io         = *io;
+  scan->dropped_to = UINT64_MAX;
+  scan->pace_start = 0.0;
+  scan->io_mark    = ( io->drop_behind || io->rate > 0 ) ? 0 : UINT64_MAX;
+
+  if ( io->drop_behind && NULL != scan->map ) {
+    // read ahead is still wanted, but nothing should be kept around after
+    posix_fadvise( scan->fd, 0, 0, POSIX_FADV_NOREUSE );
+  }
+
+  if ( io->direct && !( O_DIRECT & fcntl( scan->fd, F_GETFL ) ) ) {
+    int fd;
+    if ( TCHSCAN_MMAP == scan->engine ) {
+      fprintf( stderr, "O_DIRECT is only for the buffered engines, %s reads through the page cache\n", scan->path );
+      ok = false;
+    } else if ( -1 == ( fd = open( scan->path, O_RDONLY | O_DIRECT ) ) ) {
+      fprintf( stderr, "Failure opening [%s] with O_DIRECT : %s\n", scan->path, strerror( errno ));
+      ok = false;
+    } else {
+      close( scan->fd );
+      scan->fd = fd;
+    }
+    scan->io.direct = ok;
+  }
+  return ok;
+}
+
+const char* tchscan_engine_name( int engine )
+{
+  switch ( engine ) {
+    case TCHSCAN_MMAP:     return "mmap";
+    case TCHSCAN_BUFFERED: return "buffered";
+    case TCHSCAN_URING:    return "uring";
+  }
+  return "unknown";
+}
+
+int tchscan_engine_named( const char* name )
+{
+  if ( 0 == strcmp( name, "mmap" ) )     { return TCHSCAN_MMAP; }
+  if ( 0 == strcmp( name, "buffered" ) ) { return TCHSCAN_BUFFERED; }
+#ifdef HAVE_LIBURING
+  if ( 0 == strcmp( name, "uring" ) )    { return TCHSCAN_URING; }
+#endif
+  return -1;
+}
+
+tchscan_t* tchscan_open( const char* path )
+{
+  return tchscan_open_engine( path, TCHSCAN_MMAP, 0 );
+}
+
+tchscan_t* tchscan_open_engine( const char* path, int engine, uint64_t window_size )
+{
+  struct stat st;
+  tchscan_t *scan = (tchscan_t*)calloc( 1, sizeof( tchscan_t ));
+
+  scan->engine = engine;
+  scan->fd     = -1;
+
+  if ( NULL == realpath( path, scan->path ) ) {
+    fprintf( stderr, "Failure resolving [%s] : %s\n", path, strerror( errno ));
+    free( scan );
+    return NULL;
+  }
+
+  if ( -1 == ( scan->fd = open( scan->path, O_RDONLY ) ) ) {
+    fprintf( stderr, "Failure opening file [%s] : %s\n", scan->path, strerror( errno ));
+    free( scan );
+    return NULL;
+  }
+
+  if ( !tchhdr_read( scan->fd, &(scan->hdr) ) || ( -1 == fstat( scan->fd, &st ) ) ) {
+    fprintf( stderr, "Failure reading header of [%s] : %s\n", scan->path, tchhdr_error( errno ));
+    tchscan_close( scan );
+    return NULL;
+  }
+
+  scan->file_size = st.st_size;
+  scan->end       = ( scan->hdr.file_size < (uint64_t)st.st_size ) ? scan->hdr.file_size : (uint64_t)st.st_size;
+  scan->offset    = scan->hdr.first_record;
+  scan->io_mark   = UINT64_MAX;
+
+  posix_fadvise( scan->fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+  if ( TCHSCAN_MMAP == engine ) {
+    scan->map = mmap( NULL, scan->file_size, PROT_READ, MAP_SHARED, scan->fd, 0 );
+    if ( MAP_FAILED == scan->map ) {
+      fprintf( stderr, "Failure mapping file [%s] : %s\n", scan->path, strerror( errno ));
+      scan->map = NULL;
+      tchscan_close( scan );
+      return NULL;
+    }
+    madvise( (void*)scan->map, scan->file_size, MADV_SEQUENTIAL );
+    return scan;
+  }
+
+  scan->window_size = ( window_size > 0 ) ? window_size : TCHSCAN_WINDOW_SIZE;
+  scan->window_size = ( scan->window_size + TCHSCAN_ALIGN - 1 ) & ~( (uint64_t)TCHSCAN_ALIGN - 1 );
+  scan->window_base = scan->window_size;
+  if ( !tchscan_resize( scan, scan->window_size ) ) {
+    fprintf( stderr, "Failure allocating %llu byte windows\n", (long long unsigned)scan->window_size );
+    tchscan_close( scan );
+    return NULL;
+  }
+
+#ifdef HAVE_LIBURING
+  if ( TCHSCAN_URING == engine ) {
+    scan->uring = calloc( 1, sizeof( struct io_uring ) );
+    if ( 0 != io_uring_queue_init( 4, (struct io_uring*)scan->uring, 0 ) ) {
+      fprintf( stderr, "Failure setting up io_uring\n" );
+      free( scan->uring );
+      scan->uring = NULL;
+      tchscan_close( scan );
+      return NULL;
+    }
+  }
+#else
+  if ( TCHSCAN_URING == engine ) {
+    fprintf( stderr, "io_uring engine not built in, rebuild with HAVE_LIBURING\n" );
+    tchscan_close( scan );
+    return NULL;
+  }
+#endif
+
+  return scan;
+}
+
+void tchscan_close( tchscan_t* scan )
+{
+  if ( NULL != scan ) {
+
+#ifdef HAVE_LIBURING
+    if ( NULL != scan->uring ) {
+      if ( scan->prefetching ) {
+        uring_wait_prefetch( scan );
+      }
+      io_uring_queue_exit( (struct io_uring*)scan->uring );
+      free( scan->uring );
+    }
+#endif
+    if ( NULL != scan->map ) {
+      munmap( (void*)scan->map, scan->file_size );
+    }
+    free( scan->bufs[0] );
+    free( scan->bufs[1] );
+    // what was read since the last drop is done with as well, now it is
+    // unmapped, but not the rest of the file, another range may be reading it
+    if ( scan->io.drop_behind && UINT64_MAX != scan->dropped_to && scan->offset > scan->dropped_to ) {
+      posix_fadvise( scan->fd, scan->dropped_to, scan->offset - scan->dropped_to, POSIX_FADV_DONTNEED );
+    }
+    if ( -1 != scan->fd ) {
+      close( scan->fd );
+    }
+    free( scan );
+  }
+}
@@ -0,0 +1,200 @@
+#ifndef __TCHSCAN_H__
+#define __TCHSCAN_H__
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <zlib.h>
+
+#include "tchhdr.h"
+
+/*
+ * Raw sequential scanner over the record region of a hash database.  This is
+ * the same record parsing tchsplit does, but without fseek/fread per field,
+ * and without ever calling tchdbopen.
+ *
+ * There are several ways of getting the bytes in:
+ *
+ *   TCHSCAN_MMAP      a read only mapping of the whole file
+ *   TCHSCAN_BUFFERED  large pread windows, the end of one window carried to
+ *                     the front of the next so records never straddle
+ *   TCHSCAN_URING     the buffered engine with the next window read ahead
+ *                     through io_uring ( only when built with HAVE_LIBURING )
+ *
+ * The buffered engines grow their windows for a record that does not fit,
+ * up to TCHSCAN_MAX_WINDOW, but only once the record's key hashes to the
+ * hash byte in its header, so stray bytes that look like a record header
+ * while a scan resyncs never allocate a window that size.  A record larger
+ * than that is reported and stepped over.
+ *
+ * Any engine can be made polite to whatever else is using the page cache on
+ * the host with tchscan_set_io: pages behind the cursor are dropped, the
+ * buffered engines can read with O_DIRECT so they never go through the page
+ * cache at all, and reading can be held to a number of bytes per second.
+ *
+ * The key and value pointers handed back point directly into the mapping or
+ * the current window.  They are only valid until the next call on the
+ * scanner, they are NOT NUL terminated, and the value is exactly as it is
+ * stored on disk ( so still deflated if the database has the deflate option ).
+ */
+
+enum {                                  // enumeration for magic data
+ TCH_MAGIC_DATA_BLOCK = 0xc8,           // for data block
+ TCH_MAGIC_FREE_BLOCK = 0xb0            // for free block
+};
+
+enum {
+  TCHSCAN_MMAP,
+  TCHSCAN_BUFFERED,
+  TCHSCAN_URING
+};
+
+#define TCHSCAN_WINDOW_SIZE ( 8 * 1024 * 1024 )
+#define TCHSCAN_MAX_WINDOW  ( 256 * 1024 * 1024 ) /* most a window grows to for one record */
+#define TCHSCAN_IO_STEP     ( 4 * 1024 * 1024 )   /* bytes between drops and pacing checks */
+
+/*
+ * how a scanner treats the page cache and the disk
+ */
+typedef struct tchscan_io {
+  bool     drop_behind;   /* POSIX_FADV_DONTNEED ( and MADV_DONTNEED ) what has been scanned */
+  bool     direct;        /* O_DIRECT reads, buffered engines only                           */
+  uint64_t rate;          /* most bytes per second to scan, 0 for no limit                   */
+} tchscan_io_t;
+
+/*
+ * lighter weight copy of the TCHREC from tchdb.c
+ */
+typedef struct tchscan_rec {
+  uint64_t    offset;     /* direct offset of the record in the source file */
+  uint64_t    length;     /* total length of the record, padding included   */
+
+  uint64_t    left;       /* file offsets of the chain children             */
+  uint64_t    right;
+
+  const char *key_buf;    /* not NUL terminated                             */
+  const char *val_buf;    /* not NUL terminated                             */
+
+  uint32_t    key_size;   /* number of bytes in key_buf */
+  uint32_t    val_size;   /* number of bytes in val_buf */
+  uint16_t    pad_size;
+
+  uint8_t     magic;
+  uint8_t     hash;
+} tchscan_rec_t;
+
+typedef struct tchscan {
+  char           path[PATH_MAX+1]; /* full pathname to the database file          */
+  tchhdr_t       hdr;
+  int            engine;
+
+  int            fd;
+  uint64_t       file_size;
+  const uint8_t *map;              /* TCHSCAN_MMAP: mapping of the whole file      */
+
+  uint8_t       *bufs[2];          /* buffered engines: each 2 * window_size, the
+                                      carried tail goes in the first half and the
+                                      fresh read in the second                     */
+  int            cur;              /* which of bufs holds the current window       */
+  uint64_t       window_size;
+  uint64_t       window_base;      /* the size asked for, a larger record only
+                                      grows the window while it is read        */
+  const uint8_t *win;              /* the current window                           */
+  uint64_t       win_start;        /* file offset of win[0]                        */
+  uint64_t       win_end;          /* file offset just past the window             */
+  void          *uring;            /* TCHSCAN_URING state                          */
+  bool           prefetching;      /* a read of [win_end, win_end + window_size)
+                                      into bufs[!cur] is outstanding               */
+
+  uint64_t       offset;           /* offset of the next record to be read        */
+  uint64_t       end;              /* end of the record region                    */
+
+  uint64_t       free_blocks;      /* free blocks stepped over so far             */
+  uint64_t       skipped_bytes;    /* bytes skipped resyncing on non magic bytes  */
+  uint64_t       bytes_read;       /* bytes read by the buffered engines          */
+  uint64_t       read_ns;          /* nanoseconds the buffered engines waited on
+                                      their reads, the mmap engine's page faults
+                                      are not counted                             */
+
+  tchscan_io_t   io;
+  uint64_t       io_mark;          /* offset of the next drop / pacing check, or
+                                      UINT64_MAX when there is nothing to do      */
+  uint64_t       dropped_to;       /* pages before this have been dropped         */
+  uint64_t       pace_offset;      /* where pacing started, and when              */
+  double         pace_start;
+  double         paused;           /* seconds spent holding to io.rate            */
+} tchscan_t;
+
+/*
+ * Open the database at path with the mmap engine.  Prints the reason and
+ * returns NULL on failure.
+ */
+extern tchscan_t* tchscan_open( const char* path );
+
+/*
+ * Open with a particular engine, window_size is ignored for TCHSCAN_MMAP and
+ * 0 means TCHSCAN_WINDOW_SIZE.
+ */
+extern tchscan_t* tchscan_open_engine( const char* path, int engine, uint64_t window_size );
+
+/*
+ * Change how the scanner reads, see tchscan_io_t.  Asking for O_DIRECT on the
+ * mmap engine, or on a file system that does not support it, prints why and
+ * returns false, leaving the scanner reading through the page cache.
+ */
+extern bool tchscan_set_io( tchscan_t* scan, const tchscan_io_t* io );
+
+/*
+ * Name of an engine and the reverse, -1 if unknown or not built in.
+ */
+extern const char* tchscan_engine_name( int engine );
+extern int         tchscan_engine_named( const char* name );
+
+/*
+ * Position the scanner so the next record read starts at offset.  The offset
+ * must be one previously reported by the scanner ( or first_record ).
+ */
+extern bool tchscan_seek( tchscan_t* scan, uint64_t offset );
+
+/*
+ * Read the next data record into rec, stepping over free blocks.  Returns
+ * false at the end of the record region.
+ */
+extern bool tchscan_next( tchscan_t* scan, tchscan_rec_t* rec );
+
+/*
+ * Parse the single block at offset without moving the scanner.  Returns false
+ * if there is not a well formed data or free block there.
+ */
+extern bool tchscan_read_at( tchscan_t* scan, uint64_t offset, tchscan_rec_t* rec );
+
+/*
+ * The bucket index a key lands in and, through hash, the hash byte stored in
+ * its record.  This is tchdbbidx from tchdb.c ( bucket_idx_for_key in
+ * tcrecords.rb ).
+ */
+extern uint64_t tchscan_bucket_for( uint64_t bucket_number, const char* kbuf, int ksiz, uint8_t* hash );
+
+/*
+ * tchdbget without the library: down the tree of the key's bucket to the
+ * record with the key, into rec.  false if it is not there or the walk can
+ * not be read.  The bucket entry is read with pread, so not on a scanner
+ * with direct io.
+ */
+extern bool tchscan_lookup( tchscan_t* scan, const char* kbuf, uint32_t ksiz, tchscan_rec_t* rec );
+
+/*
+ * The same before it is taken modulo the bucket number, so one pass can place
+ * the keys in buckets of any size.
+ */
+extern uint64_t tchscan_key_hash( const char* kbuf, int ksiz, uint8_t* hash );
+
+/*
+ * Inflate a raw deflate value ( what tcdeflate writes ) into *buf, growing
+ * *buf as needed.  Returns the inflated size or -1 on a corrupt value.
+ */
+extern int tchscan_inflate( z_stream* zs, const char* vbuf, int vsiz, char** buf, int* buf_size );
+
+extern void tchscan_close( tchscan_t* scan );
+
+#endif
@@ -12,8 +12,13 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
+#include <getopt.h>
 
 #include "backend_for.h"
+#include "routing.h"
+#include "tchhdr.h"
+#include "profile.h"
+#include "metrics.h"
 
 /* meta information from the Hash Database
  * used to cooridinate the other operations
@@ -27,7 +32,12 @@ typedef struct split {
   short    free_block_pow;
   uint8_t  db_options;
   uint64_t bucket_number;
-  
+
+  /* how the outputs are tuned, the source's unless given as options */
+  short    out_apow;
+  short    out_fpow;
+  uint8_t  out_opts;
+  uint64_t out_bnum;
 
   short    bytes_per;            /* number of bytes per 'file address', this is 4 or 8 */
 
@@ -46,6 +56,20 @@ typedef struct split {
   TCHDB     *dest1_hdb;
   TCHDB     *dest2_hdb;
 
+  profile_thread_t *profile;     /* NULL unless --profile                          */
+  int       phase_read;
+  int       phase_route;
+  int       phase_write;
+
+  metrics_t      *metrics;       /* records and bytes split, how long reads and
+                                    writes took, for the progress line and
+                                    --metrics / --prometheus                     */
+  metrics_slot_t *counts;
+  int       m_records;
+  int       m_bytes;
+  int       h_read;
+  int       h_write;
+
 } split_t;
 
 
@@ -177,9 +201,8 @@ split_t* split_new( const char* source_filename,
                     const char* d1_bitmask_s, const char* d1_filename, 
                     const char* d2_bitmask_s, const char* d2_filename )
 {
-  TCHDB     *hdb;
   split_t *split;
-  int     errnum;
+  tchhdr_t  hdr;
 
   split = (split_t*)calloc( 1, sizeof( split_t ));
 
@@ -190,37 +213,35 @@ split_t* split_new( const char* source_filename,
   split->dest1_bitmask = strtoll( d1_bitmask_s, NULL, 0) ;
   split->dest2_bitmask = strtoll( d2_bitmask_s, NULL, 0) ;
 
-  hdb = tchdbnew();
+  if ( NULL == ( split->src_file = fopen( split->src_path, "r" ) ) ) {
+    fprintf(stderr, "Failure opening file [%s] : %s\n", split->src_path, strerror( errno ));
+    exit(1);
+  }
 
-  if ( !tchdbopen( hdb, split->src_path , HDBOREADER )) {
-    errnum = tchdbecode( hdb );
-    fprintf( stderr, "Failure opening database [%s] : %s\n", split->src_path, tchdberrmsg( errnum ));
-    tchdbdel( hdb );
+  if ( !tchhdr_read( fileno( split->src_file ), &hdr ) ) {
+    fprintf( stderr, "Failure opening database [%s] : %s\n", split->src_path, tchhdr_error( errno ));
     exit( 1 );
   }
 
-  split->bytes_per     = (hdb->opts & HDBTLARGE) ? sizeof(uint64_t) : sizeof(uint32_t);
+  split->bytes_per     = hdr.bytes_per;
 
-  split->record_count  = tchdbrnum( hdb );
-  split->record_offset = hdb->frec;
-  split->alignment_pow = hdb->apow;
-  split->db_options    = hdb->opts;
-  split->free_block_pow= hdb->fpow;
-  split->bucket_number = hdb->bnum;
+  split->record_count  = hdr.record_number;
+  split->record_offset = hdr.first_record;
+  split->alignment_pow = hdr.alignment_pow;
+  split->db_options    = hdr.options;
+  split->free_block_pow= hdr.free_block_pow;
+  split->bucket_number = hdr.bucket_number;
+
+  split->out_apow      = split->alignment_pow;
+  split->out_fpow      = split->free_block_pow;
+  split->out_opts      = split->db_options;
+  split->out_bnum      = split->bucket_number;
 
   split->keep_compressed = true;
 
   split->dest1_hdb     = NULL;
   split->dest2_hdb     = NULL;
 
-  tchdbclose( hdb );
-  tchdbdel( hdb );
-
-  if ( NULL == ( split->src_file = fopen( split->src_path, "r" ) ) ) {
-    fprintf(stderr, "Failure opening file [%s] : %s\n", split->src_path, strerror( errno ));
-    exit(1);
-  }
-
   return split;
 }
 
@@ -230,8 +251,8 @@ TCHDB* split_clone_db( split_t* split, const char* path )
 
   fprintf( stdout , "-> Creating destination file %s\n", path );
   hdb  = tchdbnew();
-  tchdbtune(hdb, split->bucket_number, split->alignment_pow, 
-                 split->free_block_pow, split->db_options );
+  tchdbtune(hdb, split->out_bnum, split->out_apow, 
+                 split->out_fpow, split->out_opts );
 
   if( !tchdbopen( hdb, path, HDBOWRITER | HDBOCREAT | HDBONOLCK) ) {
     int errnum = tchdbecode( hdb );
@@ -257,7 +278,7 @@ void split_close_db( split_t* split, TCHDB* hdb )
     if ( split->keep_compressed ) {
       if ( split->db_options & HDBTDEFLATE ) {
         hdb->zmode = true;
-        hdb->opts  = split->db_options;
+        hdb->opts  = split->out_opts;
       }
     }
     tchdbclose( hdb );
@@ -292,27 +313,32 @@ void split_initialize_destination_dbs( split_t* split )
 
 }
 
-void split_split_source_to_destinations( split_t* split )
+void split_split_source_to_destinations( split_t* split, const routing_t* map )
 {
   split_rec_t       rec;
-  const storage_config_t *storage;
+  int               slot;
   TCHDB          *store_hdb = NULL;
   off_t              offset = split->record_offset;
   uint64_t      dest1_count = 0;
   uint64_t      dest2_count = 0;
   uint64_t           errors = 0;
   uint64_t           so_far = 0;
-  time_t         start_time = time(NULL);
+  uint64_t       read_start = metrics_now();
+  uint64_t            begin = profile_begin( split->profile, split->phase_read );
 
   fprintf( stdout, "-> Processing an estimated %llu records...\n", (long long unsigned)split->record_count );
   while ( split_read_next_rec( split, offset, &rec ) ) {
+    profile_end( split->profile, split->phase_read, begin );
+    metrics_observe( split->counts, split->h_read, metrics_now() - read_start );
 
-    storage = backend_for( rec.key_buf, rec.key_size );
+    begin = profile_begin( split->profile, split->phase_route );
+    slot  = routing_slot( map, rec.key_buf, rec.key_size );
+    profile_end( split->profile, split->phase_route, begin );
 
-    if ( storage->bitmask == split->dest1_bitmask ) {
+    if ( slot >= 0 && (unsigned long long)slot == split->dest1_bitmask ) {
       store_hdb = split->dest1_hdb;
       dest1_count += 1;
-    } else if ( storage->bitmask == split->dest2_bitmask ) {
+    } else if ( slot >= 0 && (unsigned long long)slot == split->dest2_bitmask ) {
       store_hdb = split->dest2_hdb;
       dest2_count += 1;
     } else {
@@ -323,15 +349,24 @@ void split_split_source_to_destinations( split_t* split )
     }
 
     if ( NULL != store_hdb ) {
+      uint64_t write_start = metrics_now();
+      begin = profile_begin( split->profile, split->phase_write );
       tchdbputkeep( store_hdb, rec.key_buf, rec.key_size, rec.val_buf, rec.val_size ); 
+      profile_end( split->profile, split->phase_write, begin );
+      metrics_observe( split->counts, split->h_write, metrics_now() - write_start );
     }
 
     so_far += 1;
     offset = rec.offset + rec.length;
+    metrics_add( split->counts, split->m_records, 1 );
+    metrics_add( split->counts, split->m_bytes, rec.key_size + rec.val_size );
 
     if ( so_far % 1000 == 0 ) {
-      print_progress( stdout , start_time, split->record_count, so_far); 
+      metrics_tick( split->metrics, false );
+      metrics_progress( split->metrics, stdout, split->m_records, split->record_count, so_far );
     }
+    read_start = metrics_now();
+    begin      = profile_begin( split->profile, split->phase_read );
   }
   fprintf( stdout, "\n");
   fprintf( stdout, "Processed records             : %15llu\n", (long long unsigned)so_far);
@@ -344,29 +379,138 @@ void split_split_source_to_destinations( split_t* split )
 
 }
 
+static void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options] source.tch mask_a out_a.tch mask_b out_b.tch [routing.map]\n", name );
+  fprintf( stderr, "  -f, --profile          print where the time went at the end\n" );
+  fprintf( stderr, "  -E, --trace FILE       and write the timed spans to FILE as a Chrome trace\n" );
+  fprintf( stderr, "  -j, --metrics FILE     append the counters and latencies to FILE as JSON lines every second\n" );
+  fprintf( stderr, "  -P, --prometheus FILE  keep FILE up to date in Prometheus text format\n" );
+  fprintf( stderr, "  -b, --bnum N           make the outputs with N buckets instead of the source's number\n" );
+  fprintf( stderr, "  -a, --apow N           with 2^N byte alignment instead of the source's\n" );
+  fprintf( stderr, "  -p, --fpow N           with 2^N free pool entries instead of the source's\n" );
+  fprintf( stderr, "  -l, --large            with 64 bit offsets\n" );
+  fprintf( stderr, "  -L, --no-large         with 32 bit offsets\n" );
+  fprintf( stderr, "                         tchstat --advise works these out from the source\n" );
+  exit(1);
+}
+
 int main( int argc, char** argv )
 {
+  routing_t  *map;
+  const char *name       = argv[0];
+  profile_t  *profile    = NULL;
+  bool        profiling  = false;
+  const char *trace_path = NULL;
+  const char *json_path  = NULL;
+  const char *prom_path  = NULL;
+  long long   bnum       = -1;
+  int         apow       = -1;
+  int         fpow       = -1;
+  int         large      = -1;
+  int         opt;
+
+  static struct option long_options[] = {
+    { "profile",    no_argument,       NULL, 'f' },
+    { "trace",      required_argument, NULL, 'E' },
+    { "metrics",    required_argument, NULL, 'j' },
+    { "prometheus", required_argument, NULL, 'P' },
+    { "bnum",       required_argument, NULL, 'b' },
+    { "apow",       required_argument, NULL, 'a' },
+    { "fpow",       required_argument, NULL, 'p' },
+    { "large",      no_argument,       NULL, 'l' },
+    { "no-large",   no_argument,       NULL, 'L' },
+    { NULL,         0,                 NULL, 0   }
+  };
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "fE:j:P:b:a:p:lL", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'f': profiling  = true; break;
+      case 'E': trace_path = optarg; break;
+      case 'j': json_path  = optarg; break;
+      case 'P': prom_path  = optarg; break;
+      case 'b': bnum       = atoll( optarg ); break;
+      case 'a': apow       = atoi( optarg ); break;
+      case 'p': fpow       = atoi( optarg ); break;
+      case 'l': large      = 1; break;
+      case 'L': large      = 0; break;
+      default : usage( name );
+    }
+  }
+  // the positional arguments keep the numbers they had before there were options
+  argc -= optind - 1;
+  argv += optind - 1;
+
   if ( argc < 6 ) {
-    fprintf(stderr, "Usage: %s source.tch mask_a out_a.tch mask_b out_b.tch\n", argv[0] );
+    usage( name );
+  }
+
+  // the masks are of the map given, or of the servers compiled in
+  if ( NULL == ( map = ( argc > 6 ) ? routing_load( argv[6] ) : routing_compiled( ) ) ) {
     exit(1);
   }
 
   split_t *split = split_new( argv[1], argv[2], argv[3], argv[4], argv[5] );
 
+  // the outputs are tuned like the source unless told otherwise, the
+  // source's own numbers are still the ones its records are read with
+  if ( bnum > 0 ) {
+    split->out_bnum = bnum;
+  }
+  if ( apow >= 0 ) {
+    split->out_apow = apow;
+  }
+  if ( fpow >= 0 ) {
+    split->out_fpow = fpow;
+  }
+  if ( large >= 0 ) {
+    split->out_opts = large ? ( split->out_opts | HDBTLARGE ) : ( split->out_opts & ~HDBTLARGE );
+  }
+
+  if ( profiling || NULL != trace_path ) {
+    profile            = profile_new( "tchsplit", PROFILE_SAMPLE_EVERY, trace_path );
+    split->phase_read  = profile_phase( profile, "read" );
+    split->phase_route = profile_phase( profile, "route" );
+    split->phase_write = profile_phase( profile, "write" );
+    split->profile     = profile_thread( profile, "split" );
+  }
+
+  split->metrics   = metrics_new( "tchsplit", 1 );
+  split->m_records = metrics_counter( split->metrics, "records" );
+  split->m_bytes   = metrics_counter( split->metrics, "bytes" );
+  split->h_read    = metrics_histogram( split->metrics, "read" );
+  split->h_write   = metrics_histogram( split->metrics, "write" );
+  if ( !metrics_output( split->metrics, json_path, prom_path ) ) {
+    exit(1);
+  }
+  split->counts    = metrics_slot( split->metrics );
+
   fprintf( stdout, "Source Database       : %s\n",   split->src_path );
   fprintf( stdout, "  Destination 1 DB    : %s\n",   split->dest1_path );
   fprintf( stdout, "  Destination 1 mask  : 0x%02x\n",   split->dest1_bitmask );
   fprintf( stdout, "  Destination 2 DB    : %s\n",   split->dest2_path);
   fprintf( stdout, "  Destination 2 mask  : 0x%02x\n",   split->dest2_bitmask );
-  fprintf( stdout, "  alignment power     : %llu ( %d byte alignment )\n", (long long unsigned)split->alignment_pow,
-                                                                         1 << split->alignment_pow);
+  fprintf( stdout, "  routing map         : %s ( %d servers )\n", ( argc > 6 ) ? argv[6] : "compiled in", map->count );
+  fprintf( stdout, "  alignment power     : %llu ( %d byte alignment ), outputs %d\n", (long long unsigned)split->alignment_pow,
+                                                                         1 << split->alignment_pow, split->out_apow );
+  fprintf( stdout, "  bucket number       : %llu, outputs %llu\n", (long long unsigned)split->bucket_number,
+                                                                  (long long unsigned)split->out_bnum );
+  fprintf( stdout, "  free block power    : %d, outputs %d\n", split->free_block_pow, split->out_fpow );
+  fprintf( stdout, "  large offsets       : %s, outputs %s\n", ( split->db_options & HDBTLARGE ) ? "yes" : "no",
+                                                              ( split->out_opts & HDBTLARGE ) ? "yes" : "no" );
   fprintf( stdout, "  number of records   : %llu\n", (long long unsigned)split->record_count );
   fprintf( stdout, "  offset of records   : %llu\n", (long long unsigned)split->record_offset );
 
   split_initialize_destination_dbs( split );
-  split_split_source_to_destinations( split );
+  split_split_source_to_destinations( split, map );
 
   split_destroy( split );
+  metrics_destroy( split->metrics );
+  if ( NULL != profile ) {
+    profile_report( profile, stdout );
+    profile_destroy( profile );
+  }
+  routing_free( map );
 
   exit(0);
  
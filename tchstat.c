@@ -0,0 +1,515 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <zlib.h>
+#include <sys/mman.h>
+
+#include "tchhdr.h"
+#include "tchscan.h"
+#include "tchpar.h"
+#include "tchtune.h"
+#include "tchidx.h"
+#include "tchbf.h"
+
+/*
+ * Where the bytes and the lookup time of a hash database go, in one parallel
+ * pass of tchpar over the records and one read of the bucket array, written
+ * out as JSON.
+ *
+ *   chains        records per bucket, from the bucket each key hashes to
+ *   key, value, padding and record sizes, as log2 histograms
+ *   free blocks   count, bytes and a log2 histogram of their sizes
+ *   buckets       how many entries of the bucket array are in use
+ *   compression   for a deflate database what every --sample'th value
+ *                 inflates to, for any other what deflate would make of it
+ *
+ * With --advise the same pass also feeds tchtune, which works out the bnum,
+ * apow and fpow a shard cut from this one should get.
+ * With --bloom it adds every key to a tchbloom filter as well and writes it
+ * next to the database, saving tchbloom build its own pass.
+ *
+ * A lookup walks the tree hanging off its bucket, so long chains are what
+ * make a shard slow to read, and padding and free blocks are what make its
+ * file bigger than its records.
+ */
+
+#define STAT_THREADS    4
+#define STAT_SAMPLE     64        /* one value in this many is ( in|de )flated */
+#define STAT_HIST       33        /* bucket b holds values under 2^b, 0 only 0 */
+#define STAT_CHAIN_MAX  64        /* longer chains are counted together       */
+
+void print_json_string( FILE* out, const char* s );
+
+typedef struct stat_hist {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[STAT_HIST];
+} stat_hist_t;
+
+typedef struct stat_thread {
+  stat_hist_t key_size;
+  stat_hist_t val_size;
+  stat_hist_t pad_size;
+  stat_hist_t rec_size;
+  uint64_t    hash_mismatches;      /* records whose hash byte is not their key's */
+
+  uint64_t    until_sample;
+  uint64_t    sampled;
+  uint64_t    sampled_stored;       /* value bytes as they are on disk        */
+  uint64_t    sampled_other;        /* inflated, or deflated, size of the same */
+  uint64_t    sample_errors;
+  z_stream    zs;
+  char       *buf;
+  int         buf_size;
+} __attribute__(( aligned( 64 ) )) stat_thread_t;
+
+typedef struct stat_run {
+  tchhdr_t       hdr;
+  int            sample_every;      /* 0 for no sampling                      */
+  bool           inflate;           /* deflate database, else try deflating   */
+  uint32_t      *chains;            /* records per bucket, shared             */
+  tchtune_t     *tune;              /* NULL without --advise                  */
+  tchbf_t       *bloom;             /* NULL without --bloom                   */
+  stat_thread_t *threads;
+} stat_run_t;
+
+static inline void stat_hist_add( stat_hist_t* h, uint64_t v )
+{
+  int b = ( 0 == v ) ? 0 : 64 - __builtin_clzll( v );
+
+  h->count += 1;
+  h->sum   += v;
+  if ( v > h->max ) {
+    h->max = v;
+  }
+  h->buckets[( b < STAT_HIST ) ? b : STAT_HIST - 1] += 1;
+}
+
+static void stat_hist_merge( stat_hist_t* into, const stat_hist_t* h )
+{
+  into->count += h->count;
+  into->sum   += h->sum;
+  if ( h->max > into->max ) {
+    into->max = h->max;
+  }
+  for ( int b = 0 ; b < STAT_HIST ; b++ ) {
+    into->buckets[b] += h->buckets[b];
+  }
+}
+
+/*
+ * upper bound of the bucket holding the pct'th percentile
+ */
+static uint64_t stat_hist_percentile( const stat_hist_t* h, double pct )
+{
+  uint64_t seen = 0;
+
+  for ( int b = 0 ; b < STAT_HIST ; b++ ) {
+    seen += h->buckets[b];
+    if ( seen > 0 && seen >= h->count * pct ) {
+      return ( 0 == b ) ? 0 : ( 1ULL << b ) - 1;
+    }
+  }
+  return h->max;
+}
+
+void stat_sample( stat_run_t* run, stat_thread_t* st, const tchscan_rec_t* rec )
+{
+  int size;
+
+  if ( run->inflate ) {
+    size = tchscan_inflate( &(st->zs), rec->val_buf, rec->val_size, &(st->buf), &(st->buf_size) );
+  } else {
+    uLong bound = deflateBound( &(st->zs), rec->val_size );
+    if ( bound > (uLong)st->buf_size ) {
+      st->buf_size = bound;
+      st->buf      = realloc( st->buf, st->buf_size );
+    }
+    deflateReset( &(st->zs) );
+    st->zs.next_in   = (Bytef*)rec->val_buf;
+    st->zs.avail_in  = rec->val_size;
+    st->zs.next_out  = (Bytef*)st->buf;
+    st->zs.avail_out = st->buf_size;
+    size = ( Z_STREAM_END == deflate( &(st->zs), Z_FINISH ) ) ? (int)st->zs.total_out : -1;
+  }
+
+  if ( size < 0 ) {
+    st->sample_errors += 1;
+    return;
+  }
+  st->sampled        += 1;
+  st->sampled_stored += rec->val_size;
+  st->sampled_other  += size;
+}
+
+bool stat_record( const tchscan_rec_t* rec, int thread, void* ctx )
+{
+  stat_run_t    *run = (stat_run_t*)ctx;
+  stat_thread_t *st  = &(run->threads[thread]);
+  uint8_t        hash;
+  uint64_t       key_hash = tchscan_key_hash( rec->key_buf, rec->key_size, &hash );
+
+  __atomic_fetch_add( &(run->chains[key_hash % run->hdr.bucket_number]), 1, __ATOMIC_RELAXED );
+  if ( hash != rec->hash ) {
+    st->hash_mismatches += 1;
+  }
+
+  stat_hist_add( &(st->key_size), rec->key_size );
+  stat_hist_add( &(st->val_size), rec->val_size );
+  stat_hist_add( &(st->pad_size), rec->pad_size );
+  stat_hist_add( &(st->rec_size), rec->length );
+
+  if ( run->sample_every > 0 && 0 == st->until_sample-- ) {
+    st->until_sample = run->sample_every - 1;
+    stat_sample( run, st, rec );
+  }
+  if ( NULL != run->tune ) {
+    tchtune_add( run->tune, thread, rec, key_hash );
+  }
+  if ( NULL != run->bloom ) {
+    tchbf_add( run->bloom, tchbf_hash( key_hash ) );
+  }
+  return true;
+}
+
+/*
+ * entries of the bucket array that point at a record
+ */
+bool count_nonzero_buckets( const char* path, const tchhdr_t* hdr, uint64_t* nonzero )
+{
+  uint64_t  length = TCH_HEADER_SIZE + tchhdr_bucket_bytes( hdr );
+  uint8_t  *mem;
+  int       fd;
+
+  *nonzero = 0;
+  if ( -1 == ( fd = open( path, O_RDONLY ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", path, strerror( errno ) );
+    return false;
+  }
+  mem = (uint8_t*)mmap( NULL, length, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( MAP_FAILED == mem ) {
+    fprintf( stderr, "error mapping %s : %s\n", path, strerror( errno ) );
+    return false;
+  }
+  madvise( mem, length, MADV_SEQUENTIAL );
+
+  if ( sizeof( uint64_t ) == hdr->bytes_per ) {
+    const uint64_t *b = (const uint64_t*)( mem + TCH_HEADER_SIZE );
+    for ( uint64_t i = 0 ; i < hdr->bucket_number ; i++ ) {
+      *nonzero += ( 0 != b[i] );
+    }
+  } else {
+    const uint32_t *b = (const uint32_t*)( mem + TCH_HEADER_SIZE );
+    for ( uint64_t i = 0 ; i < hdr->bucket_number ; i++ ) {
+      *nonzero += ( 0 != b[i] );
+    }
+  }
+  munmap( mem, length );
+  return true;
+}
+
+void print_hist( FILE* out, const char* name, const stat_hist_t* h, bool last )
+{
+  bool first = true;
+
+  fprintf( out, "  \"%s\": { \"count\": %llu, \"sum\": %llu, \"mean\": %.2f, \"max\": %llu, "
+                "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu,\n    \"histogram\": [",
+           name, (long long unsigned)h->count, (long long unsigned)h->sum,
+           h->count ? h->sum / (double)h->count : 0.0, (long long unsigned)h->max,
+           (long long unsigned)stat_hist_percentile( h, 0.50 ), (long long unsigned)stat_hist_percentile( h, 0.90 ),
+           (long long unsigned)stat_hist_percentile( h, 0.99 ) );
+  for ( int b = 0 ; b < STAT_HIST ; b++ ) {
+    if ( 0 == h->buckets[b] ) {
+      continue;
+    }
+    fprintf( out, "%s { \"under\": %llu, \"count\": %llu }", first ? "" : ",",
+             (long long unsigned)( 1ULL << b ), (long long unsigned)h->buckets[b] );
+    first = false;
+  }
+  fprintf( out, " ] }%s\n", last ? "" : "," );
+}
+
+void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options] database.tch\n", name );
+  fprintf( stderr, "  -t, --threads N   scan with N threads ( default %d )\n", STAT_THREADS );
+  fprintf( stderr, "  -s, --sample N    ( in|de )flate one value in N for the compression ratio, 0 for none ( default %d )\n", STAT_SAMPLE );
+  fprintf( stderr, "  -o, --output FILE write the JSON to FILE instead of stdout\n" );
+  fprintf( stderr, "  -a, --advise      and the bnum, apow and fpow a shard cut from this one should get to stderr\n" );
+  fprintf( stderr, "  -g, --growth F    for a shard expected to grow F times before it is split again ( default %.1f )\n", TCHTUNE_GROWTH );
+  fprintf( stderr, "  -b, --bloom       and write the tchbloom filter of the keys next to the database\n" );
+}
+
+int main( int argc, char** argv )
+{
+  int            threads     = STAT_THREADS;
+  int            sample      = STAT_SAMPLE;
+  const char    *output_path = NULL;
+  bool           advise      = false;
+  bool           bloom       = false;
+  double         growth      = TCHTUNE_GROWTH;
+  double         ratio;
+  FILE          *out         = stdout;
+  tchidx_stamp_t before, after;
+  char           bf_path[PATH_MAX+1];
+  stat_run_t     run;
+  tchpar_t      *par;
+  stat_thread_t  total;
+  uint64_t       chain_hist[STAT_CHAIN_MAX + 1];
+  uint64_t       chain_max   = 0;
+  uint64_t       with_records = 0;
+  uint64_t       probes      = 0;
+  uint64_t       nonzero     = 0;
+  uint64_t       free_blocks = 0;
+  uint64_t       free_bytes  = 0;
+  uint64_t       skipped     = 0;
+  uint64_t       free_sizes[TCHPAR_FREE_HIST];
+  int64_t        records;
+  struct timespec start, stop;
+  bool           first;
+  int            opt;
+
+  struct option long_options[] = {
+    { "threads", required_argument, NULL, 't' },
+    { "sample",  required_argument, NULL, 's' },
+    { "output",  required_argument, NULL, 'o' },
+    { "advise",  no_argument,       NULL, 'a' },
+    { "growth",  required_argument, NULL, 'g' },
+    { "bloom",   no_argument,       NULL, 'b' },
+    { NULL,      0,                 NULL,  0  }
+  };
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "t:s:o:ag:b", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 't': threads     = atoi( optarg ); break;
+      case 's': sample      = atoi( optarg ); break;
+      case 'o': output_path = optarg; break;
+      case 'a': advise      = true; break;
+      case 'g': growth      = atof( optarg ); break;
+      case 'b': bloom       = true; break;
+      default :
+        usage( argv[0] );
+        exit(1);
+    }
+  }
+
+  if ( optind >= argc || threads < 1 || sample < 0 || growth < 1 ) {
+    usage( argv[0] );
+    exit(1);
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  if ( NULL == ( par = tchpar_new( argv[optind], threads, TCHSCAN_MMAP, 0 ) ) ) {
+    exit(1);
+  }
+
+  memset( &run, 0, sizeof( run ) );
+  run.hdr          = par->ranges[0].scan->hdr;
+  run.inflate      = ( run.hdr.options & TCH_OPT_DEFLATE );
+  run.sample_every = sample;
+  if ( run.hdr.options & ( TCH_OPT_BZIP2 | TCH_OPT_TCBS | TCH_OPT_EXCODEC ) ) {
+    fprintf( stderr, "Only deflate values can be sampled, no compression ratio for %s\n", argv[optind] );
+    run.sample_every = 0;
+  }
+  if ( 0 == run.hdr.bucket_number ||
+       NULL == ( run.chains = (uint32_t*)calloc( run.hdr.bucket_number, sizeof( uint32_t ) ) ) ) {
+    fprintf( stderr, "Can not count chains over %llu buckets\n", (long long unsigned)run.hdr.bucket_number );
+    exit(1);
+  }
+  if ( 0 != posix_memalign( (void**)&(run.threads), 64, par->nthreads * sizeof( stat_thread_t ) ) ) {
+    fprintf( stderr, "Failure allocating %d scan threads\n", par->nthreads );
+    exit(1);
+  }
+  memset( run.threads, 0, par->nthreads * sizeof( stat_thread_t ) );
+  if ( advise ) {
+    run.tune = tchtune_new( &(run.hdr), par->nthreads, growth );
+  }
+  if ( bloom ) {
+    if ( !tchbf_path( par->path, bf_path, sizeof( bf_path ) ) ||
+         !tchidx_stamp_path( par->path, &before ) ) {
+      exit(1);
+    }
+    if ( NULL == ( run.bloom = tchbf_new( run.hdr.record_number, TCHBF_FPR ) ) ) {
+      fprintf( stderr, "Out of memory for the filter of %llu keys\n", (long long unsigned)run.hdr.record_number );
+      exit(1);
+    }
+  }
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    stat_thread_t *st = &(run.threads[i]);
+    st->buf_size = 64 * 1024;
+    st->buf      = malloc( st->buf_size );
+    if ( run.inflate ) {
+      inflateInit2( &(st->zs), -15 );
+    } else {
+      deflateInit2( &(st->zs), Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY );
+    }
+  }
+
+  if ( !tchpar_start( par, 0, stat_record, &run ) ) {
+    exit(1);
+  }
+  records = tchpar_finish( par );
+  if ( records < 0 ) {
+    fprintf( stderr, "The scan of %s did not line up, no statistics\n", argv[optind] );
+    exit(1);
+  }
+
+  memset( &total, 0, sizeof( total ) );
+  memset( free_sizes, 0, sizeof( free_sizes ) );
+  for ( int i = 0 ; i < par->nthreads ; i++ ) {
+    stat_thread_t  *st    = &(run.threads[i]);
+    tchpar_range_t *range = &(par->ranges[i]);
+
+    stat_hist_merge( &(total.key_size), &(st->key_size) );
+    stat_hist_merge( &(total.val_size), &(st->val_size) );
+    stat_hist_merge( &(total.pad_size), &(st->pad_size) );
+    stat_hist_merge( &(total.rec_size), &(st->rec_size) );
+    total.hash_mismatches += st->hash_mismatches;
+    total.sampled         += st->sampled;
+    total.sampled_stored  += st->sampled_stored;
+    total.sampled_other   += st->sampled_other;
+    total.sample_errors   += st->sample_errors;
+    if ( run.inflate ) {
+      inflateEnd( &(st->zs) );
+    } else {
+      deflateEnd( &(st->zs) );
+    }
+    free( st->buf );
+
+    free_blocks += range->free_blocks;
+    free_bytes  += range->free_bytes;
+    skipped     += range->skipped_bytes;
+    for ( int b = 0 ; b < TCHPAR_FREE_HIST ; b++ ) {
+      free_sizes[b] += range->free_sizes[b];
+    }
+  }
+
+  // a lookup that hits walks on average half the chain if it were a list, the tree is no worse
+  memset( chain_hist, 0, sizeof( chain_hist ) );
+  for ( uint64_t i = 0 ; i < run.hdr.bucket_number ; i++ ) {
+    uint64_t n = run.chains[i];
+    chain_hist[( n < STAT_CHAIN_MAX ) ? n : STAT_CHAIN_MAX] += 1;
+    with_records += ( n > 0 );
+    probes       += n * ( n + 1 ) / 2;
+    if ( n > chain_max ) {
+      chain_max = n;
+    }
+  }
+  free( run.chains );
+
+  if ( !count_nonzero_buckets( par->path, &(run.hdr), &nonzero ) ) {
+    exit(1);
+  }
+
+  // the filter is only written for a database nothing wrote to while it was read
+  if ( NULL != run.bloom ) {
+    if ( !tchidx_stamp_path( par->path, &after ) ) {
+      exit(1);
+    }
+    if ( 0 != memcmp( &before, &after, sizeof( before ) ) ) {
+      fprintf( stderr, "%s changed while it was read, not writing %s\n", par->path, bf_path );
+    } else if ( !tchbf_write( run.bloom, bf_path, &before ) ) {
+      exit(1);
+    }
+    tchbf_destroy( run.bloom );
+  }
+  clock_gettime( CLOCK_MONOTONIC, &stop );
+
+  if ( NULL != output_path && NULL == ( out = fopen( output_path, "w" ) ) ) {
+    fprintf( stderr, "open error on %s : %s\n", output_path, strerror( errno ) );
+    exit(1);
+  }
+
+  // how many times smaller deflate makes a value, either way round
+  ratio = 0;
+  if ( total.sampled_stored > 0 && total.sampled_other > 0 ) {
+    ratio = run.inflate ? total.sampled_other / (double)total.sampled_stored
+                        : total.sampled_stored / (double)total.sampled_other;
+  }
+
+  fprintf( out, "{\n" );
+  fprintf( out, "  \"file\": " );
+  print_json_string( out, par->path );
+  fprintf( out, ",\n" );
+  fprintf( out, "  \"file_size\": %llu,\n", (long long unsigned)par->ranges[0].scan->file_size );
+  fprintf( out, "  \"seconds\": %.3f,\n", ( stop.tv_sec - start.tv_sec ) + ( stop.tv_nsec - start.tv_nsec ) / 1e9 );
+  fprintf( out, "  \"threads\": %d,\n", par->nthreads );
+  fprintf( out, "  \"header\": { \"type\": \"%s\", \"alignment_pow\": %d, \"free_block_pow\": %d, \"options\": %d, "
+                "\"bucket_number\": %llu, \"record_number\": %llu, \"first_record\": %llu, \"bytes_per\": %d },\n",
+           tchhdr_type_name( run.hdr.db_type ), run.hdr.alignment_pow, run.hdr.free_block_pow, run.hdr.options,
+           (long long unsigned)run.hdr.bucket_number, (long long unsigned)run.hdr.record_number,
+           (long long unsigned)run.hdr.first_record, run.hdr.bytes_per );
+  fprintf( out, "  \"records\": %lld,\n", (long long)records );
+  fprintf( out, "  \"hash_mismatches\": %llu,\n", (long long unsigned)total.hash_mismatches );
+
+  fprintf( out, "  \"buckets\": { \"nonzero\": %llu, \"fill_ratio\": %.4f, \"with_records\": %llu, \"load_factor\": %.4f },\n",
+           (long long unsigned)nonzero, nonzero / (double)run.hdr.bucket_number, (long long unsigned)with_records,
+           records / (double)run.hdr.bucket_number );
+
+  fprintf( out, "  \"chains\": { \"max\": %llu, \"mean_nonempty\": %.3f, \"list_probes_per_hit\": %.3f,\n    \"histogram\": [",
+           (long long unsigned)chain_max, with_records ? records / (double)with_records : 0.0,
+           records > 0 ? probes / (double)records : 0.0 );
+  first = true;
+  for ( int n = 0 ; n <= STAT_CHAIN_MAX ; n++ ) {
+    if ( 0 == chain_hist[n] ) {
+      continue;
+    }
+    fprintf( out, "%s { \"length\": %d%s, \"buckets\": %llu }", first ? "" : ",", n,
+             ( STAT_CHAIN_MAX == n ) ? ", \"or_more\": true" : "", (long long unsigned)chain_hist[n] );
+    first = false;
+  }
+  fprintf( out, " ] },\n" );
+
+  print_hist( out, "key_size", &(total.key_size), false );
+  print_hist( out, "value_size", &(total.val_size), false );
+  print_hist( out, "padding", &(total.pad_size), false );
+  print_hist( out, "record_size", &(total.rec_size), false );
+
+  fprintf( out, "  \"free_blocks\": { \"count\": %llu, \"bytes\": %llu,\n    \"histogram\": [",
+           (long long unsigned)free_blocks, (long long unsigned)free_bytes );
+  first = true;
+  for ( int b = 0 ; b < TCHPAR_FREE_HIST ; b++ ) {
+    if ( 0 == free_sizes[b] ) {
+      continue;
+    }
+    fprintf( out, "%s { \"under\": %llu, \"count\": %llu }", first ? "" : ",",
+             (long long unsigned)( 1ULL << b ), (long long unsigned)free_sizes[b] );
+    first = false;
+  }
+  fprintf( out, " ] },\n" );
+
+  fprintf( out, "  \"bytes\": { \"header\": %d, \"bucket_array\": %llu, \"free_pool\": %llu, \"record_headers\": %llu, "
+                "\"keys\": %llu, \"values\": %llu, \"padding\": %llu, \"free_blocks\": %llu, \"unparsed\": %llu },\n",
+           TCH_HEADER_SIZE, (long long unsigned)tchhdr_bucket_bytes( &(run.hdr) ),
+           (long long unsigned)tchhdr_free_pool_bytes( &(run.hdr) ),
+           (long long unsigned)( total.rec_size.sum - total.key_size.sum - total.val_size.sum - total.pad_size.sum ),
+           (long long unsigned)total.key_size.sum, (long long unsigned)total.val_size.sum,
+           (long long unsigned)total.pad_size.sum, (long long unsigned)free_bytes, (long long unsigned)skipped );
+
+  fprintf( out, "  \"compression\": { \"mode\": \"%s\", \"sample_every\": %d, \"sampled\": %llu, \"errors\": %llu, "
+                "\"stored_bytes\": %llu, \"%s_bytes\": %llu, \"ratio\": %.4f }\n",
+           ( 0 == run.sample_every ) ? "none" : run.inflate ? "inflate" : "deflate", run.sample_every,
+           (long long unsigned)total.sampled, (long long unsigned)total.sample_errors,
+           (long long unsigned)total.sampled_stored, run.inflate ? "inflated" : "deflated",
+           (long long unsigned)total.sampled_other, ratio );
+  fprintf( out, "}\n" );
+
+  if ( stdout != out ) {
+    fclose( out );
+  }
+  if ( NULL != run.tune ) {
+    tchtune_report( run.tune, par->path, free_blocks, ratio, stderr );
+    tchtune_destroy( run.tune );
+  }
+  free( run.threads );
+  tchpar_destroy( par );
+  exit(0);
+}
@@ -0,0 +1,317 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "tchhdr.h"
+#include "tchstream.h"
+
+#define TCHSTREAM_FRAME_SIZE 8       /* payload length and record count */
+
+static int put_varint( uint8_t* p, uint32_t v )
+{
+  int n = 0;
+  while ( v >= 0x80 ) {
+    p[n++] = (uint8_t)( v | 0x80 );
+    v >>= 7;
+  }
+  p[n++] = (uint8_t)v;
+  return n;
+}
+
+/*
+ * returns the bytes consumed or 0 if it runs past end
+ */
+static int get_varint( const uint8_t* p, const uint8_t* end, uint32_t* v )
+{
+  uint64_t num   = 0;
+  int      shift = 0;
+
+  for ( int n = 0 ; p + n < end && n < 5 ; n++ ) {
+    num |= (uint64_t)( p[n] & 0x7f ) << shift;
+    if ( 0 == ( p[n] & 0x80 ) ) {
+      if ( num > UINT32_MAX ) {
+        return 0;
+      }
+      *v = (uint32_t)num;
+      return n + 1;
+    }
+    shift += 7;
+  }
+  return 0;
+}
+
+/*
+ * read until len bytes or the end of the stream, returns the bytes read or -1
+ */
+static int64_t read_fully( int fd, void* buf, uint64_t len )
+{
+  uint64_t got = 0;
+
+  while ( got < len ) {
+    ssize_t r = read( fd, (uint8_t*)buf + got, len - got );
+    if ( r < 0 ) {
+      if ( EINTR == errno ) { continue; }
+      return -1;
+    }
+    if ( 0 == r ) {
+      break;
+    }
+    got += r;
+  }
+  return got;
+}
+
+bool tchstream_write_fully( int fd, const void* buf, uint64_t len )
+{
+  uint64_t done = 0;
+
+  while ( done < len ) {
+    ssize_t w = write( fd, (const uint8_t*)buf + done, len - done );
+    if ( w < 0 ) {
+      if ( EINTR == errno ) { continue; }
+      return false;
+    }
+    done += w;
+  }
+  return true;
+}
+
+bool tchstream_write_header( int fd, const tchstream_header_t* hdr )
+{
+  uint8_t buf[TCHSTREAM_HEADER_SIZE];
+
+  memset( buf, 0, sizeof( buf ) );
+  memcpy( buf, TCHSTREAM_MAGIC, strlen( TCHSTREAM_MAGIC ) );
+  buf[8]  = TCHSTREAM_VERSION;
+  buf[9]  = hdr->flags;
+  buf[10] = hdr->alignment_pow;
+  buf[11] = hdr->free_block_pow;
+  buf[12] = hdr->options;
+  tchhdr_put_le( buf + 16, hdr->bucket_number, 8 );
+  tchhdr_put_le( buf + 24, hdr->record_number, 8 );
+  return tchstream_write_fully( fd, buf, sizeof( buf ) );
+}
+
+void tchstream_block_init( tchstream_block_t* block, uint64_t capacity )
+{
+  block->capacity = ( capacity > 0 ) ? capacity : TCHSTREAM_BLOCK_SIZE;
+  if ( block->capacity > TCHSTREAM_MAX_PAYLOAD ) {
+    block->capacity = TCHSTREAM_MAX_PAYLOAD;
+  }
+  block->buf      = (uint8_t*)malloc( TCHSTREAM_FRAME_SIZE + block->capacity + 4 );
+  block->size     = 0;
+  block->records  = 0;
+}
+
+void tchstream_block_free( tchstream_block_t* block )
+{
+  free( block->buf );
+  block->buf = NULL;
+}
+
+int tchstream_block_add( tchstream_block_t* block, const char* kbuf, uint32_t ksiz,
+                         const char* vbuf, uint32_t vsiz )
+{
+  uint64_t need = 10 + (uint64_t)ksiz + vsiz;
+  uint8_t *p;
+
+  if ( block->size + need > TCHSTREAM_MAX_PAYLOAD ) {
+    return -1;
+  }
+  if ( block->size + need > block->capacity ) {
+    uint64_t capacity = block->capacity;
+    while ( block->size + need > capacity ) {
+      capacity *= 2;
+    }
+    if ( capacity > TCHSTREAM_MAX_PAYLOAD ) {
+      capacity = TCHSTREAM_MAX_PAYLOAD;
+    }
+    if ( NULL == ( p = (uint8_t*)realloc( block->buf, TCHSTREAM_FRAME_SIZE + capacity + 4 ) ) ) {
+      fprintf( stderr, "ERROR: out of memory growing a block to %llu bytes\n", (long long unsigned)capacity );
+      return -1;
+    }
+    block->buf      = p;
+    block->capacity = capacity;
+  }
+
+  p  = block->buf + TCHSTREAM_FRAME_SIZE + block->size;
+  p += put_varint( p, ksiz );
+  p += put_varint( p, vsiz );
+  memcpy( p, kbuf, ksiz );
+  p += ksiz;
+  memcpy( p, vbuf, vsiz );
+  p += vsiz;
+
+  block->size     = p - ( block->buf + TCHSTREAM_FRAME_SIZE );
+  block->records += 1;
+
+  // seal at three quarters so the next record usually fits without a realloc
+  return ( block->size >= block->capacity - block->capacity / 4 ) ? 1 : 0;
+}
+
+int64_t tchstream_block_write( int fd, tchstream_block_t* block, bool checksum )
+{
+  uint64_t len = TCHSTREAM_FRAME_SIZE + block->size;
+
+  if ( 0 == block->records ) {
+    return 0;
+  }
+
+  tchhdr_put_le( block->buf, block->size, 4 );
+  tchhdr_put_le( block->buf + 4, block->records, 4 );
+  if ( checksum ) {
+    uLong crc = crc32( 0L, Z_NULL, 0 );
+    crc = crc32( crc, block->buf + TCHSTREAM_FRAME_SIZE, block->size );
+    tchhdr_put_le( block->buf + len, crc, 4 );
+    len += 4;
+  }
+
+  if ( !tchstream_write_fully( fd, block->buf, len ) ) {
+    return -1;
+  }
+  block->size    = 0;
+  block->records = 0;
+  return len;
+}
+
+bool tchstream_write_end( int fd )
+{
+  uint8_t end[TCHSTREAM_FRAME_SIZE];
+
+  memset( end, 0, sizeof( end ) );
+  return tchstream_write_fully( fd, end, sizeof( end ) );
+}
+
+bool tchstream_reader_open( tchstream_reader_t* reader, int fd )
+{
+  uint8_t buf[TCHSTREAM_HEADER_SIZE];
+
+  memset( reader, 0, sizeof( *reader ) );
+  reader->fd = fd;
+
+  if ( TCHSTREAM_HEADER_SIZE != read_fully( fd, buf, sizeof( buf ) ) ||
+       0 != memcmp( buf, TCHSTREAM_MAGIC, strlen( TCHSTREAM_MAGIC ) + 1 ) ) {
+    fprintf( stderr, "ERROR: not a tchdump stream\n" );
+    return false;
+  }
+  if ( buf[8] > TCHSTREAM_VERSION ) {
+    fprintf( stderr, "ERROR: stream version %d is newer than this reader ( %d )\n", buf[8], TCHSTREAM_VERSION );
+    return false;
+  }
+
+  reader->hdr.version        = buf[8];
+  reader->hdr.flags          = buf[9];
+  reader->hdr.alignment_pow  = buf[10];
+  reader->hdr.free_block_pow = buf[11];
+  reader->hdr.options        = buf[12];
+  reader->hdr.bucket_number  = tchhdr_get_le( buf + 16, 8 );
+  reader->hdr.record_number  = tchhdr_get_le( buf + 24, 8 );
+  reader->bytes              = TCHSTREAM_HEADER_SIZE;
+  return true;
+}
+
+/*
+ * read the next block into the reader, 1 for a block, 0 for the end block
+ */
+static int tchstream_read_block( tchstream_reader_t* reader )
+{
+  uint8_t  frame[TCHSTREAM_FRAME_SIZE];
+  uint8_t  crc_buf[4];
+  uint64_t size;
+
+  if ( TCHSTREAM_FRAME_SIZE != read_fully( reader->fd, frame, sizeof( frame ) ) ) {
+    fprintf( stderr, "ERROR: stream cut off after %llu blocks\n", (long long unsigned)reader->blocks );
+    return -1;
+  }
+  size         = tchhdr_get_le( frame, 4 );
+  reader->left = (uint32_t)tchhdr_get_le( frame + 4, 4 );
+
+  if ( 0 == size && 0 == reader->left ) {
+    reader->bytes += TCHSTREAM_FRAME_SIZE;
+    reader->ended  = true;
+    return 0;
+  }
+
+  if ( size > reader->capacity ) {
+    reader->buf      = (uint8_t*)realloc( reader->buf, size );
+    reader->capacity = size;
+  }
+  if ( (int64_t)size != read_fully( reader->fd, reader->buf, size ) ) {
+    fprintf( stderr, "ERROR: stream cut off in block %llu\n", (long long unsigned)reader->blocks );
+    return -1;
+  }
+  reader->bytes += TCHSTREAM_FRAME_SIZE + size;
+
+  if ( reader->hdr.flags & TCHSTREAM_CHECKSUM ) {
+    uLong crc = crc32( 0L, Z_NULL, 0 );
+    if ( 4 != read_fully( reader->fd, crc_buf, 4 ) ) {
+      fprintf( stderr, "ERROR: stream cut off in block %llu\n", (long long unsigned)reader->blocks );
+      return -1;
+    }
+    reader->bytes += 4;
+    crc = crc32( crc, reader->buf, size );
+    if ( (uint32_t)crc != (uint32_t)tchhdr_get_le( crc_buf, 4 ) ) {
+      fprintf( stderr, "ERROR: checksum mismatch in block %llu\n", (long long unsigned)reader->blocks );
+      return -1;
+    }
+  }
+
+  reader->size    = size;
+  reader->pos     = 0;
+  reader->blocks += 1;
+  return 1;
+}
+
+int tchstream_next( tchstream_reader_t* reader, const char** kbuf, uint32_t* ksiz,
+                    const char** vbuf, uint32_t* vsiz )
+{
+  const uint8_t *p;
+  const uint8_t *end;
+  int            step;
+
+  while ( 0 == reader->left ) {
+    int rv;
+    if ( reader->ended ) {
+      return 0;
+    }
+    if ( reader->pos != reader->size ) {
+      fprintf( stderr, "ERROR: trailing bytes in block %llu\n", (long long unsigned)reader->blocks );
+      return -1;
+    }
+    if ( 1 != ( rv = tchstream_read_block( reader ) ) ) {
+      return rv;
+    }
+  }
+
+  p   = reader->buf + reader->pos;
+  end = reader->buf + reader->size;
+
+  if ( 0 != ( step = get_varint( p, end, ksiz ) ) ) {
+    p += step;
+    if ( 0 != ( step = get_varint( p, end, vsiz ) ) ) {
+      p += step;
+    }
+  }
+  if ( 0 == step || (uint64_t)( end - p ) < (uint64_t)*ksiz + *vsiz ) {
+    fprintf( stderr, "ERROR: corrupt record %llu in block %llu\n",
+             (long long unsigned)reader->records, (long long unsigned)reader->blocks );
+    return -1;
+  }
+
+  *kbuf = (const char*)p;
+  *vbuf = (const char*)( p + *ksiz );
+
+  reader->pos      = ( p + *ksiz + *vsiz ) - reader->buf;
+  reader->left    -= 1;
+  reader->records += 1;
+  return 1;
+}
+
+void tchstream_reader_close( tchstream_reader_t* reader )
+{
+  free( reader->buf );
+  reader->buf = NULL;
+}
@@ -0,0 +1,129 @@
+#ifndef __TCHSTREAM_H__
+#define __TCHSTREAM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * The binary stream tchdump writes and tchload reads.  Nothing in it needs a
+ * seek, so it goes through pipes, ssh and nc as well as to a file.
+ *
+ * header, 32 bytes ( numbers little endian ):
+ *
+ *    0  magic             8 bytes  "TCHDUMP\0"
+ *    8  version           1 byte
+ *    9  flags             1 byte   TCHSTREAM_CHECKSUM, TCHSTREAM_DEFLATED
+ *   10  alignment power   1 byte   \
+ *   11  free block power  1 byte    | of the source database, so tchload
+ *   12  options           1 byte    | can tune the one it builds the same
+ *   16  bucket number     8 bytes   |
+ *   24  record number     8 bytes  /  ( an estimate, live writes move it )
+ *
+ * then any number of blocks:
+ *
+ *    payload length       4 bytes
+ *    record count         4 bytes
+ *    payload              [varint klen][varint vlen][key][value] per record
+ *    crc32 of payload     4 bytes, only with TCHSTREAM_CHECKSUM
+ *
+ * and an end block with a payload length and record count of 0.  A stream
+ * without the end block was cut off.  The varints are plain LEB128, 7 bits a
+ * byte, low bits first.
+ *
+ * With TCHSTREAM_DEFLATED the values are exactly as stored in a source with
+ * the deflate option, still raw deflated.
+ */
+
+#define TCHSTREAM_MAGIC       "TCHDUMP"
+#define TCHSTREAM_VERSION     1
+#define TCHSTREAM_HEADER_SIZE 32
+#define TCHSTREAM_BLOCK_SIZE  ( 1024 * 1024 )     /* default payload size to seal a block at */
+#define TCHSTREAM_MAX_PAYLOAD UINT32_MAX            /* what the 4 byte payload length holds   */
+
+enum {
+  TCHSTREAM_CHECKSUM = 0x01,
+  TCHSTREAM_DEFLATED = 0x02
+};
+
+typedef struct tchstream_header {
+  uint8_t  version;
+  uint8_t  flags;
+  uint8_t  alignment_pow;
+  uint8_t  free_block_pow;
+  uint8_t  options;
+  uint64_t bucket_number;
+  uint64_t record_number;
+} tchstream_header_t;
+
+/*
+ * a block being built up by a writer
+ */
+typedef struct tchstream_block {
+  uint8_t  *buf;            /* 8 byte frame, payload, room for the crc */
+  uint64_t  size;           /* bytes of payload so far                 */
+  uint64_t  capacity;       /* of the payload                          */
+  uint32_t  records;
+} tchstream_block_t;
+
+typedef struct tchstream_reader {
+  int                fd;
+  tchstream_header_t hdr;
+
+  uint8_t           *buf;     /* the current block's payload */
+  uint64_t           capacity;
+  uint64_t           size;
+  uint64_t           pos;     /* next record in buf          */
+  uint32_t           left;    /* records left in the block   */
+
+  uint64_t           blocks;
+  uint64_t           records;
+  uint64_t           bytes;   /* stream bytes read           */
+  bool               ended;   /* the end block has been seen */
+} tchstream_reader_t;
+
+/*
+ * write all of len bytes to fd, through short writes and EINTR
+ */
+extern bool tchstream_write_fully( int fd, const void* buf, uint64_t len );
+
+extern bool tchstream_write_header( int fd, const tchstream_header_t* hdr );
+
+extern void tchstream_block_init( tchstream_block_t* block, uint64_t capacity );
+extern void tchstream_block_free( tchstream_block_t* block );
+
+/*
+ * Append a record, growing the block if this one record is larger than it.
+ * Returns 1 once the block has reached its capacity and should be written,
+ * 0 if there is room for more, and -1 without adding the record if it
+ * would take the payload past TCHSTREAM_MAX_PAYLOAD: write the block and
+ * add it again.  -1 from an empty block is a record too large for any
+ * block, or no memory to grow it ( printed ).
+ */
+extern int tchstream_block_add( tchstream_block_t* block, const char* kbuf, uint32_t ksiz,
+                                const char* vbuf, uint32_t vsiz );
+
+/*
+ * Frame, checksum and write the block to fd, then empty it.  Returns the
+ * number of bytes written or -1.
+ */
+extern int64_t tchstream_block_write( int fd, tchstream_block_t* block, bool checksum );
+
+extern bool tchstream_write_end( int fd );
+
+/*
+ * Read the header from fd.  Prints the reason and returns false on a stream
+ * that is not one of ours.
+ */
+extern bool tchstream_reader_open( tchstream_reader_t* reader, int fd );
+
+/*
+ * The next record, pointers into the reader's block buffer valid until the
+ * next call.  Returns 1 for a record, 0 at the end block and -1 on a short,
+ * corrupt or checksum failing stream ( after printing why ).
+ */
+extern int tchstream_next( tchstream_reader_t* reader, const char** kbuf, uint32_t* ksiz,
+                           const char** vbuf, uint32_t* vsiz );
+
+extern void tchstream_reader_close( tchstream_reader_t* reader );
+
+#endif
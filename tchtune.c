@@ -0,0 +1,319 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tchtune.h"
+
+#define TCHTUNE_DEF_BNUM    131071    /* HDBDEFBNUM */
+#define TCHTUNE_FBP_BASE    64        /* HDBFBPBSIZ, free block pool header */
+#define TCHTUNE_FBP_ENTRY   4         /* HDBFBPESIZ, per free pool entry    */
+#define TCHTUNE_CANDIDATES  6
+
+typedef struct tchtune_chains {
+  uint64_t used;                      /* buckets with at least one record   */
+  uint64_t max;
+  double   hit;                       /* mean nodes visited finding a key   */
+  double   miss;                      /* and not finding one, over buckets  */
+} tchtune_chains_t;
+
+typedef struct tchtune_total {
+  uint64_t records;
+  uint64_t value_bytes;
+  uint64_t unpadded;
+  uint64_t padding[2][TCHTUNE_MAX_APOW + 1];
+} tchtune_total_t;
+
+tchtune_t* tchtune_new( const tchhdr_t* hdr, int nthreads, double growth )
+{
+  tchtune_t *tune = (tchtune_t*)calloc( 1, sizeof( tchtune_t ) );
+
+  tune->hdr      = *hdr;
+  tune->growth   = growth;
+  tune->nthreads = nthreads;
+  if ( 0 != posix_memalign( (void**)&(tune->threads), 64, nthreads * sizeof( tchtune_thread_t ) ) ) {
+    fprintf( stderr, "tchtune: out of memory\n" );
+    exit(1);
+  }
+  memset( tune->threads, 0, nthreads * sizeof( tchtune_thread_t ) );
+  return tune;
+}
+
+void tchtune_add( tchtune_t* tune, int thread, const tchscan_rec_t* rec, uint64_t key_hash )
+{
+  tchtune_thread_t *t = &(tune->threads[thread]);
+  // the links are 8 bytes each with the large option, 4 without
+  uint64_t          u32 = rec->length - rec->pad_size - ( ( tune->hdr.options & TCH_OPT_LARGE ) ? 8 : 0 );
+  uint64_t          u64 = u32 + 8;
+
+  if ( t->records == t->hash_capacity ) {
+    t->hash_capacity = t->hash_capacity ? t->hash_capacity * 2 : 64 * 1024;
+    if ( NULL == ( t->hashes = (uint64_t*)realloc( t->hashes, t->hash_capacity * sizeof( uint64_t ) ) ) ) {
+      fprintf( stderr, "tchtune: out of memory for %llu key hashes\n", (long long unsigned)t->hash_capacity );
+      exit(1);
+    }
+  }
+  t->hashes[t->records++] = key_hash;
+  t->value_bytes         += rec->val_size;
+  t->unpadded            += u32;
+
+  // tchdbput pads each record so the next one starts aligned
+  for ( int a = 0 ; a <= TCHTUNE_MAX_APOW ; a++ ) {
+    uint64_t mask = ( 1ULL << a ) - 1;
+    t->padding[0][a] += ( 0 - u32 ) & mask;
+    t->padding[1][a] += ( 0 - u64 ) & mask;
+  }
+}
+
+static void tchtune_sum( const tchtune_t* tune, tchtune_total_t* total )
+{
+  memset( total, 0, sizeof( tchtune_total_t ) );
+  for ( int i = 0 ; i < tune->nthreads ; i++ ) {
+    const tchtune_thread_t *t = &(tune->threads[i]);
+    total->records     += t->records;
+    total->value_bytes += t->value_bytes;
+    total->unpadded    += t->unpadded;
+    for ( int a = 0 ; a <= TCHTUNE_MAX_APOW ; a++ ) {
+      total->padding[0][a] += t->padding[0][a];
+      total->padding[1][a] += t->padding[1][a];
+    }
+  }
+}
+
+/*
+ * the smallest prime at or above n, tchdbtune rounds to a prime of its own
+ * table which lands within a few percent of this
+ */
+static uint64_t tchtune_prime( uint64_t n )
+{
+  if ( n <= 2 ) {
+    return 2;
+  }
+  for ( n |= 1 ; ; n += 2 ) {
+    bool prime = true;
+    for ( uint64_t d = 3 ; d * d <= n ; d += 2 ) {
+      if ( 0 == n % d ) {
+        prime = false;
+        break;
+      }
+    }
+    if ( prime ) {
+      return n;
+    }
+  }
+}
+
+uint64_t tchtune_first_record( uint64_t bnum, int apow, int fpow, int large )
+{
+  uint64_t mask  = ( 1ULL << apow ) - 1;
+  uint64_t first = TCH_HEADER_SIZE + bnum * ( large ? 8 : 4 ) + TCHTUNE_FBP_BASE + ( (uint64_t)TCHTUNE_FBP_ENTRY << fpow );
+
+  return ( first + mask ) & ~mask;
+}
+
+static uint64_t tchtune_record_bytes( const tchtune_total_t* total, int apow, int large )
+{
+  return total->unpadded + ( large ? 8 * total->records : 0 ) + total->padding[large][apow];
+}
+
+/*
+ * with 32 bit links an offset is kept shifted right by apow
+ */
+static uint64_t tchtune_addressable( int apow, int large )
+{
+  return large ? UINT64_MAX : ( 1ULL << ( 32 + apow ) );
+}
+
+/*
+ * Place every key in bnum buckets.  A chain of n is a tree on the hash
+ * byte and the key, a hit visits 2( 1 + 1/n )H(n) - 3 nodes of it on average
+ * and a miss 2H(n+1) - 2, the random binary search tree figures.
+ */
+static void tchtune_simulate( const tchtune_t* tune, uint64_t bnum, uint64_t records, tchtune_chains_t* chains )
+{
+  uint32_t *count = (uint32_t*)calloc( bnum, sizeof( uint32_t ) );
+  double   *harmonic;
+
+  memset( chains, 0, sizeof( tchtune_chains_t ) );
+  if ( NULL == count ) {
+    fprintf( stderr, "tchtune: out of memory for %llu buckets\n", (long long unsigned)bnum );
+    exit(1);
+  }
+  for ( int i = 0 ; i < tune->nthreads ; i++ ) {
+    const tchtune_thread_t *t = &(tune->threads[i]);
+    for ( uint64_t r = 0 ; r < t->records ; r++ ) {
+      count[t->hashes[r] % bnum] += 1;
+    }
+  }
+  for ( uint64_t b = 0 ; b < bnum ; b++ ) {
+    if ( count[b] > chains->max ) {
+      chains->max = count[b];
+    }
+  }
+
+  harmonic = (double*)malloc( ( chains->max + 2 ) * sizeof( double ) );
+  harmonic[0] = 0;
+  for ( uint64_t n = 1 ; n <= chains->max + 1 ; n++ ) {
+    harmonic[n] = harmonic[n - 1] + 1.0 / n;
+  }
+  for ( uint64_t b = 0 ; b < bnum ; b++ ) {
+    uint64_t n = count[b];
+    if ( 0 == n ) {
+      continue;
+    }
+    chains->used += 1;
+    chains->hit  += n * ( 2 * ( 1 + 1.0 / n ) * harmonic[n] - 3 );
+    chains->miss += 2 * harmonic[n + 1] - 2;
+  }
+  chains->hit  = records ? chains->hit / records : 0;
+  chains->miss = chains->miss / bnum;
+
+  free( harmonic );
+  free( count );
+}
+
+static int compare_u64( const void* a, const void* b )
+{
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return ( x > y ) - ( x < y );
+}
+
+static const char* tchtune_mark( bool now, bool advised )
+{
+  return advised ? ( now ? "  now, advised" : "  advised" ) : ( now ? "  now" : "" );
+}
+
+void tchtune_report( tchtune_t* tune, const char* path, uint64_t free_blocks, double deflate_ratio, FILE* out )
+{
+  const tchhdr_t  *hdr   = &(tune->hdr);
+  int              large = ( hdr->options & TCH_OPT_LARGE ) ? 1 : 0;
+  tchtune_total_t  total;
+  uint64_t         grown;
+  uint64_t         candidates[TCHTUNE_CANDIDATES];
+  int              count = 0;
+  uint64_t         bnum;
+  int              apow  = -1;
+  int              fpow;
+  int              advised_large = 0;
+  uint64_t         best  = UINT64_MAX;
+  uint64_t         free_needed;
+
+  tchtune_sum( tune, &total );
+  grown = (uint64_t)( total.records * tune->growth );
+  if ( grown < 1 ) {
+    grown = 1;
+  }
+
+  bnum = tchtune_bnum( total.records, tune->growth );
+  candidates[count++] = hdr->bucket_number;
+  candidates[count++] = TCHTUNE_DEF_BNUM;
+  candidates[count++] = tchtune_prime( grown / 2 );
+  candidates[count++] = bnum;
+  candidates[count++] = tchtune_prime( grown * 2 );
+  candidates[count++] = tchtune_prime( grown * 4 );
+  qsort( candidates, count, sizeof( uint64_t ), compare_u64 );
+
+  // fpow: room in the free pool for as many free blocks as this one has, grown
+  free_needed = (uint64_t)( free_blocks * tune->growth );
+  fpow        = TCHTUNE_DEF_FPOW;
+  while ( fpow < TCHTUNE_MAX_FPOW && ( 1ULL << fpow ) < free_needed ) {
+    fpow += 1;
+  }
+
+  // apow and large: the smallest grown file that can still address itself
+  for ( int l = 0 ; l <= 1 ; l++ ) {
+    for ( int a = 0 ; a <= TCHTUNE_MAX_APOW ; a++ ) {
+      uint64_t size = tchtune_first_record( bnum, a, fpow, l ) +
+                      (uint64_t)( tchtune_record_bytes( &total, a, l ) * tune->growth );
+      if ( size <= tchtune_addressable( a, l ) && size < best ) {
+        best          = size;
+        apow          = a;
+        advised_large = l;
+      }
+    }
+  }
+
+  fprintf( out, "Tuning for %s\n", path );
+  fprintf( out, "  %llu records, %.1fx growth to %llu, %llu free blocks now\n",
+           (long long unsigned)total.records, tune->growth, (long long unsigned)grown, (long long unsigned)free_blocks );
+  fprintf( out, "  now     : bnum %-12llu apow %-2d fpow %-2d %-8s file %llu bytes\n",
+           (long long unsigned)hdr->bucket_number, hdr->alignment_pow, hdr->free_block_pow, large ? "large" : "",
+           (long long unsigned)hdr->file_size );
+  fprintf( out, "  advised : bnum %-12llu apow %-2d fpow %-2d %-8s file %llu bytes fresh, %llu grown\n",
+           (long long unsigned)bnum, apow, fpow, advised_large ? "large" : "",
+           (long long unsigned)( tchtune_first_record( bnum, apow, fpow, advised_large ) +
+                                 tchtune_record_bytes( &total, apow, advised_large ) ),
+           (long long unsigned)( tchtune_first_record( bnum, apow, fpow, advised_large ) +
+                                 (uint64_t)( tchtune_record_bytes( &total, apow, advised_large ) * tune->growth ) ) );
+  fprintf( out, "  tchsplit -b %llu -a %d -p %d%s\n\n", (long long unsigned)bnum, apow, fpow,
+           ( advised_large == large ) ? "" : advised_large ? " --large" : " --no-large" );
+
+  fprintf( out, "  %12s %14s %7s %7s %6s %8s %8s %14s\n",
+           "bnum", "bucket bytes", "load", "used %", "chain", "hit", "miss", "file bytes" );
+  for ( int i = 0 ; i < count ; i++ ) {
+    tchtune_chains_t chains;
+
+    if ( i > 0 && candidates[i] == candidates[i - 1] ) {
+      continue;
+    }
+    tchtune_simulate( tune, candidates[i], total.records, &chains );
+    fprintf( out, "  %12llu %14llu %7.3f %7.2f %6llu %8.3f %8.3f %14llu%s\n",
+             (long long unsigned)candidates[i], (long long unsigned)( candidates[i] * ( advised_large ? 8 : 4 ) ),
+             total.records / (double)candidates[i], chains.used * 100.0 / candidates[i],
+             (long long unsigned)chains.max, chains.hit, chains.miss,
+             (long long unsigned)( tchtune_first_record( candidates[i], apow, fpow, advised_large ) +
+                                   tchtune_record_bytes( &total, apow, advised_large ) ),
+             tchtune_mark( candidates[i] == hdr->bucket_number, candidates[i] == bnum ) );
+  }
+
+  fprintf( out, "\n  %4s %6s %14s %9s %18s %14s %14s\n",
+           "apow", "align", "padding bytes", "padding %", "addressable", "file bytes", "large file");
+  for ( int a = 0 ; a <= TCHTUNE_MAX_APOW ; a++ ) {
+    uint64_t records = tchtune_record_bytes( &total, a, 0 );
+    uint64_t size    = tchtune_first_record( bnum, a, fpow, 0 ) + records;
+    uint64_t grown_size = tchtune_first_record( bnum, a, fpow, 0 ) + (uint64_t)( records * tune->growth );
+
+    fprintf( out, "  %4d %6llu %14llu %8.2f%% %18llu %14llu %14llu%s%s\n",
+             a, (long long unsigned)( 1ULL << a ), (long long unsigned)total.padding[0][a],
+             records ? total.padding[0][a] * 100.0 / records : 0.0, (long long unsigned)tchtune_addressable( a, 0 ),
+             (long long unsigned)size,
+             (long long unsigned)( tchtune_first_record( bnum, a, fpow, 1 ) + tchtune_record_bytes( &total, a, 1 ) ),
+             ( grown_size > tchtune_addressable( a, 0 ) ) ? "  too small grown" : "",
+             tchtune_mark( a == hdr->alignment_pow, a == apow ) );
+  }
+
+  fprintf( out, "\n  %4s %12s %12s  holds the %llu free blocks grown\n", "fpow", "entries", "pool bytes",
+           (long long unsigned)free_needed );
+  for ( int f = TCHTUNE_DEF_FPOW - 2 ; f <= TCHTUNE_MAX_FPOW ; f++ ) {
+    fprintf( out, "  %4d %12llu %12llu  %-4s%s\n", f, (long long unsigned)( 1ULL << f ),
+             (long long unsigned)( TCHTUNE_FBP_BASE + ( (uint64_t)TCHTUNE_FBP_ENTRY << f ) ),
+             ( ( 1ULL << f ) >= free_needed ) ? "yes" : "no", tchtune_mark( f == hdr->free_block_pow, f == fpow ) );
+  }
+
+  fprintf( out, "\n" );
+  if ( ( hdr->options & TCH_OPT_DEFLATE ) && deflate_ratio > 0 ) {
+    fprintf( out, "  values are deflated, %.1fx smaller than they would be without\n", deflate_ratio );
+  } else if ( deflate_ratio > 0 ) {
+    fprintf( out, "  deflate would make the values %.1fx smaller, about %llu bytes less, tchsplit keeps the source's\n",
+             deflate_ratio, (long long unsigned)( total.value_bytes - total.value_bytes / deflate_ratio ) );
+  }
+}
+
+uint64_t tchtune_bnum( uint64_t records, double growth )
+{
+  uint64_t grown = (uint64_t)( records * growth );
+
+  return tchtune_prime( ( grown < 1 ) ? 1 : grown );
+}
+
+void tchtune_destroy( tchtune_t* tune )
+{
+  if ( NULL == tune ) {
+    return;
+  }
+  for ( int i = 0 ; i < tune->nthreads ; i++ ) {
+    free( tune->threads[i].hashes );
+  }
+  free( tune->threads );
+  free( tune );
+}
@@ -0,0 +1,86 @@
+#ifndef __TCHTUNE_H__
+#define __TCHTUNE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "tchhdr.h"
+#include "tchscan.h"
+
+/*
+ * What bnum, apow, fpow and the large option a new shard should be made
+ * with, from the records of the one it is cut from, for tchstat --advise.
+ *
+ * The pass keeps every key's hash before the modulo and, per record, what
+ * it would be padded to at every alignment with 32 and with 64 bit links.
+ * From those each candidate is worked out rather than guessed:
+ *
+ *   bnum   the keys are placed in buckets of that many and the chains
+ *          counted, a chain is a tree on the hash byte so a hit costs the
+ *          expected depth of a random binary search tree of that size
+ *   apow   padding at that alignment against the 2^( 32 + apow ) bytes a
+ *          file can address with 32 bit links
+ *   fpow   2^fpow free pool entries against the free blocks measured
+ *
+ * The file size of a candidate is the header, the bucket array, the free
+ * pool and the records as tchdbput writes them into a fresh file, so
+ * without free blocks and without the extra padding updates leave behind.
+ * growth is how much bigger the shard is expected to get before it is split
+ * again, the advice has to hold then and not only on the day it is made.
+ */
+
+#define TCHTUNE_MAX_APOW  TCH_MAX_APOW
+#define TCHTUNE_MAX_FPOW  TCH_MAX_FPOW
+#define TCHTUNE_DEF_FPOW  10          /* HDBDEFFPOW */
+#define TCHTUNE_GROWTH    2.0
+
+typedef struct tchtune_thread {
+  uint64_t  records;
+  uint64_t  value_bytes;
+  uint64_t  unpadded;                                /* bytes with 32 bit links  */
+  uint64_t  padding[2][TCHTUNE_MAX_APOW + 1];         /* [large][apow]            */
+  uint64_t *hashes;                                  /* tchscan_key_hash of each */
+  uint64_t  hash_capacity;
+} __attribute__(( aligned( 64 ) )) tchtune_thread_t;
+
+typedef struct tchtune {
+  tchhdr_t          hdr;
+  double            growth;
+  int               nthreads;
+  tchtune_thread_t *threads;
+} tchtune_t;
+
+/*
+ * hdr is the source database's, nthreads the number of threads that will
+ * call tchtune_add
+ */
+extern tchtune_t* tchtune_new( const tchhdr_t* hdr, int nthreads, double growth );
+
+/*
+ * one data record, key_hash is tchscan_key_hash of its key
+ */
+extern void tchtune_add( tchtune_t* tune, int thread, const tchscan_rec_t* rec, uint64_t key_hash );
+
+/*
+ * The candidates for each setting, the advice and the tchsplit options that
+ * apply it.  free_blocks is what the scan found, deflate_ratio how much
+ * smaller deflate makes the values, 0 if it was not measured.
+ */
+extern void tchtune_report( tchtune_t* tune, const char* path, uint64_t free_blocks, double deflate_ratio, FILE* out );
+
+extern void tchtune_destroy( tchtune_t* tune );
+
+/*
+ * The bucket number advised for records, growing by growth: the smallest
+ * prime that keeps the load at or under one.
+ */
+extern uint64_t tchtune_bnum( uint64_t records, double growth );
+
+/*
+ * Where tchdbopen puts the first record of a new file: after the header, the
+ * bucket array and the free block pool, at the alignment.
+ */
+extern uint64_t tchtune_first_record( uint64_t bnum, int apow, int fpow, int large );
+
+#endif
@@ -0,0 +1,522 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tcrpipe.h"
+
+#define TCRPIPE_MAX_BACKOFF 30.0          /* seconds, between retries of a batch */
+
+typedef struct tcrpipe_worker {
+  tcrpipe_t         *pipe;
+  tcrpipe_backend_t *backend;
+  int                conn;
+} tcrpipe_worker_t;
+
+/*
+ * the backends tcrpipe_add has published, set up before they are counted so
+ * a producer looping over them never sees one half filled in
+ */
+static int backends_published( tcrpipe_t* pipe )
+{
+  return __atomic_load_n( &(pipe->backend_count), __ATOMIC_ACQUIRE );
+}
+
+static int hist_bucket( double seconds )
+{
+  uint64_t usec = (uint64_t)( seconds * 1e6 );
+  int      b    = 0;
+
+  while ( usec > 1 && b < TCRPIPE_HIST_BUCKETS - 1 ) {
+    usec >>= 1;
+    b++;
+  }
+  return b;
+}
+
+/*
+ * upper bound, in milliseconds, of the latency bucket holding the pct'th
+ * percentile
+ */
+static double hist_percentile( const uint64_t* hist, double pct )
+{
+  uint64_t total = 0;
+  uint64_t seen  = 0;
+
+  for ( int i = 0 ; i < TCRPIPE_HIST_BUCKETS ; i++ ) {
+    total += hist[i];
+  }
+  if ( 0 == total ) {
+    return 0.0;
+  }
+  for ( int i = 0 ; i < TCRPIPE_HIST_BUCKETS ; i++ ) {
+    seen += hist[i];
+    if ( seen >= total * pct ) {
+      return ( 1ULL << ( i + 1 ) ) / 1000.0;
+    }
+  }
+  return ( 1ULL << TCRPIPE_HIST_BUCKETS ) / 1000.0;
+}
+
+/*
+ * where an error code is counted in ecodes, and back
+ */
+static int ecode_slot( int ecode )
+{
+  return ( ecode >= 0 && ecode < TCRPIPE_ECODES - 1 ) ? ecode : TCRPIPE_ECODES - 1;
+}
+
+static int slot_ecode( int slot )
+{
+  return ( slot < TCRPIPE_ECODES - 1 ) ? slot : TTEMISC;
+}
+
+/*
+ * free acknowledged batches off the front of the outstanding list, backend
+ * lock held
+ */
+static void backend_reap( tcrpipe_backend_t* b )
+{
+  while ( NULL != b->outstanding_head && b->outstanding_head->done ) {
+    tcrpipe_batch_t *batch = b->outstanding_head;
+    b->outstanding_head = batch->next_outstanding;
+    if ( NULL == b->outstanding_head ) {
+      b->outstanding_tail = NULL;
+    }
+    free( batch );
+  }
+}
+
+/*
+ * the next batch to send: a failed one whose pause is over, else the front
+ * of the queue.  When there is none *wake is when the first pause is over,
+ * 0 if nothing is delayed.  Backend lock held.
+ */
+static tcrpipe_batch_t* backend_next( tcrpipe_backend_t* b, double now, double* wake )
+{
+  tcrpipe_batch_t **link  = &(b->delayed);
+  tcrpipe_batch_t  *batch = NULL;
+
+  *wake = 0.0;
+  for ( ; NULL != *link ; link = &((*link)->next_queued) ) {
+    if ( (*link)->retry_at <= now ) {
+      batch = *link;
+      *link = batch->next_queued;
+      break;
+    }
+    if ( 0.0 == *wake || (*link)->retry_at < *wake ) {
+      *wake = (*link)->retry_at;
+    }
+  }
+  if ( NULL == batch && NULL != b->queue_head ) {
+    batch = b->queue_head;
+    b->queue_head = batch->next_queued;
+    if ( NULL == b->queue_head ) {
+      b->queue_tail = NULL;
+    }
+  }
+  if ( NULL != batch ) {
+    b->queued -= 1;
+    pthread_cond_signal( &(b->space) );
+  }
+  return batch;
+}
+
+/*
+ * move a producer's current batch onto the send queue, backend lock held
+ */
+static void backend_seal( tcrpipe_t* pipe, tcrpipe_backend_t* b, int producer )
+{
+  tcrpipe_batch_t *batch = b->current[producer];
+
+  while ( b->queued >= 2 * pipe->max_inflight ) {
+    pthread_cond_wait( &(b->space), &(b->lock) );
+  }
+
+  batch->next_queued = NULL;
+  if ( NULL == b->queue_tail ) {
+    b->queue_head = batch;
+  } else {
+    b->queue_tail->next_queued = batch;
+  }
+  b->queue_tail = batch;
+  b->queued    += 1;
+  b->current[producer] = NULL;
+  pthread_cond_signal( &(b->ready) );
+}
+
+/*
+ * additive increase, multiplicative decrease of the in flight window, backend
+ * lock held
+ */
+static void backend_adjust( tcrpipe_t* pipe, tcrpipe_backend_t* b, bool ok, double latency, double now )
+{
+  if ( ok && latency <= pipe->target_latency ) {
+    b->window += 1.0 / b->window;
+    if ( b->window > pipe->max_inflight ) {
+      b->window = pipe->max_inflight;
+    }
+    return;
+  }
+
+  if ( ok ) {
+    b->slow += 1;
+  }
+
+  // only back off once per round trip, not once per batch that was already out
+  if ( now - b->last_decrease > latency ) {
+    b->window /= 2.0;
+    if ( b->window < 1.0 ) {
+      b->window = 1.0;
+    }
+    b->last_decrease = now;
+    b->decreases    += 1;
+  }
+}
+
+static void* tcrpipe_worker_thread( void* arg )
+{
+  tcrpipe_worker_t  *w    = (tcrpipe_worker_t*)arg;
+  tcrpipe_t         *pipe = w->pipe;
+  tcrpipe_backend_t *b    = w->backend;
+  TCRDB             *rdb  = b->rdbs[w->conn];
+  profile_thread_t  *pt   = profile_thread( pipe->profile, "sender" );
+
+  pthread_mutex_lock( &(b->lock) );
+  while ( true ) {
+    tcrpipe_batch_t *batch = NULL;
+    double           wake  = 0.0;
+
+    if ( b->inflight < (int)b->window || b->broken ) {
+      batch = backend_next( b, metrics_now() / 1e9, &wake );
+    }
+    if ( NULL == batch ) {
+      if ( b->stopping && NULL == b->queue_head && NULL == b->delayed && 0 == b->inflight ) {
+        break;
+      }
+      if ( wake > 0.0 ) {
+        struct timespec deadline = { (time_t)wake, (long)( ( wake - (time_t)wake ) * 1e9 ) };
+        pthread_cond_timedwait( &(b->ready), &(b->lock), &deadline );
+      } else {
+        pthread_cond_wait( &(b->ready), &(b->lock) );
+      }
+      continue;
+    }
+
+    // nothing more goes to a backend that gave up a batch
+    if ( b->broken ) {
+      b->given_up += 1;
+      tclistdel( batch->list );
+      batch->list = NULL;
+      pthread_cond_broadcast( &(b->ready) );
+      continue;
+    }
+
+    b->inflight += 1;
+    pthread_mutex_unlock( &(b->lock) );
+
+    uint64_t begin    = profile_begin( pt, pipe->phase_putlist );
+    uint64_t start_ns = metrics_now();
+    TCLIST  *result   = tcrdbmisc( rdb, "putlist", 0, batch->list );
+    uint64_t stop_ns  = metrics_now();
+    profile_end( pt, pipe->phase_putlist, begin );
+    double   start    = start_ns / 1e9;
+    double   stop     = stop_ns / 1e9;
+    int      ecode    = 0;
+
+    if ( NULL != result ) {
+      tclistdel( result );
+    } else {
+      ecode = tcrdbecode( rdb );
+      tcrdbclose( rdb );
+      tcrdbopen( rdb, b->host, b->port );
+    }
+
+    pthread_mutex_lock( &(b->lock) );
+    b->inflight -= 1;
+    b->latency_hist[hist_bucket( stop - start )] += 1;
+    metrics_observe( b->metrics, pipe->metric_write, stop_ns - start_ns );
+    backend_adjust( pipe, b, ( NULL != result ), stop - start, stop );
+
+    if ( NULL != result ) {
+      batch->done  = true;
+      b->batches  += 1;
+      b->records  += batch->records;
+      b->bytes    += batch->bytes;
+      metrics_add( b->metrics, pipe->metric_sent, batch->records );
+      tclistdel( batch->list );
+      batch->list  = NULL;
+      backend_reap( b );
+    } else {
+      b->errors     += 1;
+      b->last_ecode  = ecode;
+      b->ecodes[ecode_slot( ecode )] += 1;
+      batch->attempts += 1;
+
+      if ( batch->attempts >= TCRPIPE_MAX_ATTEMPTS ) {
+        fprintf( stderr, "putlist error on %s:%d : %s, giving up after %d attempts\n",
+                 b->host, b->port, tcrdberrmsg( ecode ), batch->attempts );
+        b->broken    = true;
+        b->given_up += 1;
+        tclistdel( batch->list );
+        batch->list  = NULL;
+      } else {
+        double backoff = 0.1 * ( 1 << ( batch->attempts < 9 ? batch->attempts - 1 : 8 ) );
+        if ( backoff > TCRPIPE_MAX_BACKOFF ) {
+          backoff = TCRPIPE_MAX_BACKOFF;
+        }
+        fprintf( stderr, "putlist error on %s:%d : %s, retry %d in %.1fs\n",
+                 b->host, b->port, tcrdberrmsg( ecode ), batch->attempts, backoff );
+
+        // held back until the pause is over, the other connections carry on with the queue
+        batch->retry_at    = stop + backoff;
+        batch->next_queued = b->delayed;
+        b->delayed         = batch;
+        b->queued         += 1;
+      }
+    }
+    pthread_cond_broadcast( &(b->ready) );
+  }
+  pthread_cond_broadcast( &(b->ready) );
+  pthread_mutex_unlock( &(b->lock) );
+
+  profile_thread_stop( pt );
+  free( w );
+  return NULL;
+}
+
+tcrpipe_t* tcrpipe_new( int backend_capacity, int producers, int batch_records, int max_inflight, double target_latency )
+{
+  tcrpipe_t *pipe = (tcrpipe_t*)calloc( 1, sizeof( tcrpipe_t ) );
+
+  pipe->backend_count    = 0;
+  pipe->backend_capacity = backend_capacity;
+  pipe->producers        = ( producers > 0 ) ? producers : 1;
+  pipe->backends         = (tcrpipe_backend_t*)calloc( backend_capacity, sizeof( tcrpipe_backend_t ) );
+  pipe->batch_records    = ( batch_records > 0 ) ? batch_records : 1;
+  pipe->batch_bytes      = 4 * 1024 * 1024;
+  pipe->max_inflight     = ( max_inflight > 0 ) ? max_inflight : 1;
+  pipe->target_latency   = target_latency;
+
+  // retries wait on ready until their pause is over, on the metrics_now clock
+  pthread_condattr_t attr;
+  pthread_condattr_init( &attr );
+  pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+
+  for ( int i = 0 ; i < backend_capacity ; i++ ) {
+    tcrpipe_backend_t *b = &(pipe->backends[i]);
+    pthread_mutex_init( &(b->lock), NULL );
+    pthread_cond_init( &(b->ready), &attr );
+    pthread_cond_init( &(b->space), NULL );
+    b->current = (tcrpipe_batch_t**)calloc( pipe->producers, sizeof( tcrpipe_batch_t* ) );
+    b->window  = 1.0;
+  }
+  pthread_condattr_destroy( &attr );
+  return pipe;
+}
+
+void tcrpipe_set_metrics( tcrpipe_t* pipe, metrics_t* m, int sent, int write )
+{
+  pipe->metrics      = m;
+  pipe->metric_sent  = sent;
+  pipe->metric_write = write;
+}
+
+void tcrpipe_set_profile( tcrpipe_t* pipe, profile_t* p, int putlist )
+{
+  pipe->profile       = p;
+  pipe->phase_putlist = putlist;
+}
+
+int tcrpipe_add( tcrpipe_t* pipe, const char* host, int port )
+{
+  tcrpipe_backend_t *b;
+  int                count = pipe->backend_count;    /* only the adding thread writes it */
+
+  for ( int i = 0 ; i < count ; i++ ) {
+    if ( port == pipe->backends[i].port && 0 == strcmp( host, pipe->backends[i].host ) ) {
+      return i;
+    }
+  }
+  if ( count == pipe->backend_capacity ) {
+    fprintf( stderr, "Can not connect to %s:%d, already connected to %d tyrants\n", host, port, pipe->backend_capacity );
+    return -1;
+  }
+
+  b = &(pipe->backends[count]);
+  snprintf( b->host, sizeof( b->host ), "%s", host );
+  b->port    = port;
+  b->metrics = metrics_slot( pipe->metrics );
+  b->rdbs    = (TCRDB**)calloc( pipe->max_inflight, sizeof( TCRDB* ) );
+  b->threads = (pthread_t*)calloc( pipe->max_inflight, sizeof( pthread_t ) );
+
+  for ( int i = 0 ; i < pipe->max_inflight ; i++ ) {
+    TCRDB *rdb = tcrdbnew();
+    if ( !tcrdbopen( rdb, host, port ) ) {
+      int ecode = tcrdbecode( rdb );
+      fprintf( stderr, "open error on %s:%d : %s\n", host, port, tcrdberrmsg( ecode ) );
+      tcrdbdel( rdb );
+      b->port = -1;     /* never handed out, a later add connects afresh */
+      // still published, so finish joins the senders it did start
+      __atomic_store_n( &(pipe->backend_count), count + 1, __ATOMIC_RELEASE );
+      return -1;
+    }
+    b->rdbs[i] = rdb;
+
+    tcrpipe_worker_t *w = (tcrpipe_worker_t*)calloc( 1, sizeof( tcrpipe_worker_t ) );
+    w->pipe    = pipe;
+    w->backend = b;
+    w->conn    = i;
+    pthread_create( &(b->threads[i]), NULL, tcrpipe_worker_thread, w );
+    b->connections += 1;
+  }
+  __atomic_store_n( &(pipe->backend_count), count + 1, __ATOMIC_RELEASE );
+  return count;
+}
+
+void tcrpipe_put( tcrpipe_t* pipe, int producer, int idx, uint64_t offset,
+                  const char* kbuf, int ksiz, const char* vbuf, int vsiz )
+{
+  tcrpipe_backend_t *b     = &(pipe->backends[idx]);
+  tcrpipe_batch_t   *batch = b->current[producer];
+
+  if ( NULL == batch ) {
+    batch = (tcrpipe_batch_t*)calloc( 1, sizeof( tcrpipe_batch_t ) );
+    batch->list         = tclistnew2( pipe->batch_records * 2 );
+    batch->first_offset = offset;
+
+    pthread_mutex_lock( &(b->lock) );
+    if ( NULL == b->outstanding_tail ) {
+      b->outstanding_head = batch;
+    } else {
+      b->outstanding_tail->next_outstanding = batch;
+    }
+    b->outstanding_tail = batch;
+    b->current[producer] = batch;
+    pthread_mutex_unlock( &(b->lock) );
+  }
+
+  // only this producer touches its current batch, no lock needed to fill it
+  tclistpush( batch->list, kbuf, ksiz );
+  tclistpush( batch->list, vbuf, vsiz );
+  batch->records += 1;
+  batch->bytes   += ksiz + vsiz;
+
+  if ( batch->records >= pipe->batch_records || batch->bytes >= pipe->batch_bytes ) {
+    pthread_mutex_lock( &(b->lock) );
+    backend_seal( pipe, b, producer );
+    pthread_mutex_unlock( &(b->lock) );
+  }
+}
+
+uint64_t tcrpipe_safe_offset( tcrpipe_t* pipe, uint64_t scan_offset )
+{
+  uint64_t safe = scan_offset;
+
+  for ( int i = 0, n = backends_published( pipe ) ; i < n ; i++ ) {
+    tcrpipe_backend_t *b = &(pipe->backends[i]);
+    pthread_mutex_lock( &(b->lock) );
+    backend_reap( b );
+    // producers interleave, so the oldest batch is not always the lowest offset
+    for ( tcrpipe_batch_t *batch = b->outstanding_head ; NULL != batch ; batch = batch->next_outstanding ) {
+      if ( !batch->done && batch->first_offset < safe ) {
+        safe = batch->first_offset;
+      }
+    }
+    pthread_mutex_unlock( &(b->lock) );
+  }
+  return safe;
+}
+
+void tcrpipe_flush( tcrpipe_t* pipe, int producer )
+{
+  for ( int i = 0, n = backends_published( pipe ) ; i < n ; i++ ) {
+    tcrpipe_backend_t *b = &(pipe->backends[i]);
+    pthread_mutex_lock( &(b->lock) );
+    if ( NULL != b->current[producer] ) {
+      backend_seal( pipe, b, producer );
+    }
+    pthread_mutex_unlock( &(b->lock) );
+  }
+}
+
+void tcrpipe_summary( tcrpipe_t* pipe, FILE* file )
+{
+  for ( int i = 0, n = backends_published( pipe ) ; i < n ; i++ ) {
+    tcrpipe_backend_t *b = &(pipe->backends[i]);
+    pthread_mutex_lock( &(b->lock) );
+    fprintf( file, "  %s:%-5d window %5.2f/%d inflight %d queued %d batches %10llu records %12llu p50 %8.3fms p99 %8.3fms slow %llu errors %llu",
+             b->host, b->port, b->window, pipe->max_inflight, b->inflight, b->queued,
+             (long long unsigned)b->batches, (long long unsigned)b->records,
+             hist_percentile( b->latency_hist, 0.50 ), hist_percentile( b->latency_hist, 0.99 ),
+             (long long unsigned)b->slow, (long long unsigned)b->errors );
+    if ( b->given_up > 0 ) {
+      fprintf( file, " given up %llu", (long long unsigned)b->given_up );
+    }
+    // which errors, a refused connection and a timed out recv want different fixes
+    for ( int e = 0, shown = 0 ; e < TCRPIPE_ECODES ; e++ ) {
+      if ( b->ecodes[e] > 0 ) {
+        fprintf( file, "%s%s %llu", shown++ ? ", " : " ( ", tcrdberrmsg( slot_ecode( e ) ), (long long unsigned)b->ecodes[e] );
+      }
+    }
+    fprintf( file, "%s\n", b->errors > 0 ? " )" : "" );
+    pthread_mutex_unlock( &(b->lock) );
+  }
+  fflush( file );
+}
+
+bool tcrpipe_finish( tcrpipe_t* pipe )
+{
+  bool ok = true;
+
+  for ( int p = 0 ; p < pipe->producers ; p++ ) {
+    tcrpipe_flush( pipe, p );
+  }
+
+  for ( int i = 0, n = backends_published( pipe ) ; i < n ; i++ ) {
+    tcrpipe_backend_t *b = &(pipe->backends[i]);
+    pthread_mutex_lock( &(b->lock) );
+    b->stopping = true;
+    pthread_cond_broadcast( &(b->ready) );
+    pthread_mutex_unlock( &(b->lock) );
+  }
+
+  for ( int i = 0, n = backends_published( pipe ) ; i < n ; i++ ) {
+    tcrpipe_backend_t *b = &(pipe->backends[i]);
+    for ( int c = 0 ; c < b->connections ; c++ ) {
+      pthread_join( b->threads[c], NULL );
+      tcrdbclose( b->rdbs[c] );
+      tcrdbdel( b->rdbs[c] );
+    }
+    b->connections = 0;
+    if ( b->given_up > 0 ) {
+      fprintf( stderr, "%s:%d did not accept %llu batches\n", b->host, b->port, (long long unsigned)b->given_up );
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+void tcrpipe_destroy( tcrpipe_t* pipe )
+{
+  for ( int i = 0 ; i < pipe->backend_capacity ; i++ ) {
+    tcrpipe_backend_t *b = &(pipe->backends[i]);
+    // batches given up stay on the outstanding list
+    while ( NULL != b->outstanding_head ) {
+      tcrpipe_batch_t *batch = b->outstanding_head;
+      b->outstanding_head = batch->next_outstanding;
+      if ( NULL != batch->list ) {
+        tclistdel( batch->list );
+      }
+      free( batch );
+    }
+    pthread_mutex_destroy( &(b->lock) );
+    pthread_cond_destroy( &(b->ready) );
+    pthread_cond_destroy( &(b->space) );
+    free( b->current );
+    free( b->rdbs );
+    free( b->threads );
+  }
+  free( pipe->backends );
+  free( pipe );
+}
@@ -0,0 +1,179 @@
+#ifndef __TCRPIPE_H__
+#define __TCRPIPE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <tcutil.h>
+#include <tcrdb.h>
+#include "metrics.h"
+#include "profile.h"
+
+/*
+ * Batched, flow controlled sending of records to a set of tyrants.
+ *
+ * Records are collected into per backend batches which are sent with the
+ * "putlist" misc function by a small pool of connections per backend.  Each
+ * backend has an AIMD window on how many batches it may have in flight at
+ * once: every batch that comes back under the target latency opens the
+ * window by 1/window ( about one batch per round trip ), a batch that comes
+ * back slow or fails halves it.  A backend that is compacting or has a
+ * saturated disk therefore gets fewer and fewer concurrent batches until it
+ * recovers, and since each backend's queue is bounded the scan itself slows
+ * down rather than piling up memory.
+ *
+ * A failed batch is retried on a fresh connection after a growing pause,
+ * during which it is held out of the queue so no other connection sends it
+ * sooner.  After TCRPIPE_MAX_ATTEMPTS the batch is given up and so is the
+ * backend: everything still queued for it fails at once, so the producers
+ * are not held up by a dead tyrant.  tcrpipe_safe_offset never moves past a
+ * batch that was given up, and tcrpipe_finish reports it.
+ */
+
+#define TCRPIPE_HIST_BUCKETS 32            /* log2 microsecond latency buckets */
+#define TCRPIPE_MAX_ATTEMPTS 10            /* sends of a batch before giving up */
+#define TCRPIPE_ECODES       9             /* errors by tyrant error code, up to
+                                              TTENOREC, the last counts TTEMISC
+                                              and anything else               */
+
+typedef struct tcrpipe_batch {
+  TCLIST               *list;              /* alternating keys and values     */
+  int                   records;
+  uint64_t              bytes;
+  uint64_t              first_offset;      /* source offset of first record   */
+  int                   attempts;
+  double                retry_at;          /* seconds, metrics_now clock      */
+  bool                  done;
+  struct tcrpipe_batch *next_queued;       /* in the queue or the delayed list */
+  struct tcrpipe_batch *next_outstanding;
+} tcrpipe_batch_t;
+
+typedef struct tcrpipe_backend {
+  char             host[256];
+  int              port;
+  int              connections;            /* worker connections opened       */
+  TCRDB          **rdbs;
+  pthread_t       *threads;
+
+  pthread_mutex_t  lock;                   /* guards everything below         */
+  pthread_cond_t   ready;                  /* a batch or a window slot opened */
+  pthread_cond_t   space;                  /* the queue has room              */
+
+  tcrpipe_batch_t **current;               /* batch being filled, per producer */
+  tcrpipe_batch_t *queue_head;             /* sealed, waiting to be sent      */
+  tcrpipe_batch_t *queue_tail;
+  tcrpipe_batch_t *delayed;                /* failed, waiting out their pause */
+  int              queued;                 /* in the queue or delayed         */
+  tcrpipe_batch_t *outstanding_head;       /* every batch not yet acknowledged,
+                                              in the order they were created,
+                                              interleaved between producers   */
+  tcrpipe_batch_t *outstanding_tail;
+
+  double           window;                 /* AIMD limit on in flight batches */
+  int              inflight;
+  double           last_decrease;
+  bool             stopping;               /* no more batches will be added   */
+  bool             broken;                 /* a batch was given up            */
+
+  uint64_t         batches;
+  uint64_t         records;
+  uint64_t         bytes;
+  uint64_t         errors;
+  uint64_t         given_up;               /* batches never accepted          */
+  uint64_t         slow;                   /* batches over the target latency */
+  uint64_t         decreases;
+  uint64_t         latency_hist[TCRPIPE_HIST_BUCKETS];
+  uint64_t         ecodes[TCRPIPE_ECODES];
+  int              last_ecode;
+  metrics_slot_t  *metrics;                /* written under lock              */
+} tcrpipe_backend_t;
+
+typedef struct tcrpipe {
+  int                backend_count;        /* connected so far, atomic          */
+  int                backend_capacity;
+  tcrpipe_backend_t *backends;
+  int                producers;            /* threads calling tcrpipe_put       */
+
+  int                batch_records;        /* seal a batch at this many records */
+  uint64_t           batch_bytes;          /* ... or this many bytes            */
+  int                max_inflight;         /* connections per backend           */
+  double             target_latency;       /* seconds                           */
+
+  metrics_t         *metrics;              /* optional, see tcrpipe_set_metrics */
+  int                metric_sent;
+  int                metric_write;
+
+  profile_t         *profile;              /* optional, see tcrpipe_set_profile */
+  int                phase_putlist;
+} tcrpipe_t;
+
+/*
+ * A pipe that can connect to up to backend_capacity tyrants.  The backends
+ * are set up front so tcrpipe_add never moves one a producer is using.
+ */
+extern tcrpipe_t* tcrpipe_new( int backend_capacity, int producers, int batch_records, int max_inflight, double target_latency );
+
+/*
+ * Count the records the tyrants accept into counter sent and the putlist
+ * latency into histogram write of m, one slot per backend.  Has to come
+ * before the first tcrpipe_add.
+ */
+extern void tcrpipe_set_metrics( tcrpipe_t* pipe, metrics_t* m, int sent, int write );
+
+/*
+ * Time the putlist calls of every sender thread into phase putlist of p,
+ * each sender a "sender" thread of its own.  Has to come before the first
+ * tcrpipe_add.
+ */
+extern void tcrpipe_set_profile( tcrpipe_t* pipe, profile_t* p, int putlist );
+
+/*
+ * The index of the backend for host:port.  One that is not connected yet is
+ * connected, opening max_inflight connections and starting their sender
+ * threads, while the producers carry on with the others.  Returns -1 when
+ * the connection fails or the pipe is full.  Only one thread may add, the
+ * producers may be looping over the backends while it does.
+ */
+extern int tcrpipe_add( tcrpipe_t* pipe, const char* host, int port );
+
+/*
+ * Add a record for backend idx.  producer is 0 .. producers - 1 and each
+ * producer must only ever be used by one thread at a time, every producer
+ * fills its own batches.  offset is where the record came from in the source
+ * and is only used for tcrpipe_safe_offset.  Blocks while the backend's
+ * queue is full.
+ */
+extern void tcrpipe_put( tcrpipe_t* pipe, int producer, int idx, uint64_t offset,
+                         const char* kbuf, int ksiz, const char* vbuf, int vsiz );
+
+/*
+ * Seal every batch producer is filling so it is sent as it is rather than
+ * when it fills up.  Only the thread using producer may flush it, or any
+ * thread once that one is done with it for good.
+ */
+extern void tcrpipe_flush( tcrpipe_t* pipe, int producer );
+
+/*
+ * The source offset before which every record has been accepted by its
+ * tyrant, given that the scan has handed over everything before
+ * scan_offset.  With several producers scan_offset has to be the low water
+ * mark of all of them.
+ */
+extern uint64_t tcrpipe_safe_offset( tcrpipe_t* pipe, uint64_t scan_offset );
+
+/*
+ * One line per backend: window, in flight, batches, latency percentiles and
+ * errors, with how many of each error code there were.
+ */
+extern void tcrpipe_summary( tcrpipe_t* pipe, FILE* file );
+
+/*
+ * Send what is left, wait for it to be accepted and close every connection.
+ * false if any batch was given up.
+ */
+extern bool tcrpipe_finish( tcrpipe_t* pipe );
+
+extern void tcrpipe_destroy( tcrpipe_t* pipe );
+
+#endif
@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/*
+ * A stand in for a Tokyo Tyrant server that only understands the part of the
+ * binary protocol tch2tcr uses:
+ *
+ *   put      0xc8 0x10 [ksiz:4][vsiz:4][key][value]          -> [code:1]
+ *   putnr    0xc8 0x18 [ksiz:4][vsiz:4][key][value]          -> nothing
+ *   misc     0xc8 0x90 [nsiz:4][opts:4][rnum:4][name]
+ *                      ( [asiz:4][arg] ) * rnum               -> [code:1][rnum:4]
+ *   stat     0xc8 0x88                                        -> [code:1][ssiz:4][stat]
+ *
+ * all numbers big endian.  The only misc function accepted is "putlist",
+ * whose arguments are alternating keys and values.
+ *
+ * Records are either thrown away or counted and checksummed.  The checksum
+ * is the sum of an FNV-1a hash of every key and value pair, so it does not
+ * depend on the order records arrive in, or on which connection they come
+ * over, and can be compared against the same sum taken over the source.
+ *
+ * Latency ( added to every request ) and bandwidth ( shared across all
+ * connections ) caps make it behave like a slow or busy tyrant.
+ */
+
+#define TT_MAGIC     0xc8
+#define TT_CMD_PUT   0x10
+#define TT_CMD_PUTNR 0x18
+#define TT_CMD_STAT  0x88
+#define TT_CMD_MISC  0x90
+
+#define READ_BUFFER_SIZE ( 256 * 1024 )
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+typedef struct sink {
+  int             port;
+  long            latency_usec;      /* added to every request               */
+  uint64_t        bandwidth;         /* bytes per second, 0 for no cap       */
+  bool            checksum;          /* count and checksum, or just discard  */
+
+  pthread_mutex_t lock;              /* guards everything below              */
+  double          next_send_time;    /* bandwidth token bucket               */
+  uint64_t        records;
+  uint64_t        bytes;
+  uint64_t        sum;
+  uint64_t        connections;
+} sink_t;
+
+typedef struct conn {
+  sink_t  *sink;
+  int      fd;
+  uint8_t  buf[READ_BUFFER_SIZE];
+  size_t   pos;
+  size_t   len;
+
+  /* per connection totals, folded into the sink when the request is done */
+  uint64_t records;
+  uint64_t bytes;
+  uint64_t sum;
+} conn_t;
+
+static sink_t sink;
+static volatile sig_atomic_t stopping = 0;
+
+static double now_seconds( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ( ts.tv_nsec / 1e9 );
+}
+
+/*
+ * hold the caller until bytes more bytes fit under the bandwidth cap
+ */
+static void sink_throttle( sink_t* s, uint64_t bytes )
+{
+  double wait;
+
+  if ( 0 == s->bandwidth ) {
+    return;
+  }
+
+  pthread_mutex_lock( &(s->lock) );
+  double now = now_seconds();
+  if ( s->next_send_time < now ) {
+    s->next_send_time = now;
+  }
+  s->next_send_time += (double)bytes / s->bandwidth;
+  wait = s->next_send_time - now;
+  pthread_mutex_unlock( &(s->lock) );
+
+  if ( wait > 0 ) {
+    usleep( (useconds_t)( wait * 1e6 ) );
+  }
+}
+
+static bool conn_fill( conn_t* c )
+{
+  ssize_t got;
+
+  if ( c->pos < c->len ) {
+    return true;
+  }
+  do {
+    got = read( c->fd, c->buf, sizeof( c->buf ) );
+  } while ( got < 0 && EINTR == errno );
+
+  if ( got <= 0 ) {
+    return false;
+  }
+  c->pos = 0;
+  c->len = got;
+  sink_throttle( c->sink, got );
+  return true;
+}
+
+static bool conn_read( conn_t* c, void* out, size_t n )
+{
+  uint8_t *p = (uint8_t*)out;
+
+  while ( n > 0 ) {
+    if ( !conn_fill( c ) ) {
+      return false;
+    }
+    size_t take = c->len - c->pos;
+    if ( take > n ) { take = n; }
+    memcpy( p, c->buf + c->pos, take );
+    c->pos += take;
+    p      += take;
+    n      -= take;
+  }
+  return true;
+}
+
+static bool conn_read_u32( conn_t* c, uint32_t* v )
+{
+  uint8_t b[4];
+  if ( !conn_read( c, b, 4 ) ) {
+    return false;
+  }
+  *v = ( (uint32_t)b[0] << 24 ) | ( (uint32_t)b[1] << 16 ) | ( (uint32_t)b[2] << 8 ) | b[3];
+  return true;
+}
+
+/*
+ * consume n bytes of payload, folding them into the running hash
+ */
+static bool conn_consume( conn_t* c, size_t n, uint64_t* hash )
+{
+  c->bytes += n;
+  while ( n > 0 ) {
+    if ( !conn_fill( c ) ) {
+      return false;
+    }
+    size_t take = c->len - c->pos;
+    if ( take > n ) { take = n; }
+    if ( c->sink->checksum ) {
+      uint64_t h = *hash;
+      for ( size_t i = 0 ; i < take ; i++ ) {
+        h = ( h ^ c->buf[c->pos + i] ) * FNV_PRIME;
+      }
+      *hash = h;
+    }
+    c->pos += take;
+    n      -= take;
+  }
+  return true;
+}
+
+static bool conn_consume_record( conn_t* c, uint32_t ksiz, uint32_t vsiz )
+{
+  uint64_t hash = FNV_OFFSET;
+
+  if ( !conn_consume( c, ksiz, &hash ) ) {
+    return false;
+  }
+  hash = ( hash ^ 0xff ) * FNV_PRIME;  /* so "ab"+"c" differs from "a"+"bc" */
+  if ( !conn_consume( c, vsiz, &hash ) ) {
+    return false;
+  }
+
+  c->records += 1;
+  c->sum     += hash;
+  return true;
+}
+
+static bool conn_write( conn_t* c, const void* buf, size_t n )
+{
+  const uint8_t *p = (const uint8_t*)buf;
+
+  while ( n > 0 ) {
+    ssize_t put = write( c->fd, p, n );
+    if ( put < 0 ) {
+      if ( EINTR == errno ) { continue; }
+      return false;
+    }
+    p += put;
+    n -= put;
+  }
+  return true;
+}
+
+static void put_u32( uint8_t* p, uint32_t v )
+{
+  p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static void conn_flush_totals( conn_t* c )
+{
+  pthread_mutex_lock( &(c->sink->lock) );
+  c->sink->records += c->records;
+  c->sink->bytes   += c->bytes;
+  c->sink->sum     += c->sum;
+  pthread_mutex_unlock( &(c->sink->lock) );
+  c->records = c->bytes = c->sum = 0;
+}
+
+static bool handle_put( conn_t* c, bool reply )
+{
+  uint32_t ksiz, vsiz;
+  uint8_t  code = 0;
+
+  if ( !conn_read_u32( c, &ksiz ) || !conn_read_u32( c, &vsiz ) ) {
+    return false;
+  }
+  if ( !conn_consume_record( c, ksiz, vsiz ) ) {
+    return false;
+  }
+  return reply ? conn_write( c, &code, 1 ) : true;
+}
+
+static bool handle_misc( conn_t* c )
+{
+  uint32_t nsiz, opts, rnum;
+  char     name[64];
+  uint8_t  reply[5];
+
+  if ( !conn_read_u32( c, &nsiz ) || !conn_read_u32( c, &opts ) || !conn_read_u32( c, &rnum ) ) {
+    return false;
+  }
+  if ( nsiz >= sizeof( name ) || !conn_read( c, name, nsiz ) ) {
+    return false;
+  }
+  name[nsiz] = '\0';
+
+  if ( 0 != strcmp( name, "putlist" ) || ( rnum % 2 ) != 0 ) {
+    fprintf( stderr, "ttsink[%d] : unsupported misc function %s/%u\n", c->sink->port, name, rnum );
+    return false;
+  }
+
+  for ( uint32_t i = 0 ; i < rnum ; i += 2 ) {
+    uint32_t ksiz, vsiz;
+    uint64_t hash = FNV_OFFSET;
+    if ( !conn_read_u32( c, &ksiz ) || !conn_consume( c, ksiz, &hash ) ) {
+      return false;
+    }
+    hash = ( hash ^ 0xff ) * FNV_PRIME;
+    if ( !conn_read_u32( c, &vsiz ) || !conn_consume( c, vsiz, &hash ) ) {
+      return false;
+    }
+    c->records += 1;
+    c->sum     += hash;
+  }
+
+  reply[0] = 0;
+  put_u32( reply + 1, 0 );
+  return conn_write( c, reply, sizeof( reply ) );
+}
+
+static bool handle_stat( conn_t* c )
+{
+  char    stat[512];
+  uint8_t head[5];
+  int     len;
+
+  pthread_mutex_lock( &(c->sink->lock) );
+  len = snprintf( stat, sizeof( stat ),
+                  "version\tttsink\npid\t%d\nrnum\t%llu\nsize\t%llu\nchecksum\t%016llx\ncurconn\t%llu\n",
+                  (int)getpid(), (long long unsigned)c->sink->records,
+                  (long long unsigned)c->sink->bytes, (long long unsigned)c->sink->sum,
+                  (long long unsigned)c->sink->connections );
+  pthread_mutex_unlock( &(c->sink->lock) );
+
+  head[0] = 0;
+  put_u32( head + 1, len );
+  return conn_write( c, head, sizeof( head ) ) && conn_write( c, stat, len );
+}
+
+static void* conn_thread( void* arg )
+{
+  conn_t  *c = (conn_t*)arg;
+  uint8_t  cmd[2];
+  bool     ok = true;
+
+  while ( ok && conn_read( c, cmd, 2 ) ) {
+    if ( TT_MAGIC != cmd[0] ) {
+      fprintf( stderr, "ttsink[%d] : bad magic 0x%02x\n", c->sink->port, cmd[0] );
+      break;
+    }
+
+    if ( c->sink->latency_usec > 0 ) {
+      usleep( c->sink->latency_usec );
+    }
+
+    switch ( cmd[1] ) {
+      case TT_CMD_PUT:   ok = handle_put( c, true );  break;
+      case TT_CMD_PUTNR: ok = handle_put( c, false ); break;
+      case TT_CMD_MISC:  ok = handle_misc( c );       break;
+      case TT_CMD_STAT:  conn_flush_totals( c ); ok = handle_stat( c ); break;
+      default:
+        fprintf( stderr, "ttsink[%d] : unsupported command 0x%02x\n", c->sink->port, cmd[1] );
+        ok = false;
+    }
+
+    // fold totals in whenever the client is waiting on us anyway
+    if ( c->pos >= c->len ) {
+      conn_flush_totals( c );
+    }
+  }
+
+  conn_flush_totals( c );
+  pthread_mutex_lock( &(c->sink->lock) );
+  c->sink->connections -= 1;
+  pthread_mutex_unlock( &(c->sink->lock) );
+
+  close( c->fd );
+  free( c );
+  return NULL;
+}
+
+static void on_signal( int sig )
+{
+  (void)sig;
+  stopping = 1;
+}
+
+void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options] -p port\n", name );
+  fprintf( stderr, "  -p, --port PORT          port to listen on\n" );
+  fprintf( stderr, "  -l, --latency USEC       microseconds added to every request\n" );
+  fprintf( stderr, "  -b, --bandwidth BYTES    cap on bytes per second received, across all connections\n" );
+  fprintf( stderr, "  -d, --discard            do not checksum the records, just count them\n" );
+}
+
+int main( int argc, char** argv )
+{
+  struct sockaddr_in addr;
+  struct sigaction   sa;
+  int                listen_fd;
+  int                one = 1;
+  int                opt;
+
+  struct option long_options[] = {
+    { "port",      required_argument, NULL, 'p' },
+    { "latency",   required_argument, NULL, 'l' },
+    { "bandwidth", required_argument, NULL, 'b' },
+    { "discard",   no_argument,       NULL, 'd' },
+    { NULL,        0,                 NULL,  0  }
+  };
+
+  memset( &sink, 0, sizeof( sink ) );
+  sink.checksum = true;
+  pthread_mutex_init( &(sink.lock), NULL );
+
+  while ( -1 != ( opt = getopt_long( argc, argv, "p:l:b:d", long_options, NULL ) ) ) {
+    switch ( opt ) {
+      case 'p': sink.port         = atoi( optarg ); break;
+      case 'l': sink.latency_usec = atol( optarg ); break;
+      case 'b': sink.bandwidth    = strtoull( optarg, NULL, 10 ); break;
+      case 'd': sink.checksum     = false; break;
+      default :
+        usage( argv[0] );
+        exit(1);
+    }
+  }
+
+  if ( sink.port <= 0 ) {
+    usage( argv[0] );
+    exit(1);
+  }
+
+  memset( &sa, 0, sizeof( sa ) );
+  sa.sa_handler = on_signal;
+  sigaction( SIGINT, &sa, NULL );
+  sigaction( SIGTERM, &sa, NULL );
+  signal( SIGPIPE, SIG_IGN );
+
+  listen_fd = socket( AF_INET, SOCK_STREAM, 0 );
+  setsockopt( listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons( sink.port );
+  addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+  if ( 0 != bind( listen_fd, (struct sockaddr*)&addr, sizeof( addr ) ) || 0 != listen( listen_fd, 64 ) ) {
+    fprintf( stderr, "ttsink[%d] : listen error : %s\n", sink.port, strerror( errno ) );
+    exit(1);
+  }
+
+  while ( !stopping ) {
+    int fd = accept( listen_fd, NULL, NULL );
+    if ( fd < 0 ) {
+      if ( EINTR != errno ) {
+        fprintf( stderr, "ttsink[%d] : accept error : %s\n", sink.port, strerror( errno ) );
+      }
+      continue;
+    }
+    setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+
+    conn_t *c = (conn_t*)calloc( 1, sizeof( conn_t ) );
+    c->sink = &sink;
+    c->fd   = fd;
+
+    pthread_mutex_lock( &(sink.lock) );
+    sink.connections += 1;
+    pthread_mutex_unlock( &(sink.lock) );
+
+    pthread_t thread;
+    if ( 0 != pthread_create( &thread, NULL, conn_thread, c ) ) {
+      close( fd );
+      free( c );
+      continue;
+    }
+    pthread_detach( thread );
+  }
+
+  pthread_mutex_lock( &(sink.lock) );
+  fprintf( stdout, "ttsink %d : records %llu bytes %llu checksum %016llx\n", sink.port,
+           (long long unsigned)sink.records, (long long unsigned)sink.bytes, (long long unsigned)sink.sum );
+  pthread_mutex_unlock( &(sink.lock) );
+
+  close( listen_fd );
+  exit(0);
+}